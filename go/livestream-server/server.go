@@ -278,10 +278,20 @@ type WsMsg struct {
 // subscribed to the particular message.
 
 var (
-	ws_channel  = make(chan *WsMsg, 10000)
-	zmq_channel = make(chan *ZmqMsg, 10000)
+	ws_channel           = make(chan *WsMsg, 10000)
+	zmq_channel          = make(chan *ZmqMsg, 10000)
+	subscription_channel = make(chan *SubscriptionMsg, 10000)
 )
 
+// The dispatcher tells the zmq handler which keys have web socket
+// clients, so that the importer only sends data somebody is
+// watching. The subscriber socket must only be used by the zmq handler
+// goroutine.
+type SubscriptionMsg struct {
+	subscribe bool
+	app_env   string
+}
+
 func dispatcher() {
 	ticker := time.NewTicker(1 * time.Second)
 	defer ticker.Stop()
@@ -360,6 +370,9 @@ func handleWebSocketMsg(msg *WsMsg) {
 	switch msg.msgType {
 	case subscribeMsg:
 		log.Info("adding subscription to %s for %s", msg.app_env, msg.name)
+		if len(ai.channels) == 0 {
+			subscription_channel <- &SubscriptionMsg{subscribe: true, app_env: msg.app_env}
+		}
 		ai.channels[msg.name] = msg.channel
 		if err := ai.metrics.Send(msg.channel); err != nil {
 			log.Error("%v", err)
@@ -372,7 +385,12 @@ func handleWebSocketMsg(msg *WsMsg) {
 		}
 	case unsubscribeMsg:
 		log.Info("removing subscription to %s for %s", msg.app_env, msg.name)
-		delete(ai.channels, msg.name)
+		if _, found := ai.channels[msg.name]; found {
+			delete(ai.channels, msg.name)
+			if len(ai.channels) == 0 {
+				subscription_channel <- &SubscriptionMsg{subscribe: false, app_env: msg.app_env}
+			}
+		}
 		close(msg.channel)
 	}
 }
@@ -383,11 +401,28 @@ func setupSocket() *zmq.Socket {
 	subscriber, _ := zmq.NewSocket(zmq.SUB)
 	subscriber.SetLinger(100)
 	subscriber.SetRcvhwm(1000)
-	subscriber.SetSubscribe("")
 	subscriber.Connect(importer_spec)
 	return subscriber
 }
 
+// apply subscription changes requested by the dispatcher
+func updateSubscriptions(subscriber *zmq.Socket) {
+	for {
+		select {
+		case msg := <-subscription_channel:
+			if msg.subscribe {
+				log.Info("subscribing to %s", msg.app_env)
+				subscriber.SetSubscribe(msg.app_env)
+			} else {
+				log.Info("unsubscribing from %s", msg.app_env)
+				subscriber.SetUnsubscribe(msg.app_env)
+			}
+		default:
+			return
+		}
+	}
+}
+
 // run zmq event loop
 func zmqMsgHandler() {
 	subscriber := setupSocket()
@@ -397,7 +432,8 @@ func zmqMsgHandler() {
 	poller.Add(subscriber, zmq.POLLIN)
 
 	for !util.Interrupted() {
-		sockets, _ := poller.Poll(1 * time.Second)
+		updateSubscriptions(subscriber)
+		sockets, _ := poller.Poll(100 * time.Millisecond)
 		for _, socket := range sockets {
 			s := socket.Socket
 			msg, _ := s.RecvMessage(0)
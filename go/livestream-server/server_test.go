@@ -141,3 +141,27 @@ func TestSignalsAreDeliveredToMultipleListeners(t *testing.T) {
 	waitSig(t, c1, syscall.SIGWINCH)
 	waitSig(t, c2, syscall.SIGWINCH)
 }
+
+func TestSubscriptionChanges(t *testing.T) {
+	c1 := make(chan string, 1000)
+	c2 := make(chan string, 1000)
+	handleWebSocketMsg(&WsMsg{msgType: subscribeMsg, app_env: "app-test,all_pages", name: "c1", channel: c1})
+	handleWebSocketMsg(&WsMsg{msgType: subscribeMsg, app_env: "app-test,all_pages", name: "c2", channel: c2})
+	if n := len(subscription_channel); n != 1 {
+		t.Fatalf("expected one subscription for two clients, got %d", n)
+	}
+	if msg := <-subscription_channel; !msg.subscribe || msg.app_env != "app-test,all_pages" {
+		t.Errorf("unexpected subscription message: %v", *msg)
+	}
+	handleWebSocketMsg(&WsMsg{msgType: unsubscribeMsg, app_env: "app-test,all_pages", name: "c1", channel: c1})
+	if n := len(subscription_channel); n != 0 {
+		t.Fatalf("expected no unsubscription while a client is left, got %d", n)
+	}
+	handleWebSocketMsg(&WsMsg{msgType: unsubscribeMsg, app_env: "app-test,all_pages", name: "c2", channel: c2})
+	if n := len(subscription_channel); n != 1 {
+		t.Fatalf("expected one unsubscription after the last client left, got %d", n)
+	}
+	if msg := <-subscription_channel; msg.subscribe || msg.app_env != "app-test,all_pages" {
+		t.Errorf("unexpected unsubscription message: %v", *msg)
+	}
+}
@@ -9,6 +9,7 @@
 #include <getopt.h>
 #include "logjam-util.h"
 #include "zring.h"
+#include "device-traffic.h"
 
 bool verbose = false;
 
@@ -64,5 +65,6 @@ int main(int argc, char * const *argv)
     process_arguments(argc, argv);
     zring_test(verbose);
     logjam_util_test(verbose);
+    device_traffic_test(verbose);
     return 0;
 }
@@ -2,6 +2,20 @@
 #include <prometheus/registry.h>
 #include "device-prometheus-client.h"
 #include <sys/resource.h>
+#include <mutex>
+#include <map>
+#include <time.h>
+
+// traffic series of keys which were not reported for this many seconds get removed
+#define TRAFFIC_SERIES_MAX_IDLE 10
+
+struct traffic_series_t {
+    prometheus::Counter *msgs;
+    prometheus::Counter *bytes;
+    time_t last_seen;
+};
+
+typedef std::map<std::string, traffic_series_t> traffic_series_map_t;
 
 static struct prometheus_client_t {
     prometheus::Exposer *exposer;
@@ -14,12 +28,21 @@ static struct prometheus_client_t {
     prometheus::Counter *compressed_msgs_total;
     prometheus::Family<prometheus::Counter> *compressed_bytes_total_family;
     prometheus::Counter *compressed_bytes_total;
+    prometheus::Family<prometheus::Counter> *stream_msgs_total_family;
+    prometheus::Family<prometheus::Counter> *stream_bytes_total_family;
+    prometheus::Family<prometheus::Counter> *topic_msgs_total_family;
+    prometheus::Family<prometheus::Counter> *topic_bytes_total_family;
+    // workers report traffic concurrently
+    std::mutex traffic_lock;
+    traffic_series_map_t stream_series;
+    traffic_series_map_t topic_series;
     prometheus::Family<prometheus::Counter> *cpu_usage_total_family;
     prometheus::Counter *cpu_usage_total;
     std::vector<prometheus::Counter*> cpu_usage_total_compressors;
+    std::vector<prometheus::Counter*> cpu_usage_total_workers;
 } client;
 
-void device_prometheus_client_init(const char* address, const char* device, int num_compressors)
+void device_prometheus_client_init(const char* address, const char* device, int num_compressors, int num_workers)
 {
     // create a http server running on the given address
     client.exposer = new prometheus::Exposer{address};
@@ -58,6 +81,30 @@ void device_prometheus_client_init(const char* address, const char* device, int
 
     client.compressed_bytes_total = &client.compressed_bytes_total_family->Add({});
 
+    client.stream_msgs_total_family = &prometheus::BuildCounter()
+        .Name("logjam:device:stream_msgs_received_total")
+        .Help("How many logjam messages has this device received per stream (top streams only)")
+        .Labels({{"device", device}})
+        .Register(*client.registry);
+
+    client.stream_bytes_total_family = &prometheus::BuildCounter()
+        .Name("logjam:device:stream_msgs_received_bytes_total")
+        .Help("How many bytes of logjam messages has this device received per stream (top streams only)")
+        .Labels({{"device", device}})
+        .Register(*client.registry);
+
+    client.topic_msgs_total_family = &prometheus::BuildCounter()
+        .Name("logjam:device:topic_msgs_received_total")
+        .Help("How many logjam messages has this device received per topic (top topics only)")
+        .Labels({{"device", device}})
+        .Register(*client.registry);
+
+    client.topic_bytes_total_family = &prometheus::BuildCounter()
+        .Name("logjam:device:topic_msgs_received_bytes_total")
+        .Help("How many bytes of logjam messages has this device received per topic (top topics only)")
+        .Labels({{"device", device}})
+        .Register(*client.registry);
+
     client.cpu_usage_total_family = &prometheus::BuildCounter()
         .Name("logjam:device:cpu_seconds_total")
         .Help("Sum of user and system CPU usage per thread")
@@ -71,6 +118,12 @@ void device_prometheus_client_init(const char* address, const char* device, int
         sprintf(name, "compressor%d", i);
         client.cpu_usage_total_compressors.push_back(&client.cpu_usage_total_family->Add({{"thread", name}}));
     }
+    client.cpu_usage_total_workers = {};
+    for (int i=0; i<num_workers; i++) {
+        char name[256];
+        sprintf(name, "worker%d", i);
+        client.cpu_usage_total_workers.push_back(&client.cpu_usage_total_family->Add({{"thread", name}}));
+    }
 
     // ask the exposer to scrape the registry on incoming scrapes
     client.exposer->RegisterCollectable(client.registry);
@@ -102,6 +155,67 @@ void device_prometheus_client_count_bytes_compressed(double value)
     client.compressed_bytes_total->Increment(value);
 }
 
+static
+void count_traffic(traffic_series_map_t &series_map,
+                   prometheus::Family<prometheus::Counter> *msgs_family,
+                   prometheus::Family<prometheus::Counter> *bytes_family,
+                   const char *label, const char *key, double msgs, double bytes)
+{
+    std::lock_guard<std::mutex> guard(client.traffic_lock);
+    if (key == NULL) {
+        // the overflow bucket never expires
+        std::map<std::string, std::string> labels = {{label, "__other__"}};
+        msgs_family->Add(labels).Increment(msgs);
+        bytes_family->Add(labels).Increment(bytes);
+        return;
+    }
+    auto it = series_map.find(key);
+    if (it == series_map.end()) {
+        std::map<std::string, std::string> labels = {{label, key}};
+        traffic_series_t series = {&msgs_family->Add(labels), &bytes_family->Add(labels), 0};
+        it = series_map.emplace(key, series).first;
+    }
+    it->second.msgs->Increment(msgs);
+    it->second.bytes->Increment(bytes);
+    it->second.last_seen = time(NULL);
+}
+
+static
+void expire_traffic(traffic_series_map_t &series_map,
+                    prometheus::Family<prometheus::Counter> *msgs_family,
+                    prometheus::Family<prometheus::Counter> *bytes_family,
+                    time_t now)
+{
+    for (auto it = series_map.begin(); it != series_map.end(); ) {
+        if (now - it->second.last_seen > TRAFFIC_SERIES_MAX_IDLE) {
+            msgs_family->Remove(it->second.msgs);
+            bytes_family->Remove(it->second.bytes);
+            it = series_map.erase(it);
+        } else
+            it++;
+    }
+}
+
+void device_prometheus_client_count_stream(const char *stream, double msgs, double bytes)
+{
+    count_traffic(client.stream_series, client.stream_msgs_total_family, client.stream_bytes_total_family,
+                  "stream", stream, msgs, bytes);
+}
+
+void device_prometheus_client_count_topic(const char *topic, double msgs, double bytes)
+{
+    count_traffic(client.topic_series, client.topic_msgs_total_family, client.topic_bytes_total_family,
+                  "topic", topic, msgs, bytes);
+}
+
+void device_prometheus_client_expire_traffic()
+{
+    std::lock_guard<std::mutex> guard(client.traffic_lock);
+    time_t now = time(NULL);
+    expire_traffic(client.stream_series, client.stream_msgs_total_family, client.stream_bytes_total_family, now);
+    expire_traffic(client.topic_series, client.topic_msgs_total_family, client.topic_bytes_total_family, now);
+}
+
 static
 double get_combined_cpu_usage()
 {
@@ -132,3 +246,10 @@ void device_prometheus_client_record_rusage_compressor(int i)
     double oldvalue = client.cpu_usage_total_compressors[i]->Value();
     client.cpu_usage_total_compressors[i]->Increment(value - oldvalue);
 }
+
+void device_prometheus_client_record_rusage_worker(int i)
+{
+    double value = get_combined_cpu_usage();
+    double oldvalue = client.cpu_usage_total_workers[i]->Value();
+    client.cpu_usage_total_workers[i]->Increment(value - oldvalue);
+}
@@ -7,15 +7,21 @@
 extern "C" {
 #endif
 
-extern void device_prometheus_client_init(const char* address, const char* device, int num_compressors);
+extern void device_prometheus_client_init(const char* address, const char* device, int num_compressors, int num_workers);
 extern void device_prometheus_client_shutdown();
 
 extern void device_prometheus_client_count_msgs_received(double value);
 extern void device_prometheus_client_count_bytes_received(double value);
 extern void device_prometheus_client_count_msgs_compressed(double value);
 extern void device_prometheus_client_count_bytes_compressed(double value);
+// stream or topic NULL counts all traffic not attributed to a single one (label "__other__")
+extern void device_prometheus_client_count_stream(const char *stream, double msgs, double bytes);
+extern void device_prometheus_client_count_topic(const char *topic, double msgs, double bytes);
+// removes the series of streams and topics which are no longer tracked by any worker
+extern void device_prometheus_client_expire_traffic();
 extern void device_prometheus_client_record_rusage();
 extern void device_prometheus_client_record_rusage_compressor(int i);
+extern void device_prometheus_client_record_rusage_worker(int i);
 
 #ifdef __cplusplus
 }
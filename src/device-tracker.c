@@ -5,21 +5,174 @@ extern bool verbose;
 
 bool log_gaps = true;
 
+const double device_latency_bucket_bounds[DEVICE_LATENCY_BUCKETS-1] = {
+    0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 30
+};
+
+const char* device_gap_bucket_names[DEVICE_GAP_BUCKETS] = {
+    "1", "2-10", "11-100", "101-1000", "1001+"
+};
+
 typedef struct {
     uint32_t device_number;
     uint64_t sequence_number;
     uint64_t lost;
     int credit;
     const char* pub_spec;
+    device_stats_t stats;
 } device_info_t;
 
+typedef struct {
+    uint32_t device_number;
+    device_stats_t stats;
+} retired_stats_t;
+
 struct _device_tracker_t {
-    zhashx_t *seen_devices;
-    zhash_t *known_devices;
-    char *localhost_spec;
+    zhashx_t *seen_devices;                               // owns all device infos
+    device_info_t *dense[DEVICE_TRACKER_DENSE_SIZE];      // lookup cache for small device numbers
+    zlist_t *retired_stats;                               // unflushed stats of deleted stale devices
+    bool flushes_stats;                                   // whether anybody consumes the stats
     zsock_t *sub_socket;
+    zactor_t *reconnector;                                // schedules reconnects of stale devices
 };
 
+// Reconnecting a device means disconnecting and connecting the sub socket,
+// which must happen on the thread owning the socket. The reconnector actor
+// only decides when: each spec is reconnected after an exponentially growing,
+// jittered delay, so that many devices going stale at once don't stall the
+// subscriber. Due specs are sent back over the actor pipe.
+
+#define RECONNECT_MIN_DELAY_MS 1000
+#define RECONNECT_MAX_DELAY_MS 60000
+
+typedef struct {
+    zhash_t *known_devices;
+    char *localhost_spec;
+    char *hostname;
+} reconnector_args_t;
+
+typedef struct {
+    int attempts;
+    int64_t due;            // 0 unless a reconnect is pending
+    int64_t last_report;
+} reconnect_t;
+
+typedef struct {
+    reconnector_args_t *args;
+    zsock_t *pipe;
+    zhash_t *schedule;      // spec -> reconnect_t
+    fast_random_t rng;
+} reconnector_state_t;
+
+static
+void schedule_reconnect(reconnector_state_t *state, const char *device, const char *spec)
+{
+    if (strstr(spec, state->args->hostname) && state->args->localhost_spec)
+        spec = state->args->localhost_spec;
+
+    if (!zhash_lookup(state->args->known_devices, spec)) {
+        fprintf(stderr, "[E] unkown device %s sends us messages\n", device);
+        return;
+    }
+
+    reconnect_t *r = zhash_lookup(state->schedule, spec);
+    if (r == NULL) {
+        r = zmalloc(sizeof(*r));
+        assert(r);
+        zhash_insert(state->schedule, spec, r);
+        zhash_freefn(state->schedule, spec, free);
+    }
+    if (r->due)
+        return;
+
+    int64_t now = zclock_mono();
+    // devices which stayed alive for a while start over with the minimum delay
+    if (now - r->last_report > 2 * RECONNECT_MAX_DELAY_MS)
+        r->attempts = 0;
+    int64_t delay = RECONNECT_MAX_DELAY_MS;
+    if (r->attempts < 6 && (RECONNECT_MIN_DELAY_MS << r->attempts) < RECONNECT_MAX_DELAY_MS)
+        delay = RECONNECT_MIN_DELAY_MS << r->attempts;
+    // jitter: between half and one and a half times the delay
+    r->due = now + delay / 2 + fast_random(&state->rng) % delay;
+    r->attempts++;
+    r->last_report = now;
+
+    printf("[I] scheduled reconnect of stale device %s in %" PRId64 "ms: %s\n", device, r->due - now, spec);
+}
+
+static
+int reconnector_timer(zloop_t *loop, int timer_id, void *arg)
+{
+    reconnector_state_t *state = arg;
+    int64_t now = zclock_mono();
+    reconnect_t *r = zhash_first(state->schedule);
+    while (r) {
+        if (r->due && r->due <= now) {
+            zstr_send(state->pipe, zhash_cursor(state->schedule));
+            r->due = 0;
+        }
+        r = zhash_next(state->schedule);
+    }
+    return 0;
+}
+
+static
+int reconnector_command(zloop_t *loop, zsock_t *socket, void *arg)
+{
+    int rc = 0;
+    reconnector_state_t *state = arg;
+    zmsg_t *msg = zmsg_recv(socket);
+    if (msg) {
+        char *cmd = zmsg_popstr(msg);
+        if (streq(cmd, "$TERM")) {
+            rc = -1;
+        } else if (streq(cmd, "stale")) {
+            char *device = zmsg_popstr(msg);
+            char *spec = zmsg_popstr(msg);
+            schedule_reconnect(state, device, spec);
+            free(device);
+            free(spec);
+        } else {
+            fprintf(stderr, "[E] reconnector: received unknown actor command: %s\n", cmd);
+        }
+        free(cmd);
+        zmsg_destroy(&msg);
+    }
+    return rc;
+}
+
+static
+void reconnector(zsock_t *pipe, void *args)
+{
+    set_thread_name("reconnector");
+
+    reconnector_state_t state = { .args = args, .pipe = pipe, .schedule = zhash_new() };
+    fast_random_seed(&state.rng, zclock_time() ^ (uintptr_t) &state);
+
+    // signal readyiness
+    zsock_signal(pipe, 0);
+
+    zloop_t *loop = zloop_new();
+    assert(loop);
+    zloop_set_verbose(loop, 0);
+    // we rely on the tracker shutting us down
+    zloop_ignore_interrupts(loop);
+
+    int rc = zloop_timer(loop, 100, 0, reconnector_timer, &state);
+    assert(rc != -1);
+    rc = zloop_reader(loop, pipe, reconnector_command, &state);
+    assert(rc == 0);
+
+    zloop_start(loop);
+
+    zloop_destroy(&loop);
+    zhash_destroy(&state.schedule);
+    zhash_destroy(&state.args->known_devices);
+    free(state.args->localhost_spec);
+    free(state.args->hostname);
+    free(state.args);
+}
+
 static size_t uint64_hash(const void *key)
 {
     return (size_t) key;
@@ -43,14 +196,19 @@ device_tracker_t* device_tracker_new(zlist_t* known_devices, zsock_t* sub_socket
     device_tracker_t *tracker = zmalloc(sizeof(*tracker));
     tracker->sub_socket = sub_socket;
 
-    tracker->known_devices = zhash_new();
+    reconnector_args_t *args = zmalloc(sizeof(*args));
+    args->known_devices = zhash_new();
+    args->hostname = strdup(my_fqdn());
     char *spec = zlist_first(known_devices);
     while (spec) {
-        zhash_insert(tracker->known_devices, spec, (void*)1);
-        if (strstr(spec, "localhost") || strstr(spec, "127.0.0.1") || strstr(spec, "::1"))
-            tracker->localhost_spec = spec;
+        zhash_insert(args->known_devices, spec, (void*)1);
+        if (strstr(spec, "localhost") || strstr(spec, "127.0.0.1") || strstr(spec, "::1")) {
+            free(args->localhost_spec);
+            args->localhost_spec = strdup(spec);
+        }
         spec = zlist_next(known_devices);
     }
+    tracker->reconnector = zactor_new(reconnector, args);
 
     tracker->seen_devices = zhashx_new();
     zhashx_set_key_hasher(tracker->seen_devices, uint64_hash);
@@ -59,16 +217,53 @@ device_tracker_t* device_tracker_new(zlist_t* known_devices, zsock_t* sub_socket
     zhashx_set_key_comparator(tracker->seen_devices, uint64_comparator);
     zhashx_set_destructor(tracker->seen_devices, device_info_destroy);
 
+    tracker->retired_stats = zlist_new();
+
     return tracker;
 }
 
 void device_tracker_destroy(device_tracker_t** tracker)
 {
+    zactor_destroy(&(*tracker)->reconnector);
     zhashx_destroy(&(*tracker)->seen_devices);
-    zhash_destroy(&(*tracker)->known_devices);
+    zlist_destroy(&(*tracker)->retired_stats);
+    free(*tracker);
     *tracker = NULL;
 }
 
+static inline
+device_info_t* device_tracker_lookup(device_tracker_t* tracker, uint64_t device_number)
+{
+    if (device_number < DEVICE_TRACKER_DENSE_SIZE)
+        return tracker->dense[device_number];
+    return zhashx_lookup(tracker->seen_devices, (const void*) device_number);
+}
+
+static inline
+int gap_bucket(int64_t gap)
+{
+    if (gap <= 1) return 0;
+    if (gap <= 10) return 1;
+    if (gap <= 100) return 2;
+    if (gap <= 1000) return 3;
+    return 4;
+}
+
+static inline
+void record_latency(device_stats_t *stats, uint64_t created_ms)
+{
+    if (created_ms == 0)
+        return;
+    int64_t latency_ms = zclock_time() - (int64_t)created_ms;
+    if (latency_ms < 0)
+        latency_ms = 0;
+    int i = 0;
+    while (i < DEVICE_LATENCY_BUCKETS-1 && latency_ms > device_latency_bucket_bounds[i] * 1000)
+        i++;
+    stats->latency[i]++;
+    stats->latency_ms_sum += latency_ms;
+}
+
 size_t device_tracker_calculate_gap(device_tracker_t* tracker, msg_meta_t* meta, const char* pub_spec)
 {
     uint64_t device_number = meta->device_number;
@@ -76,7 +271,7 @@ size_t device_tracker_calculate_gap(device_tracker_t* tracker, msg_meta_t* meta,
         return 0;
 
     uint64_t sequence_number = meta->sequence_number;
-    device_info_t *info = zhashx_lookup(tracker->seen_devices, (const void*) device_number);
+    device_info_t *info = device_tracker_lookup(tracker, device_number);
 
     if (info == NULL) {
         if (!quiet)
@@ -90,16 +285,25 @@ size_t device_tracker_calculate_gap(device_tracker_t* tracker, msg_meta_t* meta,
         info->pub_spec = pub_spec;
         int rc = zhashx_insert(tracker->seen_devices, (const void*) device_number, info);
         assert(rc == 0);
+        if (device_number < DEVICE_TRACKER_DENSE_SIZE)
+            tracker->dense[device_number] = info;
+        info->stats.messages++;
+        record_latency(&info->stats, meta->created_ms);
         return 0;
     } else {
+        info->stats.messages++;
+        record_latency(&info->stats, meta->created_ms);
         int64_t gap = sequence_number - info->sequence_number - 1;
         if (gap) {
             if (gap < 0) {
+                info->stats.out_of_order++;
                 fprintf(stderr, "[W] sequence number for device %" PRIu64 " wrapped to %" PRIu64 " from %" PRIu64 ")\n",
                         device_number, sequence_number, info->sequence_number);
                 gap = 0;
             } else if (gap > 0) {
                 info->lost += gap;
+                info->stats.lost += gap;
+                info->stats.gaps[gap_bucket(gap)]++;
                 if (!quiet && log_gaps)
                     fprintf(stderr, "[W] lost %" PRIu64 " messages from device %" PRIu64 " (%" PRIu64 "-%" PRIu64 "-1)\n",
                             gap, device_number, sequence_number, info->sequence_number);
@@ -120,8 +324,6 @@ size_t device_tracker_calculate_gap(device_tracker_t* tracker, msg_meta_t* meta,
 
 void device_tracker_reconnect_stale_devices(device_tracker_t* tracker)
 {
-    const char *my_hostname = my_fqdn();
-
     // determine publishers we should reconnect to
     zlist_t *stale_devices = zlist_new();
     device_info_t *info = zhashx_first(tracker->seen_devices);
@@ -136,27 +338,186 @@ void device_tracker_reconnect_stale_devices(device_tracker_t* tracker)
         }
         info = zhashx_next(tracker->seen_devices);
     }
-    // handle localhost
+    // leave the actual reconnect to the reconnector
     info = zlist_first(stale_devices);
     while (info) {
-        const char *pub_spec;
-        if (strstr(info->pub_spec, my_hostname))
-            pub_spec = tracker->localhost_spec;
-        else
-            pub_spec = info->pub_spec;
-
-        if (zhash_lookup(tracker->known_devices, pub_spec)) {
-            printf("[I] disconnecting stale device %d: %s\n", info->device_number, pub_spec);
-            zsock_disconnect(tracker->sub_socket, "%s", pub_spec);
-
-            printf("[I] reconnecting device %d: %s\n", info->device_number, pub_spec);
-            zsock_connect(tracker->sub_socket, "%s", pub_spec);
-        } else {
-            fprintf(stderr, "[E] unkown device %d sends us messages\n", info->device_number);
-        }
+        char device[16];
+        snprintf(device, sizeof(device), "%d", info->device_number);
+        zstr_sendx(tracker->reconnector, "stale", device, info->pub_spec, NULL);
 
+        // keep stats not flushed yet, they get reported on the next flush
+        if (tracker->flushes_stats && info->stats.messages) {
+            retired_stats_t *retired = zmalloc(sizeof(*retired));
+            assert(retired);
+            retired->device_number = info->device_number;
+            retired->stats = info->stats;
+            zlist_append(tracker->retired_stats, retired);
+            zlist_freefn(tracker->retired_stats, retired, free, true);
+        }
+        if (info->device_number < DEVICE_TRACKER_DENSE_SIZE)
+            tracker->dense[info->device_number] = NULL;
         zhashx_delete(tracker->seen_devices, (const void*)(uint64_t)info->device_number);
         info = zlist_next(stale_devices);
     }
     zlist_destroy(&stale_devices);
 }
+
+static
+int handle_reconnect(zloop_t *loop, zsock_t *socket, void *arg)
+{
+    device_tracker_t *tracker = arg;
+    char *spec = zstr_recv(socket);
+    if (spec) {
+        printf("[I] reconnecting stale device: %s\n", spec);
+        zsock_disconnect(tracker->sub_socket, "%s", spec);
+        zsock_connect(tracker->sub_socket, "%s", spec);
+        free(spec);
+    }
+    return 0;
+}
+
+int device_tracker_register_reconnects(device_tracker_t* tracker, zloop_t *loop)
+{
+    return zloop_reader(loop, zactor_sock(tracker->reconnector), handle_reconnect, tracker);
+}
+
+void device_tracker_flush_stats(device_tracker_t* tracker, device_stats_fn *fn, void *arg)
+{
+    tracker->flushes_stats = true;
+
+    retired_stats_t *retired;
+    while ((retired = zlist_pop(tracker->retired_stats))) {
+        fn(retired->device_number, &retired->stats, arg);
+        free(retired);
+    }
+
+    device_info_t *info = zhashx_first(tracker->seen_devices);
+    while (info) {
+        if (info->stats.messages) {
+            fn(info->device_number, &info->stats, arg);
+            memset(&info->stats, 0, sizeof(info->stats));
+        }
+        info = zhashx_next(tracker->seen_devices);
+    }
+}
+
+typedef struct {
+    size_t calls;
+    uint32_t device_number;
+    device_stats_t stats;
+} tracker_test_result_t;
+
+static void tracker_test_collect(uint32_t device_number, const device_stats_t *stats, void *arg)
+{
+    tracker_test_result_t *result = arg;
+    result->calls++;
+    result->device_number = device_number;
+    result->stats = *stats;
+}
+
+static size_t tracker_test_send(device_tracker_t *tracker, uint32_t device, uint64_t sequence, int64_t age_ms, const char *spec)
+{
+    msg_meta_t meta = META_INFO_EMPTY;
+    meta.device_number = device;
+    meta.sequence_number = sequence;
+    meta.created_ms = age_ms < 0 ? 0 : zclock_time() - age_ms;
+    return device_tracker_calculate_gap(tracker, &meta, spec ? strdup(spec) : NULL);
+}
+
+void device_tracker_test(int verbose)
+{
+    printf(" * device-tracker: ");
+    if (verbose)
+        printf("\n");
+
+    bool old_log_gaps = log_gaps;
+    log_gaps = verbose;
+    const char *spec = "tcp://localhost:9606";
+    zlist_t *devices = zlist_new();
+    zlist_append(devices, (void*)spec);
+    tracker_test_result_t result;
+
+    device_tracker_t *tracker = device_tracker_new(devices, NULL);
+    assert(tracker_test_send(tracker, 1, 1, 0, NULL) == 0);
+    assert(tracker_test_send(tracker, 1, 2, 2000, NULL) == 0);
+    // lost 3 and 4
+    assert(tracker_test_send(tracker, 1, 5, 2000, NULL) == 2);
+    // out of order
+    assert(tracker_test_send(tracker, 1, 4, -1, NULL) == 0);
+    // lost 5 to 19, counting from 4
+    assert(tracker_test_send(tracker, 1, 20, 60000, NULL) == 15);
+    // devices above the dense range go through the hash
+    assert(tracker_test_send(tracker, DEVICE_TRACKER_DENSE_SIZE + 1, 7, -1, NULL) == 0);
+    assert(tracker_test_send(tracker, DEVICE_TRACKER_DENSE_SIZE + 1, 9, -1, NULL) == 1);
+
+    memset(&result, 0, sizeof(result));
+    device_tracker_flush_stats(tracker, tracker_test_collect, &result);
+    assert(result.calls == 2);
+
+    memset(&result, 0, sizeof(result));
+    tracker_test_send(tracker, 1, 21, -1, NULL);
+    device_tracker_flush_stats(tracker, tracker_test_collect, &result);
+    assert(result.calls == 1);
+    assert(result.device_number == 1);
+    assert(result.stats.messages == 1);
+    assert(result.stats.lost == 0);
+
+    // stats get reset by flushing
+    memset(&result, 0, sizeof(result));
+    device_tracker_flush_stats(tracker, tracker_test_collect, &result);
+    assert(result.calls == 0);
+    device_tracker_destroy(&tracker);
+    assert(tracker == NULL);
+
+    tracker = device_tracker_new(devices, NULL);
+    tracker_test_send(tracker, 1, 1, 0, NULL);
+    tracker_test_send(tracker, 1, 2, 2000, NULL);
+    tracker_test_send(tracker, 1, 5, 2000, NULL);
+    tracker_test_send(tracker, 1, 4, -1, NULL);
+    tracker_test_send(tracker, 1, 20, 60000, NULL);
+    memset(&result, 0, sizeof(result));
+    device_tracker_flush_stats(tracker, tracker_test_collect, &result);
+    assert(result.calls == 1);
+    assert(result.device_number == 1);
+    assert(result.stats.messages == 5);
+    assert(result.stats.lost == 17);
+    assert(result.stats.out_of_order == 1);
+    assert(result.stats.gaps[1] == 1);
+    assert(result.stats.gaps[2] == 1);
+    assert(result.stats.gaps[0] == 0 && result.stats.gaps[3] == 0 && result.stats.gaps[4] == 0);
+    // fresh message: <= 5ms, 2 seconds old: <= 5s, a minute old: +Inf, no timestamp: not recorded
+    assert(result.stats.latency[0] == 1);
+    assert(result.stats.latency[6] == 2);
+    assert(result.stats.latency[DEVICE_LATENCY_BUCKETS-1] == 1);
+    uint64_t latency_count = 0;
+    for (int i = 0; i < DEVICE_LATENCY_BUCKETS; i++)
+        latency_count += result.stats.latency[i];
+    assert(latency_count == 4);
+    assert(result.stats.latency_ms_sum >= 64000);
+    device_tracker_destroy(&tracker);
+
+    // stats of stale devices get flushed after they have been deleted
+    tracker = device_tracker_new(devices, NULL);
+    device_tracker_flush_stats(tracker, tracker_test_collect, &result);
+    assert(tracker_test_send(tracker, 2, 1, -1, spec) == 0);
+    assert(tracker_test_send(tracker, 2, 3, -1, spec) == 1);
+    for (int i = 0; i <= INITIAL_HEARTBEAT_CREDIT; i++)
+        device_tracker_reconnect_stale_devices(tracker);
+    assert(device_tracker_lookup(tracker, 2) == NULL);
+    memset(&result, 0, sizeof(result));
+    device_tracker_flush_stats(tracker, tracker_test_collect, &result);
+    assert(result.calls == 1);
+    assert(result.device_number == 2);
+    assert(result.stats.messages == 2);
+    assert(result.stats.lost == 1);
+    assert(result.stats.gaps[0] == 1);
+    memset(&result, 0, sizeof(result));
+    device_tracker_flush_stats(tracker, tracker_test_collect, &result);
+    assert(result.calls == 0);
+
+    device_tracker_destroy(&tracker);
+    zlist_destroy(&devices);
+    log_gaps = old_log_gaps;
+
+    printf("OK\n");
+}
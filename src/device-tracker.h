@@ -18,10 +18,43 @@ extern "C" {
 
 typedef struct _device_tracker_t device_tracker_t;
 
+// device numbers below this are looked up in a flat array, others in a hash
+#define DEVICE_TRACKER_DENSE_SIZE 8192
+
+// gap sizes: 1, 2-10, 11-100, 101-1000, more
+#define DEVICE_GAP_BUCKETS 5
+// upper bounds of the delivery latency buckets (seconds), the last one is +Inf
+#define DEVICE_LATENCY_BUCKETS 9
+extern const double device_latency_bucket_bounds[DEVICE_LATENCY_BUCKETS-1];
+extern const char* device_gap_bucket_names[DEVICE_GAP_BUCKETS];
+
+// per device statistics, accumulated between calls to device_tracker_flush_stats.
+// all fields are uint64_t, so the struct can be treated as an array of counters.
+typedef struct {
+    uint64_t messages;
+    uint64_t lost;
+    uint64_t out_of_order;
+    uint64_t gaps[DEVICE_GAP_BUCKETS];
+    uint64_t latency[DEVICE_LATENCY_BUCKETS];
+    uint64_t latency_ms_sum;
+} device_stats_t;
+
+#define DEVICE_STATS_NUM_COUNTERS (sizeof(device_stats_t) / sizeof(uint64_t))
+
+typedef void (device_stats_fn) (uint32_t device_number, const device_stats_t *stats, void *arg);
+
 extern device_tracker_t* device_tracker_new(zlist_t* known_devices, zsock_t* sub_socket);
 extern void device_tracker_destroy(device_tracker_t** tracker);
 extern size_t device_tracker_calculate_gap(device_tracker_t* tracker, msg_meta_t* meta, const char* pub_spec);
+// hands devices which stopped sending heartbeats to the reconnector
 extern void device_tracker_reconnect_stale_devices(device_tracker_t* tracker);
+// reconnects are executed by a reader on the loop of the thread owning the sub socket
+extern int device_tracker_register_reconnects(device_tracker_t* tracker, zloop_t *loop);
+// calls fn for every device which sent messages since the last call and resets the stats.
+// once called, stats of stale devices are kept after deleting them until the next call.
+extern void device_tracker_flush_stats(device_tracker_t* tracker, device_stats_fn *fn, void *arg);
+
+extern void device_tracker_test(int verbose);
 
 extern bool log_gaps;
 
@@ -0,0 +1,250 @@
+#include "device-traffic.h"
+
+device_traffic_t* device_traffic_new()
+{
+    device_traffic_t *traffic = zmalloc(sizeof(*traffic));
+    assert(traffic);
+    return traffic;
+}
+
+void device_traffic_destroy(device_traffic_t **traffic_p)
+{
+    free(*traffic_p);
+    *traffic_p = NULL;
+}
+
+static inline
+size_t sketch_index(uint64_t hash, int row)
+{
+    // double hashing: derive all row indexes from a single 64 bit hash
+    uint64_t h2 = (hash >> 32) | 1;
+    return (hash + row * h2) & (DEVICE_TRAFFIC_SKETCH_WIDTH - 1);
+}
+
+static
+uint64_t sketch_add(device_traffic_t *traffic, uint64_t hash, size_t bytes)
+{
+    uint64_t estimate = UINT64_MAX;
+    for (int row = 0; row < DEVICE_TRAFFIC_SKETCH_DEPTH; row++) {
+        uint64_t *cell = &traffic->sketch[row][sketch_index(hash, row)];
+        *cell += bytes;
+        if (*cell < estimate)
+            estimate = *cell;
+    }
+    return estimate;
+}
+
+static
+void entry_set_key(device_traffic_entry_t *entry, const char *key, size_t key_len)
+{
+    if (key_len > DEVICE_TRAFFIC_MAX_KEY_LEN)
+        key_len = DEVICE_TRAFFIC_MAX_KEY_LEN;
+    // keys end up in metric labels, so keep them printable
+    for (size_t i = 0; i < key_len; i++)
+        entry->key[i] = isprint((unsigned char)key[i]) ? key[i] : '?';
+    entry->key[key_len] = '\0';
+}
+
+void device_traffic_add(device_traffic_t *traffic, const char *key, size_t key_len, size_t bytes)
+{
+    traffic->msgs++;
+    traffic->bytes += bytes;
+
+    uint64_t hash = hash_string(key, key_len);
+    uint64_t estimate = sketch_add(traffic, hash, bytes);
+
+    device_traffic_entry_t *min = NULL;
+    for (size_t i = 0; i < traffic->num_entries; i++) {
+        device_traffic_entry_t *entry = &traffic->entries[i];
+        if (entry->hash == hash) {
+            entry->msgs++;
+            entry->bytes += bytes;
+            entry->recent_bytes += bytes;
+            return;
+        }
+        if (min == NULL || entry->recent_bytes < min->recent_bytes)
+            min = entry;
+    }
+
+    if (traffic->num_entries < DEVICE_TRAFFIC_TOP_K)
+        min = &traffic->entries[traffic->num_entries++];
+    else if (estimate > min->recent_bytes)
+        traffic->evictions++;
+    else
+        return;
+
+    memset(min, 0, sizeof(*min));
+    min->hash = hash;
+    min->msgs = 1;
+    min->bytes = bytes;
+    min->recent_bytes = estimate;
+    entry_set_key(min, key, key_len);
+}
+
+void device_traffic_tick(device_traffic_t *traffic, device_traffic_export_fn *fn, void *arg)
+{
+    uint64_t other_msgs = traffic->msgs - traffic->exported_msgs;
+    uint64_t other_bytes = traffic->bytes - traffic->exported_bytes;
+    traffic->exported_msgs = traffic->msgs;
+    traffic->exported_bytes = traffic->bytes;
+
+    for (size_t i = 0; i < traffic->num_entries; i++) {
+        device_traffic_entry_t *entry = &traffic->entries[i];
+        uint64_t msgs = entry->msgs - entry->exported_msgs;
+        uint64_t bytes = entry->bytes - entry->exported_bytes;
+        // report idle entries too, so that consumers can tell which keys are still tracked
+        fn(entry->key, msgs, bytes, arg);
+        entry->exported_msgs = entry->msgs;
+        entry->exported_bytes = entry->bytes;
+        entry->recent_bytes >>= 1;
+        other_msgs -= msgs;
+        other_bytes -= bytes;
+    }
+    // counts of entries evicted before being exported land here
+    if (other_msgs)
+        fn(NULL, other_msgs, other_bytes, arg);
+
+    for (int row = 0; row < DEVICE_TRAFFIC_SKETCH_DEPTH; row++)
+        for (size_t j = 0; j < DEVICE_TRAFFIC_SKETCH_WIDTH; j++)
+            traffic->sketch[row][j] >>= 1;
+}
+
+typedef struct {
+    uint64_t msgs;
+    uint64_t bytes;
+    uint64_t other_msgs;
+    uint64_t other_bytes;
+    size_t keys;
+    bool heavy_seen;
+    uint64_t heavy_msgs;
+    uint64_t heavy_bytes;
+    bool evicted_seen;
+} traffic_test_result_t;
+
+static const char *traffic_test_heavy = "heavy-production";
+static char traffic_test_evicted[DEVICE_TRAFFIC_MAX_KEY_LEN+1];
+
+static void traffic_test_collect(const char *key, uint64_t msgs, uint64_t bytes, void *arg)
+{
+    traffic_test_result_t *result = arg;
+    result->msgs += msgs;
+    result->bytes += bytes;
+    if (key == NULL) {
+        result->other_msgs += msgs;
+        result->other_bytes += bytes;
+        return;
+    }
+    result->keys++;
+    if (!strcmp(key, traffic_test_heavy)) {
+        result->heavy_seen = true;
+        result->heavy_msgs = msgs;
+        result->heavy_bytes = bytes;
+    }
+    if (!strcmp(key, traffic_test_evicted))
+        result->evicted_seen = true;
+}
+
+static uint64_t traffic_test_estimate(device_traffic_t *traffic, const char *key)
+{
+    uint64_t hash = hash_string(key, strlen(key));
+    uint64_t estimate = UINT64_MAX;
+    for (int row = 0; row < DEVICE_TRAFFIC_SKETCH_DEPTH; row++) {
+        uint64_t cell = traffic->sketch[row][sketch_index(hash, row)];
+        if (cell < estimate)
+            estimate = cell;
+    }
+    return estimate;
+}
+
+void device_traffic_test(int verbose)
+{
+    printf(" * device-traffic: ");
+    if (verbose)
+        printf("\n");
+
+    device_traffic_t *traffic = device_traffic_new();
+    traffic_test_result_t result;
+    char key[64];
+
+    // many light keys, more than fit into the table, and a single heavy one
+    size_t heavy_len = strlen(traffic_test_heavy);
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 2 * DEVICE_TRAFFIC_TOP_K; i++) {
+            int n = snprintf(key, sizeof(key), "light%d-production", i);
+            device_traffic_add(traffic, key, n, 10);
+        }
+        for (int i = 0; i < 10; i++)
+            device_traffic_add(traffic, traffic_test_heavy, heavy_len, 1000);
+    }
+    assert(traffic->num_entries == DEVICE_TRAFFIC_TOP_K);
+    assert(traffic->msgs == 10 * (2 * DEVICE_TRAFFIC_TOP_K + 10));
+    assert(traffic->bytes == 10 * (2 * DEVICE_TRAFFIC_TOP_K * 10 + 10 * 1000));
+
+    // count-min sketches never underestimate
+    assert(traffic_test_estimate(traffic, traffic_test_heavy) >= 100 * 1000);
+    assert(traffic_test_estimate(traffic, "light0-production") >= 10 * 10);
+
+    // the heavy key gets tracked early and is counted exactly from then on
+    memset(&result, 0, sizeof(result));
+    device_traffic_tick(traffic, traffic_test_collect, &result);
+    assert(result.heavy_seen);
+    assert(result.heavy_msgs == 100);
+    assert(result.heavy_bytes == 100 * 1000);
+    assert(result.keys == DEVICE_TRAFFIC_TOP_K);
+    assert(result.msgs == traffic->msgs);
+    assert(result.bytes == traffic->bytes);
+    assert(result.other_msgs > 0);
+
+    // ticking halves the sketch
+    assert(traffic_test_estimate(traffic, traffic_test_heavy) >= 50 * 1000);
+
+    // idle keys are still reported, but with zero increments
+    memset(&result, 0, sizeof(result));
+    device_traffic_tick(traffic, traffic_test_collect, &result);
+    assert(result.keys == DEVICE_TRAFFIC_TOP_K);
+    assert(result.heavy_seen);
+    assert(result.heavy_msgs == 0);
+    assert(result.msgs == 0);
+    assert(result.other_msgs == 0);
+
+    // a new heavy key evicts the entry with the least recent traffic
+    device_traffic_entry_t *min = &traffic->entries[0];
+    for (size_t i = 1; i < traffic->num_entries; i++)
+        if (traffic->entries[i].recent_bytes < min->recent_bytes)
+            min = &traffic->entries[i];
+    assert(strcmp(min->key, traffic_test_heavy));
+    strcpy(traffic_test_evicted, min->key);
+    uint64_t evictions = traffic->evictions;
+    device_traffic_add(traffic, "burst-production", 16, 1000000);
+    assert(traffic->evictions == evictions + 1);
+    assert(traffic->num_entries == DEVICE_TRAFFIC_TOP_K);
+
+    memset(&result, 0, sizeof(result));
+    device_traffic_tick(traffic, traffic_test_collect, &result);
+    assert(!result.evicted_seen);
+    assert(result.heavy_seen);
+    assert(result.keys == DEVICE_TRAFFIC_TOP_K);
+    assert(result.msgs == 1);
+    assert(result.bytes == 1000000);
+    assert(result.other_msgs == 0);
+
+    // unprintable characters are replaced and long keys truncated
+    char long_key[2 * DEVICE_TRAFFIC_MAX_KEY_LEN];
+    memset(long_key, 'x', sizeof(long_key));
+    long_key[0] = '\n';
+    device_traffic_add(traffic, long_key, sizeof(long_key), 10000000);
+    bool found = false;
+    for (size_t i = 0; i < traffic->num_entries; i++) {
+        device_traffic_entry_t *entry = &traffic->entries[i];
+        if (entry->key[0] == '?') {
+            assert(strlen(entry->key) == DEVICE_TRAFFIC_MAX_KEY_LEN);
+            found = true;
+        }
+    }
+    assert(found);
+
+    device_traffic_destroy(&traffic);
+    assert(traffic == NULL);
+
+    printf("OK\n");
+}
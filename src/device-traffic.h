@@ -0,0 +1,62 @@
+#ifndef __LOGJAM_DEVICE_TRAFFIC_H_INCLUDED__
+#define __LOGJAM_DEVICE_TRAFFIC_H_INCLUDED__
+
+#include "logjam-util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per key (stream or topic) traffic accounting for the device's hot path.
+//
+// Recent bytes per key are estimated with a count-min sketch, which is halved
+// every tick. Keys whose estimate exceeds the smallest entry of a fixed size
+// top-k table replace that entry and are counted exactly from then on.
+// Everything else ends up in the "__other__" bucket. No memory is allocated
+// after construction.
+
+#define DEVICE_TRAFFIC_TOP_K 32
+#define DEVICE_TRAFFIC_MAX_KEY_LEN 127
+#define DEVICE_TRAFFIC_SKETCH_DEPTH 4
+#define DEVICE_TRAFFIC_SKETCH_WIDTH 1024
+
+typedef struct {
+    uint64_t hash;
+    uint64_t msgs;
+    uint64_t bytes;
+    uint64_t exported_msgs;
+    uint64_t exported_bytes;
+    uint64_t recent_bytes;
+    char key[DEVICE_TRAFFIC_MAX_KEY_LEN+1];
+} device_traffic_entry_t;
+
+typedef struct {
+    uint64_t sketch[DEVICE_TRAFFIC_SKETCH_DEPTH][DEVICE_TRAFFIC_SKETCH_WIDTH];
+    device_traffic_entry_t entries[DEVICE_TRAFFIC_TOP_K];
+    size_t num_entries;
+    uint64_t msgs;
+    uint64_t bytes;
+    uint64_t exported_msgs;
+    uint64_t exported_bytes;
+    uint64_t evictions;
+} device_traffic_t;
+
+typedef void (device_traffic_export_fn) (const char *key, uint64_t msgs, uint64_t bytes, void *arg);
+
+extern device_traffic_t* device_traffic_new();
+extern void device_traffic_destroy(device_traffic_t **traffic_p);
+
+extern void device_traffic_add(device_traffic_t *traffic, const char *key, size_t key_len, size_t bytes);
+
+// calls fn with the increments since the last call for every tracked key, even
+// if they are zero, and with key NULL for all other traffic, then starts a new
+// tick. keys evicted from the table are not reported anymore.
+extern void device_traffic_tick(device_traffic_t *traffic, device_traffic_export_fn *fn, void *arg);
+
+extern void device_traffic_test(int verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
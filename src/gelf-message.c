@@ -1,50 +1,202 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "gelf-message.h"
 
-gelf_message* gelf_message_new(const char *host, const char *short_message)
+struct _gelf_message {
+    char *data;
+    size_t size;
+    size_t pos;
+    bool finished;
+};
+
+static inline void ensure_space(gelf_message *msg, size_t needed)
+{
+    size_t required = msg->pos + needed + 1;
+    if (required <= msg->size)
+        return;
+    size_t new_size = 2 * msg->size;
+    while (new_size < required)
+        new_size *= 2;
+    msg->data = realloc(msg->data, new_size);
+    assert(msg->data);
+    msg->size = new_size;
+}
+
+static inline void append_raw(gelf_message *msg, const char *str, size_t len)
+{
+    ensure_space(msg, len);
+    memcpy(msg->data + msg->pos, str, len);
+    msg->pos += len;
+}
+
+static inline void append_char(gelf_message *msg, char c)
+{
+    ensure_space(msg, 1);
+    msg->data[msg->pos++] = c;
+}
+
+#define append_literal(msg, str) append_raw(msg, str, sizeof(str) - 1)
+
+static
+void append_escaped(gelf_message *msg, const char *str, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    // worst case: every character needs a \u00XX escape
+    ensure_space(msg, 6 * len);
+    char *p = msg->data + msg->pos;
+    const char *end = str + len;
+    while (str < end) {
+        const char *start = str;
+        while (str < end && (unsigned char)*str >= 0x20 && *str != '"' && *str != '\\')
+            str++;
+        memcpy(p, start, str - start);
+        p += str - start;
+        if (str == end)
+            break;
+        unsigned char c = *str++;
+        *p++ = '\\';
+        switch (c) {
+        case '"':  *p++ = '"'; break;
+        case '\\': *p++ = '\\'; break;
+        case '\n': *p++ = 'n'; break;
+        case '\r': *p++ = 'r'; break;
+        case '\t': *p++ = 't'; break;
+        case '\b': *p++ = 'b'; break;
+        case '\f': *p++ = 'f'; break;
+        default:
+            *p++ = 'u'; *p++ = '0'; *p++ = '0';
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 0xf];
+        }
+    }
+    msg->pos = p - msg->data;
+}
+
+static
+void append_key(gelf_message *msg, const char *key)
 {
-    json_object *json = json_object_new_object();
-    json_object_object_add(json, "version", json_object_new_string("1.1"));
-    json_object_object_add(json, "host", json_object_new_string(host));
-    json_object_object_add(json, "short_message", json_object_new_string(short_message));
+    append_literal(msg, ",\"");
+    append_escaped(msg, key, strlen(key));
+    append_literal(msg, "\":");
+}
 
-    return (gelf_message *) json;
+gelf_message* gelf_message_new(size_t initial_size)
+{
+    gelf_message *msg = malloc(sizeof(gelf_message));
+    assert(msg);
+    msg->size = initial_size > 64 ? initial_size : 64;
+    msg->data = malloc(msg->size);
+    assert(msg->data);
+    msg->pos = 0;
+    msg->finished = false;
+    return msg;
+}
+
+void gelf_message_start(gelf_message *msg, const char *host, const char *short_message)
+{
+    msg->pos = 0;
+    msg->finished = false;
+    append_literal(msg, "{\"version\":\"1.1\",\"host\":\"");
+    append_escaped(msg, host, strlen(host));
+    append_literal(msg, "\",\"short_message\":\"");
+    append_escaped(msg, short_message, strlen(short_message));
+    append_char(msg, '"');
 }
 
 void gelf_message_add_string(gelf_message *msg, const char *key, const char *value)
 {
-    json_object *json = (json_object *) msg;
-    json_object_object_add(json, key, json_object_new_string(value));
+    append_key(msg, key);
+    append_char(msg, '"');
+    append_escaped(msg, value, strlen(value));
+    append_char(msg, '"');
 }
 
 void gelf_message_add_double(gelf_message *msg, const char *key, double value)
 {
-    json_object *json = (json_object *) msg;
-    json_object_object_add(json, key, json_object_new_double(value));
+    // nan and inf aren't valid json and graylog would reject the whole message
+    if (!isfinite(value))
+        return;
+    char number[64];
+    int n = snprintf(number, sizeof(number), "%.17g", value);
+    append_key(msg, key);
+    append_raw(msg, number, n);
 }
 
 void gelf_message_add_int(gelf_message *msg, const char *key, int value)
 {
-    json_object *json = (json_object *) msg;
-    json_object_object_add(json, key, json_object_new_int(value));
+    char number[16];
+    int n = snprintf(number, sizeof(number), "%d", value);
+    append_key(msg, key);
+    append_raw(msg, number, n);
 }
 
 void gelf_message_add_json_object(gelf_message *msg, const char *key, json_object *obj)
 {
-    json_object *json = (json_object *) msg;
-    // obj is now part of two container objects, so: increment reference count
-    json_object_get(obj);
-    json_object_object_add(json, key, obj);
+    switch (json_object_get_type(obj)) {
+    case json_type_string:
+        append_key(msg, key);
+        append_char(msg, '"');
+        append_escaped(msg, json_object_get_string(obj), json_object_get_string_len(obj));
+        append_char(msg, '"');
+        break;
+    case json_type_int: {
+        char number[32];
+        int n = snprintf(number, sizeof(number), "%" PRId64, json_object_get_int64(obj));
+        append_key(msg, key);
+        append_raw(msg, number, n);
+        break;
+    }
+    case json_type_null:
+        append_key(msg, key);
+        append_literal(msg, "null");
+        break;
+    default: {
+        // doubles keep their original representation, containers are rare
+        const char *json = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN);
+        append_key(msg, key);
+        append_raw(msg, json, strlen(json));
+    }
+    }
+}
+
+void gelf_message_begin_string(gelf_message *msg, const char *key)
+{
+    append_key(msg, key);
+    append_char(msg, '"');
+}
+
+void gelf_message_append_string(gelf_message *msg, const char *str, size_t len)
+{
+    append_escaped(msg, str, len);
+}
+
+void gelf_message_end_string(gelf_message *msg)
+{
+    append_char(msg, '"');
+}
+
+const char* gelf_message_to_string(gelf_message *msg)
+{
+    if (!msg->finished) {
+        append_char(msg, '}');
+        msg->finished = true;
+    }
+    msg->data[msg->pos] = '\0';
+    return msg->data;
 }
 
-const char* gelf_message_to_string(const gelf_message *msg)
+size_t gelf_message_size(const gelf_message *msg)
 {
-    json_object *json = (json_object *) msg;
-    return json_object_to_json_string_ext(json, JSON_C_TO_STRING_PLAIN);
+    return msg->pos;
 }
 
 void gelf_message_destroy(gelf_message **msg)
 {
-    json_object *json = (json_object *) *msg;
-    json_object_put(json);
+    free((*msg)->data);
+    free(*msg);
     *msg = NULL;
 }
@@ -1,25 +1,43 @@
 #ifndef __GELF_MESSAGE_H_INCLUDED__
 #define __GELF_MESSAGE_H_INCLUDED__
 
+#include <stdbool.h>
 #include <json-c/json.h>
 
 #define gelf_message_add_full_message(m,v) gelf_message_add_string(m, "full_message", v)
 #define gelf_message_add_timestamp(m,v) gelf_message_add_double(m, "timestamp", v)
 #define gelf_message_add_level(m,v) gelf_message_add_int(m, "level", v)
 
-typedef json_object gelf_message;
+// GELF messages are written as escaped JSON directly into a buffer, which
+// can be reused for any number of messages. Fields are emitted in the order
+// they are added, so callers must not add the same key twice.
+typedef struct _gelf_message gelf_message;
 
-gelf_message* gelf_message_new(const char *host, const char *short_message);
+gelf_message* gelf_message_new(size_t initial_size);
+
+// discard the previous contents and start a new message
+void gelf_message_start(gelf_message *msg, const char *host, const char *short_message);
 
 void gelf_message_add_string(gelf_message *msg, const char *key, const char *value);
 
+// skips the field for nan and infinite values
 void gelf_message_add_double(gelf_message *msg, const char *key, double value);
 
 void gelf_message_add_int(gelf_message *msg, const char *key, int value);
 
 void gelf_message_add_json_object(gelf_message *msg, const char *key, json_object *obj);
 
-const char* gelf_message_to_string(const gelf_message *msg);
+// build a string field piece by piece
+void gelf_message_begin_string(gelf_message *msg, const char *key);
+
+void gelf_message_append_string(gelf_message *msg, const char *str, size_t len);
+
+void gelf_message_end_string(gelf_message *msg);
+
+// close the message and return the 0 terminated JSON text, owned by msg
+const char* gelf_message_to_string(gelf_message *msg);
+
+size_t gelf_message_size(const gelf_message *msg);
 
 void gelf_message_destroy(gelf_message **msg);
 
@@ -0,0 +1,119 @@
+#include "gelf-rules.h"
+#include "logjam-util.h"
+
+static
+void normalize_header_name(char *name)
+{
+    for (char *p = name; *p; ++p) {
+        *p = tolower(*p);
+        if (*p == '-')
+            *p = '_';
+    }
+}
+
+static
+zhash_t* parse_header_list(const char *list)
+{
+    zhash_t *headers = zhash_new();
+    assert(headers);
+    char *copy = strdup(list);
+    char *saveptr = NULL;
+    for (char *name = strtok_r(copy, ", ", &saveptr); name; name = strtok_r(NULL, ", ", &saveptr)) {
+        normalize_header_name(name);
+        // items only need to be non NULL
+        zhash_insert(headers, name, (void*)"");
+    }
+    free(copy);
+    return headers;
+}
+
+static
+gelf_rule_t* gelf_rule_new(zconfig_t *section, gelf_rule_t *defaults)
+{
+    gelf_rule_t *rule = zmalloc(sizeof(*rule));
+    assert(rule);
+    rule->sample_rate = 1;
+    if (defaults) {
+        rule->min_severity = defaults->min_severity;
+        rule->sample_rate = defaults->sample_rate;
+        rule->max_full_message = defaults->max_full_message;
+        if (defaults->headers)
+            rule->headers = zhash_dup(defaults->headers);
+    }
+    if (section == NULL)
+        return rule;
+
+    char *value;
+    if ((value = zconfig_resolve(section, "min_severity", NULL)))
+        rule->min_severity = atoi(value);
+    if ((value = zconfig_resolve(section, "sample_rate", NULL)))
+        rule->sample_rate = strtoul(value, NULL, 0);
+    if (rule->sample_rate == 0)
+        rule->sample_rate = 1;
+    if ((value = zconfig_resolve(section, "max_full_message", NULL)))
+        rule->max_full_message = strtoul(value, NULL, 0);
+    if ((value = zconfig_resolve(section, "headers", NULL))) {
+        zhash_destroy(&rule->headers);
+        rule->headers = parse_header_list(value);
+    }
+    return rule;
+}
+
+static
+void gelf_rule_destroy(gelf_rule_t **rule_p)
+{
+    gelf_rule_t *rule = *rule_p;
+    if (rule) {
+        zhash_destroy(&rule->headers);
+        free(rule);
+        *rule_p = NULL;
+    }
+}
+
+static
+void gelf_rule_free(void *item)
+{
+    gelf_rule_t *rule = item;
+    gelf_rule_destroy(&rule);
+}
+
+gelf_rules_t* gelf_rules_new(zconfig_t *config)
+{
+    gelf_rules_t *rules = zmalloc(sizeof(*rules));
+    assert(rules);
+    rules->streams = zhash_new();
+    assert(rules->streams);
+
+    zconfig_t *section = config ? zconfig_locate(config, "graylog/rules") : NULL;
+    zconfig_t *default_section = section ? zconfig_locate(section, "default") : NULL;
+    rules->default_rule = gelf_rule_new(default_section, NULL);
+
+    zconfig_t *stream = section ? zconfig_child(section) : NULL;
+    while (stream) {
+        char *name = zconfig_name(stream);
+        if (strcmp(name, "default")) {
+            gelf_rule_t *rule = gelf_rule_new(stream, rules->default_rule);
+            zhash_insert(rules->streams, name, rule);
+            zhash_freefn(rules->streams, name, gelf_rule_free);
+        }
+        stream = zconfig_next(stream);
+    }
+    return rules;
+}
+
+void gelf_rules_destroy(gelf_rules_t **rules_p)
+{
+    gelf_rules_t *rules = *rules_p;
+    if (rules) {
+        zhash_destroy(&rules->streams);
+        gelf_rule_destroy(&rules->default_rule);
+        free(rules);
+        *rules_p = NULL;
+    }
+}
+
+gelf_rule_t* gelf_rules_lookup(gelf_rules_t *rules, const char *app_env)
+{
+    gelf_rule_t *rule = zhash_lookup(rules->streams, app_env);
+    return rule ? rule : rules->default_rule;
+}
@@ -0,0 +1,78 @@
+#ifndef __GELF_RULES_H_INCLUDED__
+#define __GELF_RULES_H_INCLUDED__
+
+#include <czmq.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per stream forwarding rules, read from the graylog/rules config section:
+ *
+ *   graylog
+ *       rules
+ *           default
+ *               min_severity = 1          # logjam severity: 0=Debug .. 5=Unknown
+ *               sample_rate = 1           # forward every n-th message
+ *               max_full_message = 65536  # truncate log lines after n bytes, 0 = no limit
+ *               headers = "user_agent,referer"  # normalized names, omit to forward all
+ *           myapp-production
+ *               min_severity = 2
+ *
+ * Streams without a section of their own use the default rule. Settings missing
+ * from a stream section are inherited from the default section.
+ *
+ * Rules are cheap to evaluate but not thread safe: each parser needs its own copy.
+ */
+
+typedef struct {
+    int min_severity;
+    size_t sample_rate;
+    size_t max_full_message;
+    zhash_t *headers;           // allowed header names, NULL means all
+    size_t sample_counter;
+} gelf_rule_t;
+
+typedef struct {
+    gelf_rule_t *default_rule;
+    zhash_t *streams;           // app-env -> gelf_rule_t
+    // statistics, reset by the owner
+    size_t dropped_sampled;
+    size_t dropped_severity;
+    size_t truncated;
+} gelf_rules_t;
+
+extern gelf_rules_t* gelf_rules_new(zconfig_t *config);
+
+extern void gelf_rules_destroy(gelf_rules_t **rules_p);
+
+extern gelf_rule_t* gelf_rules_lookup(gelf_rules_t *rules, const char *app_env);
+
+// returns true if the message should be dropped by sampling
+static inline bool gelf_rule_sample_out(gelf_rules_t *rules, gelf_rule_t *rule)
+{
+    if (rule->sample_rate <= 1 || rule->sample_counter++ % rule->sample_rate == 0)
+        return false;
+    rules->dropped_sampled++;
+    return true;
+}
+
+static inline bool gelf_rule_severity_too_low(gelf_rules_t *rules, gelf_rule_t *rule, int severity)
+{
+    if (severity >= rule->min_severity)
+        return false;
+    rules->dropped_severity++;
+    return true;
+}
+
+static inline bool gelf_rule_header_allowed(gelf_rule_t *rule, const char *normalized_name)
+{
+    return rule->headers == NULL || zhash_lookup(rule->headers, normalized_name) != NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,348 @@
+#include "gelf-transport.h"
+#include "logjam-util.h"
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+typedef enum { GELF_ZMQ, GELF_UDP, GELF_TCP } gelf_transport_type_t;
+
+#define TCP_RECONNECT_INTERVAL_MS 1000
+
+// GELF chunk header: magic bytes, message id, sequence number, sequence count
+#define GELF_CHUNK_HEADER_SIZE 12
+
+struct _gelf_transport {
+    gelf_transport_type_t type;
+    char *spec;
+    zsock_t *push_socket;                   // GELF_ZMQ
+    int fd;                                 // GELF_UDP, GELF_TCP
+    char host[256];
+    char port[16];
+    bool connected;                         // GELF_TCP
+    int64_t next_connect_attempt;           // GELF_TCP
+    size_t partial;                         // GELF_TCP: bytes of the first message written already
+    uint64_t next_message_id;               // GELF_UDP
+    size_t chunk_size;                      // GELF_UDP
+    size_t oversized;
+};
+
+bool gelf_transport_spec_is_native(const char *spec)
+{
+    return !strncmp(spec, "gelf-udp://", 11) || !strncmp(spec, "gelf-tcp://", 11);
+}
+
+static
+bool split_host_and_port(gelf_transport_t *self, const char *address)
+{
+    const char *colon = strrchr(address, ':');
+    if (colon == NULL || colon == address || (size_t)(colon - address) >= sizeof(self->host) || strlen(colon + 1) >= sizeof(self->port))
+        return false;
+    memcpy(self->host, address, colon - address);
+    self->host[colon - address] = '\0';
+    strcpy(self->port, colon + 1);
+    return true;
+}
+
+static
+int open_socket(gelf_transport_t *self, int socktype)
+{
+    struct addrinfo hints, *result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    int rc = getaddrinfo(self->host, self->port, &hints, &result);
+    if (rc) {
+        fprintf(stderr, "[E] writer: could not resolve %s:%s: %s\n", self->host, self->port, gai_strerror(rc));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        // for UDP, connect just sets the default destination
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    if (fd < 0)
+        fprintf(stderr, "[E] writer: could not connect to %s:%s: %s\n", self->host, self->port, strerror(errno));
+    return fd;
+}
+
+static
+void tcp_disconnect(gelf_transport_t *self)
+{
+    if (self->fd >= 0)
+        close(self->fd);
+    self->fd = -1;
+    self->connected = false;
+    // the receiver discards the incomplete message, so we start over
+    self->partial = 0;
+    self->next_connect_attempt = zclock_mono() + TCP_RECONNECT_INTERVAL_MS;
+}
+
+static
+bool tcp_ensure_connected(gelf_transport_t *self)
+{
+    if (self->connected)
+        return true;
+
+    if (self->fd < 0) {
+        if (zclock_mono() < self->next_connect_attempt)
+            return false;
+        self->fd = open_socket(self, SOCK_STREAM);
+        if (self->fd < 0) {
+            self->next_connect_attempt = zclock_mono() + TCP_RECONNECT_INTERVAL_MS;
+            return false;
+        }
+    }
+
+    struct pollfd pfd = { .fd = self->fd, .events = POLLOUT };
+    if (poll(&pfd, 1, 0) <= 0)
+        return false;
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(self->fd, SOL_SOCKET, SO_ERROR, &error, &len) || error) {
+        fprintf(stderr, "[E] writer: could not connect to %s:%s: %s\n", self->host, self->port, strerror(error));
+        tcp_disconnect(self);
+        return false;
+    }
+
+    printf("[I] writer: connected to %s\n", self->spec);
+    self->connected = true;
+    return true;
+}
+
+static
+size_t tcp_send(gelf_transport_t *self, struct iovec *msgs, size_t n)
+{
+    if (!tcp_ensure_connected(self))
+        return 0;
+
+    static char terminator = '\0';
+    struct iovec iov[2 * GELF_TRANSPORT_BATCH_SIZE];
+    if (n > GELF_TRANSPORT_BATCH_SIZE)
+        n = GELF_TRANSPORT_BATCH_SIZE;
+
+    // the first message may have been written partially by the previous call
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t skip = i == 0 ? self->partial : 0;
+        if (skip < msgs[i].iov_len) {
+            iov[k].iov_base = (char*)msgs[i].iov_base + skip;
+            iov[k].iov_len = msgs[i].iov_len - skip;
+            k++;
+        }
+        iov[k].iov_base = &terminator;
+        iov[k].iov_len = 1;
+        k++;
+    }
+
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = k;
+    ssize_t written = sendmsg(self->fd, &hdr, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (written < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            fprintf(stderr, "[E] writer: lost connection to %s: %s\n", self->spec, strerror(errno));
+            tcp_disconnect(self);
+        }
+        return 0;
+    }
+
+    // count completely written messages, remember how far we got into the next one
+    size_t done = 0;
+    size_t remaining = written + self->partial;
+    while (done < n && remaining >= msgs[done].iov_len + 1) {
+        remaining -= msgs[done].iov_len + 1;
+        done++;
+    }
+    self->partial = remaining;
+    return done;
+}
+
+// every message needs at least one datagram, chunked ones up to GELF_UDP_MAX_CHUNKS
+#define UDP_MAX_DATAGRAMS (GELF_UDP_MAX_CHUNKS + GELF_TRANSPORT_BATCH_SIZE)
+
+static
+size_t udp_send(gelf_transport_t *self, struct iovec *msgs, size_t n)
+{
+    struct mmsghdr datagrams[UDP_MAX_DATAGRAMS];
+    struct iovec iov[2 * UDP_MAX_DATAGRAMS];
+    uint8_t headers[UDP_MAX_DATAGRAMS][GELF_CHUNK_HEADER_SIZE];
+    size_t datagrams_needed[GELF_TRANSPORT_BATCH_SIZE];
+    size_t payload_size = self->chunk_size - GELF_CHUNK_HEADER_SIZE;
+
+    if (n > GELF_TRANSPORT_BATCH_SIZE)
+        n = GELF_TRANSPORT_BATCH_SIZE;
+
+    // put as many complete messages into the batch as fit
+    size_t d = 0, i;
+    for (i = 0; i < n; i++) {
+        size_t len = msgs[i].iov_len;
+        size_t chunks = len <= self->chunk_size ? 1 : (len + payload_size - 1) / payload_size;
+        if (chunks > GELF_UDP_MAX_CHUNKS) {
+            // graylog can't reassemble this message, so we skip it
+            datagrams_needed[i] = d;
+            continue;
+        }
+        if (d + chunks > UDP_MAX_DATAGRAMS)
+            break;
+        uint64_t id = self->next_message_id++;
+        for (size_t c = 0; c < chunks; c++) {
+            memset(&datagrams[d], 0, sizeof(datagrams[d]));
+            datagrams[d].msg_hdr.msg_iov = &iov[2*d];
+            if (chunks == 1) {
+                iov[2*d] = msgs[i];
+                datagrams[d].msg_hdr.msg_iovlen = 1;
+            } else {
+                uint8_t *header = headers[d];
+                header[0] = 0x1e;
+                header[1] = 0x0f;
+                memcpy(header + 2, &id, 8);
+                header[10] = c;
+                header[11] = chunks;
+                size_t offset = c * payload_size;
+                iov[2*d].iov_base = header;
+                iov[2*d].iov_len = GELF_CHUNK_HEADER_SIZE;
+                iov[2*d+1].iov_base = (char*)msgs[i].iov_base + offset;
+                iov[2*d+1].iov_len = len - offset < payload_size ? len - offset : payload_size;
+                datagrams[d].msg_hdr.msg_iovlen = 2;
+            }
+            d++;
+        }
+        datagrams_needed[i] = d;
+    }
+    n = i;
+
+    size_t sent = 0;
+    bool retried = false;
+    while (sent < d) {
+#ifdef __linux__
+        int rc = sendmmsg(self->fd, datagrams + sent, d - sent, MSG_DONTWAIT);
+#else
+        int rc = sendmsg(self->fd, &datagrams[sent].msg_hdr, MSG_DONTWAIT) < 0 ? -1 : 1;
+#endif
+        if (rc < 0) {
+            // an earlier datagram was refused by the receiver. the error is reported only once.
+            if (errno == ECONNREFUSED && !retried) {
+                retried = true;
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                fprintf(stderr, "[E] writer: could not send to %s: %s\n", self->spec, strerror(errno));
+            break;
+        }
+        sent += rc;
+    }
+
+    // messages are done when all of their datagrams have been sent
+    size_t done = 0;
+    size_t previous = 0;
+    while (done < n && datagrams_needed[done] <= sent) {
+        if (datagrams_needed[done] == previous && msgs[done].iov_len > 0)
+            self->oversized++;
+        previous = datagrams_needed[done];
+        done++;
+    }
+    return done;
+}
+
+static
+size_t zmq_send_messages(gelf_transport_t *self, struct iovec *msgs, size_t n)
+{
+    void *socket = zsock_resolve(self->push_socket);
+    size_t done = 0;
+    while (done < n) {
+        int rc = zmq_send(socket, msgs[done].iov_base, msgs[done].iov_len, ZMQ_DONTWAIT);
+        if (rc < 0)
+            break;
+        done++;
+    }
+    return done;
+}
+
+gelf_transport_t* gelf_transport_new(const char *spec, int snd_hwm)
+{
+    gelf_transport_t *self = zmalloc(sizeof(*self));
+    self->spec = strdup(spec);
+    self->fd = -1;
+    self->chunk_size = GELF_UDP_DEFAULT_CHUNK_SIZE;
+    self->next_message_id = ((uint64_t)getpid() << 32) ^ zclock_usecs();
+
+    if (!gelf_transport_spec_is_native(spec)) {
+        self->type = GELF_ZMQ;
+        self->push_socket = zsock_new(ZMQ_PUSH);
+        assert(self->push_socket);
+        zsock_set_sndhwm(self->push_socket, snd_hwm);
+        printf("[I] writer: binding PUSH socket for graylog to %s\n", spec);
+        int rc = zsock_bind(self->push_socket, "%s", spec);
+        assert(rc > 0);
+        return self;
+    }
+
+    if (!split_host_and_port(self, spec + 11)) {
+        fprintf(stderr, "[E] writer: invalid graylog endpoint: %s\n", spec);
+        free(self->spec);
+        free(self);
+        return NULL;
+    }
+
+    if (!strncmp(spec, "gelf-udp://", 11)) {
+        self->type = GELF_UDP;
+        self->fd = open_socket(self, SOCK_DGRAM);
+        if (self->fd < 0) {
+            free(self->spec);
+            free(self);
+            return NULL;
+        }
+        printf("[I] writer: sending GELF over UDP to %s\n", spec);
+    } else {
+        self->type = GELF_TCP;
+        printf("[I] writer: sending GELF over TCP to %s\n", spec);
+        tcp_ensure_connected(self);
+    }
+    return self;
+}
+
+size_t gelf_transport_send(gelf_transport_t *self, struct iovec *msgs, size_t n)
+{
+    switch (self->type) {
+    case GELF_ZMQ: return zmq_send_messages(self, msgs, n);
+    case GELF_UDP: return udp_send(self, msgs, n);
+    case GELF_TCP: return tcp_send(self, msgs, n);
+    }
+    return 0;
+}
+
+bool gelf_transport_supports_compression(gelf_transport_t *self)
+{
+    // null byte framing doesn't work for binary data
+    return self->type != GELF_TCP;
+}
+
+size_t gelf_transport_oversized(gelf_transport_t *self)
+{
+    return self->oversized;
+}
+
+void gelf_transport_destroy(gelf_transport_t **transport_p)
+{
+    gelf_transport_t *self = *transport_p;
+    if (self == NULL)
+        return;
+    zsock_destroy(&self->push_socket);
+    if (self->fd >= 0)
+        close(self->fd);
+    free(self->spec);
+    free(self);
+    *transport_p = NULL;
+}
@@ -0,0 +1,49 @@
+#ifndef __GELF_TRANSPORT_H_INCLUDED__
+#define __GELF_TRANSPORT_H_INCLUDED__
+
+#include <czmq.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Output transports for GELF messages:
+ *
+ *   gelf-udp://host:port   chunked GELF over UDP, batched with sendmmsg
+ *   gelf-tcp://host:port   null byte framed GELF over TCP, batched with a single sendmsg
+ *   anything else          ZeroMQ PUSH socket, bound to the given spec
+ *
+ * All transports are non-blocking: gelf_transport_send returns how many of the
+ * given messages have been sent completely, which is 0 if the transport can't
+ * accept messages right now. Callers keep unsent messages and try again later.
+ */
+
+// graylog recommends 8154 bytes on LANs and 1420 bytes on WANs
+#define GELF_UDP_DEFAULT_CHUNK_SIZE 8154
+#define GELF_UDP_MAX_CHUNKS 128
+
+// how many messages are passed to the kernel at once
+#define GELF_TRANSPORT_BATCH_SIZE 64
+
+typedef struct _gelf_transport gelf_transport_t;
+
+extern bool gelf_transport_spec_is_native(const char *spec);
+
+extern gelf_transport_t* gelf_transport_new(const char *spec, int snd_hwm);
+
+extern size_t gelf_transport_send(gelf_transport_t *transport, struct iovec *msgs, size_t n);
+
+extern bool gelf_transport_supports_compression(gelf_transport_t *transport);
+
+// messages which could not be sent at all (e.g. UDP messages exceeding 128 chunks)
+extern size_t gelf_transport_oversized(gelf_transport_t *transport);
+
+extern void gelf_transport_destroy(gelf_transport_t **transport_p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4 +1,5 @@
 #include "graylog-forwarder-common.h"
+#include <pthread.h>
 
 bool compress_gelf = false;
 
@@ -8,16 +9,31 @@ zlist_t *subscriptions = NULL;
 
 int rcv_hwm = -1;
 int snd_hwm = -1;
+size_t spill_queue_size = 0;
 
 
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static compressed_gelf_t *pool[COMPRESSED_GELF_POOL_SIZE];
+static size_t pool_size = 0;
+
 compressed_gelf_t *
-compressed_gelf_new(Bytef *data, uLongf len)
+compressed_gelf_new(uLongf capacity)
 {
-    compressed_gelf_t *self = zmalloc(sizeof(*self));
-    if (self) {
-        self->data = data;
-        self->len = len;
+    compressed_gelf_t *self = NULL;
+    pthread_mutex_lock(&pool_lock);
+    if (pool_size > 0)
+        self = pool[--pool_size];
+    pthread_mutex_unlock(&pool_lock);
+
+    if (self == NULL)
+        self = zmalloc(sizeof(*self));
+    if (self->capacity < capacity) {
+        free(self->data);
+        self->data = malloc(capacity);
+        assert(self->data);
+        self->capacity = capacity;
     }
+    self->len = 0;
     return self;
 }
 
@@ -26,8 +42,18 @@ void compressed_gelf_destroy(compressed_gelf_t **self_p)
     assert (self_p);
     if (*self_p) {
         compressed_gelf_t *self = *self_p;
-        free (self->data);
-        free (self);
+        if (self->capacity <= COMPRESSED_GELF_MAX_POOLED_CAPACITY) {
+            pthread_mutex_lock(&pool_lock);
+            if (pool_size < COMPRESSED_GELF_POOL_SIZE) {
+                pool[pool_size++] = self;
+                self = NULL;
+            }
+            pthread_mutex_unlock(&pool_lock);
+        }
+        if (self) {
+            free (self->data);
+            free (self);
+        }
         *self_p = NULL;
     }
 }
@@ -19,12 +19,16 @@ extern bool compress_gelf;
 #define DEFAULT_INTERFACE_PORT 9609
 #define DEFAULT_INTERFACE "tcp://0.0.0.0:9609"
 
+#define DEFAULT_SPILL_QUEUE_SIZE      10000
+#define DEFAULT_SPILL_QUEUE_SIZE_STR "10000"
+
 extern zlist_t *hosts;
 extern char *interface;
 extern zlist_t *subscriptions;
 
 extern int rcv_hwm;
 extern int snd_hwm;
+extern size_t spill_queue_size;
 
 #define MAX_PARSERS 20
 extern unsigned int num_parsers;
@@ -32,9 +36,16 @@ extern unsigned int num_parsers;
 typedef struct {
     Bytef *data;
     uLongf len;
+    uLongf capacity;
 } compressed_gelf_t;
 
-extern compressed_gelf_t* compressed_gelf_new(Bytef *data, uLongf len);
+// compressed messages are recycled through a pool shared by parsers and writer
+#define COMPRESSED_GELF_POOL_SIZE 1024
+// larger buffers are freed instead, so a few huge messages can't pin memory in the pool
+#define COMPRESSED_GELF_MAX_POOLED_CAPACITY (64 * 1024)
+
+// returns a compressed message with room for at least capacity bytes
+extern compressed_gelf_t* compressed_gelf_new(uLongf capacity);
 extern void compressed_gelf_destroy(compressed_gelf_t **self_p);
 
 #endif
@@ -63,6 +63,8 @@ int send_tick_commands(zloop_t *loop, int timer_id, void *arg)
     // send tick commands to actors to let them print out their stats
     zstr_send(state->subscriber, "tick");
     zstr_send(state->writer, "tick");
+    for (size_t i=0; i<num_parsers; i++)
+        zstr_send(state->parsers[i], "tick");
 
     int rc = zloop_timer(loop, 1000, 1, send_tick_commands, state);
     assert(rc != -1);
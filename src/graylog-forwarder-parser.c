@@ -12,11 +12,51 @@ typedef struct {
     zchunk_t *decompression_buffer;         // grows dynamically on demand
     zchunk_t *scratch_buffer;               // scratch buffer for string operations
     json_tokener *tokener;                  // json tokener instance
+    gelf_message *gelf_msg;                 // reused for every forwarded message
+    gelf_rules_t *rules;                    // per stream forwarding rules
+    z_stream deflate_stream;                // reset for every compressed message
+    size_t compressed_count;                // messages compressed since last tick
+    size_t compressed_bytes_in;             // uncompressed size of these
+    size_t compressed_bytes_out;            // compressed size of these
+    int64_t compression_cpu_ns;             // CPU time spent compressing since last tick
     zhash_t *stream_info_cache;             // thread local stream info cache
     bool received_term_cmd;
 } parser_state_t;
 
 
+static inline int64_t thread_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static
+compressed_gelf_t* compress_gelf_data(parser_state_t *state, const char *data, size_t len)
+{
+    int64_t start_ns = thread_cpu_ns();
+    z_stream *strm = &state->deflate_stream;
+    int rc = deflateReset(strm);
+    assert(rc == Z_OK);
+
+    uLong bound = deflateBound(strm, len);
+    compressed_gelf_t *compressed_gelf = compressed_gelf_new(bound);
+    strm->next_in = (Bytef *)data;
+    strm->avail_in = len;
+    strm->next_out = compressed_gelf->data;
+    strm->avail_out = compressed_gelf->capacity;
+    rc = deflate(strm, Z_FINISH);
+    assert(rc == Z_STREAM_END);
+    compressed_gelf->len = strm->total_out;
+
+    // printf("[D] GELF bytes uncompressed/compressed: %ld/%ld\n", len, compressed_gelf->len);
+    state->compressed_count++;
+    state->compressed_bytes_in += len;
+    state->compressed_bytes_out += compressed_gelf->len;
+    state->compression_cpu_ns += thread_cpu_ns() - start_ns;
+    return compressed_gelf;
+}
+
 static
 int process_message(zloop_t *loop, zsock_t *socket, void *arg)
 {
@@ -25,8 +65,12 @@ int process_message(zloop_t *loop, zsock_t *socket, void *arg)
     logjam_message *logjam_msg = logjam_message_read(socket);
 
     if (logjam_msg && !zsys_interrupted) {
-        gelf_message *gelf_msg = logjam_message_to_gelf (logjam_msg, state->tokener, state->stream_info_cache, state->decompression_buffer, state->scratch_buffer);
-        const char *gelf_data = gelf_message_to_string (gelf_msg);
+        if (!logjam_message_to_gelf (logjam_msg, state->tokener, state->stream_info_cache, state->decompression_buffer, state->scratch_buffer, state->gelf_msg, state->rules)) {
+            logjam_message_destroy (&logjam_msg);
+            return 0;
+        }
+        const char *gelf_data = gelf_message_to_string (state->gelf_msg);
+        size_t gelf_data_len = gelf_message_size (state->gelf_msg);
 
         if (debug)
             printf("[D] GELF message: %s\n", gelf_data);
@@ -35,19 +79,10 @@ int process_message(zloop_t *loop, zsock_t *socket, void *arg)
         assert(msg);
 
         if (compress_gelf) {
-            const Bytef *raw_data = (Bytef *)gelf_data;
-            uLong raw_len = strlen(gelf_data);
-            uLongf compressed_len = compressBound(raw_len);
-            Bytef *compressed_data = zmalloc(compressed_len);
-            int rc = compress(compressed_data, &compressed_len, raw_data, raw_len);
-            assert(rc == Z_OK);
-
-            // printf("[D] GELF bytes uncompressed/compressed: %ld/%ld\n", raw_len, compressed_len);
-
-            compressed_gelf_t *compressed_gelf = compressed_gelf_new(compressed_data, compressed_len);
+            compressed_gelf_t *compressed_gelf = compress_gelf_data(state, gelf_data, gelf_data_len);
             zmsg_addptr(msg, compressed_gelf);
         } else {
-            zmsg_addstr(msg, gelf_data);
+            zmsg_addmem(msg, gelf_data, gelf_data_len);
         }
 
         while (!zsys_interrupted && !output_socket_ready(state->push_socket, 1000)) {
@@ -60,9 +95,8 @@ int process_message(zloop_t *loop, zsock_t *socket, void *arg)
             zmsg_destroy(&msg);
         }
 
-        gelf_message_destroy(&gelf_msg);
         logjam_message_destroy (&logjam_msg);
-        // we don't free gelf_data because it's owned by the json library
+        // we don't free gelf_data because it's owned by the reusable gelf message
     }
 
     return 0;
@@ -114,6 +148,10 @@ parser_state_t* parser_state_new(zconfig_t* config, size_t id)
     state->decompression_buffer = zchunk_new(NULL, INITIAL_DECOMPRESSION_BUFFER_SIZE);
     state->scratch_buffer = zchunk_new(NULL, 4096);
     state->tokener = json_tokener_new();
+    state->gelf_msg = gelf_message_new(16 * 1024);
+    state->rules = gelf_rules_new(config);
+    int rc = deflateInit(&state->deflate_stream, Z_DEFAULT_COMPRESSION);
+    assert(rc == Z_OK);
     state->stream_info_cache = zhash_new();
     return state;
 }
@@ -128,6 +166,9 @@ void parser_state_destroy(parser_state_t **state_p)
     zchunk_destroy(&state->decompression_buffer);
     zchunk_destroy(&state->scratch_buffer);
     json_tokener_free(state->tokener);
+    gelf_message_destroy(&state->gelf_msg);
+    gelf_rules_destroy(&state->rules);
+    deflateEnd(&state->deflate_stream);
     zhash_destroy(&state->stream_info_cache);
     free(state);
     *state_p = NULL;
@@ -147,6 +188,27 @@ int actor_command(zloop_t *loop, zsock_t *socket, void *arg)
             free(cmd);
             state->received_term_cmd = true;
             rc = -1;
+        } else if (streq(cmd, "tick")) {
+            if (state->compressed_count) {
+                printf("[I] parser [%zu]: compressed %zu messages (%.2fMB -> %.2fMB, ratio: %.2f, cpu: %.1fms)\n",
+                       state->id, state->compressed_count,
+                       state->compressed_bytes_in / 1048576.0, state->compressed_bytes_out / 1048576.0,
+                       (double) state->compressed_bytes_in / state->compressed_bytes_out,
+                       state->compression_cpu_ns / 1000000.0);
+            }
+            state->compressed_count = 0;
+            state->compressed_bytes_in = 0;
+            state->compressed_bytes_out = 0;
+            state->compression_cpu_ns = 0;
+            gelf_rules_t *rules = state->rules;
+            if (rules->dropped_sampled || rules->dropped_severity || rules->truncated) {
+                printf("[I] parser [%zu]: rules dropped %zu sampled and %zu low severity messages, truncated %zu\n",
+                       state->id, rules->dropped_sampled, rules->dropped_severity, rules->truncated);
+            }
+            rules->dropped_sampled = 0;
+            rules->dropped_severity = 0;
+            rules->truncated = 0;
+            free(cmd);
         } else {
             fprintf(stderr, "[E] parser [%zu]: received unknown command: %s\n", state->id, cmd);
             free(cmd);
@@ -287,6 +287,10 @@ void graylog_forwarder_subscriber(zsock_t *pipe, void *args)
     rc = zloop_reader(loop, state->sub_socket, read_request_and_forward, state);
     assert(rc == 0);
 
+    // setup handler for reconnects of stale devices
+    rc = device_tracker_register_reconnects(state->tracker, loop);
+    assert(rc == 0);
+
     // set up timer for adapting socket subscriptions, if we have a subscription pattern
     if (!streq(get_subscription_pattern(), ""))
         zloop_timer(loop, 60000, 0, timer_function, state);
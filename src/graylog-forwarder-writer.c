@@ -1,49 +1,89 @@
 #include "graylog-forwarder-common.h"
 #include "graylog-forwarder-writer.h"
 #include "gelf-message.h"
+#include "gelf-transport.h"
+
+/*
+ * Messages received from the parsers are appended to a bounded spill queue and
+ * sent from there whenever the transport accepts them. If graylog can't keep up,
+ * the queue fills up and new messages get dropped, instead of blocking the parsers.
+ */
+
+typedef struct {
+    zframe_t *frame;                        // owns uncompressed data
+    compressed_gelf_t *compressed;          // owns compressed data
+} queued_gelf_t;
 
 typedef struct {
-    zsock_t *pipe;          // actor commands
-    zsock_t *pull_socket;   // incoming messages from parsers
-    zsock_t *push_socket;   // outgoing GELF messages to graylog; the GELF ZeroMQ PULL device should connect to this (not bind)
-    size_t message_count;   // how many messages we have sent since last tick
+    zsock_t *pipe;                          // actor commands
+    zsock_t *pull_socket;                   // incoming messages from parsers
+    gelf_transport_t *transport;            // outgoing GELF messages to graylog
+    queued_gelf_t *queue;                   // ring buffer of messages waiting to be sent
+    struct iovec *iovecs;                   // data of the next batch to send
+    size_t queue_head;
+    size_t queue_length;
+    bool transport_blocked;                 // the last attempt to send didn't make progress
+    size_t message_count;                   // how many messages we have sent since last tick
+    size_t drop_count;                      // how many messages we dropped since last tick
+    size_t last_oversized;                  // oversized messages reported by the transport at the last tick
 } writer_state_t;
 
-static void send_graylog_message(zmsg_t* msg, writer_state_t* state)
+static void queued_gelf_destroy(queued_gelf_t *item)
 {
-    zmsg_t *out_msg = zmsg_new();
-    assert(out_msg);
+    zframe_destroy(&item->frame);
+    compressed_gelf_destroy(&item->compressed);
+}
 
+static void enqueue_graylog_message(zmsg_t* msg, writer_state_t* state)
+{
+    queued_gelf_t item = {NULL, NULL};
     if (compress_gelf) {
-        compressed_gelf_t *compressed_gelf = zmsg_popptr(msg);
-        assert(compressed_gelf);
-
-        int rc = zmsg_addmem(out_msg, compressed_gelf->data, compressed_gelf->len);
-        assert(rc == 0);
-        compressed_gelf_destroy(&compressed_gelf);
+        item.compressed = zmsg_popptr(msg);
+        assert(item.compressed);
     } else {
-        zframe_t *gelf_data = zmsg_pop(msg);
-        assert(gelf_data);
-
-        int rc = zmsg_append(out_msg, &gelf_data);
-        assert(rc == 0);
+        item.frame = zmsg_pop(msg);
+        assert(item.frame);
     }
 
     if (dryrun) {
-        zmsg_destroy(&out_msg);
+        queued_gelf_destroy(&item);
         return;
     }
 
-    while (!zsys_interrupted && !output_socket_ready(state->push_socket, 1000)) {
-        fprintf(stderr, "[W] writer: push socket not ready (graylog not connected?). blocking!\n");
+    if (state->queue_length == spill_queue_size) {
+        if (!state->drop_count++)
+            fprintf(stderr, "[W] writer: spill queue is full (graylog too slow?). dropping messages!\n");
+        queued_gelf_destroy(&item);
+        return;
     }
 
-    if (!zsys_interrupted) {
-        zmsg_send(&out_msg, state->push_socket);
-        state->message_count++;
-    } else {
-        zmsg_destroy(&out_msg);
+    state->queue[(state->queue_head + state->queue_length++) % spill_queue_size] = item;
+}
+
+static void send_queued_messages(writer_state_t* state)
+{
+    size_t n = 0;
+    while (n < state->queue_length && n < GELF_TRANSPORT_BATCH_SIZE) {
+        queued_gelf_t *item = &state->queue[(state->queue_head + n) % spill_queue_size];
+        if (item->compressed) {
+            state->iovecs[n].iov_base = item->compressed->data;
+            state->iovecs[n].iov_len = item->compressed->len;
+        } else {
+            state->iovecs[n].iov_base = zframe_data(item->frame);
+            state->iovecs[n].iov_len = zframe_size(item->frame);
+        }
+        n++;
     }
+
+    size_t sent = gelf_transport_send(state->transport, state->iovecs, n);
+    state->transport_blocked = sent == 0;
+    state->message_count += sent;
+
+    for (size_t i = 0; i < sent; i++) {
+        queued_gelf_destroy(&state->queue[state->queue_head]);
+        state->queue_head = (state->queue_head + 1) % spill_queue_size;
+    }
+    state->queue_length -= sent;
 }
 
 static
@@ -56,27 +96,16 @@ zsock_t* writer_pull_socket_new()
     return socket;
 }
 
-static
-zsock_t* writer_push_socket_new(zconfig_t* config)
-{
-    zsock_t *socket = zsock_new(ZMQ_PUSH);
-    assert(socket);
-    zsock_set_sndhwm(socket, snd_hwm);
-
-    printf("[I] writer: binding PUSH socket for graylog to %s\n", interface);
-    int rc = zsock_bind(socket, "%s", interface);
-    assert(rc > 0);
-
-    return socket;
-}
-
 static
 writer_state_t* writer_state_new(zsock_t *pipe, zconfig_t* config)
 {
     writer_state_t *state = zmalloc(sizeof(writer_state_t));
     state->pipe = pipe;
     state->pull_socket = writer_pull_socket_new();
-    state->push_socket = writer_push_socket_new(config);
+    state->transport = gelf_transport_new(interface, snd_hwm);
+    assert(state->transport);
+    state->queue = zmalloc(spill_queue_size * sizeof(queued_gelf_t));
+    state->iovecs = zmalloc(GELF_TRANSPORT_BATCH_SIZE * sizeof(struct iovec));
     return state;
 }
 
@@ -86,7 +115,14 @@ void writer_state_destroy(writer_state_t **state_p)
     writer_state_t *state = *state_p;
     // must not destroy the pipe, as it's owned by the actor
     zsock_destroy(&state->pull_socket);
-    zsock_destroy(&state->push_socket);
+    gelf_transport_destroy(&state->transport);
+    while (state->queue_length) {
+        queued_gelf_destroy(&state->queue[state->queue_head]);
+        state->queue_head = (state->queue_head + 1) % spill_queue_size;
+        state->queue_length--;
+    }
+    free(state->queue);
+    free(state->iovecs);
     free(state);
     *state_p = NULL;
 }
@@ -105,8 +141,10 @@ void graylog_forwarder_writer(zsock_t *pipe, void *args)
 
     while (!zsys_interrupted) {
         // printf("[D] writer [%zu]: polling\n", id);
-        // -1 == block until something is readable
-        void *socket = zpoller_wait(poller, -1);
+        // -1 == block until something is readable. if there are queued messages,
+        // only wait a little while before we try again to send them.
+        int timeout = state->queue_length == 0 ? -1 : state->transport_blocked ? 10 : 0;
+        void *socket = zpoller_wait(poller, timeout);
         zmsg_t *msg = NULL;
         if (socket == state->pipe) {
             msg = zmsg_recv(state->pipe);
@@ -118,9 +156,12 @@ void graylog_forwarder_writer(zsock_t *pipe, void *args)
                 break;
             }
             else if (streq(cmd, "tick")) {
-                printf("[I] writer: sent %zu messages\n",
-                       state->message_count);
+                size_t oversized = gelf_transport_oversized(state->transport);
+                printf("[I] writer: sent %zu messages (queued: %zu, dropped: %zu, oversized: %zu)\n",
+                       state->message_count, state->queue_length, state->drop_count, oversized - state->last_oversized);
                 state->message_count = 0;
+                state->drop_count = 0;
+                state->last_oversized = oversized;
             } else {
                 fprintf(stderr, "[E] writer: received unknown command: %s\n", cmd);
                 assert(false);
@@ -128,16 +169,19 @@ void graylog_forwarder_writer(zsock_t *pipe, void *args)
         } else if (socket == state->pull_socket) {
             msg = zmsg_recv(state->pull_socket);
             if (msg != NULL) {
-                send_graylog_message(msg, state);
+                enqueue_graylog_message(msg, state);
                 zmsg_destroy(&msg);
             }
-        } else {
+        } else if (socket || zpoller_terminated(poller)) {
             // msg == NULL, probably interrupted by signal handler
             break;
         }
+        if (state->queue_length > 0)
+            send_queued_messages(state);
     }
 
     fprintf(stdout, "[I] writer: shutting down\n");
+    zpoller_destroy(&poller);
     writer_state_destroy(&state);
     fprintf(stdout, "[I] writer: terminated\n");
 }
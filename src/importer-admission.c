@@ -0,0 +1,137 @@
+#include "importer-admission.h"
+
+size_t admission_high_water_mark = 0;
+size_t admission_sample_rate = ADMISSION_DEFAULT_SAMPLE_RATE;
+int64_t admission_queued_msgs = 0;
+
+static const char* reason_names[ADMISSION_NUM_REASONS] = {
+    "accepted",
+    "frontend",
+    "sampled",
+};
+
+void admission_setup(zconfig_t *config)
+{
+    char *hwm = zconfig_resolve(config, "frontend/admission/high_water_mark", NULL);
+    if (hwm)
+        admission_high_water_mark = strtoul(hwm, NULL, 0);
+    else
+        admission_high_water_mark = ADMISSION_DEFAULT_HWM_PER_PARSER * num_parsers;
+
+    char *rate = zconfig_resolve(config, "frontend/admission/sample_rate", NULL);
+    if (rate)
+        admission_sample_rate = strtoul(rate, NULL, 0);
+    if (admission_sample_rate == 0)
+        admission_sample_rate = 1;
+
+    if (!quiet) {
+        if (admission_high_water_mark)
+            printf("[I] admission: shedding load above %zu queued messages (sample rate: %zu)\n",
+                   admission_high_water_mark, admission_sample_rate);
+        else
+            printf("[I] admission: disabled\n");
+    }
+}
+
+const char* admission_reason_to_string(admission_reason_t reason)
+{
+    assert(reason < ADMISSION_NUM_REASONS);
+    return reason_names[reason];
+}
+
+static
+bool is_error_request(zframe_t *body_frame, int compression_method, zchunk_t *buffer)
+{
+    char *body;
+    size_t body_len;
+    if (compression_method) {
+        if (!decompress_frame(body_frame, compression_method, buffer, &body, &body_len))
+            // corrupt messages are the parser's business
+            return true;
+    } else {
+        body = (char*) zframe_data(body_frame);
+        body_len = zframe_size(body_frame);
+    }
+    // 3 is the logger severity ERROR. agents send the response code as
+    // "code", the parsers rename it to response_code later on.
+    if (find_json_int_value(body, body_len, "\"severity\"") >= 3)
+        return true;
+    return find_json_int_value(body, body_len, "\"code\"") >= 500;
+}
+
+admission_reason_t admission_check(int level, zframe_t *topic_frame, zframe_t *body_frame,
+                                   int compression_method, uint64_t *sample_counter, zchunk_t *buffer)
+{
+    if (level == 0)
+        return ADMISSION_ACCEPT;
+
+    const char *topic = (const char*) zframe_data(topic_frame);
+    size_t n = zframe_size(topic_frame);
+
+    if (n >= 9 && !strncmp("frontend.", topic, 9))
+        return ADMISSION_SHED_FRONTEND;
+
+    // javascript errors and events are rare, so we keep them
+    if (level < 2 || n < 4 || strncmp("logs", topic, 4))
+        return ADMISSION_ACCEPT;
+
+    if ((*sample_counter)++ % admission_sample_rate == 0)
+        return ADMISSION_ACCEPT;
+
+    if (body_frame && is_error_request(body_frame, compression_method, buffer))
+        return ADMISSION_ACCEPT;
+
+    return ADMISSION_SHED_SAMPLED;
+}
+
+static
+zframe_t* test_frame(const char *data)
+{
+    return zframe_new(data, strlen(data));
+}
+
+void admission_test(int verbose)
+{
+    printf (" * importer-admission: ");
+    if (verbose)
+        printf("\n");
+
+    size_t old_sample_rate = admission_sample_rate;
+    admission_sample_rate = 1000;
+    zchunk_t *buffer = zchunk_new(NULL, INITIAL_DECOMPRESSION_BUFFER_SIZE);
+    zframe_t *backend = test_frame("logs.app.env");
+    zframe_t *frontend = test_frame("frontend.page");
+    zframe_t *ok = test_frame("{\"code\":200,\"severity\":1}");
+    zframe_t *failed = test_frame("{\"code\":500,\"severity\":1}");
+    zframe_t *error = test_frame("{\"code\":200,\"severity\":3}");
+    uint64_t counter = 0;
+
+    assert(admission_check(0, frontend, ok, NO_COMPRESSION, &counter, buffer) == ADMISSION_ACCEPT);
+    assert(admission_check(1, frontend, ok, NO_COMPRESSION, &counter, buffer) == ADMISSION_SHED_FRONTEND);
+    assert(admission_check(1, backend, ok, NO_COMPRESSION, &counter, buffer) == ADMISSION_ACCEPT);
+
+    // the first request of a stream is always sampled
+    assert(admission_check(2, backend, ok, NO_COMPRESSION, &counter, buffer) == ADMISSION_ACCEPT);
+    assert(admission_check(2, backend, ok, NO_COMPRESSION, &counter, buffer) == ADMISSION_SHED_SAMPLED);
+    // raw agent payloads: errors survive shedding
+    assert(admission_check(2, backend, failed, NO_COMPRESSION, &counter, buffer) == ADMISSION_ACCEPT);
+    assert(admission_check(2, backend, error, NO_COMPRESSION, &counter, buffer) == ADMISSION_ACCEPT);
+
+    zmq_msg_t compressed;
+    zmq_msg_init(&compressed);
+    compress_message_data(SNAPPY_COMPRESSION, buffer, &compressed, (char*)zframe_data(failed), zframe_size(failed));
+    zframe_t *compressed_failed = zframe_new(zmq_msg_data(&compressed), zmq_msg_size(&compressed));
+    zmq_msg_close(&compressed);
+    assert(admission_check(2, backend, compressed_failed, SNAPPY_COMPRESSION, &counter, buffer) == ADMISSION_ACCEPT);
+
+    zframe_destroy(&compressed_failed);
+    zframe_destroy(&backend);
+    zframe_destroy(&frontend);
+    zframe_destroy(&ok);
+    zframe_destroy(&failed);
+    zframe_destroy(&error);
+    zchunk_destroy(&buffer);
+    admission_sample_rate = old_sample_rate;
+
+    printf ("OK\n");
+}
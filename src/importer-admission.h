@@ -0,0 +1,75 @@
+#ifndef __LOGJAM_IMPORTER_ADMISSION_H_INCLUDED__
+#define __LOGJAM_IMPORTER_ADMISSION_H_INCLUDED__
+
+#include "importer-common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Admission control between subscribers and parsers.
+ *
+ * Subscribers count the messages they hand to the parsers, parsers count the
+ * messages they take off their sockets. Once the difference exceeds the high
+ * water mark, subscribers shed frontend beacons. At twice the high water mark
+ * they also sample backend requests per stream, always keeping errors. This
+ * way the push socket should never block or drop arbitrary messages.
+ */
+
+#define ADMISSION_DEFAULT_HWM_PER_PARSER 250
+#define ADMISSION_DEFAULT_SAMPLE_RATE 10
+
+typedef enum {
+    ADMISSION_ACCEPT = 0,        // message is forwarded to the parsers
+    ADMISSION_SHED_FRONTEND = 1, // frontend beacon shed because parsers are behind
+    ADMISSION_SHED_SAMPLED = 2,  // backend request not selected by per stream sampling
+} admission_reason_t;
+#define ADMISSION_NUM_REASONS 3
+
+extern size_t admission_high_water_mark; // 0 disables admission control
+extern size_t admission_sample_rate;     // keep one of N non error backend requests under heavy load
+extern int64_t admission_queued_msgs;    // messages sent to the parsers, but not yet received
+
+// read settings from frontend/admission in the config. must be called after
+// the number of parsers has been determined.
+extern void admission_setup(zconfig_t *config);
+
+extern const char* admission_reason_to_string(admission_reason_t reason);
+
+// decide whether to forward a message at the given load level. sample_counter
+// is the per stream sampling state, buffer is used to decompress the body
+// when we need to look for errors.
+extern admission_reason_t admission_check(int level, zframe_t *topic_frame, zframe_t *body_frame,
+                                          int compression_method, uint64_t *sample_counter, zchunk_t *buffer);
+
+extern void admission_test(int verbose);
+
+static inline void admission_msg_queued()
+{
+    __atomic_fetch_add(&admission_queued_msgs, 1, __ATOMIC_RELAXED);
+}
+
+static inline void admission_msg_dequeued()
+{
+    __atomic_fetch_sub(&admission_queued_msgs, 1, __ATOMIC_RELAXED);
+}
+
+// 0: accept everything, 1: shed frontend beacons, 2: also sample backend requests
+static inline int admission_load_level()
+{
+    if (admission_high_water_mark == 0)
+        return 0;
+    int64_t queued = __atomic_load_n(&admission_queued_msgs, __ATOMIC_RELAXED);
+    if (queued < (int64_t)admission_high_water_mark)
+        return 0;
+    if (queued < 2 * (int64_t)admission_high_water_mark)
+        return 1;
+    return 2;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,436 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include "importer-backend.h"
+#include "importer-mongoutils.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+backend_type_t backend_type = BACKEND_MONGO;
+
+static char *store_directory = NULL;
+static backend_counts_t counts;
+
+struct _backend {
+    backend_type_t type;
+    mongoc_client_t *mongo_clients[MAX_DATABASES];
+};
+
+struct _backend_collection {
+    backend_type_t type;
+    mongoc_collection_t *mongo;     // BACKEND_MONGO
+    int fd;                         // BACKEND_FILE
+    char *path;                     // BACKEND_FILE
+};
+
+static const char* type_names[] = {
+    "mongo",
+    "null",
+    "file",
+};
+
+const char* backend_type_name(backend_type_t type)
+{
+    return type_names[type];
+}
+
+void backend_setup(zconfig_t *config)
+{
+    const char *type = zconfig_resolve(config, "backend/store/type", "mongo");
+    if (dryrun || streq(type, "null"))
+        backend_type = BACKEND_NULL;
+    else if (streq(type, "file"))
+        backend_type = BACKEND_FILE;
+    else if (streq(type, "mongo"))
+        backend_type = BACKEND_MONGO;
+    else {
+        fprintf(stderr, "[E] backend: unknown store type: %s\n", type);
+        exit(1);
+    }
+
+    if (backend_type == BACKEND_FILE) {
+        store_directory = strdup(zconfig_resolve(config, "backend/store/directory", "logjam-store"));
+        if (zsys_dir_create("%s", store_directory)) {
+            fprintf(stderr, "[E] backend: could not create directory %s: %s\n", store_directory, strerror(errno));
+            exit(1);
+        }
+    }
+
+    if (!quiet) {
+        if (store_directory)
+            printf("[I] backend: %s (%s)\n", backend_type_name(backend_type), store_directory);
+        else
+            printf("[I] backend: %s\n", backend_type_name(backend_type));
+    }
+}
+
+void backend_get_counts(backend_counts_t *result)
+{
+    result->inserts = __atomic_load_n(&counts.inserts, __ATOMIC_RELAXED);
+    result->upserts = __atomic_load_n(&counts.upserts, __ATOMIC_RELAXED);
+    result->commands = __atomic_load_n(&counts.commands, __ATOMIC_RELAXED);
+    result->bytes = __atomic_load_n(&counts.bytes, __ATOMIC_RELAXED);
+}
+
+static inline
+void count_operation(uint64_t *counter, uint64_t n, uint64_t bytes)
+{
+    __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counts.bytes, bytes, __ATOMIC_RELAXED);
+}
+
+backend_t* backend_new()
+{
+    backend_t *backend = zmalloc(sizeof(*backend));
+    assert(backend);
+    backend->type = backend_type;
+    if (backend->type == BACKEND_MONGO) {
+        for (int i=0; i<num_databases; i++) {
+            backend->mongo_clients[i] = mongoc_client_new(databases[i]);
+            assert(backend->mongo_clients[i]);
+        }
+    }
+    return backend;
+}
+
+void backend_destroy(backend_t **backend_p)
+{
+    backend_t *backend = *backend_p;
+    if (backend->type == BACKEND_MONGO) {
+        for (int i=0; i<num_databases; i++)
+            mongoc_client_destroy(backend->mongo_clients[i]);
+    }
+    free(backend);
+    *backend_p = NULL;
+}
+
+int backend_ping(backend_t *backend, int server)
+{
+    if (backend->type == BACKEND_MONGO)
+        return mongo_client_ping(backend->mongo_clients[server]);
+    return 0;
+}
+
+static
+int file_open(const char *db_name, const char *collection_name, char **path_p, bson_error_t *error)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.%s.json", store_directory, db_name, collection_name);
+    int fd = open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "[E] backend: could not open %s: %s\n", path, strerror(errno));
+        if (error)
+            bson_set_error(error, 0, errno, "could not open %s: %s", path, strerror(errno));
+    } else if (path_p)
+        *path_p = strdup(path);
+    return fd;
+}
+
+// writes the prefix followed by each document and its separator. the data is written
+// with as few writev calls as IOV_MAX allows, never splitting a document from its
+// separator, so that concurrent appends don't interleave lines.
+static
+bool file_write(int fd, const char *path, const char *prefix, const bson_t **documents, const char **separators, size_t n, bson_error_t *error)
+{
+    size_t k = 2*n+1;
+    struct iovec *iov = malloc(k * sizeof(struct iovec));
+    char **json = malloc(n * sizeof(char*));
+    assert(iov && json);
+    iov[0].iov_base = (void*) prefix;
+    iov[0].iov_len = strlen(prefix);
+    for (size_t i=0; i<n; i++) {
+        size_t len;
+        json[i] = bson_as_json(documents[i], &len);
+        iov[2*i+1].iov_base = json[i];
+        iov[2*i+1].iov_len = len;
+        iov[2*i+2].iov_base = (void*) separators[i];
+        iov[2*i+2].iov_len = strlen(separators[i]);
+    }
+    bool ok = true;
+    for (size_t start = 0; ok && start < k; ) {
+        size_t end = start + IOV_MAX < k ? start + IOV_MAX : k;
+        // separators have even indexes, chunks must end with one
+        if (end < k && end % 2 == 0)
+            end--;
+        ssize_t expected = 0;
+        for (size_t i=start; i<end; i++)
+            expected += iov[i].iov_len;
+        ok = writev(fd, iov + start, end - start) == expected;
+        start = end;
+    }
+    if (!ok)
+        bson_set_error(error, 0, errno, "could not write %s: %s", path, strerror(errno));
+    for (size_t i=0; i<n; i++)
+        bson_free(json[i]);
+    free(json);
+    free(iov);
+    return ok;
+}
+
+backend_collection_t* backend_get_collection(backend_t *backend, int server, const char *db_name, const char *collection_name)
+{
+    backend_collection_t *collection = zmalloc(sizeof(*collection));
+    assert(collection);
+    collection->type = backend->type;
+    collection->fd = -1;
+    switch (backend->type) {
+    case BACKEND_MONGO:
+        collection->mongo = mongoc_client_get_collection(backend->mongo_clients[server], db_name, collection_name);
+        break;
+    case BACKEND_FILE:
+        // failures are reported on every write
+        collection->fd = file_open(db_name, collection_name, &collection->path, NULL);
+        break;
+    case BACKEND_NULL:
+        break;
+    }
+    return collection;
+}
+
+void backend_collection_destroy(backend_collection_t **collection_p)
+{
+    backend_collection_t *collection = *collection_p;
+    if (collection->mongo)
+        mongoc_collection_destroy(collection->mongo);
+    if (collection->fd >= 0)
+        close(collection->fd);
+    free(collection->path);
+    free(collection);
+    *collection_p = NULL;
+}
+
+void backend_collection_free(void *collection)
+{
+    backend_collection_destroy((backend_collection_t**)&collection);
+}
+
+static inline
+bool file_collection_usable(backend_collection_t *collection, bson_error_t *error)
+{
+    if (collection->fd >= 0)
+        return true;
+    bson_set_error(error, 0, EBADF, "collection file could not be opened");
+    return false;
+}
+
+bool backend_insert(backend_collection_t *collection, const bson_t *document, bson_error_t *error)
+{
+    bool ok = true;
+    switch (collection->type) {
+    case BACKEND_MONGO:
+        ok = mongoc_collection_insert(collection->mongo, MONGOC_INSERT_NONE, document, wc_no_wait, error);
+        break;
+    case BACKEND_FILE: {
+        const char *separators[] = {"\n"};
+        ok = file_collection_usable(collection, error)
+            && file_write(collection->fd, collection->path, "", &document, separators, 1, error);
+        break;
+    }
+    case BACKEND_NULL:
+        break;
+    }
+    if (ok)
+        count_operation(&counts.inserts, 1, document->len);
+    return ok;
+}
+
+bool backend_insert_many(backend_collection_t *collection, const bson_t **documents, size_t n, bool ordered, bson_t *reply, bson_error_t *error)
+{
+    bool ok = true;
+    switch (collection->type) {
+    case BACKEND_MONGO: {
+        bson_t opts = BSON_INITIALIZER;
+        mongoc_write_concern_append(wc_wait, &opts);
+        if (!ordered)
+            bson_append_bool(&opts, "ordered", 7, false);
+        ok = mongoc_collection_insert_many(collection->mongo, documents, n, &opts, reply, error);
+        bson_destroy(&opts);
+        break;
+    }
+    case BACKEND_FILE: {
+        if (reply)
+            bson_init(reply);
+        if (!file_collection_usable(collection, error)) {
+            ok = false;
+            break;
+        }
+        // one line per document
+        const char *separators[n];
+        for (size_t i=0; i<n; i++)
+            separators[i] = "\n";
+        ok = file_write(collection->fd, collection->path, "", documents, separators, n, error);
+        break;
+    }
+    case BACKEND_NULL:
+        if (reply)
+            bson_init(reply);
+        break;
+    }
+    if (ok) {
+        uint64_t bytes = 0;
+        for (size_t i=0; i<n; i++)
+            bytes += documents[i]->len;
+        count_operation(&counts.inserts, n, bytes);
+    }
+    return ok;
+}
+
+bool backend_upsert(backend_collection_t *collection, const bson_t *selector, const bson_t *update, bson_error_t *error)
+{
+    bool ok = true;
+    switch (collection->type) {
+    case BACKEND_MONGO:
+        ok = mongoc_collection_update(collection->mongo, MONGOC_UPDATE_UPSERT, selector, update, wc_no_wait, error);
+        break;
+    case BACKEND_FILE: {
+        const bson_t *documents[] = {selector, update};
+        const char *separators[] = {",\"u\":", "}\n"};
+        ok = file_collection_usable(collection, error)
+            && file_write(collection->fd, collection->path, "{\"q\":", documents, separators, 2, error);
+        break;
+    }
+    case BACKEND_NULL:
+        break;
+    }
+    if (ok)
+        count_operation(&counts.upserts, 1, selector->len + update->len);
+    return ok;
+}
+
+static
+bool run_command(backend_t *backend, int server, const char *db_name, const bson_t *command, bool write, bson_t *reply, bson_error_t *error)
+{
+    bool ok = true;
+    switch (backend->type) {
+    case BACKEND_MONGO: {
+        mongoc_database_t *database = mongoc_client_get_database(backend->mongo_clients[server], db_name);
+        if (write)
+            ok = mongoc_database_write_command_with_opts(database, command, NULL, reply, error);
+        else
+            ok = mongoc_database_command_simple(database, command, NULL, reply, error);
+        mongoc_database_destroy(database);
+        break;
+    }
+    case BACKEND_FILE: {
+        // commands are logged, replies are empty
+        bson_init(reply);
+        char *path = NULL;
+        int fd = file_open(db_name, "$cmd", &path, error);
+        if (fd < 0) {
+            ok = false;
+            break;
+        }
+        const char *separators[] = {"\n"};
+        ok = file_write(fd, path, "", &command, separators, 1, error);
+        close(fd);
+        free(path);
+        break;
+    }
+    case BACKEND_NULL:
+        bson_init(reply);
+        break;
+    }
+    if (ok)
+        count_operation(&counts.commands, 1, command->len);
+    return ok;
+}
+
+bool backend_command(backend_t *backend, int server, const char *db_name, const bson_t *command, bson_t *reply, bson_error_t *error)
+{
+    return run_command(backend, server, db_name, command, false, reply, error);
+}
+
+bool backend_write_command(backend_t *backend, int server, const char *db_name, const bson_t *command, bson_t *reply, bson_error_t *error)
+{
+    return run_command(backend, server, db_name, command, true, reply, error);
+}
+
+static
+size_t test_count_lines(const char *directory, const char *file_name)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", directory, file_name);
+    FILE *f = fopen(path, "r");
+    assert(f);
+    size_t lines = 0;
+    int c;
+    while ((c = fgetc(f)) != EOF)
+        lines += c == '\n';
+    fclose(f);
+    return lines;
+}
+
+static
+void test_operations(size_t n)
+{
+    backend_t *backend = backend_new();
+    backend_collection_t *collection = backend_get_collection(backend, 0, "logjam-checker1-production-2026-01-01", "requests");
+    bson_error_t error;
+    bson_t reply;
+
+    bson_t *documents[n];
+    for (size_t i=0; i<n; i++) {
+        documents[i] = bson_new();
+        BSON_APPEND_INT32(documents[i], "n", i);
+    }
+    backend_counts_t before, after;
+    backend_get_counts(&before);
+
+    assert(backend_insert(collection, documents[0], &error));
+    assert(backend_insert_many(collection, (const bson_t**) documents, n, true, &reply, &error));
+    bson_destroy(&reply);
+    assert(backend_upsert(collection, documents[0], documents[1], &error));
+    assert(backend_write_command(backend, 0, "logjam-checker1-production-2026-01-01", documents[0], &reply, &error));
+    bson_destroy(&reply);
+
+    backend_get_counts(&after);
+    assert(after.inserts - before.inserts == n + 1);
+    assert(after.upserts - before.upserts == 1);
+    assert(after.commands - before.commands == 1);
+    assert(after.bytes - before.bytes == (n + 3) * documents[0]->len + documents[1]->len);
+
+    for (size_t i=0; i<n; i++)
+        bson_destroy(documents[i]);
+    backend_collection_destroy(&collection);
+    backend_destroy(&backend);
+}
+
+void backend_test(int verbose)
+{
+    printf(" * importer-backend: ");
+    if (verbose)
+        printf("\n");
+
+    zconfig_t *config = zconfig_new("root", NULL);
+
+    // the null backend only counts
+    zconfig_put(config, "backend/store/type", "null");
+    backend_setup(config);
+    assert(backend_type == BACKEND_NULL);
+    test_operations(10);
+
+    // the file backend writes one line per document, even for more than IOV_MAX documents
+    char directory[256];
+    snprintf(directory, sizeof(directory), "/tmp/importer-checker-store-%d", getpid());
+    zconfig_put(config, "backend/store/type", "file");
+    zconfig_put(config, "backend/store/directory", directory);
+    backend_setup(config);
+    assert(backend_type == BACKEND_FILE);
+    size_t n = IOV_MAX + 10;
+    test_operations(n);
+    assert(test_count_lines(directory, "logjam-checker1-production-2026-01-01.requests.json") == n + 2);
+    assert(test_count_lines(directory, "logjam-checker1-production-2026-01-01.$cmd.json") == 1);
+
+    zdir_t *dir = zdir_new(directory, NULL);
+    assert(dir);
+    zdir_remove(dir, true);
+    zdir_destroy(&dir);
+    free(store_directory);
+    store_directory = NULL;
+    backend_type = BACKEND_MONGO;
+    zconfig_destroy(&config);
+
+    printf("OK\n");
+}
@@ -0,0 +1,68 @@
+#ifndef __LOGJAM_IMPORTER_BACKEND_H_INCLUDED__
+#define __LOGJAM_IMPORTER_BACKEND_H_INCLUDED__
+
+#include "importer-common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Storage backends used by stats updaters, request writers and the indexer:
+ *
+ *   mongo   the configured mongodb servers (default)
+ *   null    discards everything, but counts operations and bytes (implied by --dryrun)
+ *   file    appends extended JSON lines to <backend/store/directory>/<db>.<collection>.json
+ *
+ * The backend is selected with backend/store/type. Each thread creates its own backend_t,
+ * which holds connections to all database servers. Inserts are unacknowledged, bulk inserts
+ * are acknowledged.
+ */
+
+typedef enum {
+    BACKEND_MONGO,
+    BACKEND_NULL,
+    BACKEND_FILE,
+} backend_type_t;
+
+extern backend_type_t backend_type;
+
+typedef struct _backend backend_t;
+typedef struct _backend_collection backend_collection_t;
+
+typedef struct {
+    uint64_t inserts;
+    uint64_t upserts;
+    uint64_t commands;
+    uint64_t bytes;
+} backend_counts_t;
+
+extern void backend_setup(zconfig_t *config);
+extern const char* backend_type_name(backend_type_t type);
+
+extern backend_t* backend_new();
+extern void backend_destroy(backend_t **backend_p);
+extern int backend_ping(backend_t *backend, int server);
+
+extern backend_collection_t* backend_get_collection(backend_t *backend, int server, const char *db_name, const char *collection_name);
+extern void backend_collection_destroy(backend_collection_t **collection_p);
+// to be used as zhash free function
+extern void backend_collection_free(void *collection);
+
+extern bool backend_insert(backend_collection_t *collection, const bson_t *document, bson_error_t *error);
+extern bool backend_insert_many(backend_collection_t *collection, const bson_t **documents, size_t n, bool ordered, bson_t *reply, bson_error_t *error);
+extern bool backend_upsert(backend_collection_t *collection, const bson_t *selector, const bson_t *update, bson_error_t *error);
+
+extern bool backend_command(backend_t *backend, int server, const char *db_name, const bson_t *command, bson_t *reply, bson_error_t *error);
+extern bool backend_write_command(backend_t *backend, int server, const char *db_name, const bson_t *command, bson_t *reply, bson_error_t *error);
+
+// successful operations since startup, over all threads
+extern void backend_get_counts(backend_counts_t *counts);
+
+extern void backend_test(int verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
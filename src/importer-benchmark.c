@@ -0,0 +1,635 @@
+#include "importer-controller.h"
+#include "logjam-streaminfo.h"
+#include "importer-resources.h"
+#include "importer-mongoutils.h"
+#include "importer-prometheus-client.h"
+#include "importer-admission.h"
+#include "importer-increments.h"
+#include <getopt.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+/*
+ * Runs the complete importer pipeline (subscriber, parsers, adders, controller, writers,
+ * updaters, indexer) against the null storage backend (or the one given with --store) and
+ * feeds it synthetic messages from a generator
+ * thread, which connects to the subscriber PULL socket over tcp. The generator uses its
+ * own zmq context, so it is unaffected by the controller shutting down the czmq context.
+ *
+ * After a warmup period, the generator samples per thread CPU usage from /proc and the
+ * tick statistics of the controller, runs for the requested duration, samples again and
+ * then interrupts the controller loop. The report is printed after the importer has shut
+ * down.
+ */
+
+// the benchmark uses its own ports, so it can run next to a real importer
+#define BENCHMARK_PULL_PORT 19605
+#define BENCHMARK_ROUTER_PORT 19604
+#define BENCHMARK_SUB_PORT 19606
+
+static int metrics_port = 19610;
+static char metrics_address[256] = {0};
+static const char *config_file_name = "logjam.conf";
+static char streams_file_name[256] = {0};
+static char streams_url[256+7] = {0};
+static size_t io_threads = 1;
+
+// benchmark parameters
+static size_t num_apps = 10;
+static size_t num_actions = 100;
+static double metric_density = 0.5;
+static double frontend_ratio = 0.2;
+static int compression_method = SNAPPY_COMPRESSION;
+static size_t rate = 0;
+static int duration = 30;
+static int warmup = 5;
+static const char *store_type = "null";
+
+#define MAX_STAGES 64
+#define GENERATOR_BATCH_SIZE 100
+#define MAX_BODY_SIZE 16384
+
+typedef struct {
+    char name[16];
+    unsigned long ticks;
+    size_t threads;
+} stage_cpu_t;
+
+typedef struct {
+    stage_cpu_t stages[MAX_STAGES];
+    size_t num_stages;
+} cpu_sample_t;
+
+typedef struct {
+    void *context;
+    void *socket;
+    zchunk_t *compression_buffer;
+    uint64_t sequence_number;
+    size_t generated;
+    size_t generated_frontend;
+    size_t blocked;
+    time_t started_at_time;
+    char started_at[32];
+} generator_state_t;
+
+typedef struct {
+    bool completed;
+    double elapsed;
+    size_t generated;
+    size_t generated_frontend;
+    size_t blocked;
+    controller_tick_stats_t ticks;
+    cpu_sample_t cpu_start;
+    cpu_sample_t cpu_end;
+    backend_counts_t store_start;
+    backend_counts_t store_end;
+} benchmark_report_t;
+
+static benchmark_report_t report;
+
+static
+void sample_thread_cpu(cpu_sample_t *sample)
+{
+    memset(sample, 0, sizeof(*sample));
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == NULL)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        char path[256];
+        char comm[32] = {0};
+        char stat[1024] = {0};
+
+        snprintf(path, sizeof(path), "/proc/self/task/%s/comm", entry->d_name);
+        FILE *f = fopen(path, "r");
+        if (f == NULL)
+            continue;
+        if (!fgets(comm, sizeof(comm), f))
+            comm[0] = '\0';
+        fclose(f);
+
+        snprintf(path, sizeof(path), "/proc/self/task/%s/stat", entry->d_name);
+        f = fopen(path, "r");
+        if (f == NULL)
+            continue;
+        if (!fgets(stat, sizeof(stat), f))
+            stat[0] = '\0';
+        fclose(f);
+
+        // thread names are of the form stage[n]. group them by stage.
+        char *p = strpbrk(comm, "[\n");
+        if (p) *p = '\0';
+
+        // utime and stime are fields 14 and 15, counted after the command name
+        unsigned long utime = 0, stime = 0;
+        char *fields = strrchr(stat, ')');
+        if (fields == NULL)
+            continue;
+        char state;
+        if (sscanf(fields + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &state, &utime, &stime) != 3)
+            continue;
+
+        size_t i = 0;
+        while (i < sample->num_stages && strcmp(sample->stages[i].name, comm))
+            i++;
+        if (i == sample->num_stages) {
+            if (i == MAX_STAGES)
+                continue;
+            snprintf(sample->stages[i].name, sizeof(sample->stages[i].name), "%s", comm);
+            sample->num_stages++;
+        }
+        sample->stages[i].ticks += utime + stime;
+        sample->stages[i].threads++;
+    }
+    closedir(dir);
+}
+
+static
+unsigned long stage_ticks(cpu_sample_t *sample, const char *name)
+{
+    for (size_t i = 0; i < sample->num_stages; i++) {
+        if (streq(sample->stages[i].name, name))
+            return sample->stages[i].ticks;
+    }
+    return 0;
+}
+
+static inline
+double random_fraction()
+{
+    return (double) random() / MAX_RANDOM_VALUE;
+}
+
+static
+void update_started_at(generator_state_t *state)
+{
+    time_t now = time(NULL);
+    if (now == state->started_at_time)
+        return;
+    struct tm lt;
+    localtime_r(&now, &lt);
+    strftime(state->started_at, sizeof(state->started_at), "%Y-%m-%dT%H:%M:%S", &lt);
+    state->started_at_time = now;
+}
+
+static
+int append_metrics(char *buffer, int n, char **resources, size_t last_index, double scale)
+{
+    for (size_t i = 0; i <= last_index && n < MAX_BODY_SIZE - 256; i++) {
+        const char *r = resources[i];
+        if (streq(r, "total_time") || streq(r, "other_time"))
+            continue;
+        if (random_fraction() < metric_density)
+            n += snprintf(buffer + n, MAX_BODY_SIZE - n, ",\"%s\":%.3f", r, random_fraction() * scale);
+    }
+    return n;
+}
+
+static
+int send_message(generator_state_t *state, const char *stream, const char *topic, const char *body, size_t body_len)
+{
+    zmq_msg_t message_parts[3];
+    zmq_msg_init_size(&message_parts[0], strlen(stream));
+    memcpy(zmq_msg_data(&message_parts[0]), stream, strlen(stream));
+    zmq_msg_init_size(&message_parts[1], strlen(topic));
+    memcpy(zmq_msg_data(&message_parts[1]), topic, strlen(topic));
+    if (compression_method) {
+        zmq_msg_init(&message_parts[2]);
+        compress_message_data(compression_method, state->compression_buffer, &message_parts[2], body, body_len);
+    } else {
+        zmq_msg_init_size(&message_parts[2], body_len);
+        memcpy(zmq_msg_data(&message_parts[2]), body, body_len);
+    }
+
+    msg_meta_t meta = META_INFO_EMPTY;
+    meta.compression_method = compression_method;
+    meta.created_ms = zclock_time();
+    meta.sequence_number = ++state->sequence_number;
+
+    int rc;
+    while ((rc = publish_on_zmq_transport(&message_parts[0], state->socket, &meta, ZMQ_DONTWAIT)) == -1
+           && errno == EAGAIN && !zsys_interrupted) {
+        state->blocked++;
+        zclock_sleep(1);
+    }
+
+    for (int i = 0; i < 3; i++)
+        zmq_msg_close(&message_parts[i]);
+
+    return rc;
+}
+
+static
+void generate_messages(generator_state_t *state)
+{
+    char body[MAX_BODY_SIZE];
+    char stream[64];
+    char topic[64];
+    char request_id[33];
+
+    update_started_at(state);
+
+    size_t app = random() % num_apps;
+    size_t action = random() % num_actions;
+    snprintf(stream, sizeof(stream), "bench%zu-production", app);
+    snprintf(request_id, sizeof(request_id), "%08lx%08lx%08lx%08lx", random(), random(), random(), random());
+
+    double total_time = 1 + random_fraction() * 500;
+    int code = random_fraction() < 0.01 ? 500 : 200;
+    int severity = code == 500 ? LOG_SEVERITY_ERROR : LOG_SEVERITY_INFO;
+
+    int n = snprintf(body, MAX_BODY_SIZE,
+                     "{\"action\":\"Bench%zu::Controller#action%zu\",\"started_at\":\"%s\",\"started_ms\":%" PRIi64 ","
+                     "\"request_id\":\"%s\",\"code\":%d,\"severity\":%d,\"total_time\":%.3f,"
+                     "\"request_info\":{\"method\":\"GET\",\"url\":\"/bench/%zu\",\"headers\":{\"User-Agent\":\"benchmark\"}}",
+                     action % 10, action, state->started_at, zclock_time(), request_id, code, severity, total_time, action);
+    n = append_metrics(body, n, time_resources, last_time_resource_index, total_time / (last_time_resource_index + 1));
+    n = append_metrics(body, n, call_resources, last_call_resource_index, 100);
+    n = append_metrics(body, n, memory_resources, last_memory_resource_index, 100000);
+    n += snprintf(body + n, MAX_BODY_SIZE - n, "}");
+
+    snprintf(topic, sizeof(topic), "logs.bench.action%zu", action);
+    if (send_message(state, stream, topic, body, n) == -1)
+        return;
+    state->generated++;
+
+    if (random_fraction() >= frontend_ratio)
+        return;
+
+    // frontend timings: navigationStart, ..., loadEventEnd, in ascending order
+    int64_t base = zclock_time();
+    int64_t step = 5 + random() % 45;
+    char rts[512];
+    int m = 0;
+    for (int i = 0; i < 16; i++)
+        m += snprintf(rts + m, sizeof(rts) - m, i ? ",%" PRIi64 : "%" PRIi64, base + i * step);
+
+    n = snprintf(body, MAX_BODY_SIZE,
+                 "{\"action\":\"Bench%zu::Controller#action%zu\",\"started_at\":\"%s\",\"started_ms\":%" PRIi64 ","
+                 "\"logjam_request_id\":\"%s-%s\",\"rts\":\"%s\",\"user_agent\":\"benchmark\"}",
+                 action % 10, action, state->started_at, base, stream, request_id, rts);
+    if (send_message(state, stream, "frontend.page", body, n) == -1)
+        return;
+    state->generated++;
+    state->generated_frontend++;
+}
+
+static
+void* generator(void *args)
+{
+    set_thread_name("generator[0]");
+
+    generator_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.context = zmq_ctx_new();
+    assert(state.context);
+    state.socket = zmq_socket(state.context, ZMQ_PUSH);
+    assert(state.socket);
+    int linger = 0;
+    zmq_setsockopt(state.socket, ZMQ_LINGER, &linger, sizeof(linger));
+    char spec[256];
+    snprintf(spec, sizeof(spec), "tcp://127.0.0.1:%d", pull_port);
+    int rc = zmq_connect(state.socket, spec);
+    assert(rc == 0);
+    state.compression_buffer = zchunk_new(NULL, INITIAL_COMPRESSION_BUFFER_SIZE);
+    assert(state.compression_buffer);
+
+    int64_t start_time = zclock_mono();
+    int64_t measure_start_time = start_time + 1000 * warmup;
+    int64_t end_time = measure_start_time + 1000 * duration;
+    bool measuring = false;
+    size_t generated_at_start = 0, frontend_at_start = 0, blocked_at_start = 0;
+
+    while (!zsys_interrupted) {
+        for (int i = 0; i < GENERATOR_BATCH_SIZE && !zsys_interrupted; i++)
+            generate_messages(&state);
+
+        int64_t now = zclock_mono();
+        if (!measuring && now >= measure_start_time) {
+            measuring = true;
+            sample_thread_cpu(&report.cpu_start);
+            backend_get_counts(&report.store_start);
+            controller_get_tick_stats(&report.ticks, true);
+            generated_at_start = state.generated;
+            frontend_at_start = state.generated_frontend;
+            blocked_at_start = state.blocked;
+            if (!quiet)
+                printf("[I] benchmark: warmup complete, measuring for %d seconds\n", duration);
+        }
+        if (measuring && now >= end_time) {
+            sample_thread_cpu(&report.cpu_end);
+            backend_get_counts(&report.store_end);
+            controller_get_tick_stats(&report.ticks, false);
+            report.elapsed = (now - measure_start_time) / 1000.0;
+            report.generated = state.generated - generated_at_start;
+            report.generated_frontend = state.generated_frontend - frontend_at_start;
+            report.blocked = state.blocked - blocked_at_start;
+            report.completed = true;
+            zsys_interrupted = 1;
+            break;
+        }
+        if (rate > 0) {
+            // sleep until the next batch is due
+            int64_t due = start_time + (int64_t)(1000.0 * state.generated / rate);
+            if (due > now)
+                zclock_sleep(due - now);
+        }
+    }
+
+    zchunk_destroy(&state.compression_buffer);
+    zmq_close(state.socket);
+    zmq_ctx_term(state.context);
+    return NULL;
+}
+
+static
+void print_report()
+{
+    if (!report.completed) {
+        fprintf(stderr, "[E] benchmark: interrupted before measurement completed\n");
+        return;
+    }
+    double elapsed = report.elapsed > 0 ? report.elapsed : 1;
+    double ticks_per_second = sysconf(_SC_CLK_TCK);
+    controller_tick_stats_t *t = &report.ticks;
+
+    printf("[I] benchmark: apps: %zu, actions: %zu, metric density: %.2f, frontend ratio: %.2f, compression: %s, rate: %zu\n",
+           num_apps, num_actions, metric_density, frontend_ratio, compression_method_to_string(compression_method), rate);
+    printf("[I] benchmark: generated: %zu messages (%zu frontend), %.0f msgs/s, generator blocked: %zu\n",
+           report.generated, report.generated_frontend, report.generated / elapsed, report.blocked);
+    printf("[I] benchmark: processed: %zu messages, %.0f msgs/s\n",
+           t->parsed_msgs, t->parsed_msgs / elapsed);
+    printf("[I] benchmark: tick merge: %zu ticks, avg: %.1f ms, max: %" PRIi64 " ms\n",
+           t->ticks, t->ticks ? (double) t->runtime_ms_total / t->ticks : 0.0, t->runtime_ms_max);
+
+    backend_counts_t *s0 = &report.store_start, *s1 = &report.store_end;
+    printf("[I] benchmark: store %s: %.0f inserts/s, %.0f upserts/s, %" PRIu64 " commands, %.1f MB/s\n",
+           backend_type_name(backend_type), (s1->inserts - s0->inserts) / elapsed, (s1->upserts - s0->upserts) / elapsed,
+           s1->commands - s0->commands, (s1->bytes - s0->bytes) / elapsed / 1048576);
+
+    double importer_seconds = 0;
+    for (size_t i = 0; i < report.cpu_end.num_stages; i++) {
+        stage_cpu_t *stage = &report.cpu_end.stages[i];
+        unsigned long ticks = stage->ticks - stage_ticks(&report.cpu_start, stage->name);
+        double seconds = ticks / ticks_per_second;
+        if (!streq(stage->name, "generator"))
+            importer_seconds += seconds;
+        if (ticks == 0 && !verbose)
+            continue;
+        printf("[I] benchmark: cpu %-16s %2zu threads: %7.2f s (%5.1f%% of one core)\n",
+               stage->name, stage->threads, seconds, 100 * seconds / elapsed);
+    }
+    printf("[I] benchmark: cpu importer total: %.2f s, %.0f msgs per cpu second\n",
+           importer_seconds, importer_seconds > 0 ? t->parsed_msgs / importer_seconds : 0.0);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("[I] benchmark: peak rss: %.1f MB\n", usage.ru_maxrss / 1024.0);
+}
+
+static
+bool write_streams_file()
+{
+    snprintf(streams_file_name, sizeof(streams_file_name), "/tmp/importer-benchmark-streams-%d.json", getpid());
+    FILE *f = fopen(streams_file_name, "w");
+    if (f == NULL) {
+        fprintf(stderr, "[E] could not create stream config file %s: %s\n", streams_file_name, strerror(errno));
+        return false;
+    }
+    fprintf(f, "{");
+    for (size_t i = 0; i < num_apps; i++) {
+        fprintf(f, "%s\"bench%zu-production\":{\"import_threshold\":500,\"sampling_rate_400s\":1,"
+                "\"database_cleaning_threshold\":30,\"request_cleaning_threshold\":7,\"api_requests\":[]}",
+                i ? "," : "", i);
+    }
+    fprintf(f, "}\n");
+    fclose(f);
+    snprintf(streams_url, sizeof(streams_url), "file://%s", streams_file_name);
+    return true;
+}
+
+void print_usage(char * const *argv)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "\nOptions:\n"
+            "  -a, --apps N               number of synthetic applications\n"
+            "  -b, --subscribers N        number of subscriber threads\n"
+            "  -c, --config C             zeromq config file (for metrics definitions)\n"
+            "  -d, --duration N           measurement duration in seconds\n"
+            "  -f, --frontend-ratio F     fraction of requests followed by a page message\n"
+            "  -k, --actions N            number of distinct actions per application\n"
+            "  -m, --metrics-port N       port to use for prometheus path /metrics\n"
+            "  -p, --parsers N            number of parser threads\n"
+            "  -q, --quiet                supress most output\n"
+            "  -r, --rate N               messages per second (0 = as fast as possible)\n"
+            "  -s, --store T              storage backend (null, file, mongo), default: null\n"
+            "  -u, --updaters N           number of db stats updater threads\n"
+            "  -v, --verbose              log more (use -vv for debug output)\n"
+            "  -w, --writers N            number of db request writer threads\n"
+            "  -x, --density F            fraction of configured metrics sent per request\n"
+            "  -z, --compress M           compression method (none, zlib, snappy, lz4)\n"
+            "  -P, --input-port N         pull port for receiving logjam messages\n"
+            "  -W, --warmup N             warmup seconds before measuring\n"
+            "      --help                 display this message\n"
+            , argv[0]);
+}
+
+static
+unsigned long thread_count_arg(const char *arg, char option, unsigned long max)
+{
+    unsigned long n = strtoul(arg, NULL, 0);
+    if (n == 0 || n > max) {
+        fprintf(stderr, "[E] parameter value '%c' must be between 1 and %lu\n", option, max);
+        exit(1);
+    }
+    return n;
+}
+
+void process_arguments(int argc, char * const *argv)
+{
+    char c;
+    int longindex = 0;
+    opterr = 0;
+
+    static struct option long_options[] = {
+        { "actions",          required_argument, 0, 'k' },
+        { "apps",             required_argument, 0, 'a' },
+        { "compress",         required_argument, 0, 'z' },
+        { "config",           required_argument, 0, 'c' },
+        { "density",          required_argument, 0, 'x' },
+        { "duration",         required_argument, 0, 'd' },
+        { "frontend-ratio",   required_argument, 0, 'f' },
+        { "help",             no_argument,       0,  0  },
+        { "input-port",       required_argument, 0, 'P' },
+        { "metrics-port",     required_argument, 0, 'm' },
+        { "parsers",          required_argument, 0, 'p' },
+        { "quiet",            no_argument,       0, 'q' },
+        { "rate",             required_argument, 0, 'r' },
+        { "store",            required_argument, 0, 's' },
+        { "subscribers",      required_argument, 0, 'b' },
+        { "updaters",         required_argument, 0, 'u' },
+        { "verbose",          no_argument,       0, 'v' },
+        { "warmup",           required_argument, 0, 'W' },
+        { "writers",          required_argument, 0, 'w' },
+        { 0,                  0,                 0,  0  }
+    };
+
+    while ((c = getopt_long(argc, argv, "a:b:c:d:f:k:m:p:qr:s:u:vw:x:z:P:W:", long_options, &longindex)) != -1) {
+        switch (c) {
+        case 'v':
+            if (verbose)
+                debug = true;
+            else
+                verbose = true;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        case 'c':
+            config_file_name = optarg;
+            break;
+        case 'a':
+            num_apps = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            num_actions = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'W':
+            warmup = atoi(optarg);
+            break;
+        case 'f':
+            frontend_ratio = atof(optarg);
+            break;
+        case 'x':
+            metric_density = atof(optarg);
+            break;
+        case 'r':
+            rate = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            store_type = optarg;
+            break;
+        case 'z':
+            compression_method = streq(optarg, "none") ? NO_COMPRESSION : string_to_compression_method(optarg);
+            break;
+        case 'b':
+            num_subscribers = thread_count_arg(optarg, c, MAX_SUBSCRIBERS);
+            break;
+        case 'p':
+            num_parsers = thread_count_arg(optarg, c, MAX_PARSERS);
+            break;
+        case 'u':
+            num_updaters = thread_count_arg(optarg, c, MAX_UPDATERS);
+            break;
+        case 'w':
+            num_writers = thread_count_arg(optarg, c, MAX_WRITERS);
+            break;
+        case 'm':
+            metrics_port = atoi(optarg);
+            break;
+        case 'P':
+            pull_port = atoi(optarg);
+            break;
+        case 0:
+            print_usage(argv);
+            exit(0);
+            break;
+        case '?':
+            if (strchr("abcdfkmprsuwxzPW", optopt))
+                fprintf(stderr, "[E] option -%c requires an argument.\n", optopt);
+            else if (isprint (optopt))
+                fprintf(stderr, "[E] unknown option `-%c'.\n", optopt);
+            else
+                fprintf(stderr, "[E] unknown option character `\\x%x'.\n", optopt);
+            print_usage(argv);
+            exit(1);
+        default:
+            fprintf(stderr, "BUG: can't process option -%c\n", optopt);
+            exit(1);
+        }
+    }
+
+    if (num_apps == 0 || num_actions == 0 || duration <= 0 || warmup < 0) {
+        fprintf(stderr, "[E] apps, actions and duration must be positive\n");
+        exit(1);
+    }
+    if (rcv_hwm == -1)
+        rcv_hwm = DEFAULT_RCV_HWM;
+    if (snd_hwm == -1)
+        snd_hwm = DEFAULT_SND_HWM;
+}
+
+int main(int argc, char * const *argv)
+{
+    // don't buffer stdout and stderr
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    setvbuf(stderr, NULL, _IOLBF, 0);
+
+    pull_port = BENCHMARK_PULL_PORT;
+    router_port = BENCHMARK_ROUTER_PORT;
+    sub_port = BENCHMARK_SUB_PORT;
+    live_stream_connection_spec = "inproc://benchmark-live-stream";
+
+    process_arguments(argc, argv);
+
+    // only touch databases when asked to, never send statsd updates
+    dryrun = streq(store_type, "null");
+    send_statsd_msgs = false;
+
+    if (!zsys_file_exists(config_file_name)) {
+        fprintf(stderr, "[E] missing config file: %s\n", config_file_name);
+        exit(1);
+    }
+    config_file_init(config_file_name);
+    config_update_date_info();
+    zconfig_t* config = zconfig_load((char*)config_file_name);
+    zconfig_put(config, "backend/store/type", store_type);
+
+    // don't connect to any device listed in the config file
+    hosts = zlist_new();
+    zlist_autofree(hosts);
+    char *device_spec = augment_zmq_connection_spec("127.0.0.1", sub_port);
+    zlist_append(hosts, device_spec);
+    free(device_spec);
+
+    if (!write_streams_file())
+        exit(1);
+
+    if (!quiet)
+        printf("[I] started %s\n"
+               "[I] pull-port:     %d\n"
+               "[I] parsers:       %zu\n"
+               "[I] writers:       %zu\n"
+               "[I] updaters:      %zu\n"
+               "[I] duration:      %d (warmup %d)\n"
+               , argv[0], pull_port, num_parsers, num_writers, num_updaters, duration, warmup);
+
+    admission_setup(config);
+    key_guard_setup(config);
+    initialize_mongo_db_globals(config);
+    snprintf(metrics_address, sizeof(metrics_address), "127.0.0.1:%d", metrics_port);
+    importer_prometheus_client_params_t prometheus_params = { .num_subscribers = num_subscribers, .num_parsers = num_parsers, .num_writers = num_writers, .num_updaters = num_updaters};
+    importer_prometheus_client_init(metrics_address, prometheus_params);
+
+    setup_resource_maps(config);
+
+    pthread_t generator_thread;
+    int rc = pthread_create(&generator_thread, NULL, generator, NULL);
+    assert(rc == 0);
+
+    rc = run_controller_loop(config, io_threads, streams_url, "");
+
+    zsys_interrupted = 1;
+    pthread_join(generator_thread, NULL);
+    unlink(streams_file_name);
+
+    print_report();
+    return rc || !report.completed;
+}
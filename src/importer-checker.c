@@ -0,0 +1,109 @@
+#include "importer-common.h"
+#include "importer-admission.h"
+#include "importer-backend.h"
+#include "importer-indexer.h"
+#include "importer-increments.h"
+#include "importer-spool.h"
+#include "importer-storage.h"
+#include "device-tracker.h"
+#include "importer-prometheus-client.h"
+#include "logjam-streaminfo.h"
+#include <getopt.h>
+
+/*
+ * Runs the self tests of importer modules, which can't be linked into the
+ * checker without pulling in the whole importer.
+ */
+
+// some modules publish metrics, so the checker needs a prometheus client
+#define CHECKER_METRICS_ADDRESS "127.0.0.1:19611"
+
+static char streams_file_name[256] = {0};
+static char streams_url[256+7] = {0};
+
+static void print_usage(char * const *argv)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "Options:\n"
+            "  -v, --verbose              log more\n"
+            "      --help                 display this message\n"
+            , argv[0]);
+}
+
+static void process_arguments(int argc, char * const *argv)
+{
+    char c;
+    int longindex = 0;
+    opterr = 0;
+
+    static struct option long_options[] = {
+        { "help",          no_argument,       0,  0  },
+        { "verbose",       no_argument,       0, 'v' },
+        { 0,               0,                 0,  0  }
+    };
+
+    while ((c = getopt_long(argc, argv, "v", long_options, &longindex)) != -1) {
+        switch (c) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 0:
+            print_usage(argv);
+            exit(0);
+            break;
+        case '?':
+            if (isprint (optopt))
+                fprintf(stderr, "[E] unknown option `-%c'.\n", optopt);
+            else
+                fprintf(stderr, "[E] unknown option character `\\x%x'.\n", optopt);
+            print_usage(argv);
+            exit(1);
+        default:
+            fprintf(stderr, "BUG: can't process option -%c\n", optopt);
+            exit(1);
+        }
+    }
+}
+
+static bool setup_test_streams()
+{
+    snprintf(streams_file_name, sizeof(streams_file_name), "/tmp/importer-checker-streams-%d.json", getpid());
+    FILE *f = fopen(streams_file_name, "w");
+    if (f == NULL) {
+        fprintf(stderr, "[E] could not create stream config file %s: %s\n", streams_file_name, strerror(errno));
+        return false;
+    }
+    for (int i = 1; i <= 2; i++) {
+        fprintf(f, "%s\"checker%d-production\":{\"import_threshold\":500,\"sampling_rate_400s\":1,"
+                "\"database_cleaning_threshold\":30,\"request_cleaning_threshold\":7,\"api_requests\":[]}",
+                i == 1 ? "{" : ",", i);
+    }
+    fprintf(f, "}\n");
+    fclose(f);
+    snprintf(streams_url, sizeof(streams_url), "file://%s", streams_file_name);
+    return setup_stream_config(streams_url, "");
+}
+
+int main(int argc, char * const *argv)
+{
+    process_arguments(argc, argv);
+    quiet = !verbose;
+    importer_prometheus_client_params_t prometheus_params = { .num_subscribers = 1, .num_parsers = 1, .num_writers = 1, .num_updaters = 1 };
+    importer_prometheus_client_init(CHECKER_METRICS_ADDRESS, prometheus_params);
+    admission_test(verbose);
+    backend_test(verbose);
+    key_guard_test(verbose);
+    device_tracker_test(verbose);
+
+    bool streams_ok = setup_test_streams();
+    unlink(streams_file_name);
+    if (!streams_ok)
+        return 1;
+    indexer_test(verbose);
+    storage_test(verbose);
+    spool_test(verbose);
+
+    importer_prometheus_client_shutdown();
+    return 0;
+}
@@ -9,6 +9,17 @@ bool send_statsd_msgs = true;
 int queued_updates = 0;
 int queued_inserts = 0;
 
+// set from the command line by logjam-importer (or importer-benchmark)
+int snd_hwm = -1;
+int rcv_hwm = -1;
+int pull_port = -1;
+int router_port = -1;
+int sub_port = -1;
+char* live_stream_connection_spec = NULL;
+char* prom_collector_connection_spec = NULL;
+zlist_t *hosts = NULL;
+FILE* frontend_timings = NULL;
+
 // utf8 conversion
 static char UTF8_DOT[4] = {0xE2, 0x80, 0xA4, '\0' };
 static char UTF8_CURRENCY[3] = {0xC2, 0xA4, '\0'};
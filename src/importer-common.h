@@ -83,6 +83,30 @@ extern bool config_update_date_info();
 extern int set_thread_name(const char* name);
 
 
+// Subscribers append the time a message was received (zclock_usecs) as an additional
+// frame to messages carrying meta information. Parsers remove it before processing
+// the message, so that we can measure queueing time between subscribers and parsers.
+#define MSG_RECEIVE_TIME_FRAME_COUNT 5
+
+static inline void zmsg_add_receive_time(zmsg_t *msg)
+{
+    int64_t now_us = zclock_usecs();
+    zmsg_addmem(msg, &now_us, sizeof(now_us));
+}
+
+static inline int64_t zmsg_remove_receive_time(zmsg_t *msg)
+{
+    int64_t received_us = 0;
+    if (zmsg_size(msg) != MSG_RECEIVE_TIME_FRAME_COUNT)
+        return 0;
+    zframe_t *frame = zmsg_last(msg);
+    if (zframe_size(frame) == sizeof(received_us))
+        memcpy(&received_us, zframe_data(frame), sizeof(received_us));
+    zmsg_remove(msg, frame);
+    zframe_destroy(&frame);
+    return received_us;
+}
+
 #define USE_UNACKNOWLEDGED_WRITES 0
 #define USE_BACKGROUND_INDEX_BUILDS 1
 
@@ -11,6 +11,7 @@
 #include "importer-watchdog.h"
 #include "statsd-client.h"
 #include "importer-prometheus-client.h"
+#include <pthread.h>
 
 /*
  * connections: n_s = num_subscribers, n_w = num_writers, n_p = num_parsers, n_u= num_updaters, n_a = num_adders "[<>^v]" = connect, "o" = bind
@@ -71,6 +72,31 @@ typedef struct {
 } controller_state_t;
 
 
+// accumulated tick timings, read by the benchmark
+static controller_tick_stats_t tick_stats;
+static pthread_mutex_t tick_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void controller_get_tick_stats(controller_tick_stats_t *stats, bool reset)
+{
+    pthread_mutex_lock(&tick_stats_lock);
+    *stats = tick_stats;
+    if (reset)
+        memset(&tick_stats, 0, sizeof(tick_stats));
+    pthread_mutex_unlock(&tick_stats_lock);
+}
+
+static
+void update_tick_stats(size_t parsed_msgs_count, int runtime)
+{
+    pthread_mutex_lock(&tick_stats_lock);
+    tick_stats.ticks++;
+    tick_stats.parsed_msgs += parsed_msgs_count;
+    tick_stats.runtime_ms_total += runtime;
+    if (runtime > tick_stats.runtime_ms_max)
+        tick_stats.runtime_ms_max = runtime;
+    pthread_mutex_unlock(&tick_stats_lock);
+}
+
 static
 void extract_parser_state(controller_state_t *state, zmsg_t* msg, zhash_t **processors, size_t *parsed_msgs_count, frontend_stats_t *fe_stats)
 {
@@ -100,22 +126,15 @@ void extract_parser_state(controller_state_t *state, zmsg_t* msg, zhash_t **proc
 static
 void publish_totals(stream_info_t *stream_info, zhash_t *totals, zsock_t *live_stream_socket)
 {
-    size_t n = stream_info->app_len + 1 + stream_info->env_len;
+    if (!live_stream_is_watched(stream_info))
+        return;
+
     zhash_t *known_modules = stream_info->known_modules;
     void *value = zhash_first(known_modules);
     while (value) {
-        const char *module = zhash_cursor(known_modules);
-        const char *namespace = module;
-        // skip :: at the beginning of module
-        while (*module == ':') module++;
-        size_t m = strlen(module);
-        char key[n + m + 3];
-        sprintf(key, "%s-%s,%s", stream_info->app, stream_info->env, module);
-        // TODO: change this crap in the live stream publisher
-        // tolower is unsafe and not really necessary
-        for (char *p = key; *p; ++p) *p = tolower(*p);
-
-        // printf("[D] publishing totals for module: %s, key: %s\n", module, key);
+        const char *namespace = zhash_cursor(known_modules);
+
+        // printf("[D] publishing totals for module: %s\n", namespace);
         json_object *json = json_object_new_object();
         increments_t *incs = totals ? zhash_lookup(totals, namespace) : NULL;
         if (incs) {
@@ -130,7 +149,7 @@ void publish_totals(stream_info_t *stream_info, zhash_t *totals, zsock_t *live_s
             json_object_object_add(json, "ajax_count", json_object_new_int(0));
         }
         const char* json_str = json_object_to_json_string_ext(json, JSON_C_TO_STRING_PLAIN);
-        live_stream_publish(live_stream_socket, key, json_str);
+        live_stream_publish_for_module(stream_info, namespace, json_str, live_stream_socket);
         json_object_put(json);
 
         value = zhash_next(known_modules);
@@ -209,7 +228,7 @@ void merge_processors(controller_state_t *state, zlist_t *additions)
 }
 
 static
-void forward_updates(controller_state_t *state, zhash_t *processor)
+void forward_updates(controller_state_t *state, zhash_t *processor, int64_t tick_start_us)
 {
     zlist_t *db_names = zhash_keys(processor);
     const char* db_name = zlist_first(db_names);
@@ -225,6 +244,7 @@ void forward_updates(controller_state_t *state, zhash_t *processor)
         zmsg_addptr(stats_msg, proc->stream_info);
         reference_stream_info(proc->stream_info);
         zmsg_addptr(stats_msg, proc->totals);
+        zmsg_addmem(stats_msg, &tick_start_us, sizeof(tick_start_us));
         proc->totals = NULL;
         if (!output_socket_ready(state->updates_socket, 0)) {
             if (!state->updates_blocked++)
@@ -242,6 +262,7 @@ void forward_updates(controller_state_t *state, zhash_t *processor)
         zmsg_addptr(stats_msg, proc->stream_info);
         reference_stream_info(proc->stream_info);
         zmsg_addptr(stats_msg, proc->minutes);
+        zmsg_addmem(stats_msg, &tick_start_us, sizeof(tick_start_us));
         proc->minutes = NULL;
         if (!output_socket_ready(state->updates_socket, 0)) {
             if (!state->updates_blocked++)
@@ -259,6 +280,7 @@ void forward_updates(controller_state_t *state, zhash_t *processor)
         zmsg_addptr(stats_msg, proc->stream_info);
         reference_stream_info(proc->stream_info);
         zmsg_addptr(stats_msg, proc->quants);
+        zmsg_addmem(stats_msg, &tick_start_us, sizeof(tick_start_us));
         proc->quants = NULL;
         if (!output_socket_ready(state->updates_socket, 0)) {
             if (!state->updates_blocked++)
@@ -276,6 +298,7 @@ void forward_updates(controller_state_t *state, zhash_t *processor)
         zmsg_addptr(stats_msg, proc->stream_info);
         reference_stream_info(proc->stream_info);
         zmsg_addptr(stats_msg, proc->histograms);
+        zmsg_addmem(stats_msg, &tick_start_us, sizeof(tick_start_us));
         proc->histograms = NULL;
         if (!output_socket_ready(state->updates_socket, 0)) {
             if (!state->updates_blocked++)
@@ -293,6 +316,7 @@ void forward_updates(controller_state_t *state, zhash_t *processor)
         zmsg_addptr(stats_msg, proc->stream_info);
         reference_stream_info(proc->stream_info);
         zmsg_addptr(stats_msg, proc->agents);
+        zmsg_addmem(stats_msg, &tick_start_us, sizeof(tick_start_us));
         proc->agents = NULL;
         if (!output_socket_ready(state->updates_socket, 0)) {
             if (!state->updates_blocked++)
@@ -331,6 +355,7 @@ static
 int collect_stats_and_forward(zloop_t *loop, int timer_id, void *arg)
 {
     int64_t start_time_ms = zclock_mono();
+    int64_t start_time_us = zclock_usecs();
     controller_state_t *state = arg;
     zhash_t *processors[num_parsers];
     size_t parsed_msgs_counts[num_parsers];
@@ -401,7 +426,7 @@ int collect_stats_and_forward(zloop_t *loop, int timer_id, void *arg)
     if (state->ticks % DATABASE_UPDATE_INTERVAL == 0) {
         // printf("[D] controller: forwarding updates\n");
         zhash_t *processors = zlist_pop(state->collected_processors);
-        forward_updates(state, processors);
+        forward_updates(state, processors, start_time_us);
         zhash_destroy(&processors);
     }
 
@@ -415,6 +440,7 @@ int collect_stats_and_forward(zloop_t *loop, int timer_id, void *arg)
     int64_t end_time_ms = zclock_mono();
     int runtime = end_time_ms - start_time_ms;
     int next_tick = runtime > 999 ? 1 : 1000 - runtime;
+    update_tick_stats(parsed_msgs_count, runtime);
     double received_percent = parsed_msgs_count == 0 ? 0 : ((double) front_stats.received / parsed_msgs_count) * 100;
     double dropped_percent  = front_stats.received == 0 ? 0 : ((double) front_stats.dropped / front_stats.received) * 100;
     int updates = __sync_add_and_fetch(&queued_updates, 0);
@@ -488,7 +514,7 @@ bool controller_create_actors(controller_state_t *state)
     // start the live stream publisher
     state->live_stream_publisher = zactor_new(live_stream_actor_fn, state->config);
     // start the indexer
-    state->indexer = zactor_new(indexer, NULL);
+    state->indexer = zactor_new(indexer, state->config);
     // create subscribers
     for (size_t i=0; i<num_subscribers; i++) {
         state->subscribers[i] = subscriber_new(state->config, i);
@@ -7,6 +7,16 @@
 extern "C" {
 #endif
 
+typedef struct {
+    size_t ticks;               // number of completed ticks
+    size_t parsed_msgs;         // messages processed by the parsers in these ticks
+    int64_t runtime_ms_total;   // total time spent collecting and merging parser state
+    int64_t runtime_ms_max;     // longest tick
+} controller_tick_stats_t;
+
+// copies the tick stats accumulated so far and optionally resets them
+extern void controller_get_tick_stats(controller_tick_stats_t *stats, bool reset);
+
 extern int run_controller_loop(zconfig_t* config, size_t io_threads, const char *logjam_url, const char* subscription_pattern);
 
 #ifdef __cplusplus
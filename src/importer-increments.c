@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include "importer-common.h"
 #include "importer-resources.h"
 #include "importer-increments.h"
@@ -23,6 +24,160 @@ void dump_increments(const char *action, increments_t *increments)
     dump_json_object(stdout, "[D]", increments->others);
 }
 
+size_t key_guard_limit = KEY_GUARD_DEFAULT_LIMIT;
+
+static const char* guarded_key_other[GUARDED_NUM_KINDS] = {
+    "response.0",
+    "exceptions.__other__",
+    "soft_exceptions.__other__",
+    "js_exceptions.__other__",
+    "callers.__other__@__other__",
+};
+
+// distinct keys admitted for a stream database, i.e. per stream and day
+typedef struct _daily_keys {
+    int32_t ref_count;              // held by the daily_keys hash and by key guards
+    pthread_mutex_t lock;
+    zhash_t *keys[GUARDED_NUM_KINDS];
+} daily_keys_t;
+
+// database name -> daily_keys_t
+static zhash_t *daily_keys = NULL;
+static pthread_mutex_t daily_keys_lock = PTHREAD_MUTEX_INITIALIZER;
+// today's date when daily_keys was last purged
+static char daily_keys_date[ISO_DATE_STR_LEN] = {0};
+
+#define KEY_ADMITTED ((void*)1)
+#define KEY_COLLAPSED ((void*)2)
+
+void key_guard_setup(zconfig_t *config)
+{
+    size_t limit = strtoul(zconfig_resolve(config, "backend/max_keys_per_day", "0"), NULL, 0);
+    if (limit > 0)
+        key_guard_limit = limit;
+    if (!quiet)
+        printf("[I] increments: at most %zu distinct exception, caller and response keys per stream and day\n", key_guard_limit);
+}
+
+static
+void daily_keys_release(daily_keys_t *daily)
+{
+    if (__sync_sub_and_fetch(&daily->ref_count, 1) > 0)
+        return;
+    for (int i = 0; i < GUARDED_NUM_KINDS; i++)
+        zhash_destroy(&daily->keys[i]);
+    pthread_mutex_destroy(&daily->lock);
+    free(daily);
+}
+
+// forget databases older than yesterday, once per day. requires daily_keys_lock.
+static
+void daily_keys_purge()
+{
+    if (streq(daily_keys_date, iso_date_today))
+        return;
+    if (daily_keys_date[0]) {
+        zlist_t *names = zhash_keys(daily_keys);
+        for (const char *db_name = zlist_first(names); db_name; db_name = zlist_next(names)) {
+            size_t n = strlen(db_name);
+            const char *date = n >= ISO_DATE_STR_LEN - 1 ? db_name + n - (ISO_DATE_STR_LEN - 1) : db_name;
+            // the previous day still receives late requests
+            if (strcmp(date, daily_keys_date) < 0) {
+                daily_keys_release(zhash_lookup(daily_keys, db_name));
+                zhash_delete(daily_keys, db_name);
+            }
+        }
+        zlist_destroy(&names);
+    }
+    snprintf(daily_keys_date, sizeof(daily_keys_date), "%s", iso_date_today);
+}
+
+static
+daily_keys_t* daily_keys_acquire(const char *db_name)
+{
+    pthread_mutex_lock(&daily_keys_lock);
+    if (daily_keys == NULL) {
+        daily_keys = zhash_new();
+        assert(daily_keys);
+    }
+    daily_keys_t *daily = zhash_lookup(daily_keys, db_name);
+    if (daily == NULL) {
+        daily_keys_purge();
+        daily = zmalloc(sizeof(*daily));
+        assert(daily);
+        daily->ref_count = 1;
+        pthread_mutex_init(&daily->lock, NULL);
+        for (int i = 0; i < GUARDED_NUM_KINDS; i++)
+            daily->keys[i] = zhash_new();
+        zhash_insert(daily_keys, db_name, daily);
+    }
+    __sync_fetch_and_add(&daily->ref_count, 1);
+    pthread_mutex_unlock(&daily_keys_lock);
+    return daily;
+}
+
+void key_guard_init(key_guard_t *guard, const char *db_name)
+{
+    guard->daily = daily_keys_acquire(db_name);
+    for (int i = 0; i < GUARDED_NUM_KINDS; i++)
+        guard->keys[i] = zhash_new();
+    guard->collapsed = 0;
+}
+
+void key_guard_destroy(key_guard_t *guard)
+{
+    for (int i = 0; i < GUARDED_NUM_KINDS; i++)
+        zhash_destroy(&guard->keys[i]);
+    daily_keys_release(guard->daily);
+    guard->daily = NULL;
+}
+
+// returns whether the key is admitted. only keys not decided on by this
+// processor before need the lock of the daily keys.
+static
+bool key_guard_admit(key_guard_t *guard, guarded_key_kind_t kind, const char *key)
+{
+    zhash_t *keys = guard->keys[kind];
+    void *decision = zhash_lookup(keys, key);
+    if (decision == NULL) {
+        daily_keys_t *daily = guard->daily;
+        zhash_t *admitted = daily->keys[kind];
+        pthread_mutex_lock(&daily->lock);
+        decision = KEY_ADMITTED;
+        if (zhash_lookup(admitted, key) == NULL) {
+            if (zhash_size(admitted) < key_guard_limit)
+                zhash_insert(admitted, key, KEY_ADMITTED);
+            else
+                decision = KEY_COLLAPSED;
+        }
+        pthread_mutex_unlock(&daily->lock);
+        // don't let a flood of collapsed keys grow the cache without bounds
+        if (decision == KEY_ADMITTED || zhash_size(keys) < 2 * key_guard_limit)
+            zhash_insert(keys, key, decision);
+    }
+    if (decision == KEY_ADMITTED)
+        return true;
+    guard->collapsed++;
+    return false;
+}
+
+// several collapsed keys can end up in the same increments, so add instead of replacing
+static
+void increments_count_key(increments_t *increments, const char *key)
+{
+    json_object *count;
+    if (json_object_object_get_ex(increments->others, key, &count))
+        json_object_object_add(increments->others, key, json_object_new_int(json_object_get_int(count) + 1));
+    else
+        json_object_object_add(increments->others, key, json_object_new_int(1));
+}
+
+static
+void increments_count_guarded_key(increments_t *increments, key_guard_t *guard, guarded_key_kind_t kind, const char *key)
+{
+    increments_count_key(increments, key_guard_admit(guard, kind, key) ? key : guarded_key_other[kind]);
+}
+
 #define METRICS_ARRAY_SIZE (sizeof(metric_pair_t) * (last_resource_offset + 1))
 
 increments_t* increments_new()
@@ -175,11 +330,21 @@ const char* increments_fill_ajax_apdex(increments_t *increments, double total_ti
     }
 }
 
-void increments_fill_response_code(increments_t *increments, request_data_t *request_data)
+void increments_fill_response_code(increments_t *increments, request_data_t *request_data, key_guard_t *guard)
 {
     char rsp[256];
-    snprintf(rsp, 256, "response.%d", request_data->response_code);
-    json_object_object_add(increments->others, rsp, NEW_INT1);
+    int code = request_data->response_code;
+    snprintf(rsp, 256, "response.%d", code);
+    if (key_guard_admit(guard, GUARDED_RESPONSE_CODES, rsp)) {
+        increments_count_key(increments, rsp);
+        return;
+    }
+    // collapsed response codes are counted under their class, so that keys stay numeric
+    if (code >= 100 && code < 600)
+        snprintf(rsp, 256, "response.%d", code / 100 * 100);
+    else
+        snprintf(rsp, 256, "%s", guarded_key_other[GUARDED_RESPONSE_CODES]);
+    increments_count_key(increments, rsp);
 }
 
 void increments_fill_severity(increments_t *increments, request_data_t *request_data)
@@ -189,7 +354,7 @@ void increments_fill_severity(increments_t *increments, request_data_t *request_
     json_object_object_add(increments->others, sev, NEW_INT1);
 }
 
-void increments_fill_exceptions(increments_t *increments, json_object *exceptions)
+void increments_fill_exceptions(increments_t *increments, json_object *exceptions, key_guard_t *guard)
 {
     if (exceptions == NULL)
         return;
@@ -210,11 +375,11 @@ void increments_fill_exceptions(increments_t *increments, json_object *exception
             json_object* new_ex = json_object_new_string(ex_str_dup+11);
             json_object_array_put_idx(exceptions, i, new_ex);
         }
-        json_object_object_add(increments->others, ex_str_dup, NEW_INT1);
+        increments_count_guarded_key(increments, guard, GUARDED_EXCEPTIONS, ex_str_dup);
     }
 }
 
-void increments_fill_soft_exceptions(increments_t *increments, json_object *soft_exceptions)
+void increments_fill_soft_exceptions(increments_t *increments, json_object *soft_exceptions, key_guard_t *guard)
 {
   if (soft_exceptions == NULL)
     return;
@@ -235,11 +400,11 @@ void increments_fill_soft_exceptions(increments_t *increments, json_object *soft
       json_object* new_ex = json_object_new_string(ex_str_dup+16);
       json_object_array_put_idx(soft_exceptions, i, new_ex);
     }
-    json_object_object_add(increments->others, ex_str_dup, NEW_INT1);
+    increments_count_guarded_key(increments, guard, GUARDED_SOFT_EXCEPTIONS, ex_str_dup);
   }
 }
 
-void increments_fill_js_exception(increments_t *increments, const char *js_exception)
+void increments_fill_js_exception(increments_t *increments, const char *js_exception, key_guard_t *guard)
 {
     size_t n = strlen(js_exception);
     int l = 14;
@@ -247,10 +412,10 @@ void increments_fill_js_exception(increments_t *increments, const char *js_excep
     strcpy(xbuffer, "js_exceptions.");
     uri_replace_dots_and_dollars(xbuffer+l, js_exception);
     // printf("[D] JS EXCEPTION: %s\n", xbuffer);
-    json_object_object_add(increments->others, xbuffer, NEW_INT1);
+    increments_count_guarded_key(increments, guard, GUARDED_JS_EXCEPTIONS, xbuffer);
 }
 
-void increments_fill_caller_info(increments_t *increments, json_object *request)
+void increments_fill_caller_info(increments_t *increments, json_object *request, key_guard_t *guard)
 {
     json_object *caller_action_obj;
     if (json_object_object_get_ex(request, "caller_action", &caller_action_obj)) {
@@ -271,7 +436,7 @@ void increments_fill_caller_info(increments_t *increments, json_object *request)
                 caller_name[real_app_len + 8] = '@';
                 copy_replace_dots_and_dollars(caller_name + 8 + real_app_len + 1, caller_action);
                 // printf("[D] CALLER: %s\n", caller_name);
-                json_object_object_add(increments->others, caller_name, NEW_INT1);
+                increments_count_guarded_key(increments, guard, GUARDED_CALLERS, caller_name);
             }
         }
     }
@@ -352,3 +517,91 @@ void increments_add(increments_t *stored_increments, increments_t* increments)
         }
     }
 }
+
+static
+int test_count(increments_t *increments, const char *key)
+{
+    json_object *count;
+    return json_object_object_get_ex(increments->others, key, &count) ? json_object_get_int(count) : 0;
+}
+
+static
+void test_fill_response_code(increments_t *increments, key_guard_t *guard, int code)
+{
+    request_data_t request_data = { .response_code = code };
+    increments_fill_response_code(increments, &request_data, guard);
+}
+
+static
+void test_fill_caller(increments_t *increments, key_guard_t *guard, const char *app)
+{
+    json_object *request = json_object_new_object();
+    char caller_id[256];
+    snprintf(caller_id, sizeof(caller_id), "%s-production-4711", app);
+    json_object_object_add(request, "caller_id", json_object_new_string(caller_id));
+    json_object_object_add(request, "caller_action", json_object_new_string("Users#show"));
+    increments_fill_caller_info(increments, request, guard);
+    json_object_put(request);
+}
+
+void key_guard_test(int verbose)
+{
+    printf(" * importer-increments: ");
+    if (verbose)
+        printf("\n");
+
+    size_t limit = key_guard_limit;
+    key_guard_limit = 2;
+    increments_t *increments = increments_new();
+
+    // processors of the same database, e.g. of different parsers or ticks, share the limit
+    key_guard_t first, second, next_day;
+    key_guard_init(&first, "logjam-checker1-production-2026-01-01");
+    key_guard_init(&second, "logjam-checker1-production-2026-01-01");
+    key_guard_init(&next_day, "logjam-checker1-production-2026-01-02");
+    test_fill_response_code(increments, &first, 200);
+    test_fill_response_code(increments, &second, 404);
+    test_fill_response_code(increments, &first, 503);
+    test_fill_response_code(increments, &second, 504);
+    test_fill_response_code(increments, &first, 999);
+    test_fill_response_code(increments, &second, 200);
+    assert(test_count(increments, "response.200") == 2);
+    assert(test_count(increments, "response.404") == 1);
+    assert(test_count(increments, "response.503") == 0);
+    assert(test_count(increments, "response.500") == 2);
+    assert(test_count(increments, "response.0") == 1);
+    assert(first.collapsed + second.collapsed == 3);
+
+    // the next day starts with a limit of its own
+    test_fill_response_code(increments, &next_day, 503);
+    assert(test_count(increments, "response.503") == 1);
+    assert(next_day.collapsed == 0);
+
+    // collapsed keys keep their shape and add up within the same increments
+    test_fill_caller(increments, &first, "app1");
+    test_fill_caller(increments, &first, "app2");
+    test_fill_caller(increments, &second, "app3");
+    test_fill_caller(increments, &second, "app4");
+    assert(test_count(increments, "callers.app1@Users#show") == 1);
+    assert(test_count(increments, "callers.app2@Users#show") == 1);
+    assert(test_count(increments, "callers.__other__@__other__") == 2);
+
+    json_object *exceptions = json_object_new_array();
+    for (int i = 0; i < 4; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Error%d", i);
+        json_object_array_add(exceptions, json_object_new_string(name));
+    }
+    increments_fill_exceptions(increments, exceptions, &first);
+    assert(test_count(increments, "exceptions.Error0") == 1);
+    assert(test_count(increments, "exceptions.__other__") == 2);
+    json_object_put(exceptions);
+
+    key_guard_destroy(&first);
+    key_guard_destroy(&second);
+    key_guard_destroy(&next_day);
+    increments_destroy(increments);
+    key_guard_limit = limit;
+
+    printf("OK\n");
+}
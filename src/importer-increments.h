@@ -34,8 +34,36 @@ typedef struct {
     json_object* exceptions;
     json_object* soft_exceptions;
     const char* path;
+    uint32_t module_rules;
+    int module_threshold;
 } request_data_t;
 
+// Bounds the number of distinct keys of each kind per stream database, i.e. per stream
+// and day, over all parsers. Keys beyond the limit are counted under an overflow key
+// of the same shape: "response.<class>00", "callers.__other__@__other__" and
+// "<kind>.__other__" for exceptions.
+typedef enum {
+    GUARDED_RESPONSE_CODES,
+    GUARDED_EXCEPTIONS,
+    GUARDED_SOFT_EXCEPTIONS,
+    GUARDED_JS_EXCEPTIONS,
+    GUARDED_CALLERS,
+    GUARDED_NUM_KINDS
+} guarded_key_kind_t;
+
+#define KEY_GUARD_DEFAULT_LIMIT 1000
+
+typedef struct {
+    struct _daily_keys *daily;            // keys admitted for the database, shared by all parsers
+    zhash_t *keys[GUARDED_NUM_KINDS];     // decisions already taken by this processor
+    size_t collapsed;
+} key_guard_t;
+
+extern size_t key_guard_limit;
+extern void key_guard_setup(zconfig_t *config);
+extern void key_guard_init(key_guard_t *guard, const char *db_name);
+extern void key_guard_destroy(key_guard_t *guard);
+
 extern increments_t* increments_new();
 extern void increments_destroy(void *increments);
 extern increments_t* increments_clone(increments_t* increments);
@@ -46,12 +74,14 @@ extern const char* increments_fill_apdex(increments_t *increments, double total_
 extern const char* increments_fill_frontend_apdex(increments_t *increments, double total_time);
 extern const char* increments_fill_page_apdex(increments_t *increments, double total_time);
 extern const char* increments_fill_ajax_apdex(increments_t *increments, double total_time);
-extern void increments_fill_response_code(increments_t *increments, request_data_t *request_data);
+extern void increments_fill_response_code(increments_t *increments, request_data_t *request_data, key_guard_t *guard);
 extern void increments_fill_severity(increments_t *increments, request_data_t *request_data);
-extern void increments_fill_exceptions(increments_t *increments, json_object *exceptions);
-extern void increments_fill_soft_exceptions(increments_t *increments, json_object *soft_exceptions);
-extern void increments_fill_js_exception(increments_t *increments, const char *js_exception);
-extern void increments_fill_caller_info(increments_t *increments, json_object *request);
+extern void increments_fill_exceptions(increments_t *increments, json_object *exceptions, key_guard_t *guard);
+extern void increments_fill_soft_exceptions(increments_t *increments, json_object *soft_exceptions, key_guard_t *guard);
+extern void increments_fill_js_exception(increments_t *increments, const char *js_exception, key_guard_t *guard);
+extern void increments_fill_caller_info(increments_t *increments, json_object *request, key_guard_t *guard);
+
+extern void key_guard_test(int verbose);
 extern void increments_fill_sender_info(increments_t *increments, json_object *request);
 
 extern void dump_metrics(metric_pair_t *metrics);
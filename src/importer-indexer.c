@@ -1,6 +1,9 @@
+#include <pthread.h>
 #include "importer-indexer.h"
 #include "logjam-streaminfo.h"
 #include "importer-mongoutils.h"
+#include "importer-prometheus-client.h"
+#include "importer-storage.h"
 
 
 /*
@@ -20,26 +23,54 @@
 // The indexer therefore creates databases along with all their indexes one day in advance.
 // On startup, databases and indexes for the current day are created synchronously. The completion
 // of this is signalled to the controller by sending a started message to the controller.
-// Databases and indexes for dates in the future are always created via a fresh background
-// thread, spawned from the indexer.
+// The actual work is done by a pool of worker threads, each with its own backend. The
+// number of concurrent index builds per mongodb server is limited, so that writers don't suffer.
+// Databases for tomorrow are only pre-created for streams which were active today (or all
+// streams, if we haven't seen a full day yet). The others get created on first use.
 
 typedef struct {
     size_t id;
-    mongoc_client_t *mongo_clients[MAX_DATABASES];
-    mongoc_collection_t *global_collection;
+    backend_t *backend;
     zsock_t *controller_socket;
     zsock_t *pull_socket;
     zhash_t *databases;
+    zhash_t *active_streams;    // streams we've seen requests for today
+    bool seen_full_day;
 } indexer_state_t;
 
+#define INDEX_JOB_CREATE_INDEXES   1
+#define INDEX_JOB_CHECK_DISK_USAGE 2
+#define INDEX_JOB_URGENT           4
+
 typedef struct {
-    size_t id;
-    char iso_date[ISO_DATE_STR_LEN];
-} bg_indexer_args_t;
+    char *db_name;
+    stream_info_t *stream_info;
+    int flags;
+} index_job_t;
 
-// sleep 5 seconds in between each step when iterating over all
-// databases to create tomorrow's indexes
-#define INDEXER_DELAY 5
+#define INDEXER_DEFAULT_WORKERS 4
+#define INDEXER_MAX_WORKERS 16
+#define INDEXER_DEFAULT_CONCURRENCY 2
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t work_done;
+    zlist_t *jobs;                      // waiting jobs, urgent ones at the front
+    int running[MAX_DATABASES];         // running jobs per mongodb server
+    int concurrency;                    // limit for running jobs per mongodb server
+    size_t pending;                     // waiting plus running jobs
+    size_t completed;
+    bool shutting_down;
+    size_t num_workers;
+    pthread_t workers[INDEXER_MAX_WORKERS];
+} index_pool_t;
+
+static index_pool_t pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work_available = PTHREAD_COND_INITIALIZER,
+    .work_done = PTHREAD_COND_INITIALIZER,
+};
 
 static
 zsock_t *indexer_pull_socket_new()
@@ -52,7 +83,7 @@ zsock_t *indexer_pull_socket_new()
 }
 
 static
-void create_index(indexer_state_t *self, mongoc_database_t *db, const char* collection_name, bson_t *keys)
+void create_index(indexer_state_t *self, int server, const char *db_name, const char* collection_name, bson_t *keys)
 {
     size_t id = self->id;
     char *index_name = mongoc_collection_keys_to_index_string(keys);
@@ -75,7 +106,7 @@ void create_index(indexer_state_t *self, mongoc_database_t *db, const char* coll
 
     bson_t reply;
     bson_error_t error;
-    bool ok = mongoc_database_write_command_with_opts(db, create_index_doc, NULL /* opts */, &reply, &error);
+    bool ok = backend_write_command(self->backend, server, db_name, create_index_doc, &reply, &error);
 
     /* char *reply_str = bson_as_json (&reply, NULL); */
     /* printf("[D] indexer[%zu]: create index returned: %s\n", id, reply_str); */
@@ -91,80 +122,80 @@ void create_index(indexer_state_t *self, mongoc_database_t *db, const char* coll
 }
 
 static
-void add_request_field_index(indexer_state_t *state, mongoc_database_t *db, const char* field)
+void add_request_field_index(indexer_state_t *state, int server, const char *db_name, const char* field)
 {
     bson_t *keys;
 
     keys = bson_new();
     bson_append_int32(keys, "minute", 6, -1);
     bson_append_int32(keys, field, strlen(field), 1);
-    create_index(state, db, "requests", keys);
+    create_index(state, server, db_name, "requests", keys);
     bson_destroy(keys);
 
     keys = bson_new();
     bson_append_int32(keys, "page", 4, 1);
     bson_append_int32(keys, "minute", 6, -1);
     bson_append_int32(keys, field, strlen(field), 1);
-    create_index(state, db, "requests", keys);
+    create_index(state, server, db_name, "requests", keys);
     bson_destroy(keys);
 }
 
 static
-void add_request_collection_indexes(indexer_state_t *state, mongoc_database_t *db)
+void add_request_collection_indexes(indexer_state_t *state, int server, const char *db_name)
 {
-    add_request_field_index(state, db, "response_code");
-    add_request_field_index(state, db, "severity");
-    add_request_field_index(state, db, "exceptions");
-    add_request_field_index(state, db, "soft_exceptions");
-    // add_request_field_index(state, db, "started_ms");
+    add_request_field_index(state, server, db_name, "response_code");
+    add_request_field_index(state, server, db_name, "severity");
+    add_request_field_index(state, server, db_name, "exceptions");
+    add_request_field_index(state, server, db_name, "soft_exceptions");
+    // add_request_field_index(state, server, db_name, "started_ms");
 }
 
 static
-void add_jse_collection_indexes(indexer_state_t *state, mongoc_database_t *db)
+void add_jse_collection_indexes(indexer_state_t *state, int server, const char *db_name)
 {
     bson_t *keys;
 
     keys = bson_new();
     bson_append_int32(keys, "logjam_request_id", 17, 1);
-    create_index(state, db, "js_exceptions", keys);
+    create_index(state, server, db_name, "js_exceptions", keys);
     bson_destroy(keys);
 
     keys = bson_new();
     bson_append_int32(keys, "description", 11, 1);
-    create_index(state, db, "js_exceptions", keys);
+    create_index(state, server, db_name, "js_exceptions", keys);
     bson_destroy(keys);
 }
 
 static
-void add_metrics_collection_indexes(indexer_state_t *state, mongoc_database_t *db)
+void add_metrics_collection_indexes(indexer_state_t *state, int server, const char *db_name)
 {
     bson_t *keys;
 
     keys = bson_new();
     bson_append_int32(keys, "metric", 6, 1);
     bson_append_int32(keys, "value", 5, -1);
-    create_index(state, db, "metrics", keys);
+    create_index(state, server, db_name, "metrics", keys);
     bson_destroy(keys);
 
     keys = bson_new();
     bson_append_int32(keys, "page", 4, 1);
     bson_append_int32(keys, "metric", 6, 1);
     bson_append_int32(keys, "value", 5, -1);
-    create_index(state, db, "metrics", keys);
+    create_index(state, server, db_name, "metrics", keys);
     bson_destroy(keys);
 
     keys = bson_new();
     bson_append_int32(keys, "module", 6, 1);
     bson_append_int32(keys, "metric", 6, 1);
     bson_append_int32(keys, "value", 5, -1);
-    create_index(state, db, "metrics", keys);
+    create_index(state, server, db_name, "metrics", keys);
     bson_destroy(keys);
 
     keys = bson_new();
     bson_append_int32(keys, "minute", 6, 1);
     bson_append_int32(keys, "metric", 6, 1);
     bson_append_int32(keys, "value", 5, -1);
-    create_index(state, db, "metrics", keys);
+    create_index(state, server, db_name, "metrics", keys);
     bson_destroy(keys);
 }
 
@@ -191,19 +222,14 @@ int64_t extract_storage_size(bson_t *doc)
 static
 void indexer_check_disk_usage(indexer_state_t *state, const char *db_name, stream_info_t *stream_info)
 {
-    if (dryrun) return;
-
     bson_t *cmd = bson_new();
     bson_append_int32(cmd, "dbStats", 7, 1);
     bson_append_int32(cmd, "scale", 5, 1);
 
-    mongoc_client_t *client = state->mongo_clients[stream_info->db];
-    mongoc_database_t *database = mongoc_client_get_database(client, db_name);
     bson_t reply;
-    bson_init(&reply);
     bson_error_t error;
 
-    bool ok = mongoc_database_command_simple(database, cmd, NULL, &reply, &error);
+    bool ok = backend_command(state->backend, stream_info->db, db_name, cmd, &reply, &error);
     if (!ok) {
         fprintf(stderr, "[E] could not retrieve database statistics: (%d) %s\n", error.code, error.message);
     } else {
@@ -211,178 +237,288 @@ void indexer_check_disk_usage(indexer_state_t *state, const char *db_name, strea
         // char* bjs = bson_as_json(reply, &n);
         // printf("[D] database stats for (%s): %s\n", db_name, bjs);
         // bson_free(bjs);
-        stream_info->storage_size = extract_storage_size(&reply);
-        if (stream_info->storage_size > HARD_LIMIT_STORAGE_SIZE)
-            fprintf(stderr, "[E] indexer[%zu]: hard limiting %s at %"PRId64"\n", state->id, db_name, stream_info->storage_size);
-        else if (stream_info->storage_size > SOFT_LIMIT_STORAGE_SIZE)
-            fprintf(stderr, "[W] indexer[%zu]: soft limiting %s at %"PRId64"\n", state->id, db_name, stream_info->storage_size);
-        else if (verbose)
-            fprintf(stdout, "[I] indexer[%zu]: not limiting %s at %"PRId64"\n", state->id, db_name, stream_info->storage_size);
+        int64_t storage_size = extract_storage_size(&reply);
+        // only today's databases receive inserts
+        if (strstr(db_name, iso_date_today))
+            storage_set_measured_size(stream_info, storage_size);
+        if (verbose)
+            fprintf(stdout, "[I] indexer[%zu]: storage size of %s: %"PRId64"\n", state->id, db_name, storage_size);
     }
 
     bson_destroy(cmd);
     bson_destroy(&reply);
-    mongoc_database_destroy(database);
-}
-
-static
-void indexer_refresh_storage_sizes(indexer_state_t *self)
-{
-    if (dryrun) return;
-
-    zlist_t *streams = get_active_stream_names();
-    char *stream = zlist_first(streams);
-    while (stream && !zsys_interrupted) {
-        stream_info_t *info = get_stream_info(stream, NULL);
-        if (info) {
-            char db_name[1000];
-            sprintf(db_name, "logjam-%s-%s-%s", info->app, info->env, iso_date_today);
-            indexer_check_disk_usage(self, db_name, info);
-            release_stream_info(info);
-        }
-        stream = zlist_next(streams);
-    }
-    zlist_destroy(&streams);
 }
 
 static
 void indexer_create_indexes(indexer_state_t *state, const char *db_name, stream_info_t *stream_info)
 {
-    if (dryrun) return;
-
-    mongoc_client_t *client = state->mongo_clients[stream_info->db];
-    mongoc_database_t *db = mongoc_client_get_database(client, db_name);
+    int server = stream_info->db;
     bson_t *keys;
     size_t id = state->id;
 
     // if it is a db of today, then make it known
     if (strstr(db_name, iso_date_today)) {
         printf("[I] indexer[%zu]: ensuring known database: %s\n", id, db_name);
-        ensure_known_database(client, db_name);
+        ensure_known_database(state->backend, server, db_name);
     }
     printf("[I] indexer[%zu]: creating indexes for %s\n", id, db_name);
 
     keys = bson_new();
     assert(bson_append_int32(keys, "page", 4, 1));
-    create_index(state, db, "totals", keys);
+    create_index(state, server, db_name, "totals", keys);
     bson_destroy(keys);
 
     keys = bson_new();
     assert(bson_append_int32(keys, "page", 4, 1));
     assert(bson_append_int32(keys, "minute", 6, 1));
-    create_index(state, db, "minutes", keys);
+    create_index(state, server, db_name, "minutes", keys);
     bson_destroy(keys);
 
     keys = bson_new();
     assert(bson_append_int32(keys, "page", 4, 1));
     assert(bson_append_int32(keys, "kind", 4, 1));
     assert(bson_append_int32(keys, "quant", 5, 1));
-    create_index(state, db, "quants", keys);
+    create_index(state, server, db_name, "quants", keys);
     bson_destroy(keys);
 
     keys = bson_new();
     assert(bson_append_int32(keys, "page", 4, 1));
     assert(bson_append_int32(keys, "minute", 6, 1));
-    create_index(state, db, "heatmaps", keys);
+    create_index(state, server, db_name, "heatmaps", keys);
     bson_destroy(keys);
 
     keys = bson_new();
     assert(bson_append_int32(keys, "agent", 5, 1));
-    create_index(state, db, "agents", keys);
+    create_index(state, server, db_name, "agents", keys);
     bson_destroy(keys);
 
-    add_metrics_collection_indexes(state, db);
-    add_request_collection_indexes(state, db);
-    add_jse_collection_indexes(state, db);
+    add_metrics_collection_indexes(state, server, db_name);
+    add_request_collection_indexes(state, server, db_name);
+    add_jse_collection_indexes(state, server, db_name);
+}
 
-    mongoc_database_destroy(db);
+static
+void index_job_destroy(index_job_t **job_p)
+{
+    index_job_t *job = *job_p;
+    free(job->db_name);
+    release_stream_info(job->stream_info);
+    free(job);
+    *job_p = NULL;
 }
 
 static
-void indexer_create_all_indexes(indexer_state_t *self, const char *iso_date, int delay)
+void index_pool_add(stream_info_t *info, const char *db_name, int flags)
 {
-    if (dryrun) return;
+    index_job_t *job = zmalloc(sizeof(*job));
+    assert(job);
+    job->db_name = strdup(db_name);
+    reference_stream_info(info);
+    job->stream_info = info;
+    job->flags = flags;
+
+    pthread_mutex_lock(&pool.lock);
+    if (flags & INDEX_JOB_URGENT)
+        zlist_push(pool.jobs, job);
+    else
+        zlist_append(pool.jobs, job);
+    pool.pending++;
+    pthread_cond_signal(&pool.work_available);
+    pthread_mutex_unlock(&pool.lock);
+}
 
-    zlist_t *streams = get_active_stream_names();
-    char *stream = zlist_first(streams);
-    while (stream && !zsys_interrupted) {
-        stream_info_t *info = get_stream_info(stream, NULL);
-        if (info) {
-            char db_name[1000];
-            sprintf(db_name, "logjam-%s-%s-%s", info->app, info->env, iso_date);
-            indexer_create_indexes(self, db_name, info);
-            indexer_check_disk_usage(self, db_name, info);
-            release_stream_info(info);
-            if (delay) {
-                zclock_sleep(1000 * delay);
-            }
-        }
-        stream = zlist_next(streams);
+// must be called with the pool locked
+static
+index_job_t* index_pool_next_job()
+{
+    index_job_t *job = zlist_first(pool.jobs);
+    while (job && pool.running[job->stream_info->db] >= pool.concurrency)
+        job = zlist_next(pool.jobs);
+    if (job) {
+        zlist_remove(pool.jobs, job);
+        pool.running[job->stream_info->db]++;
     }
-    zlist_destroy(&streams);
+    return job;
 }
 
 static
-void* create_indexes_for_date(void* args)
+void* index_pool_worker(void *args)
 {
-    bg_indexer_args_t *indexer_args = args;
-    if (dryrun) goto exit;
-
-    indexer_state_t state;
-    memset(&state, 0, sizeof(state));
-    state.id = indexer_args->id;;
-
+    indexer_state_t *state = args;
     char thread_name[16];
-    memset(thread_name, 0, 16);
-    snprintf(thread_name, 16, "indexer[%zu]", state.id);
+    snprintf(thread_name, 16, "indexer[%zu]", state->id);
     set_thread_name(thread_name);
 
-    for (int i=0; i<num_databases; i++) {
-        state.mongo_clients[i] = mongoc_client_new(databases[i]);
-        assert(state.mongo_clients[i]);
+    pthread_mutex_lock(&pool.lock);
+    while (!pool.shutting_down) {
+        index_job_t *job = index_pool_next_job();
+        if (job == NULL) {
+            pthread_cond_wait(&pool.work_available, &pool.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        if (job->flags & INDEX_JOB_CREATE_INDEXES)
+            indexer_create_indexes(state, job->db_name, job->stream_info);
+        if (job->flags & INDEX_JOB_CHECK_DISK_USAGE)
+            indexer_check_disk_usage(state, job->db_name, job->stream_info);
+
+        pthread_mutex_lock(&pool.lock);
+        pool.running[job->stream_info->db]--;
+        pool.pending--;
+        pool.completed++;
+        index_job_destroy(&job);
+        // a slot for another job on the same server might have become available
+        pthread_cond_broadcast(&pool.work_available);
+        pthread_cond_broadcast(&pool.work_done);
     }
-    state.databases = zhash_new();
+    pthread_mutex_unlock(&pool.lock);
 
-    indexer_create_all_indexes(&state, indexer_args->iso_date, INDEXER_DELAY);
+    zhash_destroy(&state->databases);
+    backend_destroy(&state->backend);
+    free(state);
+    return NULL;
+}
 
-    zhash_destroy(&state.databases);
-    for (int i=0; i<num_databases; i++) {
-        mongoc_client_destroy(state.mongo_clients[i]);
+static
+void index_pool_start(zconfig_t *config)
+{
+    int workers = atoi(zconfig_resolve(config, "backend/indexer/workers", "0"));
+    if (workers <= 0)
+        workers = INDEXER_DEFAULT_WORKERS;
+    if (workers > INDEXER_MAX_WORKERS)
+        workers = INDEXER_MAX_WORKERS;
+    int concurrency = atoi(zconfig_resolve(config, "backend/indexer/concurrency", "0"));
+    if (concurrency <= 0)
+        concurrency = INDEXER_DEFAULT_CONCURRENCY;
+
+    pool.jobs = zlist_new();
+    assert(pool.jobs);
+    pool.concurrency = concurrency;
+    pool.num_workers = workers;
+    if (!quiet)
+        printf("[I] indexer[0]: starting %d workers, %d concurrent index builds per database server\n", workers, concurrency);
+
+    for (int i=0; i<workers; i++) {
+        indexer_state_t *state = zmalloc(sizeof(*state));
+        assert(state);
+        state->id = i + 1;
+        state->backend = backend_new();
+        state->databases = zhash_new();
+        int rc = pthread_create(&pool.workers[i], NULL, index_pool_worker, state);
+        assert(rc == 0);
     }
+}
 
- exit:
-    free(indexer_args);
-    return NULL;
+// only safe once the workers have terminated (or were never started)
+static
+void index_pool_discard_jobs()
+{
+    index_job_t *job;
+    while ((job = zlist_pop(pool.jobs))) {
+        index_job_destroy(&job);
+        pool.pending--;
+    }
 }
 
 static
-void spawn_bg_indexer_for_date(size_t id, const char* iso_date)
+void index_pool_stop()
 {
-    bg_indexer_args_t *indexer_args = zmalloc(sizeof(bg_indexer_args_t));
-    assert(indexer_args != NULL);
-    indexer_args->id = id;
-    strcpy(indexer_args->iso_date, iso_date);
-    pthread_t thread;
-    int rc = pthread_create (&thread, NULL, create_indexes_for_date, indexer_args);
-    assert(rc == 0);
-    rc = pthread_detach (thread);
-    assert(rc == 0);
+    pthread_mutex_lock(&pool.lock);
+    pool.shutting_down = true;
+    pthread_cond_broadcast(&pool.work_available);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (size_t i=0; i<pool.num_workers; i++)
+        pthread_join(pool.workers[i], NULL);
+
+    index_pool_discard_jobs();
+    zlist_destroy(&pool.jobs);
 }
 
 static
-void ensure_databases_are_known(indexer_state_t *state, const char* iso_date)
+void index_pool_progress(size_t *pending, size_t *completed)
 {
-    if (dryrun) return;
+    pthread_mutex_lock(&pool.lock);
+    *pending = pool.pending;
+    *completed = pool.completed;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static
+void index_pool_wait()
+{
+    pthread_mutex_lock(&pool.lock);
+    while (pool.pending > 0 && !zsys_interrupted) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        pthread_cond_timedwait(&pool.work_done, &pool.lock, &deadline);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static
+void indexer_create_all_indexes(indexer_state_t *self, const char *iso_date, zhash_t *active_streams)
+{
+    size_t queued = 0;
+    zlist_t *streams = get_active_stream_names();
+    char *stream = zlist_first(streams);
+    while (stream && !zsys_interrupted) {
+        if (active_streams == NULL || zhash_lookup(active_streams, stream)) {
+            stream_info_t *info = get_stream_info(stream, NULL);
+            if (info) {
+                char db_name[1000];
+                sprintf(db_name, "logjam-%s-%s-%s", info->app, info->env, iso_date);
+                index_pool_add(info, db_name, INDEX_JOB_CREATE_INDEXES|INDEX_JOB_CHECK_DISK_USAGE);
+                release_stream_info(info);
+                queued++;
+            }
+        }
+        stream = zlist_next(streams);
+    }
+    zlist_destroy(&streams);
+    printf("[I] indexer[%zu]: queued index creation for %zu databases of %s\n", self->id, queued, iso_date);
+}
+
+// dbStats calls are handed to the worker pool, so the indexer never blocks on them
+static
+void indexer_refresh_storage_sizes(indexer_state_t *self)
+{
+    size_t pending, completed;
+    index_pool_progress(&pending, &completed);
+    if (pending > 0) {
+        if (verbose)
+            printf("[D] indexer[%zu]: postponing storage size refresh, %zu jobs pending\n", self->id, pending);
+        return;
+    }
+
+    zlist_t *streams = get_active_stream_names();
+    char *stream = zlist_first(streams);
+    while (stream && !zsys_interrupted) {
+        stream_info_t *info = get_stream_info(stream, NULL);
+        if (info) {
+            char db_name[1000];
+            sprintf(db_name, "logjam-%s-%s-%s", info->app, info->env, iso_date_today);
+            index_pool_add(info, db_name, INDEX_JOB_CHECK_DISK_USAGE);
+            release_stream_info(info);
+        }
+        stream = zlist_next(streams);
+    }
+    zlist_destroy(&streams);
+}
 
+static
+void ensure_databases_are_known(indexer_state_t *state, const char* iso_date)
+{
     zlist_t *streams = get_active_stream_names();
     char *stream = zlist_first(streams);
     while (stream && !zsys_interrupted) {
         stream_info_t *info = get_stream_info(stream, NULL);
         if (info) {
-            mongoc_client_t *client = state->mongo_clients[info->db];
             char db_name[1000];
             sprintf(db_name, "logjam-%s-%s-%s", info->app, info->env, iso_date);
-            ensure_known_database(client, db_name);
+            ensure_known_database(state->backend, info->db, db_name);
             release_stream_info(info);
         }
         stream = zlist_next(streams);
@@ -401,18 +537,16 @@ void handle_indexer_request(zmsg_t *msg, indexer_state_t *state)
     memcpy(db_name, zframe_data(db_frame), n);
     db_name[n] = '\0';
 
-    size_t m = zframe_size(stream_frame);
-    char stream_name[m+1];
-    memcpy(stream_name, zframe_data(stream_frame), m);
-    stream_name[m] = '\0';
-
     stream_info_t *stream_info = zframe_getptr(stream_frame);
 
+    if (strstr(db_name, iso_date_today))
+        zhash_insert(state->active_streams, stream_info->key, (void*)1);
+
     const char *known_db = zhash_lookup(state->databases, db_name);
     if (known_db == NULL) {
         zhash_insert(state->databases, db_name, strdup(db_name));
         zhash_freefn(state->databases, db_name, free);
-        indexer_create_indexes(state, db_name, stream_info);
+        index_pool_add(stream_info, db_name, INDEX_JOB_CREATE_INDEXES|INDEX_JOB_URGENT);
     } else {
         // printf("[D] indexer[%zu]: indexes already created: %s\n", state->id, db_name);
     }
@@ -426,13 +560,9 @@ indexer_state_t* indexer_state_new(zsock_t *pipe, size_t id)
     state->id = id;
     state->controller_socket = pipe;
     state->pull_socket = indexer_pull_socket_new();
-    if (!dryrun) {
-        for (int i=0; i<num_databases; i++) {
-            state->mongo_clients[i] = mongoc_client_new(databases[i]);
-            assert(state->mongo_clients[i]);
-        }
-    }
+    state->backend = backend_new();
     state->databases = zhash_new();
+    state->active_streams = zhash_new();
     return state;
 }
 
@@ -442,11 +572,8 @@ void indexer_state_destroy(indexer_state_t **state_p)
     indexer_state_t *state = *state_p;
     zsock_destroy(&state->pull_socket);
     zhash_destroy(&state->databases);
-    if (!dryrun) {
-        for (int i=0; i<num_databases; i++) {
-            mongoc_client_destroy(state->mongo_clients[i]);
-        }
-    }
+    zhash_destroy(&state->active_streams);
+    backend_destroy(&state->backend);
     free(state);
     *state_p = NULL;
 }
@@ -463,18 +590,20 @@ void indexer(zsock_t *pipe, void *args)
         printf("[I] indexer[%zu]: starting\n", id);
 
     size_t ticks = 0;
-    size_t bg_indexer_runs = 0;
+    zconfig_t *config = args;
     indexer_state_t *state = indexer_state_new(pipe, id);
+    index_pool_start(config);
 
     // setup indexes for today (synchronously)
     config_update_date_info();
-    indexer_create_all_indexes(state, iso_date_today, 0);
+    indexer_create_all_indexes(state, iso_date_today, NULL);
+    index_pool_wait();
 
     // signal readyiness after index creation
     zsock_signal(pipe, 0);
 
     // setup indexes for tomorrow (asynchronously)
-    spawn_bg_indexer_for_date(++bg_indexer_runs, iso_date_tomorrow);
+    indexer_create_all_indexes(state, iso_date_tomorrow, NULL);
 
     zpoller_t *poller = zpoller_new(state->controller_socket, state->pull_socket, NULL);
     assert(poller);
@@ -493,18 +622,29 @@ void indexer(zsock_t *pipe, void *args)
                     printf("[D] indexer[%zu]: tick\n", id);
 
                 // if date has changed, make sure databases of today are added to the known datbases
-                // table and spawn a background thread to create databases for the next day
+                // table and let the pool create databases for the next day
                 if (config_update_date_info()) {
                     printf("[I] indexer[%zu]: date change detected\n", id);
                     printf("[I] indexer[%zu]: making sure today's databases are known\n", id);
                     ensure_databases_are_known(state, iso_date_today);
-                    printf("[I] indexer[%zu]: creating indexes for tomorrow\n", id);
-                    spawn_bg_indexer_for_date(++bg_indexer_runs, iso_date_tomorrow);
+                    storage_reset();
+                    printf("[I] indexer[%zu]: creating indexes for tomorrow (%zu active streams)\n",
+                           id, state->seen_full_day ? zhash_size(state->active_streams) : 0);
+                    indexer_create_all_indexes(state, iso_date_tomorrow, state->seen_full_day ? state->active_streams : NULL);
+                    zhash_destroy(&state->active_streams);
+                    state->active_streams = zhash_new();
+                    state->seen_full_day = true;
                 }
+                storage_tick();
+                size_t pending, completed;
+                index_pool_progress(&pending, &completed);
+                importer_prometheus_client_gauge_queued_index_jobs(pending);
+                if (pending > 0)
+                    printf("[I] indexer[%zu]: index creation: %zu databases pending, %zu done\n", id, pending, completed);
                 if (ticks++ % PING_INTERVAL == 0) {
                     // ping mongodb to reestablish connection if it got lost
                     for (int i=0; i<num_databases; i++) {
-                        mongo_client_ping(state->mongo_clients[i]);
+                        backend_ping(state->backend, i);
                     }
                 }
                 if (ticks % DATABASE_INFO_REFRESH_INTERVAL == 0) {
@@ -546,8 +686,56 @@ void indexer(zsock_t *pipe, void *args)
     if (!quiet)
         printf("[I] indexer[%zu]: shutting down\n", id);
 
+    index_pool_stop();
     indexer_state_destroy(&state);
 
     if (!quiet)
         printf("[I] indexer[%zu]: terminated\n", id);
 }
+
+void indexer_test(int verbose)
+{
+    printf (" * importer-indexer: ");
+    if (verbose)
+        printf("\n");
+
+    // needs a stream config containing checker1-production and checker2-production
+    config_update_date_info();
+    pool.jobs = zlist_new();
+    indexer_state_t state = { .databases = zhash_new(), .active_streams = zhash_new() };
+
+    stream_info_t *info = get_stream_info("checker1-production", NULL);
+    assert(info);
+    char db_name[1000];
+    sprintf(db_name, "logjam-%s-%s-%s", info->app, info->env, iso_date_today);
+
+    // the parsers pass along a reference, which handle_indexer_request releases
+    zmsg_t *msg = zmsg_new();
+    zmsg_addstr(msg, db_name);
+    zmsg_addptr(msg, info);
+    handle_indexer_request(msg, &state);
+    zmsg_destroy(&msg);
+    assert(zhash_size(state.active_streams) == 1);
+    assert(zhash_lookup(state.active_streams, "checker1-production"));
+    assert(pool.pending == 1);
+    index_pool_discard_jobs();
+
+    // after a full day, only streams we've seen requests for are created in advance
+    indexer_create_all_indexes(&state, iso_date_tomorrow, state.active_streams);
+    assert(pool.pending == 1);
+    index_job_t *job = zlist_first(pool.jobs);
+    assert(streq(job->stream_info->key, "checker1-production"));
+    assert(strstr(job->db_name, iso_date_tomorrow));
+    index_pool_discard_jobs();
+
+    // without that information, all of them are
+    indexer_create_all_indexes(&state, iso_date_tomorrow, NULL);
+    assert(pool.pending == 2);
+    index_pool_discard_jobs();
+
+    zlist_destroy(&pool.jobs);
+    zhash_destroy(&state.databases);
+    zhash_destroy(&state.active_streams);
+
+    printf ("OK\n");
+}
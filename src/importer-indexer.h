@@ -9,6 +9,8 @@ extern "C" {
 
 extern void indexer(zsock_t *pipe, void *args);
 
+extern void indexer_test(int verbose);
+
 #ifdef __cplusplus
 }
 #endif
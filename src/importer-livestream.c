@@ -1,14 +1,88 @@
+#include <pthread.h>
 #include "importer-common.h"
 #include "importer-livestream.h"
 
+typedef struct {
+    zchunk_t *totals;           // latest totals object, empty if none
+    zchunk_t *errors;           // all errors received since last flush, without closing bracket
+    size_t error_count;
+} live_stream_update_t;
+
 typedef struct {
     zsock_t* pipe;
     zsock_t* pull_socket;
     zsock_t* pub_socket;
+    zhash_t* updates;           // key -> live_stream_update_t, collected since last flush
     size_t message_count;
+    size_t published_count;
+    size_t error_drops;
     size_t message_drops;
 } live_stream_state_t;
 
+// subscriptions of live stream clients. written by the live stream actor, read by all
+// threads publishing updates.
+static pthread_mutex_t subscriptions_lock = PTHREAD_MUTEX_INITIALIZER;
+static zlist_t *subscriptions = NULL;  // prefixes other than the empty one
+static int subscriptions_count = 0;
+static int subscribed_to_everything = 0;
+
+bool live_stream_is_watched(stream_info_t *stream_info)
+{
+    if (__atomic_load_n(&subscribed_to_everything, __ATOMIC_RELAXED))
+        return true;
+    if (__atomic_load_n(&subscriptions_count, __ATOMIC_RELAXED) == 0)
+        return false;
+
+    bool watched = false;
+    const char *key = stream_info->live_stream_key;
+    size_t key_len = stream_info->live_stream_key_len;
+    pthread_mutex_lock(&subscriptions_lock);
+    for (const char *prefix = zlist_first(subscriptions); prefix; prefix = zlist_next(subscriptions)) {
+        // either the subscription covers the whole stream or only some of its modules
+        size_t n = strlen(prefix);
+        if (!strncmp(prefix, key, n < key_len ? n : key_len)) {
+            watched = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&subscriptions_lock);
+    return watched;
+}
+
+static
+void update_subscriptions(zframe_t *frame)
+{
+    // XPUB sockets only pass on the first subscription and the last unsubscription of a prefix
+    size_t n = zframe_size(frame);
+    if (n == 0)
+        return;
+    byte *data = zframe_data(frame);
+    bool subscribe = data[0] == 1;
+    if (n == 1) {
+        __atomic_store_n(&subscribed_to_everything, subscribe, __ATOMIC_RELAXED);
+        if (!quiet)
+            printf("[I] live_stream: %s all streams\n", subscribe ? "subscription to" : "cancelled subscription to");
+        return;
+    }
+
+    char *prefix = strndup((char*)data + 1, n - 1);
+    pthread_mutex_lock(&subscriptions_lock);
+    if (subscribe) {
+        zlist_append(subscriptions, prefix);
+        prefix = NULL;
+    } else {
+        for (char *item = zlist_first(subscriptions); item; item = zlist_next(subscriptions)) {
+            if (streq(item, prefix)) {
+                zlist_remove(subscriptions, item);
+                free(item);
+                break;
+            }
+        }
+    }
+    __atomic_store_n(&subscriptions_count, zlist_size(subscriptions), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&subscriptions_lock);
+    free(prefix);
+}
 
 static
 zsock_t* live_stream_pull_socket_new(zconfig_t* config)
@@ -23,7 +97,7 @@ zsock_t* live_stream_pull_socket_new(zconfig_t* config)
 static
 zsock_t* live_stream_pub_socket_new(zconfig_t* config)
 {
-    zsock_t *socket = zsock_new(ZMQ_PUB);
+    zsock_t *socket = zsock_new(ZMQ_XPUB);
     assert(socket);
     zsock_set_sndhwm(socket, snd_hwm);
     if (!quiet)
@@ -33,6 +107,25 @@ zsock_t* live_stream_pub_socket_new(zconfig_t* config)
     return socket;
 }
 
+static
+void live_stream_update_destroy(live_stream_update_t **update_p)
+{
+    live_stream_update_t *update = *update_p;
+    if (update) {
+        zchunk_destroy(&update->totals);
+        zchunk_destroy(&update->errors);
+        free(update);
+        *update_p = NULL;
+    }
+}
+
+static
+void live_stream_update_free(void *item)
+{
+    live_stream_update_t *update = item;
+    live_stream_update_destroy(&update);
+}
+
 static
 live_stream_state_t* live_stream_state_new(zsock_t *pipe, zconfig_t* config)
 {
@@ -40,6 +133,11 @@ live_stream_state_t* live_stream_state_new(zsock_t *pipe, zconfig_t* config)
     state->pipe = pipe;
     state->pub_socket = live_stream_pub_socket_new(config);
     state->pull_socket = live_stream_pull_socket_new(config);
+    state->updates = zhash_new();
+    assert(state->updates);
+    pthread_mutex_lock(&subscriptions_lock);
+    subscriptions = zlist_new();
+    pthread_mutex_unlock(&subscriptions_lock);
     return state;
 }
 
@@ -49,6 +147,14 @@ void live_stream_state_destroy(live_stream_state_t** state_p)
     live_stream_state_t* state = *state_p;
     zsock_destroy(&state->pub_socket);
     zsock_destroy(&state->pull_socket);
+    zhash_destroy(&state->updates);
+    pthread_mutex_lock(&subscriptions_lock);
+    for (char *prefix = zlist_first(subscriptions); prefix; prefix = zlist_next(subscriptions))
+        free(prefix);
+    zlist_destroy(&subscriptions);
+    __atomic_store_n(&subscriptions_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&subscribed_to_everything, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&subscriptions_lock);
     free(state);
     *state_p = NULL;
 }
@@ -67,21 +173,98 @@ void live_stream_publish(zsock_t *live_stream_socket, const char* key, const cha
     zstr_sendx(live_stream_socket, key, json_str, NULL);
 }
 
-void publish_error_for_module(stream_info_t *stream_info, const char* module, const char* json_str, zsock_t* live_stream_socket)
+void live_stream_publish_for_module(stream_info_t *stream_info, const char* module, const char* json_str, zsock_t* live_stream_socket)
 {
-    size_t n = stream_info->app_len + 1 + stream_info->env_len + 1;
     // skip :: at the beginning of module
     while (*module == ':') module++;
-    size_t m = strlen(module) + 1;
-    char key[n + m + 3];
-    sprintf(key, "%s-%s,%s", stream_info->app, stream_info->env, module);
-    // TODO: change this crap in the live stream publisher
-    // tolower is unsafe and not really necessary
-    for (char *p = key; *p; ++p) *p = tolower(*p);
+    size_t n = stream_info->live_stream_key_len;
+    size_t m = strlen(module);
+    char key[n + m + 1];
+    memcpy(key, stream_info->live_stream_key, n);
+    // live stream clients subscribe to lower case keys
+    for (size_t i = 0; i <= m; i++)
+        key[n + i] = tolower(module[i]);
 
     live_stream_publish(live_stream_socket, key, json_str);
 }
 
+static
+void collect_update(live_stream_state_t *state, const char *key, zframe_t *json_frame)
+{
+    live_stream_update_t *update = zhash_lookup(state->updates, key);
+    if (update == NULL) {
+        update = zmalloc(sizeof(*update));
+        assert(update);
+        update->totals = zchunk_new(NULL, 0);
+        update->errors = zchunk_new(NULL, 0);
+        zhash_insert(state->updates, key, update);
+        zhash_freefn(state->updates, key, live_stream_update_free);
+    }
+
+    const char *json = (const char*) zframe_data(json_frame);
+    size_t len = zframe_size(json_frame);
+    if (len < 2)
+        return;
+
+    if (json[0] != '[') {
+        // newer totals replace older ones
+        zchunk_set(update->totals, json, len);
+        return;
+    }
+
+    if (update->error_count >= LIVE_STREAM_MAX_ERRORS_PER_FLUSH) {
+        state->error_drops++;
+        return;
+    }
+    // errors are collected without the closing bracket: [a + [b => [a,b
+    bool first = update->error_count++ == 0;
+    const char *data = first ? json : json + 1;
+    size_t n = first ? len - 1 : len - 2;
+    ensure_chunk_can_take(update->errors, n + 1);
+    if (!first)
+        zchunk_append(update->errors, ",", 1);
+    zchunk_append(update->errors, data, n);
+}
+
+static
+void publish_chunk(live_stream_state_t *state, const char *key, zchunk_t *chunk)
+{
+    zmsg_t *msg = zmsg_new();
+    zmsg_addstr(msg, key);
+    zmsg_addmem(msg, zchunk_data(chunk), zchunk_size(chunk));
+    int rc = zmsg_send_and_destroy(&msg, state->pub_socket);
+    if (rc) {
+        if (!state->message_drops++)
+            fprintf(stderr, "[E] live_stream: dropped message on pub socket (%d: %s)\n", errno, zmq_strerror(errno));
+    } else
+        state->published_count++;
+}
+
+static
+int flush_updates(zloop_t *loop, int timer_id, void *arg)
+{
+    live_stream_state_t *state = arg;
+    if (zhash_size(state->updates) == 0)
+        return 0;
+
+    live_stream_update_t *update = zhash_first(state->updates);
+    while (update) {
+        const char *key = zhash_cursor(state->updates);
+        if (zchunk_size(update->totals))
+            publish_chunk(state, key, update->totals);
+        if (update->error_count) {
+            ensure_chunk_can_take(update->errors, 1);
+            zchunk_append(update->errors, "]", 1);
+            publish_chunk(state, key, update->errors);
+        }
+        update = zhash_next(state->updates);
+    }
+    zhash_destroy(&state->updates);
+    state->updates = zhash_new();
+    assert(state->updates);
+    return 0;
+}
+
 static
 int actor_command(zloop_t *loop, zsock_t *socket, void *callback_data)
 {
@@ -95,8 +278,11 @@ int actor_command(zloop_t *loop, zsock_t *socket, void *callback_data)
             rc = -1;
         }
         else if (streq(cmd, "tick")) {
-            printf("[I] live_stream: %5zu messages\n", state->message_count);
+            printf("[I] live_stream: %5zu messages, %5zu published, %zu errors dropped\n",
+                   state->message_count, state->published_count, state->error_drops);
             state->message_count = 0;
+            state->published_count = 0;
+            state->error_drops = 0;
             state->message_drops = 0;
         } else {
             fprintf(stderr, "[E] subscriber: received unknown actor command: %s\n", cmd);
@@ -108,17 +294,29 @@ int actor_command(zloop_t *loop, zsock_t *socket, void *callback_data)
 }
 
 static
-int read_msg_and_forward(zloop_t *loop, zsock_t *socket, void *callback_data)
+int read_msg_and_collect(zloop_t *loop, zsock_t *socket, void *callback_data)
 {
     live_stream_state_t *state = callback_data;
     zmsg_t *msg = zmsg_recv(socket);
     if (msg) {
         state->message_count++;
-        int rc = zmsg_send_and_destroy(&msg, state->pub_socket);
-        if (rc) {
-            if (!state->message_drops++)
-                fprintf(stderr, "[E] live_stream: dropped message on pub socket (%d: %s)\n", errno, zmq_strerror(errno));
-        }
+        char *key = zmsg_popstr(msg);
+        zframe_t *json_frame = zmsg_first(msg);
+        if (key && json_frame)
+            collect_update(state, key, json_frame);
+        free(key);
+        zmsg_destroy(&msg);
+    }
+    return 0;
+}
+
+static
+int read_subscription(zloop_t *loop, zsock_t *socket, void *callback_data)
+{
+    zframe_t *frame = zframe_recv(socket);
+    if (frame) {
+        update_subscriptions(frame);
+        zframe_destroy(&frame);
     }
     return 0;
 }
@@ -144,9 +342,17 @@ void live_stream_actor_fn(zsock_t *pipe, void *args)
     assert(rc == 0);
 
     // setup handler for the pull socket
-    rc = zloop_reader(loop, state->pull_socket, read_msg_and_forward, state);
+    rc = zloop_reader(loop, state->pull_socket, read_msg_and_collect, state);
     assert(rc == 0);
 
+    // setup handler for subscriptions
+    rc = zloop_reader(loop, state->pub_socket, read_subscription, state);
+    assert(rc == 0);
+
+    // publish collected updates periodically
+    int timer_id = zloop_timer(loop, LIVE_STREAM_FLUSH_INTERVAL, 0, flush_updates, state);
+    assert(timer_id != -1);
+
     // run the loop
     if (!quiet)
         fprintf(stdout, "[I] live_stream: listening\n");
@@ -8,11 +8,22 @@
 extern "C" {
 #endif
 
+// updates are collected for this many milliseconds before they get published. only the
+// latest totals per key are sent, errors for the same key are merged into one array.
+#define LIVE_STREAM_FLUSH_INTERVAL 250
+#define LIVE_STREAM_MAX_ERRORS_PER_FLUSH 100
+
 extern void live_stream_actor_fn(zsock_t *pipe, void *args);
 
 extern zsock_t* live_stream_client_socket_new(zconfig_t* config);
+
+// live stream subscribers register interest with ZeroMQ subscriptions. updates for streams
+// nobody subscribed to should not be serialized in the first place.
+extern bool live_stream_is_watched(stream_info_t *stream_info);
+
+// json_str must either be an object with totals or an array of errors
 extern void live_stream_publish(zsock_t *live_stream_socket, const char* key, const char* json_str);
-extern void publish_error_for_module(stream_info_t *stream_info, const char* module, const char* json_str, zsock_t* live_stream_socket);
+extern void live_stream_publish_for_module(stream_info_t *stream_info, const char* module, const char* json_str, zsock_t* live_stream_socket);
 
 #ifdef __cplusplus
 }
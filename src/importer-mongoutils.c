@@ -73,12 +73,14 @@ void initialize_mongo_db_globals(zconfig_t* config)
         printf("[I] database[%zu]: %s\n", num_databases, DEFAULT_MONGO_URI);
         num_databases++;
     }
+
+    backend_setup(config);
 }
 
 
-void ensure_known_database(mongoc_client_t *client, const char* db_name)
+void ensure_known_database(backend_t *backend, int server, const char* db_name)
 {
-    mongoc_collection_t *meta_collection = mongoc_client_get_collection(client, "logjam-global", "metadata");
+    backend_collection_t *meta_collection = backend_get_collection(backend, server, "logjam-global", "metadata");
     bson_t *selector = bson_new();
     assert(bson_append_utf8(selector, "name", 4, "databases", 9));
 
@@ -87,18 +89,16 @@ void ensure_known_database(mongoc_client_t *client, const char* db_name)
     bson_append_utf8(sub_doc, "value", 5, db_name, -1);
     bson_append_document(document, "$addToSet", 9, sub_doc);
 
-    if (!dryrun) {
-        bson_error_t error;
-        if (!mongoc_collection_update(meta_collection, MONGOC_UPDATE_UPSERT, selector, document, wc_no_wait, &error)) {
-            fprintf(stderr, "[E] update failed on logjam-global: (%d) %s\n", error.code, error.message);
-        }
+    bson_error_t error;
+    if (!backend_upsert(meta_collection, selector, document, &error)) {
+        fprintf(stderr, "[E] update failed on logjam-global: (%d) %s\n", error.code, error.message);
     }
 
     bson_destroy(selector);
     bson_destroy(document);
     bson_destroy(sub_doc);
 
-    mongoc_collection_destroy(meta_collection);
+    backend_collection_destroy(&meta_collection);
 }
 
 int mongo_client_ping(mongoc_client_t *client)
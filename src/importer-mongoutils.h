@@ -2,6 +2,7 @@
 #define __LOGJAM_IMPORTER_MONGO_UTILS_H_INCLUDED__
 
 #include "importer-common.h"
+#include "importer-backend.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,7 +15,7 @@ extern mongoc_write_concern_t *wc_no_wait;
 extern mongoc_write_concern_t *wc_wait;
 
 extern void initialize_mongo_db_globals(zconfig_t* config);
-extern void ensure_known_database(mongoc_client_t *client, const char* db_name);
+extern void ensure_known_database(backend_t *backend, int server, const char* db_name);
 extern int mongo_client_ping(mongoc_client_t *client);
 
 #ifdef __cplusplus
@@ -3,6 +3,7 @@
 #include "importer-processor.h"
 #include "importer-parser.h"
 #include "importer-prometheus-client.h"
+#include "importer-admission.h"
 
 /*
  * connections: n_w = num_writers, n_p = num_parsers, "[<>^v]" = connect, "o" = bind
@@ -126,23 +127,10 @@ time_t valid_database_date(const char *date)
 }
 
 static
-processor_state_t* processor_create(zframe_t* stream_frame, parser_state_t* parser_state, json_object *request, bool *known_stream)
+processor_state_t* processor_create(stream_info_t *stream_info, parser_state_t* parser_state, json_object *request)
 {
-    // extract stream name onto the stack and add null char
-    const char *stream_chars = (char*)zframe_data(stream_frame);
-    size_t stream_name_len = zframe_size(stream_frame);
-    char stream_name[stream_name_len+1];
-    memcpy(stream_name, stream_chars, stream_name_len);
-    stream_name[stream_name_len] = '\0';
-
-    // check whether it's a known stream and return NULL if not
-    stream_info_t *stream_info = get_stream_info(stream_name, parser_state->stream_info_cache);
-    *known_stream = stream_info != NULL;
-    if (stream_info == NULL) {
-        zhashx_insert(parser_state->unknown_streams, stream_name, (void*)1);
-        return NULL;
-    }
-    // printf("[D] found stream info for stream %s: %s\n", stream_name, stream_info->key);
+    const char *stream_name = stream_info->key;
+    size_t stream_name_len = stream_info->key_len;
 
     char db_name[stream_name_len+100];
     strcpy(db_name, "logjam-");
@@ -154,7 +142,6 @@ processor_state_t* processor_create(zframe_t* stream_frame, parser_state_t* pars
     json_object* started_at_value;
     if (!json_object_object_get_ex(request, "started_at", &started_at_value)) {
         fprintf(stderr, "[E] dropped request without started_at date\n");
-        release_stream_info(stream_info);
         return NULL;
     }
     const char *date_str = json_object_get_string(started_at_value);
@@ -167,7 +154,6 @@ processor_state_t* processor_create(zframe_t* stream_frame, parser_state_t* pars
             || json_object_object_get_ex(request, "page", &action_object))
             action = json_object_get_string(action_object);
         fprintf(stderr, "[E] dropped request for %*s with invalid started_at date: %s. action: %s\n", (int)stream_name_len, stream_name, date_str, action);
-        release_stream_info(stream_info);
         return NULL;
     }
     strncpy(&db_name[stream_name_len+7+1], date_str, 10);
@@ -175,9 +161,8 @@ processor_state_t* processor_create(zframe_t* stream_frame, parser_state_t* pars
     // printf("[D] db_name: %s\n", db_name);
 
     processor_state_t *p = zhash_lookup(parser_state->processors, db_name);
-    if (p)
-        release_stream_info(stream_info);
-    else {
+    if (p == NULL) {
+        reference_stream_info(stream_info);
         p = processor_new(stream_info, db_name);
         assert(p);
         int rc = zhash_insert(parser_state->processors, db_name, p);
@@ -195,22 +180,38 @@ processor_state_t* processor_create(zframe_t* stream_frame, parser_state_t* pars
     return p;
 }
 
-static
-void parse_msg_and_forward_interesting_requests(zmsg_t *msg, parser_state_t *parser_state)
+static inline
+importer_counters_t* parser_stream_counters(parser_state_t *state, stream_info_t *stream_info)
 {
-    // zmsg_dump(msg);
-    // slow down parser for testing
-    // zclock_sleep(100);
+    // only configured streams get a label, so bogus stream names can't create new time series
+    if (stream_info == NULL)
+        return NULL;
+    importer_counters_t *counters = stream_info->parser_counters[state->id];
+    if (counters == NULL)
+        counters = stream_info->parser_counters[state->id] = importer_prometheus_client_stream_counters(state->id, stream_info->key);
+    return counters;
+}
 
-    if (zmsg_size(msg) < 3) {
-        fprintf(stderr, "[E] parser received incomplete message\n");
-        my_zmsg_fprint(msg, "[E] FRAME=", stderr);
-    }
+static inline
+void parser_count(parser_state_t *state, importer_counters_t *stream_counters, importer_counter_t counter, uint64_t value)
+{
+    importer_counters_add(state->counters, counter, value);
+    if (stream_counters)
+        importer_counters_add(stream_counters, counter, value);
+}
+
+static
+void parse_msg(zmsg_t *msg, parser_state_t *parser_state, stream_info_t *stream_info)
+{
     zframe_t *stream_frame  = zmsg_first(msg);
     zframe_t *topic_frame   = zmsg_next(msg);
     zframe_t *body_frame    = zmsg_next(msg);
     zframe_t *meta_frame    = zmsg_next(msg);
 
+    importer_counters_t *stream_counters = parser_stream_counters(parser_state, stream_info);
+    parser_count(parser_state, stream_counters, IMPORTER_MSGS_PARSED, 1);
+    parser_count(parser_state, stream_counters, IMPORTER_BYTES_PARSED, zframe_size(body_frame));
+
     msg_meta_t meta;
     frame_extract_meta_info(meta_frame, &meta);
     // dump_meta_info(&meta);
@@ -226,6 +227,7 @@ void parse_msg_and_forward_interesting_requests(zmsg_t *msg, parser_state_t *par
             fprintf(stderr, "[E] parser could not decompress payload from %.*s (%s)\n", n, app_env, method_name);
             dump_meta_info("[E]", &meta);
             my_zmsg_fprint(msg, "[E] FRAME=", stderr);
+            parser_count(parser_state, stream_counters, IMPORTER_PARSE_ERRORS, 1);
             return;
         }
     } else {
@@ -238,15 +240,16 @@ void parse_msg_and_forward_interesting_requests(zmsg_t *msg, parser_state_t *par
         // dump_json_object(stdout, "[D] REQUEST", request);
         char *topic_str = (char*) zframe_data(topic_frame);
         int n = zframe_size(topic_frame);
-        bool known_stream;
-        processor_state_t *processor = processor_create(stream_frame, parser_state, request, &known_stream);
+        processor_state_t *processor = stream_info ? processor_create(stream_info, parser_state, request) : NULL;
         if (processor == NULL) {
-            if (known_stream)
+            if (stream_info)
                 dump_json_object(stderr, "[E] could not create processor for request: ", request);
+            parser_count(parser_state, stream_counters, IMPORTER_MSGS_REJECTED, 1);
             json_object_put(request);
             return;
         }
         processor->request_count++;
+        size_t collapsed = processor->key_guard.collapsed;
 
         if (n >= 4 && !strncmp("logs", topic_str, 4))
             processor_add_request(processor, parser_state, request);
@@ -257,24 +260,62 @@ void parse_msg_and_forward_interesting_requests(zmsg_t *msg, parser_state_t *par
         else if (n >= 13 && !strncmp("frontend.page", topic_str, 13)) {
             parser_state->fe_stats.received++;
             enum fe_msg_drop_reason reason = processor_add_frontend_data(processor, parser_state, request, msg);
-            if (reason)
+            if (reason) {
                 parser_state->fe_stats.dropped++;
+                parser_count(parser_state, stream_counters, IMPORTER_MSGS_REJECTED, 1);
+            }
             parser_state->fe_stats.drop_reasons[reason]++;
         } else if (n >= 13 && !strncmp("frontend.ajax", topic_str, 13)) {
             parser_state->fe_stats.received++;
             enum fe_msg_drop_reason reason = processor_add_ajax_data(processor, parser_state, request, msg);
-            if (reason)
+            if (reason) {
                 parser_state->fe_stats.dropped++;
+                parser_count(parser_state, stream_counters, IMPORTER_MSGS_REJECTED, 1);
+            }
             parser_state->fe_stats.drop_reasons[reason]++;
         } else {
             fprintf(stderr, "[W] unknown topic key\n");
             my_zmsg_fprint(msg, "[E] FRAME=", stderr);
+            parser_count(parser_state, stream_counters, IMPORTER_MSGS_REJECTED, 1);
         }
+        if (processor->key_guard.collapsed > collapsed)
+            parser_count(parser_state, stream_counters, IMPORTER_KEYS_COLLAPSED, processor->key_guard.collapsed - collapsed);
         json_object_put(request);
     } else {
         fprintf(stderr, "[E] parse error\n");
         my_zmsg_fprint(msg, "[E] MSGFRAME=", stderr);
+        parser_count(parser_state, stream_counters, IMPORTER_PARSE_ERRORS, 1);
+    }
+}
+
+static
+void parse_msg_and_forward_interesting_requests(zmsg_t *msg, parser_state_t *parser_state)
+{
+    // zmsg_dump(msg);
+    // slow down parser for testing
+    // zclock_sleep(100);
+
+    if (zmsg_size(msg) < 3) {
+        fprintf(stderr, "[E] parser received incomplete message\n");
+        my_zmsg_fprint(msg, "[E] FRAME=", stderr);
     }
+    zframe_t *stream_frame = zmsg_first(msg);
+
+    // extract stream name onto the stack and add null char
+    size_t stream_name_len = zframe_size(stream_frame);
+    char stream_name[stream_name_len+1];
+    memcpy(stream_name, zframe_data(stream_frame), stream_name_len);
+    stream_name[stream_name_len] = '\0';
+
+    // look up the stream once, it provides both the processor and the stream counters
+    stream_info_t *stream_info = get_stream_info(stream_name, parser_state->stream_info_cache);
+    if (stream_info == NULL)
+        zhashx_insert(parser_state->unknown_streams, stream_name, (void*)1);
+
+    parse_msg(msg, parser_state, stream_info);
+
+    if (stream_info)
+        release_stream_info(stream_info);
 }
 
 static
@@ -290,6 +331,7 @@ parser_state_t* parser_state_new(zconfig_t* config, size_t id)
 {
     parser_state_t *state = zmalloc(sizeof(*state));
     state->config = config;
+    assert(id < STREAM_INFO_MAX_PARSERS);
     state->id = id;
     snprintf(state->me, 16, "parser[%zu]", id);
     state->pull_socket = parser_pull_socket_new();
@@ -305,6 +347,9 @@ parser_state_t* parser_state_new(zconfig_t* config, size_t id)
     state->tracker = tracker_new();
     state->statsd_client = statsd_client_new(config, state->me);
     state->decompression_buffer = zchunk_new(NULL, INITIAL_DECOMPRESSION_BUFFER_SIZE);
+    fast_random_seed(&state->rng, zclock_usecs() ^ ((uint64_t)getpid() << 32) ^ id);
+    const char *sampling = zconfig_resolve(config, "backend/sampling/mode", "random");
+    state->sample_by_request_id = streq(sampling, "request_id");
     return state;
 }
 
@@ -333,6 +378,7 @@ void parser(zsock_t *pipe, void *args)
     parser_state_t *state = (parser_state_t*)args;
     state->pipe = pipe;
     set_thread_name(state->me);
+    state->counters = importer_prometheus_client_register_parser(state->id);
     size_t id = state->id;
 
     static uint64_t ticks = 0;
@@ -358,8 +404,6 @@ void parser(zsock_t *pipe, void *args)
                 if (state->parsed_msgs_count && verbose)
                     printf("[I] parser [%zu]: tick (%zu messages, %zu frontend)\n", id, state->parsed_msgs_count, state->fe_stats.received);
                 statsd_client_count(state->statsd_client, "importer.parses.count", state->parsed_msgs_count);
-                importer_prometheus_client_count_msgs_parsed(state->parsed_msgs_count);
-                importer_prometheus_client_record_rusage_parser(state->id);
                 zmsg_t *answer = zmsg_new();
                 zmsg_addptr(answer, state->processors);
                 zmsg_addmem(answer, &state->parsed_msgs_count, sizeof(state->parsed_msgs_count));
@@ -388,9 +432,16 @@ void parser(zsock_t *pipe, void *args)
         } else if (socket == state->pull_socket) {
             msg = zmsg_recv(state->pull_socket);
             if (msg != NULL) {
+                admission_msg_dequeued();
+                int64_t start_time_us = zclock_usecs();
+                int64_t received_us = zmsg_remove_receive_time(msg);
+                if (received_us > 0)
+                    importer_prometheus_client_observe_queue_time(id, (start_time_us - received_us) / 1000000.0);
                 state->parsed_msgs_count++;
                 parse_msg_and_forward_interesting_requests(msg, state);
                 zmsg_destroy(&msg);
+                int64_t end_time_us = zclock_usecs();
+                importer_prometheus_client_observe_processing_time(id, (end_time_us - start_time_us) / 1000000.0);
             } else {
                 // msg == NULL, probably interrupted by signal handler
                 break;
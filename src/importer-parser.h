@@ -4,6 +4,7 @@
 #include "importer-common.h"
 #include "importer-tracker.h"
 #include "statsd-client.h"
+#include "importer-prometheus-client.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -54,6 +55,9 @@ typedef struct {
     statsd_client_t *statsd_client;
     zchunk_t *decompression_buffer;
     zsock_t *prom_collector_socket;
+    importer_counters_t *counters;
+    fast_random_t rng;                    // for request sampling
+    bool sample_by_request_id;            // sample on a hash of the request id instead
 } parser_state_t;
 
 extern zactor_t* parser_new(zconfig_t *config, size_t id);
@@ -5,6 +5,7 @@
 #include "importer-livestream.h"
 #include "logjam-streaminfo.h"
 #include "importer-resources.h"
+#include "importer-storage.h"
 
 #define DB_PREFIX "logjam-"
 #define DB_PREFIX_LEN 7
@@ -21,6 +22,7 @@ processor_state_t* processor_new(stream_info_t *stream_info, char *db_name)
     p->quants = zhash_new();
     p->agents = zhash_new();
     p->histograms = zhash_new();
+    key_guard_init(&p->key_guard, db_name);
     return p;
 }
 
@@ -36,6 +38,7 @@ void processor_destroy(void* processor)
     zhash_destroy(&p->quants);
     zhash_destroy(&p->agents);
     zhash_destroy(&p->histograms);
+    key_guard_destroy(&p->key_guard);
     free(p);
 }
 
@@ -643,30 +646,40 @@ void processor_add_histogram(processor_state_t *self, const char* namespace, int
 }
 
 static
-bool slow_request(stream_info_t *stream_info, double total_time, const char* module)
+bool slow_request(stream_info_t *stream_info, request_data_t *request_data)
 {
-    if (total_time > stream_info->import_threshold)
+    if (request_data->total_time > stream_info->import_threshold)
         return true;
-    for (int i=0; i<stream_info->module_threshold_count; i++) {
-        if (!strcmp(module, stream_info->module_thresholds[i].name)) {
-            if (total_time > stream_info->module_thresholds[i].value)
-                return true;
-            else
-                return false;
+    if (request_data->module_rules & REQUEST_RULE_THRESHOLD)
+        return request_data->total_time > request_data->module_threshold;
+    return false;
+}
+
+// returns a value in 0 .. MAX_RANDOM_VALUE. hashing the request id makes all importers
+// (and replays) keep the same requests.
+static
+long sampling_value(parser_state_t *pstate, json_object *request)
+{
+    if (pstate->sample_by_request_id) {
+        json_object *request_id_obj;
+        if (json_object_object_get_ex(request, "request_id", &request_id_obj)) {
+            const char *request_id = json_object_get_string(request_id_obj);
+            if (request_id)
+                return hash_string(request_id, strlen(request_id)) >> 33;
         }
     }
-    return false;
+    return fast_random(&pstate->rng);
 }
 
 static
-bool sample_randomly(stream_info_t* info)
+bool sample_randomly(stream_info_t* info, parser_state_t *pstate, json_object *request)
 {
     double sampling_rate_threshold = info->sampling_rate_400s_threshold;
     if (sampling_rate_threshold == MAX_RANDOM_VALUE) {
         // printf("[D] processor: %s: taking 400 since sampling all requests\n", info ? info->key : "");
         return true;
     }
-    if (random() <= sampling_rate_threshold) {
+    if (sampling_value(pstate, request) <= sampling_rate_threshold) {
         // printf("[D] processor: %s: taking 400 since it matched threshold\n", info ? info->key : "");
         return true;
     }
@@ -675,23 +688,23 @@ bool sample_randomly(stream_info_t* info)
 }
 
 static
-sampling_reason_t interesting_request(request_data_t *request_data, json_object *request, stream_info_t* info)
+sampling_reason_t interesting_request(request_data_t *request_data, json_object *request, stream_info_t* info, parser_state_t *pstate)
 {
     sampling_reason_t reason = 0;
 
-    if (slow_request(info, request_data->total_time, request_data->module+2))
+    if (slow_request(info, request_data))
         reason |= SAMPLE_SLOW_REQUEST;
 
     if (request_data->severity >= LOG_SEVERITY_FATAL)
         reason |= SAMPLE_LOG_SEVERITY;
-    else if (request_data->severity >= LOG_SEVERITY_ERROR && (request_data->response_code >= 500 || sample_randomly(info)))
+    else if (request_data->severity >= LOG_SEVERITY_ERROR && (request_data->response_code >= 500 || sample_randomly(info, pstate, request)))
         reason |= SAMPLE_LOG_SEVERITY;
-    else if (request_data->severity >= LOG_SEVERITY_WARN && sample_randomly(info))
+    else if (request_data->severity >= LOG_SEVERITY_WARN && sample_randomly(info, pstate, request))
         reason |= SAMPLE_LOG_SEVERITY;
 
     if (request_data->response_code >= 500)
         reason |= SAMPLE_500;
-    else if (request_data->response_code >= 400 && sample_randomly(info))
+    else if (request_data->response_code >= 400 && sample_randomly(info, pstate, request))
         reason |= SAMPLE_400;
 
     if (request_data->exceptions != NULL)
@@ -746,7 +759,7 @@ int ignore_request(request_data_t *request_data, json_object *request, stream_in
     if (request_data->path) {
         const char *prefix = info->ignored_request_prefix;
         if (prefix != NULL) {
-            if (strstr(request_data->path, prefix) == request_data->path) {
+            if (!strncmp(request_data->path, prefix, info->ignored_request_prefix_len)) {
                 // fprintf(stderr, "[D] ignored request because ignored request prefix matched. url: %s\n", url);
                 return 1;
             }
@@ -755,35 +768,11 @@ int ignore_request(request_data_t *request_data, json_object *request, stream_in
     return 0;
 }
 
-static
-bool throttle_request(stream_info_t *stream)
-{
-    if (stream->storage_size > HARD_LIMIT_STORAGE_SIZE) {
-        return true;
-    } else if (stream->storage_size > SOFT_LIMIT_STORAGE_SIZE) {
-        return random() <= TEN_PERCENT_OF_MAX_RANDOM;
-    } else {
-        return false;
-    }
-}
-
 static int
 backend_only_request(const char *action, stream_info_t *stream)
 {
     assert(action);
-
-    if (stream->all_requests_are_backend_only_requests)
-        return 1;
-
-    if (stream->backend_only_requests_size == 0)
-        return 0;
-
-    int n = stream->backend_only_requests_size;
-    for (int i = 0; i < n; i++)
-        if (strstr(action, stream->backend_only_requests[i]) == action)
-            return 1;
-
-    return 0;
+    return stream_page_rules(stream, action) & REQUEST_RULE_BACKEND_ONLY;
 }
 
 void processor_add_request(processor_state_t *self, parser_state_t *pstate, json_object *request)
@@ -805,18 +794,19 @@ void processor_add_request(processor_state_t *self, parser_state_t *pstate, json
     processor_setup_other_time(self, request, request_data.total_time);
     processor_setup_allocated_memory(self, request);
     request_data.heap_growth = processor_setup_heap_growth(self, request);
-    adjust_caller_info(request_data.path, request_data.module, request, self->stream_info);
+    request_data.module_rules = stream_module_rules(self->stream_info, request_data.module, &request_data.module_threshold);
+    adjust_caller_info(request_data.path, request_data.module_rules, request, self->stream_info);
 
     increments_t* increments = increments_new();
     increments->backend_request_count = 1;
     increments_fill_metrics(increments, request);
     increments_fill_apdex(increments, request_data.total_time);
-    increments_fill_response_code(increments, &request_data);
+    increments_fill_response_code(increments, &request_data, &self->key_guard);
     increments_fill_severity(increments, &request_data);
-    increments_fill_caller_info(increments, request);
+    increments_fill_caller_info(increments, request, &self->key_guard);
     increments_fill_sender_info(increments, request);
-    increments_fill_exceptions(increments, request_data.exceptions);
-    increments_fill_soft_exceptions(increments, request_data.soft_exceptions);
+    increments_fill_exceptions(increments, request_data.exceptions, &self->key_guard);
+    increments_fill_soft_exceptions(increments, request_data.soft_exceptions, &self->key_guard);
 
     processor_add_totals(self, request_data.page, increments);
     processor_add_totals(self, request_data.module, increments);
@@ -857,8 +847,8 @@ void processor_add_request(processor_state_t *self, parser_state_t *pstate, json
         }
     }
 
-    sampling_reason_t sampling_reason = interesting_request(&request_data, request, self->stream_info);
-    if (sampling_reason && !throttle_request(self->stream_info)) {
+    sampling_reason_t sampling_reason = interesting_request(&request_data, request, self->stream_info, pstate);
+    if (sampling_reason && !storage_throttle_request(self->stream_info)) {
         json_object_get(request);
         zmsg_t *msg = zmsg_new();
         zmsg_addstr(msg, self->db_name);
@@ -868,6 +858,8 @@ void processor_add_request(processor_state_t *self, parser_state_t *pstate, json
         zmsg_addptr(msg, self->stream_info);
         reference_stream_info(self->stream_info);
         zmsg_addmem(msg, &sampling_reason, sizeof(sampling_reason_t));
+        int64_t queued_us = zclock_usecs();
+        zmsg_addmem(msg, &queued_us, sizeof(queued_us));
         if (!output_socket_ready(pstate->push_socket, 0)) {
             fprintf(stderr, "[W] parser [%zu]: push socket not ready\n", pstate->id);
         }
@@ -932,7 +924,7 @@ void processor_add_js_exception(processor_state_t *self, parser_state_t *pstate,
     const char *module = processor_setup_module(self, page);
 
     increments_t* increments = increments_new();
-    increments_fill_js_exception(increments, js_exception);
+    increments_fill_js_exception(increments, js_exception, &self->key_guard);
 
     processor_add_totals(self, "all_pages", increments);
     processor_add_minutes(self, "all_pages", minute, increments);
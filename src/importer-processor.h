@@ -3,6 +3,7 @@
 
 #include "importer-parser.h"
 #include "logjam-streaminfo.h"
+#include "importer-increments.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,6 +19,7 @@ typedef struct {
     zhash_t *quants;
     zhash_t *histograms;
     zhash_t *agents;
+    key_guard_t key_guard;
 } processor_state_t;
 
 extern processor_state_t* processor_new(stream_info_t *stream_info, char *db_name);
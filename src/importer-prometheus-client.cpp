@@ -1,7 +1,18 @@
 #include <prometheus/exposer.h>
 #include <prometheus/registry.h>
+#include <prometheus/collectable.h>
+#include <prometheus/metric_family.h>
 #include "importer-prometheus-client.h"
-#include <sys/resource.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <mutex>
+#include <string>
+#include <limits>
+#include <map>
+#include <unordered_map>
 
 static struct prometheus_client_t {
     prometheus::Exposer *exposer;
@@ -14,33 +25,230 @@ static struct prometheus_client_t {
     prometheus::Counter *inserts_total;
     prometheus::Family<prometheus::Counter> *inserts_seconds_family;
     prometheus::Counter *inserts_seconds;
-    prometheus::Family<prometheus::Counter> *received_msgs_total_family;
-    prometheus::Counter *received_msgs_total;
-    prometheus::Family<prometheus::Counter> *received_bytes_total_family;
-    prometheus::Counter *received_bytes_total;
     prometheus::Family<prometheus::Counter> *missed_msgs_total_family;
     prometheus::Counter *missed_msgs_total;
-    prometheus::Family<prometheus::Counter> *dropped_msgs_total_family;
-    prometheus::Counter *dropped_msgs_total;
-    prometheus::Family<prometheus::Counter> *blocked_msgs_total_family;
-    prometheus::Counter *blocked_msgs_total;
-    prometheus::Family<prometheus::Counter> *parsed_msgs_total_family;
-    prometheus::Counter *parsed_msgs_total;
     prometheus::Family<prometheus::Gauge> *queued_updates_family;
     prometheus::Gauge *queued_updates;
     prometheus::Family<prometheus::Gauge> *queued_inserts_family;
     prometheus::Gauge *queued_inserts;
+    prometheus::Family<prometheus::Gauge> *queued_index_jobs_family;
+    prometheus::Gauge *queued_index_jobs;
+    prometheus::Family<prometheus::Gauge> *throttle_ratio_family;
     prometheus::Counter *blocked_updates_total;
     prometheus::Family<prometheus::Counter> *blocked_updates_total_family;
     prometheus::Counter *failed_inserts_total;
     prometheus::Family<prometheus::Counter> *failed_inserts_total_family;
-    std::vector<prometheus::Counter*> cpu_seconds_total_subscribers;
-    std::vector<prometheus::Counter*> cpu_seconds_total_parsers;
-    std::vector<prometheus::Counter*> cpu_seconds_total_writers;
-    std::vector<prometheus::Counter*> cpu_seconds_total_updaters;
-    prometheus::Family<prometheus::Counter> *cpu_seconds_total_family;
+    std::shared_ptr<prometheus::Collectable> counters_collector;
+    prometheus::Family<prometheus::Histogram> *latency_seconds_family;
+    std::vector<prometheus::Histogram*> device_lag_subscribers;
+    std::vector<prometheus::Histogram*> queue_time_parsers;
+    std::vector<prometheus::Histogram*> processing_time_parsers;
+    std::vector<prometheus::Histogram*> insert_latency_writers;
+    std::vector<prometheus::Histogram*> stats_update_latency_updaters;
 } client;
 
+// hot path counters of a registered thread. blocks are never freed, as the
+// owning thread may still write to them while the importer shuts down.
+typedef struct {
+    importer_counters_t counters;
+    char name[32];
+    bool is_parser;
+    bool has_cpu_clock;
+    clockid_t cpu_clock;
+} thread_counters_t;
+
+static std::mutex counters_lock;
+static std::vector<thread_counters_t*> threads;
+static std::unordered_map<std::string, std::vector<importer_counters_t*>> streams;
+static std::unordered_map<std::string, std::vector<importer_counters_t*>> shed_streams;
+static std::map<uint32_t, std::vector<device_stats_t*>> devices;
+
+// C++11 operator new ignores the cache line alignment of the counter blocks
+static
+void* alloc_cache_aligned(size_t size)
+{
+    void *p = NULL;
+    int rc = posix_memalign(&p, 64, size);
+    assert(rc == 0);
+    memset(p, 0, size);
+    return p;
+}
+
+static inline double read_counter(const importer_counters_t *counters, importer_counter_t counter)
+{
+    return __atomic_load_n(&counters->values[counter], __ATOMIC_RELAXED);
+}
+
+// sums up the stats blocks of all subscribers for a device
+static
+void read_device_stats(const std::vector<device_stats_t*> &blocks, device_stats_t *sum)
+{
+    memset(sum, 0, sizeof(*sum));
+    uint64_t *p = (uint64_t*) sum;
+    for (auto block : blocks) {
+        if (!block)
+            continue;
+        const uint64_t *q = (const uint64_t*) block;
+        for (size_t i = 0; i < DEVICE_STATS_NUM_COUNTERS; i++)
+            p[i] += __atomic_load_n(&q[i], __ATOMIC_RELAXED);
+    }
+}
+
+static
+prometheus::MetricFamily make_family(const char* name, const char* help, prometheus::MetricType type)
+{
+    prometheus::MetricFamily family;
+    family.name = name;
+    family.help = help;
+    family.type = type;
+    return family;
+}
+
+static
+void add_counter(prometheus::MetricFamily &family, const char* label, const std::string &value, double total)
+{
+    prometheus::ClientMetric metric;
+    if (label)
+        metric.label.push_back({label, value});
+    metric.counter.value = total;
+    family.metric.push_back(metric);
+}
+
+// folds the per thread counter blocks into metric families on every scrape,
+// so that the importer threads never touch shared state when counting.
+class CountersCollector : public prometheus::Collectable {
+public:
+    std::vector<prometheus::MetricFamily> Collect() override
+    {
+        std::lock_guard<std::mutex> guard(counters_lock);
+        std::vector<prometheus::MetricFamily> families;
+
+        // totals, using the names of the counters this collector replaced
+        static const struct { importer_counter_t counter; const char *name, *help; } totals[] = {
+            { IMPORTER_MSGS_RECEIVED, "logjam:importer:msgs_received_total", "How many logjam messages has this importer received" },
+            { IMPORTER_BYTES_RECEIVED, "logjam:importer:msgs_received_bytes_total", "How many bytes of logjam messages has this importer received" },
+            { IMPORTER_MSGS_DROPPED, "logjam:importer:msgs_dropped_total", "How many logjam messages were dropped by this importer" },
+            { IMPORTER_MSGS_BLOCKED, "logjam:importer:msgs_blocked_total", "How many logjam messages caused the importer to block" },
+            { IMPORTER_MSGS_PARSED, "logjam:importer:msgs_parsed_total", "How many logjam messages were parsed by this importer" },
+        };
+        for (auto &t : totals) {
+            double sum = 0;
+            for (auto thread : threads)
+                sum += read_counter(&thread->counters, t.counter);
+            families.push_back(make_family(t.name, t.help, prometheus::MetricType::Counter));
+            add_counter(families.back(), NULL, "", sum);
+        }
+
+        families.push_back(make_family("logjam:importer:cpu_seconds_total", "How many CPU seconds importer threads have used", prometheus::MetricType::Counter));
+        for (auto thread : threads) {
+            struct timespec ts;
+            if (thread->has_cpu_clock && clock_gettime(thread->cpu_clock, &ts) == 0)
+                add_counter(families.back(), "thread", thread->name, ts.tv_sec + ts.tv_nsec / 1e9);
+        }
+
+        static const struct { importer_counter_t counter; const char *suffix, *help; } breakdowns[] = {
+            { IMPORTER_MSGS_PARSED, "msgs_total", "How many logjam messages were parsed" },
+            { IMPORTER_BYTES_PARSED, "bytes_total", "How many bytes of logjam messages were parsed" },
+            { IMPORTER_PARSE_ERRORS, "parse_errors_total", "How many logjam messages could not be decompressed or parsed" },
+            { IMPORTER_MSGS_REJECTED, "msgs_rejected_total", "How many parsed logjam messages were discarded" },
+            { IMPORTER_KEYS_COLLAPSED, "keys_collapsed_total", "How many exception, caller and response code counts went to an other bucket" },
+        };
+        // the same counters, once per parser thread and once per stream
+        for (auto &b : breakdowns) {
+            std::string name = std::string("logjam:importer:parser_") + b.suffix;
+            families.push_back(make_family(name.c_str(), b.help, prometheus::MetricType::Counter));
+            for (auto thread : threads)
+                if (thread->is_parser)
+                    add_counter(families.back(), "thread", thread->name, read_counter(&thread->counters, b.counter));
+        }
+        for (auto &b : breakdowns) {
+            std::string name = std::string("logjam:importer:stream_") + b.suffix;
+            families.push_back(make_family(name.c_str(), b.help, prometheus::MetricType::Counter));
+            for (auto &stream : streams) {
+                double sum = 0;
+                for (auto counters : stream.second)
+                    if (counters)
+                        sum += read_counter(counters, b.counter);
+                add_counter(families.back(), "stream", stream.first, sum);
+            }
+        }
+
+        static const struct { importer_counter_t counter; const char *reason; } shed_reasons[] = {
+            { IMPORTER_MSGS_SHED_FRONTEND, "frontend" },
+            { IMPORTER_MSGS_SHED_SAMPLED, "sampled" },
+        };
+        families.push_back(make_family("logjam:importer:msgs_shed_total", "How many logjam messages were shed by admission control", prometheus::MetricType::Counter));
+        for (auto &stream : shed_streams) {
+            for (auto &r : shed_reasons) {
+                double sum = 0;
+                for (auto counters : stream.second)
+                    if (counters)
+                        sum += read_counter(counters, r.counter);
+                if (sum == 0)
+                    continue;
+                prometheus::ClientMetric metric;
+                metric.label.push_back({"stream", stream.first});
+                metric.label.push_back({"reason", r.reason});
+                metric.counter.value = sum;
+                families.back().metric.push_back(metric);
+            }
+        }
+
+        families.push_back(make_family("logjam:importer:device_msgs_total", "How many logjam messages were received from each device", prometheus::MetricType::Counter));
+        families.push_back(make_family("logjam:importer:device_msgs_lost_total", "How many logjam messages of each device were lost, according to sequence numbers", prometheus::MetricType::Counter));
+        families.push_back(make_family("logjam:importer:device_out_of_order_total", "How many logjam messages of each device had a sequence number lower than their predecessor", prometheus::MetricType::Counter));
+        families.push_back(make_family("logjam:importer:device_gaps_total", "How many gaps in the sequence numbers of each device were detected, by gap size", prometheus::MetricType::Counter));
+        families.push_back(make_family("logjam:importer:device_latency_seconds", "Time from message creation on the device until arrival at the importer", prometheus::MetricType::Histogram));
+        size_t f = families.size() - 5;
+        for (auto &device : devices) {
+            device_stats_t stats;
+            read_device_stats(device.second, &stats);
+            std::string label = std::to_string(device.first);
+            add_counter(families[f], "device", label, stats.messages);
+            add_counter(families[f+1], "device", label, stats.lost);
+            add_counter(families[f+2], "device", label, stats.out_of_order);
+            for (int i = 0; i < DEVICE_GAP_BUCKETS; i++) {
+                prometheus::ClientMetric metric;
+                metric.label.push_back({"device", label});
+                metric.label.push_back({"size", device_gap_bucket_names[i]});
+                metric.counter.value = stats.gaps[i];
+                families[f+3].metric.push_back(metric);
+            }
+            prometheus::ClientMetric metric;
+            metric.label.push_back({"device", label});
+            uint64_t cumulative = 0;
+            for (int i = 0; i < DEVICE_LATENCY_BUCKETS; i++) {
+                cumulative += stats.latency[i];
+                prometheus::ClientMetric::Bucket bucket;
+                bucket.cumulative_count = cumulative;
+                bucket.upper_bound = i < DEVICE_LATENCY_BUCKETS-1 ? device_latency_bucket_bounds[i] : std::numeric_limits<double>::infinity();
+                metric.histogram.bucket.push_back(bucket);
+            }
+            metric.histogram.sample_count = cumulative;
+            metric.histogram.sample_sum = stats.latency_ms_sum / 1000.0;
+            families[f+4].metric.push_back(metric);
+        }
+
+        return families;
+    }
+};
+
+// latencies range from a few microseconds (queueing between threads) to
+// several minutes (a backlogged importer)
+static const prometheus::Histogram::BucketBoundaries latency_buckets = {
+    0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 2.5, 5, 10, 30, 60, 300
+};
+
+static
+void add_latency_histograms(std::vector<prometheus::Histogram*> &histograms, const char* stage, const char* thread, uint n)
+{
+    for (uint i=0; i<n; i++) {
+        char name[256];
+        sprintf(name, "%s%d", thread, i);
+        histograms.push_back(&client.latency_seconds_family->Add({{"stage", stage}, {"thread", name}}, latency_buckets));
+    }
+}
+
 void importer_prometheus_client_init(const char* address, importer_prometheus_client_params_t params)
 {
     // create a http server running on the given address
@@ -77,20 +285,6 @@ void importer_prometheus_client_init(const char* address, importer_prometheus_cl
 
     client.inserts_seconds = &client.inserts_seconds_family->Add({});
 
-    client.received_msgs_total_family = &prometheus::BuildCounter()
-        .Name("logjam:importer:msgs_received_total")
-        .Help("How many logjam messages has this importer received")
-        .Register(*client.registry);
-
-    client.received_msgs_total = &client.received_msgs_total_family->Add({});
-
-    client.received_bytes_total_family = &prometheus::BuildCounter()
-        .Name("logjam:importer:msgs_received_bytes_total")
-        .Help("How many bytes of logjam messages has this importer received")
-        .Register(*client.registry);
-
-    client.received_bytes_total = &client.received_bytes_total_family->Add({});
-
     client.missed_msgs_total_family = &prometheus::BuildCounter()
         .Name("logjam:importer:msgs_missed_total")
         .Help("How many logjam messages were missed by this importer")
@@ -98,27 +292,6 @@ void importer_prometheus_client_init(const char* address, importer_prometheus_cl
 
     client.missed_msgs_total = &client.missed_msgs_total_family->Add({});
 
-    client.dropped_msgs_total_family = &prometheus::BuildCounter()
-        .Name("logjam:importer:msgs_dropped_total")
-        .Help("How many logjam messages were dropped by this importer")
-        .Register(*client.registry);
-
-    client.dropped_msgs_total = &client.dropped_msgs_total_family->Add({});
-
-    client.blocked_msgs_total_family = &prometheus::BuildCounter()
-        .Name("logjam:importer:msgs_blocked_total")
-        .Help("How many logjam messages caused the importer to block")
-        .Register(*client.registry);
-
-    client.blocked_msgs_total = &client.blocked_msgs_total_family->Add({});
-
-    client.parsed_msgs_total_family = &prometheus::BuildCounter()
-        .Name("logjam:importer:msgs_parsed_total")
-        .Help("How many logjam messages were parsed by this importer")
-        .Register(*client.registry);
-
-    client.parsed_msgs_total = &client.parsed_msgs_total_family->Add({});
-
     client.queued_updates_family = &prometheus::BuildGauge()
         .Name("logjam:importer:updates_queued")
         .Help("How many database updates are currently waiting to be processed by the importer")
@@ -133,6 +306,18 @@ void importer_prometheus_client_init(const char* address, importer_prometheus_cl
 
     client.queued_inserts = &client.queued_inserts_family->Add({});
 
+    client.queued_index_jobs_family = &prometheus::BuildGauge()
+        .Name("logjam:importer:index_jobs_queued")
+        .Help("How many databases are waiting for the importer to create their indexes")
+        .Register(*client.registry);
+
+    client.queued_index_jobs = &client.queued_index_jobs_family->Add({});
+
+    client.throttle_ratio_family = &prometheus::BuildGauge()
+        .Name("logjam:importer:stream_throttle_ratio")
+        .Help("Fraction of sampled requests not stored because the stream's database is too large")
+        .Register(*client.registry);
+
     client.blocked_updates_total_family = &prometheus::BuildCounter()
         .Name("logjam:importer:updates_blocked_total")
         .Help("How many update msgs caused the importer controller to block")
@@ -147,34 +332,21 @@ void importer_prometheus_client_init(const char* address, importer_prometheus_cl
 
     client.failed_inserts_total = &client.failed_inserts_total_family->Add({});
 
-    client.cpu_seconds_total_family = &prometheus::BuildCounter()
-        .Name("logjam:importer:cpu_seconds_total")
-        .Help("How many CPU seconds importer threads have used")
+    client.latency_seconds_family = &prometheus::BuildHistogram()
+        .Name("logjam:importer:latency_seconds")
+        .Help("How long it took logjam messages to pass through the stages of the importer")
         .Register(*client.registry);
 
-    for (uint i=0; i<params.num_subscribers; i++) {
-        char name[256];
-        sprintf(name, "subscriber%d", i);
-        client.cpu_seconds_total_subscribers.push_back(&client.cpu_seconds_total_family->Add({{"thread", name}}));
-    }
-    for (uint i=0; i<params.num_parsers; i++) {
-        char name[256];
-        sprintf(name, "parser%d", i);
-        client.cpu_seconds_total_parsers.push_back(&client.cpu_seconds_total_family->Add({{"thread", name}}));
-    }
-    for (uint i=0; i<params.num_writers; i++) {
-        char name[256];
-        sprintf(name, "writer%d", i);
-        client.cpu_seconds_total_writers.push_back(&client.cpu_seconds_total_family->Add({{"thread", name}}));
-    }
-    for (uint i=0; i<params.num_updaters; i++) {
-        char name[256];
-        sprintf(name, "updater%d", i);
-        client.cpu_seconds_total_updaters.push_back(&client.cpu_seconds_total_family->Add({{"thread", name}}));
-    }
+    add_latency_histograms(client.device_lag_subscribers, "device_to_subscriber", "subscriber", params.num_subscribers);
+    add_latency_histograms(client.queue_time_parsers, "subscriber_to_parser", "parser", params.num_parsers);
+    add_latency_histograms(client.processing_time_parsers, "parse_and_process", "parser", params.num_parsers);
+    add_latency_histograms(client.insert_latency_writers, "parser_to_request_insert", "writer", params.num_writers);
+    add_latency_histograms(client.stats_update_latency_updaters, "tick_to_stats_update", "updater", params.num_updaters);
 
-    // ask the exposer to scrape the registry on incoming scrapes
+    // ask the exposer to scrape the registry and the thread counters on incoming scrapes
     client.exposer->RegisterCollectable(client.registry);
+    client.counters_collector = std::make_shared<CountersCollector>();
+    client.exposer->RegisterCollectable(client.counters_collector);
 }
 
 void importer_prometheus_client_shutdown()
@@ -193,107 +365,138 @@ void importer_prometheus_client_count_inserts(double value)
     client.inserts_total->Increment(value);
 }
 
-void importer_prometheus_client_count_msgs_received(double value)
+void importer_prometheus_client_count_msgs_missed(double value)
 {
-    client.received_msgs_total->Increment(value);
+    client.missed_msgs_total->Increment(value);
 }
 
-void importer_prometheus_client_count_bytes_received(double value)
+void importer_prometheus_client_count_updates_blocked(double value)
 {
-    client.received_bytes_total->Increment(value);
+    client.blocked_updates_total->Increment(value);
 }
 
-void importer_prometheus_client_count_msgs_missed(double value)
+void importer_prometheus_client_gauge_queued_updates(double value)
 {
-    client.missed_msgs_total->Increment(value);
+    client.queued_updates->Set(value);
 }
 
-void importer_prometheus_client_count_msgs_blocked(double value)
+void importer_prometheus_client_gauge_queued_inserts(double value)
 {
-    client.blocked_msgs_total->Increment(value);
+    client.queued_inserts->Set(value);
 }
 
-void importer_prometheus_client_count_msgs_dropped(double value)
+void importer_prometheus_client_gauge_queued_index_jobs(double value)
 {
-    client.dropped_msgs_total->Increment(value);
+    client.queued_index_jobs->Set(value);
 }
 
-void importer_prometheus_client_count_updates_blocked(double value)
+void importer_prometheus_client_gauge_throttle_ratio(const char* stream, double value)
 {
-    client.blocked_updates_total->Increment(value);
+    // Add returns the existing gauge for known label values
+    client.throttle_ratio_family->Add({{"stream", stream}}).Set(value);
 }
 
-void importer_prometheus_client_count_msgs_parsed(double value)
+void importer_prometheus_client_time_updates(double value)
 {
-    client.parsed_msgs_total->Increment(value);
+    client.updates_seconds->Increment(value);
 }
 
-void importer_prometheus_client_gauge_queued_updates(double value)
+void importer_prometheus_client_time_inserts(double value)
 {
-    client.queued_updates->Set(value);
+    client.inserts_seconds->Increment(value);
 }
 
-void importer_prometheus_client_gauge_queued_inserts(double value)
+void importer_prometheus_client_count_inserts_failed(double value)
 {
-    client.queued_inserts->Set(value);
+    client.failed_inserts_total->Increment(value);
 }
 
-void importer_prometheus_client_time_updates(double value)
+static
+importer_counters_t* register_thread(const char* kind, uint i)
 {
-    client.updates_seconds->Increment(value);
+    thread_counters_t *t = (thread_counters_t*) alloc_cache_aligned(sizeof(thread_counters_t));
+    snprintf(t->name, sizeof(t->name), "%s%d", kind, i);
+    t->is_parser = !strcmp(kind, "parser");
+    t->has_cpu_clock = pthread_getcpuclockid(pthread_self(), &t->cpu_clock) == 0;
+    std::lock_guard<std::mutex> guard(counters_lock);
+    threads.push_back(t);
+    return &t->counters;
 }
 
-void importer_prometheus_client_time_inserts(double value)
+importer_counters_t* importer_prometheus_client_register_subscriber(uint i)
 {
-    client.inserts_seconds->Increment(value);
+    return register_thread("subscriber", i);
 }
 
-void importer_prometheus_client_count_inserts_failed(double value)
+importer_counters_t* importer_prometheus_client_register_parser(uint i)
 {
-    client.failed_inserts_total->Increment(value);
+    return register_thread("parser", i);
+}
+
+importer_counters_t* importer_prometheus_client_register_writer(uint i)
+{
+    return register_thread("writer", i);
+}
+
+importer_counters_t* importer_prometheus_client_register_updater(uint i)
+{
+    return register_thread("updater", i);
 }
 
 static
-double get_combined_cpu_usage()
+importer_counters_t* stream_counters(std::unordered_map<std::string, std::vector<importer_counters_t*>> &map, uint i, const char* stream)
+{
+    std::lock_guard<std::mutex> guard(counters_lock);
+    std::vector<importer_counters_t*> &blocks = map[stream];
+    if (blocks.size() <= i)
+        blocks.resize(i + 1, NULL);
+    if (blocks[i] == NULL)
+        blocks[i] = (importer_counters_t*) alloc_cache_aligned(sizeof(importer_counters_t));
+    return blocks[i];
+}
+
+importer_counters_t* importer_prometheus_client_stream_counters(uint parser, const char* stream)
+{
+    return stream_counters(streams, parser, stream);
+}
+
+importer_counters_t* importer_prometheus_client_shed_counters(uint subscriber, const char* stream)
+{
+    return stream_counters(shed_streams, subscriber, stream);
+}
+
+device_stats_t* importer_prometheus_client_device_stats(uint subscriber, uint32_t device)
 {
-    struct rusage usage;
-    int rc;
-#ifdef RUSAGE_THREAD
-    rc = getrusage(RUSAGE_THREAD, &usage);
-#else
-    rc = getrusage(RUSAGE_SELF, &usage);
-#endif
-    if (rc) return 0;
+    std::lock_guard<std::mutex> guard(counters_lock);
+    std::vector<device_stats_t*> &blocks = devices[device];
+    if (blocks.size() <= subscriber)
+        blocks.resize(subscriber + 1, NULL);
+    if (blocks[subscriber] == NULL)
+        blocks[subscriber] = (device_stats_t*) alloc_cache_aligned(sizeof(device_stats_t));
+    return blocks[subscriber];
+}
 
-    struct timeval total;
-    timeradd(&usage.ru_utime, &usage.ru_stime, &total);
-    return total.tv_sec + (double)total.tv_usec/1000000;
+void importer_prometheus_client_observe_device_lag(uint i, double seconds)
+{
+    client.device_lag_subscribers[i]->Observe(seconds);
 }
 
-void importer_prometheus_client_record_rusage_subscriber(uint i)
+void importer_prometheus_client_observe_queue_time(uint i, double seconds)
 {
-    double value = get_combined_cpu_usage();
-    double oldvalue = client.cpu_seconds_total_subscribers[i]->Value();
-    client.cpu_seconds_total_subscribers[i]->Increment(value - oldvalue);
+    client.queue_time_parsers[i]->Observe(seconds);
 }
 
-void importer_prometheus_client_record_rusage_parser(uint i)
+void importer_prometheus_client_observe_processing_time(uint i, double seconds)
 {
-    double value = get_combined_cpu_usage();
-    double oldvalue = client.cpu_seconds_total_parsers[i]->Value();
-    client.cpu_seconds_total_parsers[i]->Increment(value - oldvalue);
+    client.processing_time_parsers[i]->Observe(seconds);
 }
 
-void importer_prometheus_client_record_rusage_writer(uint i)
+void importer_prometheus_client_observe_insert_latency(uint i, double seconds)
 {
-    double value = get_combined_cpu_usage();
-    double oldvalue = client.cpu_seconds_total_writers[i]->Value();
-    client.cpu_seconds_total_writers[i]->Increment(value - oldvalue);
+    client.insert_latency_writers[i]->Observe(seconds);
 }
 
-void importer_prometheus_client_record_rusage_updater(uint i)
+void importer_prometheus_client_observe_stats_update_latency(uint i, double seconds)
 {
-    double value = get_combined_cpu_usage();
-    double oldvalue = client.cpu_seconds_total_updaters[i]->Value();
-    client.cpu_seconds_total_updaters[i]->Increment(value - oldvalue);
+    client.stats_update_latency_updaters[i]->Observe(seconds);
 }
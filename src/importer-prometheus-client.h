@@ -2,6 +2,7 @@
 #define __LOGJAM_IMPORTER_PROMETHEUS_CLIENT_H_INCLUDED__
 
 #include "importer-common.h"
+#include "device-tracker.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,27 +15,74 @@ typedef struct {
     uint num_updaters;
 } importer_prometheus_client_params_t;
 
+// Counters incremented on hot paths. Each block is written by exactly one thread and
+// occupies cache lines of its own. The values are folded into the metrics registry
+// when the metrics endpoint is scraped.
+typedef enum {
+    IMPORTER_MSGS_RECEIVED = 0,
+    IMPORTER_BYTES_RECEIVED,
+    IMPORTER_MSGS_DROPPED,
+    IMPORTER_MSGS_BLOCKED,
+    IMPORTER_MSGS_PARSED,
+    IMPORTER_BYTES_PARSED,
+    IMPORTER_PARSE_ERRORS,
+    IMPORTER_MSGS_REJECTED,
+    IMPORTER_MSGS_SHED_FRONTEND,
+    IMPORTER_MSGS_SHED_SAMPLED,
+    IMPORTER_KEYS_COLLAPSED,
+    IMPORTER_NUM_COUNTERS
+} importer_counter_t;
+
+typedef struct _importer_counters {
+    uint64_t values[IMPORTER_NUM_COUNTERS];
+} __attribute__((aligned(64))) importer_counters_t;
+
+static inline void importer_counters_add(importer_counters_t *counters, importer_counter_t counter, uint64_t value)
+{
+    // there is only one writer, so we don't need a locked read-modify-write
+    uint64_t *p = &counters->values[counter];
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+// adds per device stats flushed from a device tracker, same single writer rules as above
+static inline void importer_device_stats_add(device_stats_t *totals, const device_stats_t *stats)
+{
+    uint64_t *p = (uint64_t*) totals;
+    const uint64_t *q = (const uint64_t*) stats;
+    for (size_t i = 0; i < DEVICE_STATS_NUM_COUNTERS; i++)
+        __atomic_store_n(&p[i], __atomic_load_n(&p[i], __ATOMIC_RELAXED) + q[i], __ATOMIC_RELAXED);
+}
+
 extern void importer_prometheus_client_init(const char* address, importer_prometheus_client_params_t params);
 extern void importer_prometheus_client_shutdown();
 
 extern void importer_prometheus_client_count_updates(double value);
 extern void importer_prometheus_client_count_inserts(double value);
 extern void importer_prometheus_client_count_msgs_missed(double value);
-extern void importer_prometheus_client_count_msgs_received(double value);
-extern void importer_prometheus_client_count_bytes_received(double value);
-extern void importer_prometheus_client_count_msgs_dropped(double value);
-extern void importer_prometheus_client_count_msgs_blocked(double value);
-extern void importer_prometheus_client_count_msgs_parsed(double value);
 extern void importer_prometheus_client_count_updates_blocked(double value);
 extern void importer_prometheus_client_count_inserts_failed(double value);
 extern void importer_prometheus_client_gauge_queued_inserts(double value);
 extern void importer_prometheus_client_gauge_queued_updates(double value);
+extern void importer_prometheus_client_gauge_queued_index_jobs(double value);
+extern void importer_prometheus_client_gauge_throttle_ratio(const char* stream, double value);
 extern void importer_prometheus_client_time_inserts(double value);
 extern void importer_prometheus_client_time_updates(double value);
-extern void importer_prometheus_client_record_rusage_subscriber(uint i);
-extern void importer_prometheus_client_record_rusage_parser(uint i);
-extern void importer_prometheus_client_record_rusage_writer(uint i);
-extern void importer_prometheus_client_record_rusage_updater(uint i);
+// register the calling thread for CPU accounting and return its counter block
+extern importer_counters_t* importer_prometheus_client_register_subscriber(uint i);
+extern importer_counters_t* importer_prometheus_client_register_parser(uint i);
+extern importer_counters_t* importer_prometheus_client_register_writer(uint i);
+extern importer_counters_t* importer_prometheus_client_register_updater(uint i);
+// return the counter block for the given stream, to be written only by the given parser
+extern importer_counters_t* importer_prometheus_client_stream_counters(uint parser, const char* stream);
+// return the shed counter block for the given stream, to be written only by the given subscriber
+extern importer_counters_t* importer_prometheus_client_shed_counters(uint subscriber, const char* stream);
+// return the device stats block for the given device, to be written only by the given subscriber
+extern device_stats_t* importer_prometheus_client_device_stats(uint subscriber, uint32_t device);
+extern void importer_prometheus_client_observe_device_lag(uint i, double seconds);
+extern void importer_prometheus_client_observe_queue_time(uint i, double seconds);
+extern void importer_prometheus_client_observe_processing_time(uint i, double seconds);
+extern void importer_prometheus_client_observe_insert_latency(uint i, double seconds);
+extern void importer_prometheus_client_observe_stats_update_latency(uint i, double seconds);
 
 #ifdef __cplusplus
 }
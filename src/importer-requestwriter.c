@@ -5,6 +5,8 @@
 #include "importer-mongoutils.h"
 #include "statsd-client.h"
 #include "importer-prometheus-client.h"
+#include "importer-storage.h"
+#include "importer-spool.h"
 
 /*
  * connections: n_w = num_writers, n_p = num_parsers, "o" = bind, "[<>v^]" = connect
@@ -23,7 +25,7 @@ typedef struct {
     zconfig_t* config;
     char me[16];
     size_t id;
-    mongoc_client_t* mongo_clients[MAX_DATABASES];
+    backend_t *backend;
     zhash_t *request_collections;
     zhash_t *metrics_collections;
     zhash_t *jse_collections;
@@ -35,6 +37,11 @@ typedef struct {
     int update_time;       // processing time since last tick (micro seconds)
     int updates_failed;    // how many updates failed
     statsd_client_t *statsd_client;
+    spool_t *spool;        // NULL unless backend/spool/directory is set
+    bool mongo_failing[MAX_DATABASES]; // reset on every tick
+    size_t spooled;        // documents written to the spool since last tick
+    size_t drained;        // documents inserted from the spool since last tick
+    size_t spool_drops;    // documents lost because the spool was full
 } request_writer_state_t;
 
 
@@ -50,67 +57,189 @@ zsock_t* request_writer_pull_socket_new(int i)
 }
 
 static
-mongoc_collection_t* request_writer_get_request_collection(request_writer_state_t* self, const char* db_name, stream_info_t *stream_info)
+backend_collection_t* request_writer_get_request_collection(request_writer_state_t* self, const char* db_name, stream_info_t *stream_info)
 {
-    if (dryrun) return NULL;
-    mongoc_collection_t *collection = zhash_lookup(self->request_collections, db_name);
+    backend_collection_t *collection = zhash_lookup(self->request_collections, db_name);
     if (collection == NULL) {
         // printf("[D] creating requests collection: %s\n", db_name);
-        mongoc_client_t *mongo_client = self->mongo_clients[stream_info->db];
-        collection = mongoc_client_get_collection(mongo_client, db_name, "requests");
+        collection = backend_get_collection(self->backend, stream_info->db, db_name, "requests");
         // add_request_collection_indexes(db_name, collection);
         zhash_insert(self->request_collections, db_name, collection);
-        zhash_freefn(self->request_collections, db_name, (zhash_free_fn*)mongoc_collection_destroy);
+        zhash_freefn(self->request_collections, db_name, backend_collection_free);
     }
     return collection;
 }
 
 static
-mongoc_collection_t* request_writer_get_metrics_collection(request_writer_state_t* self, const char* db_name, stream_info_t *stream_info)
+backend_collection_t* request_writer_get_metrics_collection(request_writer_state_t* self, const char* db_name, stream_info_t *stream_info)
 {
-    if (dryrun) return NULL;
-    mongoc_collection_t *collection = zhash_lookup(self->metrics_collections, db_name);
+    backend_collection_t *collection = zhash_lookup(self->metrics_collections, db_name);
     if (collection == NULL) {
         // printf("[D] creating metrics collection: %s\n", db_name);
-        mongoc_client_t *mongo_client = self->mongo_clients[stream_info->db];
-        collection = mongoc_client_get_collection(mongo_client, db_name, "metrics");
+        collection = backend_get_collection(self->backend, stream_info->db, db_name, "metrics");
         zhash_insert(self->metrics_collections, db_name, collection);
-        zhash_freefn(self->metrics_collections, db_name, (zhash_free_fn*)mongoc_collection_destroy);
+        zhash_freefn(self->metrics_collections, db_name, backend_collection_free);
     }
     return collection;
 }
 
 static
-mongoc_collection_t* request_writer_get_jse_collection(request_writer_state_t* self, const char* db_name, stream_info_t *stream_info)
+backend_collection_t* request_writer_get_jse_collection(request_writer_state_t* self, const char* db_name, stream_info_t *stream_info)
 {
-    if (dryrun) return NULL;
-    mongoc_collection_t *collection = zhash_lookup(self->jse_collections, db_name);
+    backend_collection_t *collection = zhash_lookup(self->jse_collections, db_name);
     if (collection == NULL) {
         // printf("[D] creating jse collection: %s\n", db_name);
-        mongoc_client_t *mongo_client = self->mongo_clients[stream_info->db];
-        collection = mongoc_client_get_collection(mongo_client, db_name, "js_exceptions");
+        collection = backend_get_collection(self->backend, stream_info->db, db_name, "js_exceptions");
         // add_jse_collection_indexes(db_name, collection);
         zhash_insert(self->jse_collections, db_name, collection);
-        zhash_freefn(self->jse_collections, db_name, (zhash_free_fn*)mongoc_collection_destroy);
+        zhash_freefn(self->jse_collections, db_name, backend_collection_free);
     }
     return collection;
 }
 
 static
-mongoc_collection_t* request_writer_get_events_collection(request_writer_state_t* self, const char* db_name, stream_info_t *stream_info)
+backend_collection_t* request_writer_get_events_collection(request_writer_state_t* self, const char* db_name, stream_info_t *stream_info)
 {
-    if (dryrun) return NULL;
-    mongoc_collection_t *collection = zhash_lookup(self->events_collections, db_name);
+    backend_collection_t *collection = zhash_lookup(self->events_collections, db_name);
     if (collection == NULL) {
         // printf("[D] creating events collection: %s\n", db_name);
-        mongoc_client_t *mongo_client = self->mongo_clients[stream_info->db];
-        collection = mongoc_client_get_collection(mongo_client, db_name, "events");
+        collection = backend_get_collection(self->backend, stream_info->db, db_name, "events");
         zhash_insert(self->events_collections, db_name, collection);
-        zhash_freefn(self->events_collections, db_name, (zhash_free_fn*)mongoc_collection_destroy);
+        zhash_freefn(self->events_collections, db_name, backend_collection_free);
     }
     return collection;
 }
 
+// connection problems are worth retrying, everything else would fail again
+static inline
+bool mongo_error_is_transient(const bson_error_t *error)
+{
+    return error->domain == MONGOC_ERROR_STREAM || error->domain == MONGOC_ERROR_SERVER_SELECTION;
+}
+
+static
+bool request_writer_should_spool(request_writer_state_t *state, stream_info_t *stream_info)
+{
+    if (state->spool == NULL)
+        return false;
+    return state->mongo_failing[stream_info->db] || queued_inserts > (int)spool_high_water_mark(state->spool);
+}
+
+// returns false if the spool is full
+static
+bool request_writer_try_spool(request_writer_state_t *state, const char *db_name, stream_info_t *stream_info,
+                              spool_collection_t collection, const bson_t *document)
+{
+    if (spool_append(state->spool, db_name, stream_info->key, stream_info->db, collection, document)) {
+        state->spooled++;
+        return true;
+    }
+    return false;
+}
+
+// last resort, the document is lost if the spool is full
+static
+bool request_writer_spool(request_writer_state_t *state, const char *db_name, stream_info_t *stream_info,
+                          spool_collection_t collection, const bson_t *document)
+{
+    if (request_writer_try_spool(state, db_name, stream_info, collection, document))
+        return true;
+    state->spool_drops++;
+    return false;
+}
+
+static
+void request_writer_mongo_failed(request_writer_state_t *state, int server, const bson_error_t *error)
+{
+    if (!state->mongo_failing[server])
+        fprintf(stderr, "[W] writer [%zu]: spooling documents for %s: (%d) %s\n",
+                state->id, databases[server], error->code, error->message);
+    state->mongo_failing[server] = true;
+}
+
+// returns true if the document has been inserted or spooled
+static
+bool request_writer_insert(request_writer_state_t *state, backend_collection_t *collection, const char *db_name,
+                           stream_info_t *stream_info, spool_collection_t kind, const bson_t *document, bson_error_t *error)
+{
+    if (request_writer_should_spool(state, stream_info) && request_writer_try_spool(state, db_name, stream_info, kind, document))
+        return true;
+    if (backend_insert(collection, document, error)) {
+        storage_add_bytes(stream_info, document->len);
+        return true;
+    }
+    if (state->spool && mongo_error_is_transient(error)) {
+        request_writer_mongo_failed(state, stream_info->db, error);
+        return request_writer_spool(state, db_name, stream_info, kind, document);
+    }
+    return false;
+}
+
+// drained documents count towards the storage limits of their stream, whatever day
+// they belong to, as they take up disk space now
+static
+void request_writer_account_drained(const char *stream, const bson_t **documents, size_t n)
+{
+    // segments written by older versions don't know their stream
+    if (stream == NULL)
+        return;
+    stream_info_t *stream_info = get_stream_info(stream, NULL);
+    if (stream_info == NULL)
+        return;
+    size_t bytes = 0;
+    for (size_t i=0; i<n; i++)
+        bytes += documents[i]->len;
+    storage_add_bytes(stream_info, bytes);
+    release_stream_info(stream_info);
+}
+
+static
+spool_insert_result_t request_writer_insert_spooled(void *arg, const char *db_name, const char *stream, int server,
+                                                    spool_collection_t kind, const bson_t **documents, size_t n)
+{
+    request_writer_state_t *state = arg;
+    if (state->mongo_failing[server])
+        return SPOOL_RETRY;
+    backend_collection_t *collection =
+        backend_get_collection(state->backend, server, db_name, spool_collection_names[kind]);
+    // bulk inserts are acknowledged, so documents are only removed from the spool once stored
+    bson_t reply;
+    bson_error_t error;
+    bool ok = backend_insert_many(collection, documents, n, false, &reply, &error);
+    spool_insert_result_t result = SPOOL_INSERTED;
+    // duplicates come from segments which were partially drained before a restart.
+    // the insert is unordered, so all other documents of the batch have been stored.
+    if (ok || error.code == 11000)
+        request_writer_account_drained(stream, documents, n);
+    else if (mongo_error_is_transient(&error)) {
+        request_writer_mongo_failed(state, server, &error);
+        result = SPOOL_RETRY;
+    } else {
+        fprintf(stderr, "[E] writer [%zu]: could not insert spooled %s on %s: (%d) %s\n",
+                state->id, spool_collection_names[kind], db_name, error.code, error.message);
+        result = SPOOL_REJECTED;
+    }
+    bson_destroy(&reply);
+    backend_collection_destroy(&collection);
+    if (result == SPOOL_INSERTED)
+        state->drained += n;
+    return result;
+}
+
+static
+bool request_writer_can_drain(request_writer_state_t *state)
+{
+    if (state->spool == NULL || !spool_can_drain(state->spool))
+        return false;
+    if (queued_inserts >= (int)spool_high_water_mark(state->spool) / 2)
+        return false;
+    for (int i=0; i<num_databases; i++) {
+        if (state->mongo_failing[i])
+            return false;
+    }
+    return true;
+}
+
 // Find first correct UTF8 character position before buf[n], where n is greater than 3.
 static
 size_t find_utf8_offset(const char *buf, size_t n)
@@ -297,7 +426,7 @@ bson_t* convert_metrics_for_indexing(json_object *request)
 static
 void add_metrics_to_metrics_collection(const char* db_name, stream_info_t* stream_info, bson_t* metrics, const char* page, const char* module, int minute, const char* rid, bson_oid_t* oid, request_writer_state_t* state)
 {
-    mongoc_collection_t *metrics_collection = request_writer_get_metrics_collection(state, db_name, stream_info);
+    backend_collection_t *metrics_collection = request_writer_get_metrics_collection(state, db_name, stream_info);
     size_t n = bson_count_keys(metrics);
     bson_t *docs[n];
     bson_iter_t iter;
@@ -324,12 +453,31 @@ void add_metrics_to_metrics_collection(const char* db_name, stream_info_t* strea
         }
         p++;
     }
-    if (!dryrun) {
-        bson_t *opts = NULL;
+    // documents which don't fit into the spool are inserted as usual
+    bson_t *unspooled[n];
+    size_t num_unspooled = 0;
+    if (request_writer_should_spool(state, stream_info)) {
+        for (size_t i=0; i<n; i++)
+            if (!request_writer_try_spool(state, db_name, stream_info, SPOOL_METRICS, docs[i]))
+                unspooled[num_unspooled++] = docs[i];
+    } else {
+        for (size_t i=0; i<n; i++)
+            unspooled[num_unspooled++] = docs[i];
+    }
+    if (num_unspooled > 0) {
         bson_t reply;
         bson_error_t error;
-        bool ok = mongoc_collection_insert_many(metrics_collection, (const bson_t**)docs, n, opts, &reply, &error);
-        if (!ok) {
+        bool ok = backend_insert_many(metrics_collection, (const bson_t**)unspooled, num_unspooled, true, &reply, &error);
+        if (!ok && state->spool && mongo_error_is_transient(&error)) {
+            request_writer_mongo_failed(state, stream_info->db, &error);
+            for (size_t i=0; i<num_unspooled; i++)
+                request_writer_spool(state, db_name, stream_info, SPOOL_METRICS, unspooled[i]);
+        } else if (ok) {
+            size_t bytes = 0;
+            for (size_t i=0; i<num_unspooled; i++)
+                bytes += unspooled[i]->len;
+            storage_add_bytes(stream_info, bytes);
+        } else {
             size_t m;
             char* bjs = bson_as_json(metrics, &m);
             char *reply_str = bson_as_json(&reply, NULL);
@@ -342,6 +490,7 @@ void add_metrics_to_metrics_collection(const char* db_name, stream_info_t* strea
             bson_free(reply_str);
             state->updates_failed++;
         }
+        bson_destroy(&reply);
     }
     for (size_t i=0; i<n; i++) {
         bson_destroy(docs[i]);
@@ -359,7 +508,7 @@ json_object* store_request(const char* db_name, stream_info_t* stream_info, json
         printf("[D] metrics document. size: %zu; value: %s\n", n, bs);
         bson_free(bs);
     }
-    mongoc_collection_t *requests_collection = request_writer_get_request_collection(state, db_name, stream_info);
+    backend_collection_t *requests_collection = request_writer_get_request_collection(state, db_name, stream_info);
     bson_t *document = bson_sized_new(2048);
 
     json_object *request_id_obj;
@@ -401,19 +550,17 @@ json_object* store_request(const char* db_name, stream_info_t* stream_info, json
     }
 
     bool update_failed = false;
-    if (!dryrun) {
-        bson_error_t error;
-        if (!mongoc_collection_insert(requests_collection, MONGOC_INSERT_NONE, document, wc_no_wait, &error)) {
-            size_t n;
-            char* bjs = bson_as_json(document, &n);
-            fprintf(stderr,
-                    "[E] insert failed for request document with rid '%s' on %s: (%d) %s\n"
-                    "[E] document size: %zu; value: %s\n",
-                    request_id, db_name, error.code, error.message, n, bjs);
-            bson_free(bjs);
-            update_failed = true;
-            state->updates_failed++;
-        }
+    bson_error_t error;
+    if (!request_writer_insert(state, requests_collection, db_name, stream_info, SPOOL_REQUESTS, document, &error)) {
+        size_t n;
+        char* bjs = bson_as_json(document, &n);
+        fprintf(stderr,
+                "[E] insert failed for request document with rid '%s' on %s: (%d) %s\n"
+                "[E] document size: %zu; value: %s\n",
+                request_id, db_name, error.code, error.message, n, bjs);
+        bson_free(bjs);
+        update_failed = true;
+        state->updates_failed++;
     }
     bson_destroy(document);
 
@@ -438,22 +585,20 @@ json_object* store_request(const char* db_name, stream_info_t* stream_info, json
 static
 void store_js_exception(const char* db_name, stream_info_t *stream_info, json_object* request, request_writer_state_t* state)
 {
-    mongoc_collection_t *jse_collection = request_writer_get_jse_collection(state, db_name, stream_info);
+    backend_collection_t *jse_collection = request_writer_get_jse_collection(state, db_name, stream_info);
     bson_t *document = bson_sized_new(1024);
     json_object_to_bson("js_exception", request, document);
 
-    if (!dryrun) {
-        bson_error_t error;
-        if (!mongoc_collection_insert(jse_collection, MONGOC_INSERT_NONE, document, wc_no_wait, &error)) {
-            size_t n;
-            char* bjs = bson_as_json(document, &n);
-            fprintf(stderr,
-                    "[E] insert failed for exception document on %s: (%d) %s\n"
-                    "[E] document size: %zu; value: %s\n",
-                    db_name, error.code, error.message, n, bjs);
-            bson_free(bjs);
-            state->updates_failed++;
-        }
+    bson_error_t error;
+    if (!request_writer_insert(state, jse_collection, db_name, stream_info, SPOOL_JS_EXCEPTIONS, document, &error)) {
+        size_t n;
+        char* bjs = bson_as_json(document, &n);
+        fprintf(stderr,
+                "[E] insert failed for exception document on %s: (%d) %s\n"
+                "[E] document size: %zu; value: %s\n",
+                db_name, error.code, error.message, n, bjs);
+        bson_free(bjs);
+        state->updates_failed++;
     }
     bson_destroy(document);
 }
@@ -461,7 +606,7 @@ void store_js_exception(const char* db_name, stream_info_t *stream_info, json_ob
 static
 void store_event(const char* db_name, stream_info_t *stream_info, json_object* request, request_writer_state_t* state)
 {
-    mongoc_collection_t *events_collection = request_writer_get_events_collection(state, db_name, stream_info);
+    backend_collection_t *events_collection = request_writer_get_events_collection(state, db_name, stream_info);
     bson_t *document = bson_sized_new(1024);
     json_object_to_bson("event", request, document);
 
@@ -496,20 +641,18 @@ void store_event(const char* db_name, stream_info_t *stream_info, json_object* r
         json_object_to_bson(context, request, document);
     }
 
-    if (!dryrun) {
-        bson_error_t error;
-        if (!mongoc_collection_insert(events_collection, MONGOC_INSERT_NONE, document, wc_no_wait, &error)) {
-            if (verbose) {
-                size_t n;
-                char* bjs = bson_as_json(document, &n);
-                fprintf(stderr,
-                        "[E] insert failed for event document on %s: (%d) %s\n"
-                        "[E] document size: %zu; value: %s\n",
-                        db_name, error.code, error.message, n, bjs);
-                bson_free(bjs);
-            }
-            state->updates_failed++;
+    bson_error_t error;
+    if (!request_writer_insert(state, events_collection, db_name, stream_info, SPOOL_EVENTS, document, &error)) {
+        if (verbose) {
+            size_t n;
+            char* bjs = bson_as_json(document, &n);
+            fprintf(stderr,
+                    "[E] insert failed for event document on %s: (%d) %s\n"
+                    "[E] document size: %zu; value: %s\n",
+                    db_name, error.code, error.message, n, bjs);
+            bson_free(bjs);
         }
+        state->updates_failed++;
     }
     bson_destroy(document);
 }
@@ -550,7 +693,7 @@ void request_writer_publish_error(stream_info_t* stream_info, const char* module
     json_object *severity_obj;
     if (json_object_object_get_ex(request, "severity", &severity_obj)) {
         int severity = json_object_get_int(severity_obj);
-        if (severity > 1) {
+        if (severity > 1 && live_stream_is_watched(stream_info)) {
             json_object *error_info = json_object_new_object();
             json_object_get(request_id);
             json_object_object_add(error_info, "request_id", request_id);
@@ -581,8 +724,8 @@ void request_writer_publish_error(stream_info_t* stream_info, const char* module
 
             const char *json_str = json_object_to_json_string_ext(arror, JSON_C_TO_STRING_PLAIN);
 
-            publish_error_for_module(stream_info, "all_pages", json_str, state->live_stream_socket);
-            publish_error_for_module(stream_info, module, json_str, state->live_stream_socket);
+            live_stream_publish_for_module(stream_info, "all_pages", json_str, state->live_stream_socket);
+            live_stream_publish_for_module(stream_info, module, json_str, state->live_stream_socket);
 
             json_object_put(arror);
         }
@@ -600,6 +743,7 @@ void handle_request_msg(zmsg_t* msg, request_writer_state_t* state)
     zframe_t *body_frame = zmsg_next(msg);
     zframe_t *stream_frame = zmsg_next(msg);
     zframe_t *sampling_frame = zmsg_next(msg);
+    zframe_t *queued_frame = zmsg_next(msg);
 
     size_t db_name_len = zframe_size(db_frame);
     char db_name[db_name_len+1];
@@ -630,6 +774,11 @@ void handle_request_msg(zmsg_t* msg, request_writer_state_t* state)
         memcpy(&sampling_reason, zframe_data(sampling_frame), sizeof(sampling_reason_t));
         request_id = store_request(db_name, stream_info, request, module, sampling_reason, state);
         request_writer_publish_error(stream_info, module, request, state, request_id);
+        if (queued_frame && zframe_size(queued_frame) == sizeof(int64_t)) {
+            int64_t queued_us;
+            memcpy(&queued_us, zframe_data(queued_frame), sizeof(queued_us));
+            importer_prometheus_client_observe_insert_latency(state->id, (zclock_usecs() - queued_us) / 1000000.0);
+        }
         break;
     case 'j':
         store_js_exception(db_name, stream_info, request, state);
@@ -654,15 +803,13 @@ request_writer_state_t* request_writer_state_new(zconfig_t *config, size_t id)
     snprintf(state->me, 16, "writer[%zu]", id);
     state->pull_socket = request_writer_pull_socket_new(id);
     state->live_stream_socket = live_stream_client_socket_new(config);
-    for (int i=0; i<num_databases; i++) {
-        state->mongo_clients[i] = mongoc_client_new(databases[i]);
-        assert(state->mongo_clients[i]);
-    }
+    state->backend = backend_new();
     state->request_collections = zhash_new();
     state->metrics_collections = zhash_new();
     state->jse_collections = zhash_new();
     state->events_collections = zhash_new();
     state->statsd_client = statsd_client_new(config, state->me);
+    state->spool = spool_new(config, id);
     return state;
 }
 
@@ -677,10 +824,9 @@ void request_writer_state_destroy(request_writer_state_t **state_p)
     zhash_destroy(&state->metrics_collections);
     zhash_destroy(&state->jse_collections);
     zhash_destroy(&state->events_collections);
-    for (int i=0; i<num_databases; i++) {
-        mongoc_client_destroy(state->mongo_clients[i]);
-    }
+    backend_destroy(&state->backend);
     statsd_client_destroy(&state->statsd_client);
+    spool_destroy(&state->spool);
     free(state);
     *state_p = NULL;
 }
@@ -690,6 +836,7 @@ static void request_writer(zsock_t *pipe, void *args)
     request_writer_state_t *state = (request_writer_state_t*)args;
     state->pipe = pipe;
     set_thread_name(state->me);
+    importer_prometheus_client_register_writer(state->id);
     size_t id = state->id;
 
     if (!quiet)
@@ -704,8 +851,9 @@ static void request_writer(zsock_t *pipe, void *args)
 
     while (!zsys_interrupted) {
         // printf("[D] writer [%zu]: polling\n", id);
-        // we wait for at most one second
-        void *socket = zpoller_wait(poller, 1000);
+        // we wait for at most one second, unless there is spooled work to do
+        bool draining = request_writer_can_drain(state);
+        void *socket = zpoller_wait(poller, draining ? 0 : 1000);
         zmsg_t *msg = NULL;
         if (socket == state->pipe) {
             msg = zmsg_recv(state->pipe);
@@ -720,11 +868,10 @@ static void request_writer(zsock_t *pipe, void *args)
                 importer_prometheus_client_count_inserts(state->updates_count);
                 importer_prometheus_client_time_inserts(((double)state->update_time)/1000000);
                 importer_prometheus_client_count_inserts_failed(state->updates_failed);
-                importer_prometheus_client_record_rusage_writer(state->id);
                 if (ticks++ % PING_INTERVAL == 0) {
                     // ping mongodb to reestablish connection if it got lost
                     for (int i=0; i<num_databases; i++) {
-                        mongo_client_ping(state->mongo_clients[i]);
+                        backend_ping(state->backend, i);
                     }
                 }
                 // free collection pointers every hour
@@ -737,6 +884,15 @@ static void request_writer(zsock_t *pipe, void *args)
                     state->jse_collections = zhash_new();
                     state->events_collections = zhash_new();
                 }
+                if (state->spool) {
+                    spool_sync(state->spool);
+                    if (state->spooled || state->drained || state->spool_drops)
+                        printf("[I] writer [%zu]: spooled %zu, drained %zu, dropped %zu documents (spool size: %.1fMB)\n",
+                               id, state->spooled, state->drained, state->spool_drops, spool_size(state->spool) / 1048576.0);
+                    // give failing servers another chance
+                    memset(state->mongo_failing, 0, sizeof(state->mongo_failing));
+                    state->spooled = state->drained = state->spool_drops = 0;
+                }
                 state->updates_count = 0;
                 state->update_time = 0;
                 state->updates_failed = 0;
@@ -769,6 +925,8 @@ static void request_writer(zsock_t *pipe, void *args)
             // probably interrupted by signal handler
             // if so, loop will terminate on condition !zsys_interrupted
         }
+        if (draining)
+            spool_drain(state->spool, SPOOL_DRAIN_BATCH_SIZE, request_writer_insert_spooled, state);
     }
 
     if (!quiet)
@@ -0,0 +1,641 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "importer-spool.h"
+#include "importer-mongoutils.h"
+
+#define SPOOL_MAGIC "LJSPOOL2"
+#define SPOOL_MAGIC_V1 "LJSPOOL1"
+#define SPOOL_MAGIC_SIZE 8
+#define SPOOL_HEADER_SIZE_V1 (SPOOL_MAGIC_SIZE + 4)
+// followed by the stream key
+#define SPOOL_HEADER_SIZE (SPOOL_HEADER_SIZE_V1 + 4)
+#define SPOOL_MAX_STREAM_KEY_SIZE 1024
+#define SPOOL_DEAD_LETTER_DIRECTORY "dead-letter"
+
+const char* spool_collection_names[SPOOL_NUM_COLLECTIONS] = {
+    "requests",
+    "metrics",
+    "js_exceptions",
+    "events",
+};
+
+typedef struct {
+    char *path;
+    int fd;
+    size_t size;
+    bool dirty;         // written since last sync
+    bool idle;          // not written since last tick
+} segment_t;
+
+typedef struct {
+    char *path;
+    char *db_name;
+    char *stream;       // NULL for version 1 segments
+    int server;
+    byte *data;
+    size_t size;
+    size_t header_size;
+    size_t offset;
+} drain_t;
+
+struct _spool {
+    char *directory;
+    size_t writer_id;
+    size_t high_water_mark;
+    size_t max_size;
+    size_t size;
+    uint64_t sequence;
+    zhash_t *segments;  // db name -> active segment_t
+    zlist_t *sealed;    // paths of sealed segments, oldest first
+    drain_t *drain;     // segment currently being drained
+};
+
+// segment file names: <db_name>.<writer id>.<sequence>.spool
+static
+const char* segment_sequence(const char *path)
+{
+    const char *end = path + strlen(path) - 6;
+    const char *p = end - 1;
+    while (p > path && *p != '.')
+        p--;
+    return p;
+}
+
+static
+int compare_segments(void *a, void *b)
+{
+    return strcmp(segment_sequence(a), segment_sequence(b));
+}
+
+static
+bool parse_segment_name(const char *name, char *db_name, size_t db_name_size, size_t *writer_id)
+{
+    size_t n = strlen(name);
+    if (n < 7 || strcmp(name + n - 6, ".spool"))
+        return false;
+    // walk back over sequence and writer id
+    const char *dots[2];
+    const char *p = name + n - 6;
+    for (int i = 0; i < 2; i++) {
+        do p--; while (p > name && *p != '.');
+        if (p == name)
+            return false;
+        dots[i] = p;
+    }
+    *writer_id = strtoul(dots[1] + 1, NULL, 10);
+    size_t len = dots[1] - name;
+    if (len >= db_name_size)
+        return false;
+    memcpy(db_name, name, len);
+    db_name[len] = '\0';
+    return true;
+}
+
+static
+void claim_old_segments(spool_t *spool)
+{
+    DIR *dir = opendir(spool->directory);
+    if (dir == NULL) {
+        fprintf(stderr, "[E] spool: could not open %s: %s\n", spool->directory, strerror(errno));
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        char db_name[256];
+        size_t writer_id;
+        if (!parse_segment_name(entry->d_name, db_name, sizeof(db_name), &writer_id))
+            continue;
+        if (writer_id % num_writers != spool->writer_id)
+            continue;
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", spool->directory, entry->d_name);
+        struct stat st;
+        if (stat(path, &st))
+            continue;
+        spool->size += st.st_size;
+        zlist_append(spool->sealed, strdup(path));
+    }
+    closedir(dir);
+    zlist_sort(spool->sealed, compare_segments);
+    if (zlist_size(spool->sealed))
+        printf("[I] spool: writer [%zu] found %zu segments (%.1fMB) to drain\n",
+               spool->writer_id, zlist_size(spool->sealed), spool->size / 1048576.0);
+}
+
+spool_t* spool_new(zconfig_t *config, size_t writer_id)
+{
+    const char *directory = zconfig_resolve(config, "backend/spool/directory", "");
+    if (*directory == '\0')
+        return NULL;
+    if (zsys_dir_create("%s", directory)) {
+        fprintf(stderr, "[E] spool: could not create directory %s: %s\n", directory, strerror(errno));
+        return NULL;
+    }
+
+    spool_t *spool = zmalloc(sizeof(*spool));
+    assert(spool);
+    spool->directory = strdup(directory);
+    spool->writer_id = writer_id;
+    spool->high_water_mark = strtoul(zconfig_resolve(config, "backend/spool/high_water_mark", "0"), NULL, 0);
+    if (spool->high_water_mark == 0)
+        spool->high_water_mark = SPOOL_DEFAULT_HIGH_WATER_MARK;
+    size_t max_size_mb = strtoul(zconfig_resolve(config, "backend/spool/max_size_mb", "0"), NULL, 0);
+    if (max_size_mb == 0)
+        max_size_mb = SPOOL_DEFAULT_MAX_SIZE_MB;
+    spool->max_size = max_size_mb * 1024 * 1024;
+    spool->segments = zhash_new();
+    spool->sealed = zlist_new();
+    claim_old_segments(spool);
+    return spool;
+}
+
+size_t spool_high_water_mark(spool_t *spool)
+{
+    return spool->high_water_mark;
+}
+
+size_t spool_size(spool_t *spool)
+{
+    return spool->size;
+}
+
+static
+segment_t* segment_open(spool_t *spool, const char *db_name, const char *stream, int server)
+{
+    uint64_t sequence = zclock_usecs();
+    if (sequence <= spool->sequence)
+        sequence = spool->sequence + 1;
+    spool->sequence = sequence;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.%zu.%016" PRIx64 ".spool", spool->directory, db_name, spool->writer_id, sequence);
+    int fd = open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "[E] spool: could not create %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    size_t stream_len = strlen(stream);
+    assert(stream_len <= SPOOL_MAX_STREAM_KEY_SIZE);
+    size_t header_size = SPOOL_HEADER_SIZE + stream_len;
+    char header[header_size];
+    memcpy(header, SPOOL_MAGIC, SPOOL_MAGIC_SIZE);
+    int32_t server_le = BSON_UINT32_TO_LE(server);
+    memcpy(header + SPOOL_MAGIC_SIZE, &server_le, 4);
+    uint32_t stream_len_le = BSON_UINT32_TO_LE(stream_len);
+    memcpy(header + SPOOL_HEADER_SIZE_V1, &stream_len_le, 4);
+    memcpy(header + SPOOL_HEADER_SIZE, stream, stream_len);
+    if (write(fd, header, header_size) != (ssize_t) header_size) {
+        fprintf(stderr, "[E] spool: could not write %s: %s\n", path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    segment_t *segment = zmalloc(sizeof(*segment));
+    assert(segment);
+    segment->path = strdup(path);
+    segment->fd = fd;
+    segment->size = header_size;
+    segment->dirty = true;
+    spool->size += header_size;
+    zhash_insert(spool->segments, db_name, segment);
+    return segment;
+}
+
+static
+void segment_seal(spool_t *spool, const char *db_name)
+{
+    segment_t *segment = zhash_lookup(spool->segments, db_name);
+    assert(segment);
+    if (segment->dirty)
+        fdatasync(segment->fd);
+    close(segment->fd);
+    zlist_append(spool->sealed, segment->path);
+    zhash_delete(spool->segments, db_name);
+    free(segment);
+}
+
+bool spool_append(spool_t *spool, const char *db_name, const char *stream, int server,
+                  spool_collection_t collection, const bson_t *document)
+{
+    size_t record_size = 1 + document->len;
+    if (spool->size + record_size > spool->max_size)
+        return false;
+
+    segment_t *segment = zhash_lookup(spool->segments, db_name);
+    if (segment && segment->size + record_size > SPOOL_SEGMENT_SIZE) {
+        segment_seal(spool, db_name);
+        segment = NULL;
+    }
+    if (segment == NULL && !(segment = segment_open(spool, db_name, stream, server)))
+        return false;
+
+    byte kind = collection;
+    struct iovec iov[2] = {
+        { .iov_base = &kind, .iov_len = 1 },
+        { .iov_base = (void*) bson_get_data(document), .iov_len = document->len },
+    };
+    ssize_t written = writev(segment->fd, iov, 2);
+    if (written > 0) {
+        segment->size += written;
+        spool->size += written;
+    }
+    segment->dirty = true;
+    segment->idle = false;
+    if (written != (ssize_t) record_size) {
+        // a truncated record is skipped when draining
+        fprintf(stderr, "[E] spool: could not write %s: %s\n", segment->path, strerror(errno));
+        segment_seal(spool, db_name);
+        return false;
+    }
+    return true;
+}
+
+void spool_sync(spool_t *spool)
+{
+    zlist_t *idle = zlist_new();
+    segment_t *segment = zhash_first(spool->segments);
+    while (segment) {
+        if (segment->idle)
+            zlist_append(idle, (void*) zhash_cursor(spool->segments));
+        else {
+            if (segment->dirty)
+                fdatasync(segment->fd);
+            segment->dirty = false;
+            segment->idle = true;
+        }
+        segment = zhash_next(spool->segments);
+    }
+    // keys are owned by the hash, so copy them before sealing
+    char *db_name;
+    while ((db_name = zlist_pop(idle))) {
+        char *key = strdup(db_name);
+        segment_seal(spool, key);
+        free(key);
+    }
+    zlist_destroy(&idle);
+}
+
+bool spool_can_drain(spool_t *spool)
+{
+    return spool->drain || zlist_size(spool->sealed);
+}
+
+static
+void drain_finish(spool_t *spool)
+{
+    drain_t *drain = spool->drain;
+    munmap(drain->data, drain->size);
+    if (unlink(drain->path))
+        fprintf(stderr, "[E] spool: could not remove %s: %s\n", drain->path, strerror(errno));
+    spool->size -= drain->size < spool->size ? drain->size : spool->size;
+    free(drain->path);
+    free(drain->db_name);
+    free(drain->stream);
+    free(drain);
+    spool->drain = NULL;
+}
+
+// returns the size of the segment header, or 0 if the header is invalid
+static
+size_t segment_header_size(const byte *data, size_t size, char **stream)
+{
+    *stream = NULL;
+    if (size >= SPOOL_HEADER_SIZE_V1 && !memcmp(data, SPOOL_MAGIC_V1, SPOOL_MAGIC_SIZE))
+        return SPOOL_HEADER_SIZE_V1;
+    if (size < SPOOL_HEADER_SIZE || memcmp(data, SPOOL_MAGIC, SPOOL_MAGIC_SIZE))
+        return 0;
+    uint32_t stream_len_le;
+    memcpy(&stream_len_le, data + SPOOL_HEADER_SIZE_V1, 4);
+    size_t stream_len = BSON_UINT32_FROM_LE(stream_len_le);
+    if (stream_len == 0 || stream_len > SPOOL_MAX_STREAM_KEY_SIZE || size < SPOOL_HEADER_SIZE + stream_len)
+        return 0;
+    *stream = strndup((const char*) data + SPOOL_HEADER_SIZE, stream_len);
+    return SPOOL_HEADER_SIZE + stream_len;
+}
+
+// append records the database refused to store to a segment in the dead-letter directory
+static
+void drain_reject(spool_t *spool, size_t offset, size_t end)
+{
+    drain_t *drain = spool->drain;
+    const char *name = strrchr(drain->path, '/');
+    name = name ? name + 1 : drain->path;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", spool->directory, SPOOL_DEAD_LETTER_DIRECTORY);
+    if (zsys_dir_create("%s", path)) {
+        fprintf(stderr, "[E] spool: could not create directory %s: %s\n", path, strerror(errno));
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/%s/%s", spool->directory, SPOOL_DEAD_LETTER_DIRECTORY, name);
+    int fd = open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "[E] spool: could not open %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    // a new dead-letter segment starts with the header of the drained one
+    struct iovec iov[2] = {
+        { .iov_base = drain->data, .iov_len = st.st_size ? 0 : drain->header_size },
+        { .iov_base = drain->data + offset, .iov_len = end - offset },
+    };
+    ssize_t expected = iov[0].iov_len + iov[1].iov_len;
+    if (writev(fd, iov, 2) != expected || fdatasync(fd))
+        fprintf(stderr, "[E] spool: could not write %s: %s\n", path, strerror(errno));
+    else
+        fprintf(stderr, "[E] spool: moved %zu bytes of %s to %s\n", end - offset, drain->path, path);
+    close(fd);
+}
+
+static
+bool drain_open_next(spool_t *spool)
+{
+    char *path;
+    while ((path = zlist_pop(spool->sealed))) {
+        char db_name[256];
+        size_t writer_id;
+        const char *name = strrchr(path, '/');
+        name = name ? name + 1 : path;
+        int fd = open(path, O_RDONLY|O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) || !parse_segment_name(name, db_name, sizeof(db_name), &writer_id)) {
+            fprintf(stderr, "[E] spool: could not open %s: %s\n", path, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            free(path);
+            continue;
+        }
+        void *data = st.st_size >= SPOOL_HEADER_SIZE_V1 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        char *stream = NULL;
+        size_t header_size = data == MAP_FAILED ? 0 : segment_header_size(data, st.st_size, &stream);
+        if (header_size == 0) {
+            fprintf(stderr, "[E] spool: removing invalid segment %s\n", path);
+            if (data != MAP_FAILED)
+                munmap(data, st.st_size);
+            unlink(path);
+            spool->size -= (size_t) st.st_size < spool->size ? (size_t) st.st_size : spool->size;
+            free(path);
+            continue;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+        drain_t *drain = zmalloc(sizeof(*drain));
+        assert(drain);
+        drain->path = path;
+        drain->db_name = strdup(db_name);
+        drain->stream = stream;
+        drain->data = data;
+        drain->size = st.st_size;
+        drain->header_size = header_size;
+        drain->offset = header_size;
+        int32_t server_le;
+        memcpy(&server_le, drain->data + SPOOL_MAGIC_SIZE, 4);
+        drain->server = BSON_UINT32_FROM_LE(server_le);
+        if (drain->server < 0 || (size_t) drain->server >= num_databases)
+            drain->server = 0;
+        spool->drain = drain;
+        return true;
+    }
+    return false;
+}
+
+size_t spool_drain(spool_t *spool, size_t max_documents, spool_insert_fn *insert, void *arg)
+{
+    size_t drained = 0;
+    while (drained < max_documents) {
+        if (spool->drain == NULL && !drain_open_next(spool))
+            break;
+        drain_t *drain = spool->drain;
+
+        bson_t documents[SPOOL_DRAIN_BATCH_SIZE];
+        const bson_t *batch[SPOOL_DRAIN_BATCH_SIZE];
+        size_t limit = max_documents - drained;
+        if (limit > SPOOL_DRAIN_BATCH_SIZE)
+            limit = SPOOL_DRAIN_BATCH_SIZE;
+        size_t n = 0;
+        int collection = -1;
+        size_t offset = drain->offset;
+        bool truncated = false;
+
+        // collect consecutive records for the same collection
+        while (n < limit && offset < drain->size) {
+            size_t remaining = drain->size - offset;
+            uint32_t len = 0;
+            if (remaining > 5) {
+                memcpy(&len, drain->data + offset + 1, 4);
+                len = BSON_UINT32_FROM_LE(len);
+            }
+            int kind = drain->data[offset];
+            if (len < 5 || len > remaining - 1 || kind >= SPOOL_NUM_COLLECTIONS
+                || !bson_init_static(&documents[n], drain->data + offset + 1, len)) {
+                truncated = true;
+                break;
+            }
+            if (collection >= 0 && kind != collection)
+                break;
+            collection = kind;
+            batch[n] = &documents[n];
+            n++;
+            offset += 1 + len;
+        }
+
+        if (n > 0) {
+            spool_insert_result_t result = insert(arg, drain->db_name, drain->stream, drain->server, collection, batch, n);
+            if (result == SPOOL_RETRY)
+                break;
+            if (result == SPOOL_REJECTED)
+                drain_reject(spool, drain->offset, offset);
+            else
+                drained += n;
+            drain->offset = offset;
+        }
+        if (truncated)
+            fprintf(stderr, "[W] spool: ignoring truncated record at offset %zu of %s\n", offset, drain->path);
+        if (truncated || drain->offset >= drain->size)
+            drain_finish(spool);
+    }
+    return drained;
+}
+
+void spool_destroy(spool_t **spool_p)
+{
+    spool_t *spool = *spool_p;
+    if (spool == NULL)
+        return;
+    // remaining segments are picked up on the next start
+    segment_t *segment = zhash_first(spool->segments);
+    while (segment) {
+        fdatasync(segment->fd);
+        close(segment->fd);
+        free(segment->path);
+        free(segment);
+        segment = zhash_next(spool->segments);
+    }
+    zhash_destroy(&spool->segments);
+    if (spool->drain) {
+        munmap(spool->drain->data, spool->drain->size);
+        free(spool->drain->path);
+        free(spool->drain->db_name);
+        free(spool->drain->stream);
+        free(spool->drain);
+    }
+    char *path;
+    while ((path = zlist_pop(spool->sealed)))
+        free(path);
+    zlist_destroy(&spool->sealed);
+    free(spool->directory);
+    free(spool);
+    *spool_p = NULL;
+}
+
+static size_t test_inserted[SPOOL_NUM_COLLECTIONS];
+static const char *test_stream;
+static spool_insert_result_t test_result;
+
+static
+spool_insert_result_t test_insert(void *arg, const char *db_name, const char *stream, int server,
+                                  spool_collection_t collection, const bson_t **documents, size_t n)
+{
+    assert(streq(db_name, "logjam-checker1-production-2026-01-01"));
+    assert(server == 0);
+    test_stream = stream;
+    for (size_t i = 0; i < n; i++)
+        assert(bson_has_field(documents[i], "n"));
+    if (test_result == SPOOL_INSERTED)
+        test_inserted[collection] += n;
+    return test_result;
+}
+
+static
+void test_append(spool_t *spool, spool_collection_t collection, int n)
+{
+    for (int i = 0; i < n; i++) {
+        bson_t *document = bson_new();
+        BSON_APPEND_INT32(document, "n", i);
+        assert(spool_append(spool, "logjam-checker1-production-2026-01-01", "checker1-production", 0, collection, document));
+        bson_destroy(document);
+    }
+}
+
+static
+void test_seal(spool_t *spool)
+{
+    // the first sync marks segments idle, the second one seals them
+    spool_sync(spool);
+    spool_sync(spool);
+    assert(zhash_size(spool->segments) == 0);
+}
+
+void spool_test(int verbose)
+{
+    printf(" * importer-spool: ");
+    if (verbose)
+        printf("\n");
+
+    char directory[256];
+    snprintf(directory, sizeof(directory), "/tmp/importer-checker-spool-%d", getpid());
+    zconfig_t *config = zconfig_new("root", NULL);
+    zconfig_put(config, "backend/spool/directory", directory);
+    spool_t *spool = spool_new(config, 0);
+    assert(spool);
+    assert(spool_size(spool) == 0);
+    assert(!spool_can_drain(spool));
+
+    // segment header: magic, server and stream key
+    test_append(spool, SPOOL_REQUESTS, 3);
+    test_append(spool, SPOOL_METRICS, 2);
+    test_seal(spool);
+    assert(spool_can_drain(spool));
+    assert(zlist_size(spool->sealed) == 1);
+    char *path = strdup(zlist_first(spool->sealed));
+    FILE *f = fopen(path, "r");
+    assert(f);
+    char header[SPOOL_HEADER_SIZE + 32];
+    size_t header_size = SPOOL_HEADER_SIZE + strlen("checker1-production");
+    assert(fread(header, 1, header_size, f) == header_size);
+    fclose(f);
+    char *stream;
+    assert(segment_header_size((byte*) header, header_size, &stream) == header_size);
+    assert(streq(stream, "checker1-production"));
+    free(stream);
+    int32_t server;
+    memcpy(&server, header + SPOOL_MAGIC_SIZE, 4);
+    assert(BSON_UINT32_FROM_LE(server) == 0);
+
+    // a truncated record at the end of a segment is skipped
+    int fd = open(path, O_WRONLY|O_APPEND);
+    assert(fd >= 0);
+    assert(write(fd, "\x01\x20\x00", 3) == 3);
+    close(fd);
+
+    // segments of other writers are left alone, segments without stream key are drained
+    spool_t *other = spool_new(config, 1);
+    assert(other);
+    test_append(other, SPOOL_EVENTS, 1);
+    test_seal(other);
+    spool_destroy(&other);
+    char old_path[PATH_MAX];
+    snprintf(old_path, sizeof(old_path), "%s/logjam-checker1-production-2026-01-01.0.0000000000000001.spool", directory);
+    f = fopen(old_path, "w");
+    assert(f);
+    bson_t *document = bson_new();
+    BSON_APPEND_INT32(document, "n", 0);
+    fwrite(SPOOL_MAGIC_V1 "\0\0\0\0\x03", 1, SPOOL_HEADER_SIZE_V1 + 1, f);
+    fwrite(bson_get_data(document), 1, document->len, f);
+    fclose(f);
+    bson_destroy(document);
+
+    // segments left behind by a previous run are claimed, oldest first
+    spool_destroy(&spool);
+    spool = spool_new(config, 0);
+    assert(spool);
+    assert(zlist_size(spool->sealed) == 2);
+    assert(streq(zlist_first(spool->sealed), old_path));
+    assert(streq(zlist_next(spool->sealed), path));
+
+    // draining passes on batches per collection and removes drained segments
+    test_result = SPOOL_INSERTED;
+    assert(spool_drain(spool, 100, test_insert, NULL) == 6);
+    assert(test_inserted[SPOOL_EVENTS] == 1);
+    assert(test_inserted[SPOOL_REQUESTS] == 3);
+    assert(test_inserted[SPOOL_METRICS] == 2);
+    assert(streq(test_stream, "checker1-production"));
+    assert(!spool_can_drain(spool));
+    assert(spool_size(spool) == 0);
+    assert(access(path, F_OK) && access(old_path, F_OK));
+    free(path);
+
+    // batches which can't be stored right now stay in the spool
+    test_append(spool, SPOOL_REQUESTS, 2);
+    test_seal(spool);
+    test_result = SPOOL_RETRY;
+    assert(spool_drain(spool, 100, test_insert, NULL) == 0);
+    assert(spool_can_drain(spool));
+
+    // batches which will never be stored are moved to the dead-letter directory
+    test_result = SPOOL_REJECTED;
+    assert(spool_drain(spool, 100, test_insert, NULL) == 0);
+    assert(!spool_can_drain(spool));
+    assert(test_inserted[SPOOL_REQUESTS] == 3);
+    char dead_letters[PATH_MAX];
+    snprintf(dead_letters, sizeof(dead_letters), "%s/%s", directory, SPOOL_DEAD_LETTER_DIRECTORY);
+    zdir_t *dir = zdir_new(dead_letters, NULL);
+    assert(dir);
+    assert(zdir_count(dir) == 1);
+    zdir_destroy(&dir);
+
+    spool_destroy(&spool);
+    zconfig_destroy(&config);
+    dir = zdir_new(directory, NULL);
+    assert(dir);
+    zdir_remove(dir, true);
+    zdir_destroy(&dir);
+
+    printf("OK\n");
+}
@@ -0,0 +1,87 @@
+#ifndef __LOGJAM_IMPORTER_SPOOL_H_INCLUDED__
+#define __LOGJAM_IMPORTER_SPOOL_H_INCLUDED__
+
+#include "importer-common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Write ahead spool for the request writers.
+ *
+ * When mongodb is unavailable or the writers fall behind, documents are appended to
+ * segment files in backend/spool/directory instead of being inserted. There is one
+ * active segment per database and writer. Segments are sealed when they reach
+ * SPOOL_SEGMENT_SIZE or didn't receive documents for a tick, and then drained into
+ * mongodb with bulk inserts, by mapping them into memory.
+ *
+ * Segment layout: "LJSPOOL2", int32 server index, uint32 length and bytes of the
+ * stream key, followed by records consisting of a collection byte and a BSON document
+ * (which starts with its own length). "LJSPOOL1" segments have no stream key.
+ *
+ * Batches the database refuses to store are moved to segments in the dead-letter
+ * subdirectory of the spool, which are not drained again.
+ *
+ * A spool belongs to a single writer thread and must not be shared.
+ */
+
+#define SPOOL_SEGMENT_SIZE (64 * 1024 * 1024)
+#define SPOOL_DRAIN_BATCH_SIZE 100
+#define SPOOL_DEFAULT_HIGH_WATER_MARK 20000
+#define SPOOL_DEFAULT_MAX_SIZE_MB 10240
+
+typedef enum {
+    SPOOL_REQUESTS = 0,
+    SPOOL_METRICS = 1,
+    SPOOL_JS_EXCEPTIONS = 2,
+    SPOOL_EVENTS = 3,
+} spool_collection_t;
+#define SPOOL_NUM_COLLECTIONS 4
+
+extern const char* spool_collection_names[SPOOL_NUM_COLLECTIONS];
+
+typedef struct _spool spool_t;
+
+// returns NULL if spooling is not configured. picks up segments left behind by a
+// previous run of writer (writer_id mod num_writers).
+extern spool_t* spool_new(zconfig_t *config, size_t writer_id);
+
+extern void spool_destroy(spool_t **spool_p);
+
+// spool if more than this many inserts are queued
+extern size_t spool_high_water_mark(spool_t *spool);
+
+// returns false if the spool is full
+extern bool spool_append(spool_t *spool, const char *db_name, const char *stream, int server,
+                         spool_collection_t collection, const bson_t *document);
+
+// flush written data to disk and seal idle segments. called once per tick.
+extern void spool_sync(spool_t *spool);
+
+extern bool spool_can_drain(spool_t *spool);
+
+typedef enum {
+    SPOOL_INSERTED = 0,     // batch stored, continue draining
+    SPOOL_RETRY = 1,        // batch could not be stored right now, stop draining
+    SPOOL_REJECTED = 2,     // batch will never be stored, move it to the dead-letter directory
+} spool_insert_result_t;
+
+// the callback inserts a batch of documents, all belonging to the same collection.
+// stream is NULL for segments written before stream keys were recorded.
+typedef spool_insert_result_t (spool_insert_fn) (void *arg, const char *db_name, const char *stream, int server,
+                                                 spool_collection_t collection, const bson_t **documents, size_t n);
+
+// drain at most max_documents from sealed segments. returns the number of documents drained.
+extern size_t spool_drain(spool_t *spool, size_t max_documents, spool_insert_fn *insert, void *arg);
+
+// bytes currently held on disk
+extern size_t spool_size(spool_t *spool);
+
+extern void spool_test(int verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
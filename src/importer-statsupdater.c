@@ -25,8 +25,7 @@
 typedef struct {
     size_t id;
     char me[16];
-    mongoc_client_t *mongo_clients[MAX_DATABASES];
-    mongoc_collection_t *global_collection;
+    backend_t *backend;
     zhash_t *stats_collections;
     zsock_t *pipe;
     zsock_t *pull_socket;
@@ -36,16 +35,16 @@ typedef struct {
 } stats_updater_state_t;
 
 typedef struct {
-    mongoc_collection_t *totals;
-    mongoc_collection_t *minutes;
-    mongoc_collection_t *quants;
-    mongoc_collection_t *histograms;
-    mongoc_collection_t *agents;
+    backend_collection_t *totals;
+    backend_collection_t *minutes;
+    backend_collection_t *quants;
+    backend_collection_t *histograms;
+    backend_collection_t *agents;
 } stats_collections_t;
 
 typedef struct {
     const char *db_name;
-    mongoc_collection_t *collection;
+    backend_collection_t *collection;
 } collection_update_callback_t;
 
 typedef int (updater_foreach_fn) (const char *key, void *item, void *argument);
@@ -123,7 +122,7 @@ static
 int minutes_add_increments(const char* namespace, void* data, void* arg)
 {
     collection_update_callback_t *cb = arg;
-    mongoc_collection_t *collection = cb->collection;
+    backend_collection_t *collection = cb->collection;
     const char *db_name = cb->db_name;
     increments_t* increments = data;
 
@@ -145,17 +144,15 @@ int minutes_add_increments(const char* namespace, void* data, void* arg)
     // bson_free(bs);
 
     bson_t *document = increments_to_bson(namespace, increments);
-    if (!dryrun) {
-        bson_error_t error;
-        if (!mongoc_collection_update(collection, MONGOC_UPDATE_UPSERT, selector, document, wc_no_wait, &error)) {
-            size_t n;
-            char* bjs = bson_as_json(document, &n);
-            fprintf(stderr,
-                    "[E] update failed for %s on minutes: (%d) %s\n"
-                    "[E] document size: %zu; value: %s\n",
-                    db_name, error.code, error.message, n, bjs);
-            bson_free(bjs);
-        }
+    bson_error_t error;
+    if (!backend_upsert(collection, selector, document, &error)) {
+        size_t n;
+        char* bjs = bson_as_json(document, &n);
+        fprintf(stderr,
+                "[E] update failed for %s on minutes: (%d) %s\n"
+                "[E] document size: %zu; value: %s\n",
+                db_name, error.code, error.message, n, bjs);
+        bson_free(bjs);
     }
     bson_destroy(selector);
     bson_destroy(document);
@@ -166,7 +163,7 @@ static
 int totals_add_increments(const char* namespace, void* data, void* arg)
 {
     collection_update_callback_t *cb = arg;
-    mongoc_collection_t *collection = cb->collection;
+    backend_collection_t *collection = cb->collection;
     const char *db_name = cb->db_name;
     increments_t* increments = data;
     assert(increments);
@@ -180,17 +177,15 @@ int totals_add_increments(const char* namespace, void* data, void* arg)
     // bson_free(bs);
 
     bson_t *document = increments_to_bson(namespace, increments);
-    if (!dryrun) {
-        bson_error_t error;
-        if (!mongoc_collection_update(collection, MONGOC_UPDATE_UPSERT, selector, document, wc_no_wait, &error)) {
-            size_t n;
-            char* bjs = bson_as_json(document, &n);
-            fprintf(stderr,
-                    "[E] update failed for %s on totals: (%d) %s\n"
-                    "[E] document size: %zu; value: %s\n",
-                    db_name, error.code, error.message, n, bjs);
-            bson_free(bjs);
-        }
+    bson_error_t error;
+    if (!backend_upsert(collection, selector, document, &error)) {
+        size_t n;
+        char* bjs = bson_as_json(document, &n);
+        fprintf(stderr,
+                "[E] update failed for %s on totals: (%d) %s\n"
+                "[E] document size: %zu; value: %s\n",
+                db_name, error.code, error.message, n, bjs);
+        bson_free(bjs);
     }
 
     bson_destroy(selector);
@@ -202,7 +197,7 @@ static
 int quants_add_quants(const char* namespace, void* data, void* arg)
 {
     collection_update_callback_t *cb = arg;
-    mongoc_collection_t *collection = cb->collection;
+    backend_collection_t *collection = cb->collection;
     const char *db_name = cb->db_name;
 
     // extract keys from namespace: kind-quant-page
@@ -245,17 +240,15 @@ int quants_add_quants(const char* namespace, void* data, void* arg)
     // printf("[D] document. size: %zu; value:%s\n", n, bs);
     // bson_free(bs);
 
-    if (!dryrun) {
-        bson_error_t error;
-        if (!mongoc_collection_update(collection, MONGOC_UPDATE_UPSERT, selector, document, wc_no_wait, &error)) {
-            size_t n;
-            char* bjs = bson_as_json(document, &n);
-            fprintf(stderr,
-                    "[E] update failed for %s on quants: (%d) %s\n"
-                    "[E] document size: %zu; value: %s\n",
-                    db_name, error.code, error.message, n, bjs);
-            bson_free(bjs);
-        }
+    bson_error_t error;
+    if (!backend_upsert(collection, selector, document, &error)) {
+        size_t n;
+        char* bjs = bson_as_json(document, &n);
+        fprintf(stderr,
+                "[E] update failed for %s on quants: (%d) %s\n"
+                "[E] document size: %zu; value: %s\n",
+                db_name, error.code, error.message, n, bjs);
+        bson_free(bjs);
     }
     bson_destroy(selector);
     bson_destroy(incs);
@@ -267,7 +260,7 @@ static
 int histograms_add_histograms(const char* namespace, void* data, void* arg)
 {
     collection_update_callback_t *cb = arg;
-    mongoc_collection_t *collection = cb->collection;
+    backend_collection_t *collection = cb->collection;
     const char *db_name = cb->db_name;
 
     // extract details from key: minute-resource-page
@@ -317,17 +310,15 @@ int histograms_add_histograms(const char* namespace, void* data, void* arg)
     // printf("[D] document. size: %zu; value:%s\n", n2, bs2);
     // bson_free(bs2);
 
-    if (!dryrun) {
-        bson_error_t error;
-        if (!mongoc_collection_update(collection, MONGOC_UPDATE_UPSERT, selector, document, wc_no_wait, &error)) {
-            size_t n;
-            char* bjs = bson_as_json(document, &n);
-            fprintf(stderr,
-                    "[E] update failed for %s on histograms: (%d) %s\n"
-                    "[E] document size: %zu; value: %s\n",
-                    db_name, error.code, error.message, n, bjs);
-            bson_free(bjs);
-        }
+    bson_error_t error;
+    if (!backend_upsert(collection, selector, document, &error)) {
+        size_t n;
+        char* bjs = bson_as_json(document, &n);
+        fprintf(stderr,
+                "[E] update failed for %s on histograms: (%d) %s\n"
+                "[E] document size: %zu; value: %s\n",
+                db_name, error.code, error.message, n, bjs);
+        bson_free(bjs);
     }
     bson_destroy(selector);
     bson_destroy(incs);
@@ -340,7 +331,7 @@ static
 int agents_add_agent(const char* agent, void* data, void* arg)
 {
     collection_update_callback_t *cb = arg;
-    mongoc_collection_t *collection = cb->collection;
+    backend_collection_t *collection = cb->collection;
     const char *db_name = cb->db_name;
     user_agent_stats_t *stats = data;
 
@@ -389,17 +380,15 @@ int agents_add_agent(const char* agent, void* data, void* arg)
     // printf("[D] document. size: %zu; value:%s\n", n, bs);
     // bson_free(bs);
 
-    if (!dryrun) {
-        bson_error_t error;
-        if (!mongoc_collection_update(collection, MONGOC_UPDATE_UPSERT, selector, document, wc_no_wait, &error)) {
-            size_t n;
-            char* bjs = bson_as_json(document, &n);
-            fprintf(stderr,
-                    "[E] update failed for %s on agents: (%d) %s\n"
-                    "[E] document size: %zu; value: %s\n",
-                    db_name, error.code, error.message, n, bjs);
-            bson_free(bjs);
-        }
+    bson_error_t error;
+    if (!backend_upsert(collection, selector, document, &error)) {
+        size_t n;
+        char* bjs = bson_as_json(document, &n);
+        fprintf(stderr,
+                "[E] update failed for %s on agents: (%d) %s\n"
+                "[E] document size: %zu; value: %s\n",
+                db_name, error.code, error.message, n, bjs);
+        bson_free(bjs);
     }
     bson_destroy(selector);
     bson_destroy(document);
@@ -407,34 +396,28 @@ int agents_add_agent(const char* agent, void* data, void* arg)
 }
 
 static
-stats_collections_t *stats_collections_new(mongoc_client_t* client, const char* db_name)
+stats_collections_t *stats_collections_new(backend_t *backend, int server, const char* db_name)
 {
     stats_collections_t *collections = zmalloc(sizeof(stats_collections_t));
 
-    if (dryrun) return collections;
-
-    collections->totals = mongoc_client_get_collection(client, db_name, "totals");
-    collections->minutes = mongoc_client_get_collection(client, db_name, "minutes");
-    collections->quants = mongoc_client_get_collection(client, db_name, "quants");
-    collections->histograms = mongoc_client_get_collection(client, db_name, "heatmaps");
-    collections->agents = mongoc_client_get_collection(client, db_name, "agents");
+    collections->totals = backend_get_collection(backend, server, db_name, "totals");
+    collections->minutes = backend_get_collection(backend, server, db_name, "minutes");
+    collections->quants = backend_get_collection(backend, server, db_name, "quants");
+    collections->histograms = backend_get_collection(backend, server, db_name, "heatmaps");
+    collections->agents = backend_get_collection(backend, server, db_name, "agents");
 
     return collections;
 }
 
 static
-void destroy_stats_collections(stats_collections_t* collections)
+void destroy_stats_collections(void* item)
 {
-    if (collections->totals != NULL)
-        mongoc_collection_destroy(collections->totals);
-    if (collections->minutes != NULL)
-        mongoc_collection_destroy(collections->minutes);
-    if (collections->quants != NULL)
-        mongoc_collection_destroy(collections->quants);
-    if (collections->histograms != NULL)
-        mongoc_collection_destroy(collections->histograms);
-    if (collections->agents != NULL)
-        mongoc_collection_destroy(collections->agents);
+    stats_collections_t *collections = item;
+    backend_collection_destroy(&collections->totals);
+    backend_collection_destroy(&collections->minutes);
+    backend_collection_destroy(&collections->quants);
+    backend_collection_destroy(&collections->histograms);
+    backend_collection_destroy(&collections->agents);
     free(collections);
 }
 
@@ -443,12 +426,11 @@ stats_collections_t *stats_updater_get_collections(stats_updater_state_t *self,
 {
     stats_collections_t *collections = zhash_lookup(self->stats_collections, db_name);
     if (collections == NULL) {
-        mongoc_client_t *mongo_client = self->mongo_clients[stream_info->db];
-        // ensure_known_database(mongo_client, db_name);
-        collections = stats_collections_new(mongo_client, db_name);
+        // ensure_known_database(self->backend, stream_info->db, db_name);
+        collections = stats_collections_new(self->backend, stream_info->db, db_name);
         assert(collections);
         zhash_insert(self->stats_collections, db_name, collections);
-        zhash_freefn(self->stats_collections, db_name, (zhash_free_fn*)destroy_stats_collections);
+        zhash_freefn(self->stats_collections, db_name, destroy_stats_collections);
     }
     return collections;
 }
@@ -466,10 +448,7 @@ stats_updater_state_t* stats_updater_state_new(zconfig_t *config, size_t id)
     int rc = zsock_connect(state->pull_socket, "inproc://stats-updates");
     assert(rc==0);
 
-    for (int i = 0; i<num_databases; i++) {
-        state->mongo_clients[i] = mongoc_client_new(databases[i]);
-        assert(state->mongo_clients[i]);
-    }
+    state->backend = backend_new();
     state->stats_collections = zhash_new();
     state->statsd_client = statsd_client_new(config, state->me);
     return state;
@@ -481,9 +460,7 @@ void stats_updater_state_destroy(stats_updater_state_t **state_p)
     stats_updater_state_t *state = *state_p;
     zsock_destroy(&state->pull_socket);
     zhash_destroy(&state->stats_collections);
-    for (int i = 0; i<num_databases; i++) {
-        mongoc_client_destroy(state->mongo_clients[i]);
-    }
+    backend_destroy(&state->backend);
     statsd_client_destroy(&state->statsd_client);
     free(state);
     *state_p = NULL;
@@ -506,6 +483,7 @@ static void stats_updater(zsock_t *pipe, void *args)
     stats_updater_state_t *state = (stats_updater_state_t*)args;
     state->pipe = pipe;
     set_thread_name(state->me);
+    importer_prometheus_client_register_updater(state->id);
     size_t id = state->id;
 
     if (!quiet)
@@ -535,12 +513,11 @@ static void stats_updater(zsock_t *pipe, void *args)
                 statsd_client_timing(state->statsd_client, "importer.updates.time", ((double)state->update_time)/1000);
                 importer_prometheus_client_count_updates(state->updates_count);
                 importer_prometheus_client_time_updates(((double)state->update_time)/1000000);
-                importer_prometheus_client_record_rusage_updater(state->id);
 
                 // ping the server
                 if (ticks++ % PING_INTERVAL == 0) {
                     for (int i=0; i<num_databases; i++) {
-                        mongo_client_ping(state->mongo_clients[i]);
+                        backend_ping(state->backend, i);
                     }
                 }
                 // refresh database information
@@ -568,6 +545,7 @@ static void stats_updater(zsock_t *pipe, void *args)
             zframe_t *db_frame = zmsg_next(msg);
             zframe_t *stream_frame = zmsg_next(msg);
             zframe_t *hash_frame = zmsg_next(msg);
+            zframe_t *tick_frame = zmsg_next(msg);
 
             assert(zframe_size(task_frame) == 1);
             char task_type = *(char*)zframe_data(task_frame);
@@ -620,6 +598,11 @@ static void stats_updater(zsock_t *pipe, void *args)
             int64_t end_time_us = zclock_usecs();
             int runtime = end_time_us - start_time_us;
             state->update_time += runtime;
+            if (tick_frame && zframe_size(tick_frame) == sizeof(int64_t)) {
+                int64_t tick_start_us;
+                memcpy(&tick_start_us, zframe_data(tick_frame), sizeof(tick_start_us));
+                importer_prometheus_client_observe_stats_update_latency(id, (end_time_us - tick_start_us) / 1000000.0);
+            }
             // printf("[D] updater[%zu]: task[%c]: (%3d ms) %s\n", id, task_type, runtime/1000, db_name);
             zmsg_destroy(&msg);
         } else if (socket) {
@@ -0,0 +1,208 @@
+#include <pthread.h>
+#include "importer-storage.h"
+#include "importer-prometheus-client.h"
+
+// tokens are counted in thousandths of a request, so that small rates don't round to zero
+#define TOKEN_SCALE 1000
+
+// weight of the last tick in the smoothed demand
+#define DEMAND_SMOOTHING 0.1
+
+struct _storage_account {
+    char *stream;
+    int64_t measured_size;      // storage size reported by dbStats
+    int64_t bytes_written;      // bytes inserted since the last measurement
+    int64_t tokens;             // token bucket, in TOKEN_SCALE units
+    int32_t limited;            // whether the token bucket applies
+    uint64_t requested;         // requests to be stored since the last tick
+    uint64_t throttled;         // requests throttled since the last tick
+    // only used by storage_tick
+    double demand;              // smoothed requests per tick
+    double throttle_ratio;      // last published value
+};
+
+// accounts outlive stream infos, which get replaced on every stream config update.
+// they are never freed, as streams come and go rarely.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static zhash_t *accounts = NULL;
+
+storage_account_t* storage_account(stream_info_t *stream_info)
+{
+    storage_account_t *account = __atomic_load_n(&stream_info->storage, __ATOMIC_ACQUIRE);
+    if (account)
+        return account;
+
+    pthread_mutex_lock(&lock);
+    if (accounts == NULL) {
+        accounts = zhash_new();
+        assert(accounts);
+    }
+    account = zhash_lookup(accounts, stream_info->key);
+    if (account == NULL) {
+        account = zmalloc(sizeof(*account));
+        assert(account);
+        account->stream = strdup(stream_info->key);
+        zhash_insert(accounts, stream_info->key, account);
+    }
+    pthread_mutex_unlock(&lock);
+
+    __atomic_store_n(&stream_info->storage, account, __ATOMIC_RELEASE);
+    return account;
+}
+
+void storage_add_bytes(stream_info_t *stream_info, size_t bytes)
+{
+    storage_account_t *account = storage_account(stream_info);
+    __atomic_fetch_add(&account->bytes_written, bytes, __ATOMIC_RELAXED);
+}
+
+void storage_set_measured_size(stream_info_t *stream_info, int64_t size)
+{
+    storage_account_t *account = storage_account(stream_info);
+    __atomic_store_n(&account->measured_size, size, __ATOMIC_RELAXED);
+    __atomic_store_n(&account->bytes_written, 0, __ATOMIC_RELAXED);
+}
+
+bool storage_throttle_request(stream_info_t *stream_info)
+{
+    storage_account_t *account = storage_account(stream_info);
+    __atomic_fetch_add(&account->requested, 1, __ATOMIC_RELAXED);
+    if (!__atomic_load_n(&account->limited, __ATOMIC_RELAXED))
+        return false;
+    if (__atomic_sub_fetch(&account->tokens, TOKEN_SCALE, __ATOMIC_RELAXED) >= 0)
+        return false;
+    __atomic_fetch_add(&account->tokens, TOKEN_SCALE, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&account->throttled, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static
+double allowed_fraction(int64_t size)
+{
+    if (size <= SOFT_LIMIT_STORAGE_SIZE)
+        return 1;
+    if (size >= HARD_LIMIT_STORAGE_SIZE)
+        return 0;
+    return (double)(HARD_LIMIT_STORAGE_SIZE - size) / (HARD_LIMIT_STORAGE_SIZE - SOFT_LIMIT_STORAGE_SIZE);
+}
+
+static
+void account_tick(storage_account_t *account)
+{
+    uint64_t requested = __atomic_exchange_n(&account->requested, 0, __ATOMIC_RELAXED);
+    uint64_t throttled = __atomic_exchange_n(&account->throttled, 0, __ATOMIC_RELAXED);
+    account->demand += DEMAND_SMOOTHING * (requested - account->demand);
+
+    int64_t size = __atomic_load_n(&account->measured_size, __ATOMIC_RELAXED)
+        + __atomic_load_n(&account->bytes_written, __ATOMIC_RELAXED);
+    double fraction = allowed_fraction(size);
+    bool was_limited = __atomic_load_n(&account->limited, __ATOMIC_RELAXED);
+
+    if (fraction < 1) {
+        // allow bursts of up to two ticks worth of tokens
+        int64_t rate = fraction * account->demand * TOKEN_SCALE;
+        int64_t burst = 2 * rate;
+        int64_t tokens = __atomic_load_n(&account->tokens, __ATOMIC_RELAXED);
+        int64_t refill = tokens + rate > burst ? burst - tokens : rate;
+        __atomic_fetch_add(&account->tokens, refill, __ATOMIC_RELAXED);
+        if (!was_limited) {
+            __atomic_store_n(&account->limited, 1, __ATOMIC_RELAXED);
+            fprintf(stderr, "[W] storage: limiting %s at %.2fGB (%.0f%% allowed)\n",
+                    account->stream, size / 1073741824.0, 100 * fraction);
+        }
+    } else if (was_limited) {
+        __atomic_store_n(&account->limited, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&account->tokens, 0, __ATOMIC_RELAXED);
+        printf("[I] storage: no longer limiting %s at %.2fGB\n", account->stream, size / 1073741824.0);
+    }
+
+    double ratio = requested ? (double) throttled / requested : 0;
+    if (ratio > 0 || account->throttle_ratio > 0)
+        importer_prometheus_client_gauge_throttle_ratio(account->stream, ratio);
+    account->throttle_ratio = ratio;
+}
+
+void storage_tick()
+{
+    pthread_mutex_lock(&lock);
+    if (accounts) {
+        storage_account_t *account = zhash_first(accounts);
+        while (account) {
+            account_tick(account);
+            account = zhash_next(accounts);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void storage_reset()
+{
+    pthread_mutex_lock(&lock);
+    if (accounts) {
+        storage_account_t *account = zhash_first(accounts);
+        while (account) {
+            __atomic_store_n(&account->measured_size, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&account->bytes_written, 0, __ATOMIC_RELAXED);
+            account = zhash_next(accounts);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void storage_test(int verbose)
+{
+    printf(" * importer-storage: ");
+    if (verbose)
+        printf("\n");
+
+    // needs a stream config containing checker1-production
+    stream_info_t *info = get_stream_info("checker1-production", NULL);
+    assert(info);
+    storage_account_t *account = storage_account(info);
+    assert(account == storage_account(info));
+
+    // below the soft limit, nothing gets throttled
+    storage_set_measured_size(info, SOFT_LIMIT_STORAGE_SIZE / 2);
+    storage_add_bytes(info, 1000);
+    assert(account->bytes_written == 1000);
+    for (int i = 0; i < 100; i++)
+        assert(!storage_throttle_request(info));
+    account_tick(account);
+    assert(!account->limited);
+
+    // halfway between the limits, half of the demand gets tokens
+    storage_set_measured_size(info, (SOFT_LIMIT_STORAGE_SIZE + HARD_LIMIT_STORAGE_SIZE) / 2);
+    assert(account->bytes_written == 0);
+    account->demand = 100;
+    account->requested = 100;
+    account_tick(account);
+    assert(account->limited);
+    assert(account->tokens == 50 * TOKEN_SCALE);
+    for (int i = 0; i < 50; i++)
+        assert(!storage_throttle_request(info));
+    assert(storage_throttle_request(info));
+    assert(account->tokens == 0);
+
+    // unused tokens accumulate up to two ticks worth
+    for (int i = 0; i < 3; i++) {
+        account->requested = 100;
+        account_tick(account);
+    }
+    assert(account->tokens == 100 * TOKEN_SCALE);
+    for (int i = 0; i < 100; i++)
+        assert(!storage_throttle_request(info));
+    assert(storage_throttle_request(info));
+
+    // the databases of a new day start out empty
+    storage_reset();
+    assert(account->measured_size == 0 && account->bytes_written == 0);
+    account->requested = 100;
+    account_tick(account);
+    assert(!account->limited);
+    assert(account->tokens == 0);
+    assert(!storage_throttle_request(info));
+
+    release_stream_info(info);
+
+    printf("OK\n");
+}
@@ -0,0 +1,54 @@
+#ifndef __LOGJAM_IMPORTER_STORAGE_H_INCLUDED__
+#define __LOGJAM_IMPORTER_STORAGE_H_INCLUDED__
+
+#include "importer-common.h"
+#include "logjam-streaminfo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Storage accounting for request inserts.
+ *
+ * The size of each stream's database for today is the storage size last reported by
+ * dbStats plus the bytes inserted by the request writers since then. Between the soft
+ * and the hard limit, inserts are throttled by a per stream token bucket: the bucket
+ * is refilled every tick with a fraction of the recent demand, which falls linearly
+ * from 1 at the soft limit to 0 at the hard limit.
+ *
+ * Writers and parsers only touch atomic counters; the bucket is refilled by
+ * storage_tick, which is called by the indexer once per second.
+ */
+
+// request storage size soft limit is 15 GB, hard limit 30 GB, per app
+#define SOFT_LIMIT_STORAGE_SIZE 16106127360
+#define HARD_LIMIT_STORAGE_SIZE 32212254720
+
+typedef struct _storage_account storage_account_t;
+
+// returns the account for the given stream, creating it if necessary
+extern storage_account_t* storage_account(stream_info_t *stream_info);
+
+// record bytes inserted into the stream's database of today
+extern void storage_add_bytes(stream_info_t *stream_info, size_t bytes);
+
+// record the storage size reported by mongodb
+extern void storage_set_measured_size(stream_info_t *stream_info, int64_t size);
+
+// decide whether to skip storing a sampled request
+extern bool storage_throttle_request(stream_info_t *stream_info);
+
+// refill token buckets and publish throttle rates
+extern void storage_tick();
+
+// forget all sizes, called when the date changes
+extern void storage_reset();
+
+extern void storage_test(int verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,7 @@
 #include "device-tracker.h"
 #include "statsd-client.h"
 #include "importer-prometheus-client.h"
+#include "importer-admission.h"
 
 /*
  * connections: n_s = num_subscribers, n_w = num_writers, n_p = num_parsers, "[<>^v]" = connect, "o" = bind
@@ -41,10 +42,28 @@ typedef struct {
     size_t message_gap_size;                  // messages missed due to gaps in the stream (since last tick)
     size_t message_drops;                     // messages dropped because push_socket wasn't ready (since last tick)
     size_t message_blocks;                    // how often the subscriber blocked on the push_socket (since last tick)
+    size_t message_sheds;                     // messages shed by admission control (since last tick)
     zlist_t *subscriptions;                   // current subscriptions, NULL if socket has not been subscribed before
     statsd_client_t *statsd_client;
+    importer_counters_t *counters;            // prometheus counters, owned by this thread
+    zhash_t *stream_admissions;               // admission state of configured streams, unknown_stream for others
+    uint32_t stream_admissions_version;       // stream config version stream_admissions was built from
+    size_t unknown_stream_admissions;         // number of unknown stream entries in stream_admissions
+    uint64_t unknown_streams_sampled;         // sampling state shared by all unknown streams
+    zchunk_t *decompression_buffer;           // used to look for errors in sampled requests
 } subscriber_state_t;
 
+typedef struct {
+    uint64_t sampled;                         // per stream sampling state
+    importer_counters_t *counters;            // shed counts of the stream
+} stream_admission_t;
+
+// negative cache entry for stream names without a stream config
+static stream_admission_t unknown_stream;
+
+// don't let bogus stream names grow the admission cache without bounds
+#define MAX_UNKNOWN_STREAM_ADMISSIONS 1024
+
 
 static
 zlist_t* extract_devices_from_config(zconfig_t* config)
@@ -166,6 +185,10 @@ int process_meta_information_and_handle_heartbeat(subscriber_state_t *state, zms
             fprintf(stderr, "[E] subscriber[%zu]: received invalid meta info\n", state->id);
         return is_heartbeat;
     }
+    if (!is_heartbeat && meta.created_ms > 0) {
+        int64_t lag_ms = zclock_time() - (int64_t)meta.created_ms;
+        importer_prometheus_client_observe_device_lag(state->id, lag_ms > 0 ? lag_ms / 1000.0 : 0);
+    }
     if (meta.device_number == 0) {
         // ignore device number 0
         state->messages_dev_zero++;
@@ -182,14 +205,89 @@ int process_meta_information_and_handle_heartbeat(subscriber_state_t *state, zms
     return is_heartbeat;
 }
 
+static
+stream_admission_t* subscriber_stream_admission(subscriber_state_t *state, zframe_t *stream_frame)
+{
+    size_t n = zframe_size(stream_frame);
+    char stream_name[n+1];
+    memcpy(stream_name, zframe_data(stream_frame), n);
+    stream_name[n] = '\0';
+
+    // forget cached entries when the stream config has been reloaded
+    uint32_t version = get_stream_config_version();
+    if (version != state->stream_admissions_version) {
+        zhash_destroy(&state->stream_admissions);
+        state->stream_admissions = zhash_new();
+        state->stream_admissions_version = version;
+        state->unknown_stream_admissions = 0;
+    }
+
+    stream_admission_t *admission = zhash_lookup(state->stream_admissions, stream_name);
+    if (admission)
+        return admission == &unknown_stream ? NULL : admission;
+
+    // don't let bogus stream names create new time series
+    stream_info_t *stream_info = get_stream_info(stream_name, NULL);
+    if (stream_info == NULL) {
+        if (state->unknown_stream_admissions < MAX_UNKNOWN_STREAM_ADMISSIONS) {
+            zhash_insert(state->stream_admissions, stream_name, &unknown_stream);
+            state->unknown_stream_admissions++;
+        }
+        return NULL;
+    }
+    release_stream_info(stream_info);
+
+    admission = zmalloc(sizeof(*admission));
+    admission->counters = importer_prometheus_client_shed_counters(state->id, stream_name);
+    zhash_insert(state->stream_admissions, stream_name, admission);
+    zhash_freefn(state->stream_admissions, stream_name, free);
+    return admission;
+}
+
+static
+bool admit_message(subscriber_state_t *state, zmsg_t *msg)
+{
+    int level = admission_load_level();
+    if (level == 0)
+        return true;
+
+    zframe_t *stream_frame = zmsg_first(msg);
+    zframe_t *topic_frame = zmsg_next(msg);
+    zframe_t *body_frame = zmsg_next(msg);
+    zframe_t *meta_frame = zmsg_next(msg);
+
+    int compression_method = NO_COMPRESSION;
+    msg_meta_t meta;
+    if (meta_frame && frame_extract_meta_info(meta_frame, &meta))
+        compression_method = meta.compression_method;
+
+    stream_admission_t *admission = subscriber_stream_admission(state, stream_frame);
+    uint64_t *sampled = admission ? &admission->sampled : &state->unknown_streams_sampled;
+    admission_reason_t reason = admission_check(level, topic_frame, body_frame, compression_method, sampled, state->decompression_buffer);
+    if (reason == ADMISSION_ACCEPT)
+        return true;
+
+    importer_counter_t counter = reason == ADMISSION_SHED_FRONTEND ? IMPORTER_MSGS_SHED_FRONTEND : IMPORTER_MSGS_SHED_SAMPLED;
+    importer_counters_add(state->counters, counter, 1);
+    if (admission)
+        importer_counters_add(admission->counters, counter, 1);
+    if (!state->message_sheds++)
+        fprintf(stderr, "[W] subscriber[%zu]: parsers are falling behind. shedding load (%s)!\n",
+                state->id, admission_reason_to_string(reason));
+    return false;
+}
+
 static
 int read_request_and_forward(zloop_t *loop, zsock_t *socket, void *callback_data)
 {
     subscriber_state_t *state = callback_data;
     zmsg_t *msg = zmsg_recv(socket);
     if (msg) {
+        size_t bytes = zmsg_content_size(msg);
         state->message_count++;
-        state->message_bytes += zmsg_content_size(msg);
+        state->message_bytes += bytes;
+        importer_counters_add(state->counters, IMPORTER_MSGS_RECEIVED, 1);
+        importer_counters_add(state->counters, IMPORTER_BYTES_RECEIVED, bytes);
         // printf("[D] received messsage size: %zu\n", zmsg_content_size(msg));
         int n = zmsg_size(msg);
         if (n < 3 || n > 4) {
@@ -203,16 +301,27 @@ int read_request_and_forward(zloop_t *loop, zsock_t *socket, void *callback_data
                 zmsg_destroy(&msg);
                 return 0;
             }
+            zmsg_add_receive_time(msg);
         }
 
-        if (!output_socket_ready(state->push_socket, 0) && !state->message_blocks++)
-            fprintf(stderr, "[W] subscriber[%zu]: push socket not ready. blocking!\n", state->id);
+        if (!admit_message(state, msg)) {
+            zmsg_destroy(&msg);
+            return 0;
+        }
+
+        if (!output_socket_ready(state->push_socket, 0)) {
+            importer_counters_add(state->counters, IMPORTER_MSGS_BLOCKED, 1);
+            if (!state->message_blocks++)
+                fprintf(stderr, "[W] subscriber[%zu]: push socket not ready. blocking!\n", state->id);
+        }
 
         int rc = zmsg_send_and_destroy(&msg, state->push_socket);
         if (rc) {
+            importer_counters_add(state->counters, IMPORTER_MSGS_DROPPED, 1);
             if (!state->message_drops++)
                 fprintf(stderr, "[E] subscriber[%zu]: dropped message on push socket (%d: %s)\n", state->id, errno, zmq_strerror(errno));
-        }
+        } else
+            admission_msg_queued();
     }
     return 0;
 }
@@ -225,8 +334,11 @@ int read_router_request_forward(zloop_t *loop, zsock_t *socket, void *callback_d
     assert(msg);
     bool ok = true;
     bool is_ping = false;
+    size_t bytes = zmsg_content_size(msg);
     state->message_count++;
-    state->message_bytes += zmsg_content_size(msg);
+    state->message_bytes += bytes;
+    importer_counters_add(state->counters, IMPORTER_MSGS_RECEIVED, 1);
+    importer_counters_add(state->counters, IMPORTER_BYTES_RECEIVED, bytes);
 
     // pop the sender id added by the router socket
     zframe_t *sender_id = zmsg_pop(msg);
@@ -260,16 +372,26 @@ int read_router_request_forward(zloop_t *loop, zsock_t *socket, void *callback_d
         is_ping = zframe_streq(zmsg_first(msg), "ping");
         if (is_ping)
             goto answer;
+        zmsg_add_receive_time(msg);
     }
 
-    if (!output_socket_ready(state->push_socket, 0) && !state->message_blocks++)
-        fprintf(stderr, "[W] subscriber[%zu]: push socket not ready. blocking!\n", state->id);
+    // shed messages are accepted as far as the producer is concerned
+    if (!admit_message(state, msg))
+        goto answer;
+
+    if (!output_socket_ready(state->push_socket, 0)) {
+        importer_counters_add(state->counters, IMPORTER_MSGS_BLOCKED, 1);
+        if (!state->message_blocks++)
+            fprintf(stderr, "[W] subscriber[%zu]: push socket not ready. blocking!\n", state->id);
+    }
 
     int rc = zmsg_send_and_destroy(&msg, state->push_socket);
     if (rc) {
+        importer_counters_add(state->counters, IMPORTER_MSGS_DROPPED, 1);
         if (!state->message_drops++)
             fprintf(stderr, "[E] subscriber[%zu]: dropped message on push socket (%d: %s)\n", state->id, errno, zmq_strerror(errno));
-    }
+    } else
+        admission_msg_queued();
  answer:
     zmsg_destroy(&msg);
     if (reply) {
@@ -289,6 +411,13 @@ int read_router_request_forward(zloop_t *loop, zsock_t *socket, void *callback_d
     return 0;
 }
 
+static
+void record_device_stats(uint32_t device_number, const device_stats_t *stats, void *arg)
+{
+    subscriber_state_t *state = arg;
+    importer_device_stats_add(importer_prometheus_client_device_stats(state->id, device_number), stats);
+}
+
 static
 int actor_command(zloop_t *loop, zsock_t *socket, void *callback_data)
 {
@@ -304,22 +433,19 @@ int actor_command(zloop_t *loop, zsock_t *socket, void *callback_data)
         }
         else if (streq(cmd, "tick")) {
             printf("[I] subscriber[%zu]: %5zu messages"
-                   "(size: %.2fMB, gap_size: %zu, no_info: %zu, dev_zero: %zu, blocks: %zu, drops: %zu)\n",
+                   "(size: %.2fMB, gap_size: %zu, no_info: %zu, dev_zero: %zu, blocks: %zu, drops: %zu, sheds: %zu)\n",
                    state->id,
                    state->message_count, (double)state->message_bytes / 1048576,
                    state->message_gap_size, state->meta_info_failures,
-                   state->messages_dev_zero, state->message_blocks, state->message_drops);
+                   state->messages_dev_zero, state->message_blocks, state->message_drops, state->message_sheds);
             statsd_client_count(state->statsd_client, "subscriber.messsages.received.count", state->message_count);
             statsd_client_count(state->statsd_client, "subscriber.messsages.received.bytes", state->message_bytes);
             statsd_client_count(state->statsd_client, "subscriber.messsages.missed.count", state->message_gap_size);
             statsd_client_count(state->statsd_client, "subscriber.messsages.dropped.count", state->message_drops);
             statsd_client_count(state->statsd_client, "subscriber.messsages.blocked.count", state->message_blocks);
-            importer_prometheus_client_count_msgs_received(state->message_count);
-            importer_prometheus_client_count_bytes_received(state->message_bytes);
+            statsd_client_count(state->statsd_client, "subscriber.messsages.shed.count", state->message_sheds);
             importer_prometheus_client_count_msgs_missed(state->message_gap_size);
-            importer_prometheus_client_count_msgs_dropped(state->message_drops);
-            importer_prometheus_client_count_msgs_blocked(state->message_blocks);
-            importer_prometheus_client_record_rusage_subscriber(state->id);
+            device_tracker_flush_stats(state->tracker, record_device_stats, state);
             state->message_count = 0;
             state->message_bytes = 0;
             state->message_gap_size = 0;
@@ -327,6 +453,7 @@ int actor_command(zloop_t *loop, zsock_t *socket, void *callback_data)
             state->messages_dev_zero = 0;
             state->message_drops = 0;
             state->message_blocks = 0;
+            state->message_sheds = 0;
             if (++ticks % HEART_BEAT_INTERVAL == 0)
                 device_tracker_reconnect_stale_devices(state->tracker);
         } else {
@@ -365,6 +492,9 @@ subscriber_state_t* subscriber_state_new(zconfig_t* config, size_t id, zlist_t *
     }
     state->push_socket = subscriber_push_socket_new(config, state->id);
     state->statsd_client = statsd_client_new(config, state->me);
+    state->stream_admissions = zhash_new();
+    state->stream_admissions_version = get_stream_config_version();
+    state->decompression_buffer = zchunk_new(NULL, INITIAL_DECOMPRESSION_BUFFER_SIZE);
     return state;
 }
 
@@ -380,6 +510,8 @@ void subscriber_state_destroy(subscriber_state_t **state_p)
     zsock_destroy(&state->push_socket);
     device_tracker_destroy(&state->tracker);
     statsd_client_destroy(&state->statsd_client);
+    zhash_destroy(&state->stream_admissions);
+    zchunk_destroy(&state->decompression_buffer);
     *state_p = NULL;
 }
 
@@ -448,6 +580,7 @@ int timer_function(zloop_t *loop, int timer_id, void* arg)
     subscriber_state_t *state = (subscriber_state_t*)args;
     state->pipe = pipe;
     set_thread_name(state->me);
+    state->counters = importer_prometheus_client_register_subscriber(state->id);
     size_t id = state->id;
     int rc;
 
@@ -474,6 +607,10 @@ int timer_function(zloop_t *loop, int timer_id, void* arg)
     rc = zloop_reader(loop, state->sub_socket, read_request_and_forward, state);
     assert(rc == 0);
 
+    // setup handler for reconnects of stale devices
+    rc = device_tracker_register_reconnects(state->tracker, loop);
+    assert(rc == 0);
+
     if (state->id == 0) {
         // setup handler for the router socket
         rc = zloop_reader(loop, state->router_socket, read_router_request_forward, state);
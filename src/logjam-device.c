@@ -11,6 +11,7 @@
 #include "message-compressor.h"
 #include "importer-watchdog.h"
 #include "device-prometheus-client.h"
+#include "device-traffic.h"
 
 // shared globals
 bool verbose = false;
@@ -28,25 +29,28 @@ static int router_port = 9604;
 static int pull_port = 9605;
 static int pub_port = 9606;
 
-static size_t received_messages_count = 0;
-static size_t received_messages_bytes = 0;
-static size_t received_messages_max_bytes = 0;
-
-static size_t compressed_messages_count = 0;
-static size_t compressed_messages_bytes = 0;
-static size_t compressed_messages_max_bytes = 0;
-
 static size_t io_threads = 1;
 static size_t num_compressors = 4;
 
-static msg_meta_t msg_meta = META_INFO_EMPTY;
+// in sharded mode, each worker owns its sockets and sequence space
+#define MAX_WORKERS 64   // must fit into WORKER_INDEX_BITS
+#define WORKER_PORT_STRIDE 10
+// worker device numbers have bit 31 set, followed by the device id and the
+// worker index, so they can't collide with the numbers of unsharded devices
+#define WORKER_DEVICE_NUMBER_BASE 0x80000000U
+#define WORKER_INDEX_BITS 6
+#define MAX_SHARDED_DEVICE_NUMBER ((WORKER_DEVICE_NUMBER_BASE >> WORKER_INDEX_BITS) - 1)
+static size_t num_workers = 1;
+
+static uint32_t device_number = 0;
 static char device_number_s[11] = {'0', 0};
 
+// how many router messages are handled per event loop iteration
+#define ROUTER_BATCH_SIZE 128
+
 #define MAX_COMPRESSORS 64
 static zactor_t *compressors[MAX_COMPRESSORS];
 static int compression_method = NO_COMPRESSION;
-static zchunk_t *compression_buffer;
-static uint64_t global_time = 0;
 
 static zactor_t *device_watchdog = NULL;
 
@@ -55,79 +59,190 @@ char metrics_address[256] = {0};
 const char *metrics_ip = "0.0.0.0";
 
 typedef struct {
+    size_t id;
+    bool sharded;
+    int pull_port;
+    int router_port;
+    int pub_port;
+    zsock_t *receiver_socket;
+    zsock_t *router_receiver_socket;
+    zsock_t *publisher_socket;
+    zsock_t *compressor_input_socket;
+    zsock_t *compressor_output_socket;
     // raw zmq sockets, to avoid zsock_resolve
     void *receiver;
     void *router_receiver;
-    void *router_output;
     void *publisher;
     void *compressor_input;
     void *compressor_output;
+    // compresses messages in this thread when there are no compressor actors
+    zchunk_t *compression_buffer;
+    msg_meta_t msg_meta;
+    uint64_t global_time;
+    size_t ticks;
+    size_t received_messages_count;
+    size_t received_messages_bytes;
+    size_t received_messages_max_bytes;
+    size_t compressed_messages_count;
+    size_t compressed_messages_bytes;
+    size_t compressed_messages_max_bytes;
+    size_t last_received_count;
+    size_t last_received_bytes;
+    size_t last_compressed_count;
+    size_t last_compressed_bytes;
+    device_traffic_t *stream_traffic;
+    device_traffic_t *topic_traffic;
 } publisher_state_t;
 
+static publisher_state_t *publisher_states[MAX_WORKERS];
 
-static int timer_event(zloop_t *loop, int timer_id, void *arg)
+
+static void export_stream_traffic(const char *stream, uint64_t msgs, uint64_t bytes, void *arg)
+{
+    device_prometheus_client_count_stream(stream, msgs, bytes);
+}
+
+static void export_topic_traffic(const char *topic, uint64_t msgs, uint64_t bytes, void *arg)
 {
-    zsock_t* pub_socket = arg;
+    device_prometheus_client_count_topic(topic, msgs, bytes);
+}
 
-    static size_t last_received_count   = 0;
-    static size_t last_received_bytes   = 0;
-    static size_t last_compressed_count = 0;
-    static size_t last_compressed_bytes = 0;
+static int timer_event(zloop_t *loop, int timer_id, void *arg)
+{
+    publisher_state_t *state = arg;
 
-    size_t message_count    = received_messages_count - last_received_count;
-    size_t message_bytes    = received_messages_bytes - last_received_bytes;
-    size_t compressed_count = compressed_messages_count - last_compressed_count;
-    size_t compressed_bytes = compressed_messages_bytes - last_compressed_bytes;
+    size_t message_count    = state->received_messages_count - state->last_received_count;
+    size_t message_bytes    = state->received_messages_bytes - state->last_received_bytes;
+    size_t compressed_count = state->compressed_messages_count - state->last_compressed_count;
+    size_t compressed_bytes = state->compressed_messages_bytes - state->last_compressed_bytes;
 
     device_prometheus_client_count_msgs_received(message_count);
     device_prometheus_client_count_bytes_received(message_bytes);
     device_prometheus_client_count_msgs_compressed(compressed_count);
     device_prometheus_client_count_bytes_compressed(compressed_bytes);
-    device_prometheus_client_record_rusage();
+    device_traffic_tick(state->stream_traffic, export_stream_traffic, NULL);
+    device_traffic_tick(state->topic_traffic, export_topic_traffic, NULL);
+    if (state->sharded)
+        device_prometheus_client_record_rusage_worker(state->id);
+    else {
+        device_prometheus_client_expire_traffic();
+        device_prometheus_client_record_rusage();
+    }
 
     double avg_msg_size        = message_count ? (message_bytes / 1024.0) / message_count : 0;
-    double max_msg_size        = received_messages_max_bytes / 1024.0;
+    double max_msg_size        = state->received_messages_max_bytes / 1024.0;
     double avg_compressed_size = compressed_count ? (compressed_bytes / 1024.0) / compressed_count : 0;
-    double max_compressed_size = compressed_messages_max_bytes / 1024.0;
+    double max_compressed_size = state->compressed_messages_max_bytes / 1024.0;
+
+    char prefix[32] = "";
+    if (state->sharded)
+        snprintf(prefix, sizeof(prefix), "worker[%zu]: ", state->id);
 
-    printf("[I] processed %zu messages (%.2f KB), avg: %.2f KB, max: %.2f KB\n",
-           message_count, message_bytes/1024.0, avg_msg_size, max_msg_size);
+    printf("[I] %sprocessed %zu messages (%.2f KB), avg: %.2f KB, max: %.2f KB\n",
+           prefix, message_count, message_bytes/1024.0, avg_msg_size, max_msg_size);
 
-    printf("[I] compressd %zu messages (%.2f KB), avg: %.2f KB, max: %.2f KB\n",
-           compressed_count, compressed_bytes/1024.0, avg_compressed_size, max_compressed_size);
+    printf("[I] %scompressd %zu messages (%.2f KB), avg: %.2f KB, max: %.2f KB\n",
+           prefix, compressed_count, compressed_bytes/1024.0, avg_compressed_size, max_compressed_size);
 
-    last_received_count = received_messages_count;
-    last_received_bytes = received_messages_bytes;
-    received_messages_max_bytes = 0;
-    last_compressed_count = compressed_messages_count;
-    last_compressed_bytes = compressed_messages_bytes;
-    compressed_messages_max_bytes = 0;
+    state->last_received_count = state->received_messages_count;
+    state->last_received_bytes = state->received_messages_bytes;
+    state->received_messages_max_bytes = 0;
+    state->last_compressed_count = state->compressed_messages_count;
+    state->last_compressed_bytes = state->compressed_messages_bytes;
+    state->compressed_messages_max_bytes = 0;
 
     // update timestamp
-    global_time = zclock_time();
+    state->global_time = zclock_time();
 
-    static size_t ticks = 0;
+    // the main thread checks this to decide whether to tick the watchdog
+    size_t ticks = __atomic_add_fetch(&state->ticks, 1, __ATOMIC_RELAXED);
 
     // publish heartbeat
-    if (++ticks % HEART_BEAT_INTERVAL == 0) {
-        msg_meta.compression_method = NO_COMPRESSION;
-        msg_meta.sequence_number++;
-        msg_meta.created_ms = global_time;
+    if (ticks % HEART_BEAT_INTERVAL == 0) {
+        state->msg_meta.compression_method = NO_COMPRESSION;
+        state->msg_meta.sequence_number++;
+        state->msg_meta.created_ms = state->global_time;
         if (verbose)
-            printf("[I] sending heartbeat\n");
-        send_heartbeat(pub_socket, &msg_meta, pub_port);
+            printf("[I] %ssending heartbeat\n", prefix);
+        send_heartbeat(state->publisher_socket, &state->msg_meta, state->pub_port);
     }
 
-    // tick compressors
-    for (size_t i = 0; i < num_compressors; i++)
-        zstr_send(compressors[i], "tick");
+    if (!state->sharded) {
+        // tick compressors
+        for (size_t i = 0; i < num_compressors; i++)
+            zstr_send(compressors[i], "tick");
 
-    // tick watchdog
-    zstr_send(device_watchdog, "tick");
+        // tick watchdog
+        zstr_send(device_watchdog, "tick");
+    }
 
     return 0;
 }
 
+static void compress_body(publisher_state_t *state, zmq_msg_t *body)
+{
+    zmq_msg_t compressed;
+    zmq_msg_init(&compressed);
+    compress_message_data(compression_method, state->compression_buffer, &compressed, zmq_msg_data(body), zmq_msg_size(body));
+    zmq_msg_move(body, &compressed);
+    zmq_msg_close(&compressed);
+
+    size_t msg_bytes = zmq_msg_size(body);
+    state->compressed_messages_count++;
+    state->compressed_messages_bytes += msg_bytes;
+    if (msg_bytes > state->compressed_messages_max_bytes)
+        state->compressed_messages_max_bytes = msg_bytes;
+}
+
+// count and publish a message consisting of app-env, topic, body and optional
+// meta frames. uncompressed messages take a detour through the compressors,
+// or get compressed right here in sharded mode.
+static void forward_message(publisher_state_t *state, zmq_msg_t *message_parts, int n, bool compressed)
+{
+    zmq_msg_t *body = &message_parts[2];
+    msg_meta_t meta = META_INFO_EMPTY;
+    if (n==4)
+        zmq_msg_extract_meta_info(&message_parts[3], &meta);
+
+    // const char *prefix = compressed ? "EXTERNAL MESSAGE" : "INTERNAL MESSAGE";
+    // my_zmq_msg_fprint(&message_parts[0], 3, prefix, stdout);
+    // dump_meta_info(&meta);
+
+    if (meta.created_ms)
+        state->msg_meta.created_ms = meta.created_ms;
+    else
+        state->msg_meta.created_ms = state->global_time;
+
+    size_t msg_bytes = zmq_msg_size(body);
+    if (compressed) {
+        state->compressed_messages_count++;
+        state->compressed_messages_bytes += msg_bytes;
+        if (msg_bytes > state->compressed_messages_max_bytes)
+            state->compressed_messages_max_bytes = msg_bytes;
+    } else {
+        state->received_messages_count++;
+        state->received_messages_bytes += msg_bytes;
+        if (msg_bytes > state->received_messages_max_bytes)
+            state->received_messages_max_bytes = msg_bytes;
+        device_traffic_add(state->stream_traffic, zmq_msg_data(&message_parts[0]), zmq_msg_size(&message_parts[0]), msg_bytes);
+        device_traffic_add(state->topic_traffic, zmq_msg_data(&message_parts[1]), zmq_msg_size(&message_parts[1]), msg_bytes);
+    }
+
+    if (compression_method && !meta.compression_method) {
+        if (state->compressor_input) {
+            publish_on_zmq_transport(&message_parts[0], state->compressor_input, &state->msg_meta, 0);
+            return;
+        }
+        compress_body(state, body);
+        meta.compression_method = compression_method;
+    }
+    state->msg_meta.compression_method = meta.compression_method;
+    state->msg_meta.sequence_number++;
+    // my_zmq_msg_fprint(&message_parts[0], 3, "OUT", stdout);
+    // dump_meta_info(&state->msg_meta);
+    publish_on_zmq_transport(&message_parts[0], state->publisher, &state->msg_meta, ZMQ_DONTWAIT);
+}
+
 static int read_zmq_message_and_forward(zloop_t *loop, zsock_t *sock, void *callback_data)
 {
     int i = 0;
@@ -161,42 +276,7 @@ static int read_zmq_message_and_forward(zloop_t *loop, zsock_t *sock, void *call
         goto cleanup;
     }
 
-    zmq_msg_t *body = &message_parts[2];
-    msg_meta_t meta = META_INFO_EMPTY;
-    if (i==3)
-        zmq_msg_extract_meta_info(&message_parts[3], &meta);
-
-    // const char *prefix = socket == state->compressor_output ? "EXTERNAL MESSAGE" : "INTERNAL MESSAGE";
-    // my_zmq_msg_fprint(&message_parts[0], 3, prefix, stdout);
-    // dump_meta_info(&meta);
-
-    if (meta.created_ms)
-        msg_meta.created_ms = meta.created_ms;
-    else
-        msg_meta.created_ms = global_time;
-
-    size_t msg_bytes = zmq_msg_size(body);
-    if (socket == state->compressor_output) {
-        compressed_messages_count++;
-        compressed_messages_bytes += msg_bytes;
-        if (msg_bytes > compressed_messages_max_bytes)
-            compressed_messages_max_bytes = msg_bytes;
-    } else {
-        received_messages_count++;
-        received_messages_bytes += msg_bytes;
-        if (msg_bytes > received_messages_max_bytes)
-            received_messages_max_bytes = msg_bytes;
-    }
-
-    if (compression_method && !meta.compression_method) {
-        publish_on_zmq_transport(&message_parts[0], state->compressor_input, &msg_meta, 0);
-    } else {
-        msg_meta.compression_method = meta.compression_method;
-        msg_meta.sequence_number++;
-        // my_zmq_msg_fprint(&message_parts[0], 3, "OUT", stdout);
-        // dump_meta_info(&msg_meta);
-        publish_on_zmq_transport(&message_parts[0], state->publisher, &msg_meta, ZMQ_DONTWAIT);
-    }
+    forward_message(state, message_parts, i+1, socket == state->compressor_output);
 
  cleanup:
     for (;i>=0;i--) {
@@ -206,54 +286,102 @@ static int read_zmq_message_and_forward(zloop_t *loop, zsock_t *sock, void *call
     return 0;
 }
 
-static int read_router_message_and_forward(zloop_t *loop, zsock_t *socket, void *callback_data)
+typedef struct {
+    zmq_msg_t sender_id;
+    const char *status;
+    bool is_ping;
+} router_reply_t;
+
+static void send_router_replies(void *socket, router_reply_t *replies, int n)
+{
+    for (int i = 0; i < n; i++) {
+        router_reply_t *reply = &replies[i];
+        // ROUTER sockets never block: replies to unknown or slow peers are dropped
+        int rc = zmq_msg_send(&reply->sender_id, socket, ZMQ_SNDMORE);
+        if (rc != -1)
+            rc = zmq_send(socket, "", 0, ZMQ_SNDMORE);
+        if (rc != -1) {
+            if (reply->is_ping) {
+                rc = zmq_send(socket, reply->status, strlen(reply->status), ZMQ_SNDMORE);
+                if (rc != -1)
+                    rc = zmq_send(socket, my_fqdn(), strlen(my_fqdn()), 0);
+            } else
+                rc = zmq_send(socket, reply->status, strlen(reply->status), 0);
+        }
+        if (rc == -1)
+            fprintf(stderr, "[E] could not send response (%d: %s)\n", errno, zmq_strerror(errno));
+        zmq_msg_close(&reply->sender_id);
+    }
+}
+
+// reads up to ROUTER_BATCH_SIZE messages without returning to the event loop and
+// forwards them directly. replies are sent once the batch has been forwarded.
+static int read_router_message_and_forward(zloop_t *loop, zsock_t *sock, void *callback_data)
 {
     publisher_state_t *state = (publisher_state_t*)callback_data;
-    zmsg_t* msg = zmsg_recv(socket);
-    assert(msg);
+    void *socket = state->router_receiver;
+    router_reply_t replies[ROUTER_BATCH_SIZE];
+    int num_replies = 0;
+
+    for (int batch = 0; batch < ROUTER_BATCH_SIZE && !zsys_interrupted; batch++) {
+        router_reply_t *reply = &replies[num_replies];
+        zmq_msg_init(&reply->sender_id);
+        if (zmq_msg_recv(&reply->sender_id, socket, batch ? ZMQ_DONTWAIT : 0) == -1) {
+            zmq_msg_close(&reply->sender_id);
+            break;
+        }
 
-    zframe_t *sender_id = zmsg_pop(msg);
-    zframe_t *empty = zmsg_first(msg);
+        // optional empty delimiter followed by app-env, topic, body and meta
+        zmq_msg_t frames[5];
+        int n = 0, dropped = 0;
+        while (zsock_rcvmore(sock)) {
+            zmq_msg_t *frame = &frames[n < 5 ? n : 4];
+            if (n == 5) {
+                zmq_msg_close(frame);
+                dropped++;
+            } else
+                n++;
+            zmq_msg_init(frame);
+            zmq_msg_recv(frame, socket, 0);
+        }
 
-    // if the second frame is empty, we need to send a reply
-    if (zframe_size(empty) > 0)
-        zframe_destroy(&sender_id);
-    else {
-        // pop the empty frame
-        empty = zmsg_pop(msg);
-        zmsg_t *reply = zmsg_new();
-        zmsg_append(reply, &sender_id);
-        zmsg_append(reply, &empty);
-
-        // return bad request if we don't receive 4 frames and meta frame can't be decoded
-        size_t n = zmsg_size(msg);
-        msg_meta_t meta;
-        bool decodable = n==4 && msg_extract_meta_info(msg, &meta);
-
-        zframe_t *app_env = zmsg_first(msg);
-        bool is_ping = zframe_streq(app_env, "ping");
-        if (is_ping) {
-            if (decodable) {
-                zmsg_addstr(reply, "200 Pong");
-                zmsg_addstr(reply, my_fqdn());
+        // if the first frame is empty, we need to send a reply
+        bool wants_reply = n > 0 && zmq_msg_size(&frames[0]) == 0;
+        zmq_msg_t *message_parts = wants_reply ? frames + 1 : frames;
+        int num_parts = (wants_reply ? n - 1 : n) + dropped;
+        bool forward = true;
+
+        if (wants_reply) {
+            // return bad request if we don't receive 4 frames and meta frame can't be decoded
+            msg_meta_t meta;
+            bool decodable = num_parts==4 && zmq_msg_extract_meta_info(&message_parts[3], &meta);
+            reply->is_ping = num_parts > 0 && zmq_msg_size(&message_parts[0]) == 4
+                && !memcmp(zmq_msg_data(&message_parts[0]), "ping", 4);
+            if (reply->is_ping) {
+                reply->is_ping = decodable;
+                reply->status = decodable ? "200 Pong" : "400 Bad Request";
+                // don't forward pings
+                forward = false;
             } else
-                zmsg_addstr(reply, "400 Bad Request");
+                reply->status = decodable ? "202 Accepted" : "400 Bad Request";
+            num_replies++;
         } else
-            zmsg_addstr(reply, decodable ? "202 Accepted" : "400 Bad Request");
+            zmq_msg_close(&reply->sender_id);
 
-        int rc = zmsg_send_and_destroy(&reply, socket);
-        if (rc)
-            fprintf(stderr, "[E] could not send response (%d: %s)\n", errno, zmq_strerror(errno));
+        if (forward) {
+            if (num_parts < 3)
+                fprintf(stderr, "[E] received only %d message parts\n", num_parts);
+            else if (num_parts > 4)
+                fprintf(stderr, "[E] received more than 4 message parts\n");
+            else
+                forward_message(state, message_parts, num_parts, false);
+        }
 
-        // don't forward pings
-        if (is_ping) return 0;
+        for (int i = 0; i < n; i++)
+            zmq_msg_close(&frames[i]);
     }
 
-    // put message back on to the event loop
-    // TODO: this is slow. refactor to forward directly.
-    int rc = zmsg_send_and_destroy(&msg, state->router_output);
-    if (rc)
-        fprintf(stderr, "[E] could not forward router message (%d: %s)\n", errno, zmq_strerror(errno));
+    send_router_replies(socket, replies, num_replies);
 
     return 0;
 }
@@ -270,6 +398,7 @@ static void print_usage(char * const *argv)
             "  -s, --compressors N        number of compressor threads\n"
             "  -t, --router-port N        port number of zeromq router socket\n"
             "  -v, --verbose              log more (use -vv for debug output)\n"
+            "  -w, --workers N            number of ingest workers (sharded mode if > 1)\n"
             "  -x, --compress M           compress logjam traffic using (snappy|zlib)\n"
             "  -P, --output-port N        port number of zeromq ouput socket\n"
             "  -R, --rcv-hwm N            high watermark for input socket\n"
@@ -302,12 +431,13 @@ static void process_arguments(int argc, char * const *argv)
         { "rcv-hwm",       required_argument, 0, 'R' },
         { "snd-hwm",       required_argument, 0, 'S' },
         { "verbose",       no_argument,       0, 'v' },
+        { "workers",       required_argument, 0, 'w' },
         { "metrics-port",  required_argument, 0, 'm' },
         { "metrics-ip",    required_argument, 0, 'M' },
         { 0,               0,                 0,  0  }
     };
 
-    while ((c = getopt_long(argc, argv, "vqd:p:c:i:x:s:P:S:R:t:m:M:", long_options, &longindex)) != -1) {
+    while ((c = getopt_long(argc, argv, "vqd:p:c:i:x:s:P:S:R:t:m:M:w:", long_options, &longindex)) != -1) {
         switch (c) {
         case 'v':
             if (verbose)
@@ -319,8 +449,8 @@ static void process_arguments(int argc, char * const *argv)
             quiet = true;
             break;
         case 'd':
-            msg_meta.device_number = atoi(optarg);
-            snprintf(device_number_s, sizeof(device_number_s), "%d", msg_meta.device_number);
+            device_number = atoi(optarg);
+            snprintf(device_number_s, sizeof(device_number_s), "%d", device_number);
             break;
         case 'p':
             pull_port = atoi(optarg);
@@ -348,6 +478,15 @@ static void process_arguments(int argc, char * const *argv)
         case 't':
             router_port = atoi(optarg);
             break;
+        case 'w':
+            num_workers = atoi(optarg);
+            if (num_workers == 0)
+                num_workers = 1;
+            if (num_workers > MAX_WORKERS) {
+                num_workers = MAX_WORKERS;
+                printf("[I] number of workers reduced to %d\n", MAX_WORKERS);
+            }
+            break;
         case 'x':
             compression_method = string_to_compression_method(optarg);
             if (compression_method)
@@ -364,7 +503,7 @@ static void process_arguments(int argc, char * const *argv)
             exit(0);
             break;
         case '?':
-            if (strchr("dpcixsPSRt", optopt))
+            if (strchr("dpcixsPSRtw", optopt))
                 fprintf(stderr, "option -%c requires an argument.\n", optopt);
             else if (isprint (optopt))
                 fprintf(stderr, "unknown option `-%c'.\n", optopt);
@@ -378,6 +517,15 @@ static void process_arguments(int argc, char * const *argv)
         }
     }
 
+    if (device_number >= WORKER_DEVICE_NUMBER_BASE) {
+        fprintf(stderr, "[E] device numbers from %u upwards are reserved for workers\n", WORKER_DEVICE_NUMBER_BASE);
+        exit(1);
+    }
+    if (num_workers > 1 && device_number > MAX_SHARDED_DEVICE_NUMBER) {
+        fprintf(stderr, "[E] device number must not exceed %u when running several workers\n", MAX_SHARDED_DEVICE_NUMBER);
+        exit(1);
+    }
+
     if (rcv_hwm == -1) {
         if (( v = getenv("LOGJAM_RCV_HWM") ))
             rcv_hwm = atoi(v);
@@ -393,131 +541,127 @@ static void process_arguments(int argc, char * const *argv)
     }
 }
 
-int main(int argc, char * const *argv)
+static publisher_state_t* publisher_state_new(size_t id, bool sharded)
 {
-    int rc = 0;
-    process_arguments(argc, argv);
-
-    setvbuf(stdout, NULL, _IOLBF, 0);
-    setvbuf(stderr, NULL, _IOLBF, 0);
-
-    printf("[I] started %s\n"
-           "[I] pull-port:   %d\n"
-           "[I] pub-port:    %d\n"
-           "[I] router-port: %d\n"
-           "[I] io-threads:  %lu\n"
-           "[I] rcv-hwm:     %d\n"
-           "[I] snd-hwm:     %d\n"
-           , argv[0], pull_port, pub_port, router_port, io_threads, rcv_hwm, snd_hwm);
-
-    // set global config
-    zsys_init();
-    zsys_set_rcvhwm(10000);
-    zsys_set_sndhwm(10000);
-    zsys_set_pipehwm(1000);
-    zsys_set_linger(100);
-    zsys_set_io_threads(io_threads);
-
-    compression_buffer = zchunk_new(NULL, INITIAL_COMPRESSION_BUFFER_SIZE);
-
-    // initalize prometheus client
-    snprintf(metrics_address, sizeof(metrics_address), "%s:%d", metrics_ip, metrics_port);
-    device_prometheus_client_init(metrics_address, device_number_s, num_compressors);
+    int rc;
+    publisher_state_t *state = zmalloc(sizeof(*state));
+    state->id = id;
+    state->sharded = sharded;
+    state->pull_port = pull_port + id * WORKER_PORT_STRIDE;
+    state->router_port = router_port + id * WORKER_PORT_STRIDE;
+    state->pub_port = pub_port + id * WORKER_PORT_STRIDE;
+    state->msg_meta = (msg_meta_t) META_INFO_EMPTY;
+    state->msg_meta.device_number = sharded
+        ? WORKER_DEVICE_NUMBER_BASE | device_number << WORKER_INDEX_BITS | id
+        : device_number;
+    state->global_time = zclock_time();
+    state->stream_traffic = device_traffic_new();
+    state->topic_traffic = device_traffic_new();
 
     // create socket to receive messages on
-    zsock_t *receiver = zsock_new(ZMQ_PULL);
-    assert_x(receiver != NULL, "zmq socket creation failed", __FILE__, __LINE__);
+    state->receiver_socket = zsock_new(ZMQ_PULL);
+    assert_x(state->receiver_socket != NULL, "zmq socket creation failed", __FILE__, __LINE__);
 
     //  configure the socket
-    zsock_set_rcvhwm(receiver, rcv_hwm);
+    zsock_set_rcvhwm(state->receiver_socket, rcv_hwm);
 
     // bind externally
-    rc = zsock_bind(receiver, "tcp://%s:%d", "*", pull_port);
-    assert_x(rc == pull_port, "receiver socket: external bind failed", __FILE__, __LINE__);
-
-    // bind internally
-    rc = zsock_bind(receiver, "inproc://receiver");
-    assert_x(rc != -1, "receiver socket: internal bind failed", __FILE__, __LINE__);
+    rc = zsock_bind(state->receiver_socket, "tcp://%s:%d", "*", state->pull_port);
+    assert_x(rc == state->pull_port, "receiver socket: external bind failed", __FILE__, __LINE__);
 
     // create and bind socket for receiving logjam messages
-    zsock_t *router_receiver = zsock_new(ZMQ_ROUTER);
-    assert_x(router_receiver != NULL, "zmq socket creation failed", __FILE__, __LINE__);
-    rc = zsock_bind(router_receiver, "tcp://%s:%d", "*", router_port);
-    assert_x(rc == router_port, "receiver socket: external bind failed", __FILE__, __LINE__);
-
-    // create router output socket and connect to the inproc receiver
-    zsock_t *router_output = zsock_new(ZMQ_PUSH);
-    assert_x(router_output != NULL, "zmq socket creation failed", __FILE__, __LINE__);
-    rc = zsock_connect(router_output, "inproc://receiver");
-    assert(rc == 0);
+    state->router_receiver_socket = zsock_new(ZMQ_ROUTER);
+    assert_x(state->router_receiver_socket != NULL, "zmq socket creation failed", __FILE__, __LINE__);
+    rc = zsock_bind(state->router_receiver_socket, "tcp://%s:%d", "*", state->router_port);
+    assert_x(rc == state->router_port, "receiver socket: external bind failed", __FILE__, __LINE__);
 
     // create socket for publishing
-    zsock_t *publisher = zsock_new(ZMQ_PUB);
-    assert_x(publisher != NULL, "publisher socket creation failed", __FILE__, __LINE__);
-    zsock_set_sndhwm(publisher, snd_hwm);
+    state->publisher_socket = zsock_new(ZMQ_PUB);
+    assert_x(state->publisher_socket != NULL, "publisher socket creation failed", __FILE__, __LINE__);
+    zsock_set_sndhwm(state->publisher_socket, snd_hwm);
 
-    rc = zsock_bind(publisher, "tcp://%s:%d", "*", pub_port);
-    assert_x(rc == pub_port, "publisher socket bind failed", __FILE__, __LINE__);
+    rc = zsock_bind(state->publisher_socket, "tcp://%s:%d", "*", state->pub_port);
+    assert_x(rc == state->pub_port, "publisher socket bind failed", __FILE__, __LINE__);
 
-    // create compressor sockets
-    zsock_t *compressor_input = zsock_new(ZMQ_PUSH);
-    assert_x(compressor_input != NULL, "compressor input socket creation failed", __FILE__, __LINE__);
-    rc = zsock_bind(compressor_input, "inproc://compressor-input");
-    assert_x(rc==0, "compressor input socket bind failed", __FILE__, __LINE__);
+    if (sharded) {
+        state->compression_buffer = zchunk_new(NULL, INITIAL_COMPRESSION_BUFFER_SIZE);
+    } else {
+        // create compressor sockets
+        state->compressor_input_socket = zsock_new(ZMQ_PUSH);
+        assert_x(state->compressor_input_socket != NULL, "compressor input socket creation failed", __FILE__, __LINE__);
+        rc = zsock_bind(state->compressor_input_socket, "inproc://compressor-input");
+        assert_x(rc==0, "compressor input socket bind failed", __FILE__, __LINE__);
+
+        state->compressor_output_socket = zsock_new(ZMQ_PULL);
+        assert_x(state->compressor_output_socket != NULL, "compressor output socket creation failed", __FILE__, __LINE__);
+        rc = zsock_bind(state->compressor_output_socket, "inproc://compressor-output");
+        assert_x(rc==0, "compressor output socket bind failed", __FILE__, __LINE__);
+
+        state->compressor_input = zsock_resolve(state->compressor_input_socket);
+        state->compressor_output = zsock_resolve(state->compressor_output_socket);
+    }
 
-    zsock_t *compressor_output = zsock_new(ZMQ_PULL);
-    assert_x(compressor_output != NULL, "compressor output socket creation failed", __FILE__, __LINE__);
-    rc = zsock_bind(compressor_output, "inproc://compressor-output");
-    assert_x(rc==0, "compressor output socket bind failed", __FILE__, __LINE__);
+    state->receiver = zsock_resolve(state->receiver_socket);
+    state->router_receiver = zsock_resolve(state->router_receiver_socket);
+    state->publisher = zsock_resolve(state->publisher_socket);
 
-    // create compressor agents
-    for (size_t i = 0; i < num_compressors; i++)
-        compressors[i] = message_compressor_new(i, compression_method, device_prometheus_client_record_rusage_compressor);
+    return state;
+}
 
-    // create watchdog
-    device_watchdog = zactor_new(watchdog, NULL);
+static void publisher_state_destroy(publisher_state_t **state_p)
+{
+    publisher_state_t *state = *state_p;
+    zsock_destroy(&state->receiver_socket);
+    zsock_destroy(&state->router_receiver_socket);
+    zsock_destroy(&state->publisher_socket);
+    zsock_destroy(&state->compressor_input_socket);
+    zsock_destroy(&state->compressor_output_socket);
+    zchunk_destroy(&state->compression_buffer);
+    device_traffic_destroy(&state->stream_traffic);
+    device_traffic_destroy(&state->topic_traffic);
+    free(state);
+    *state_p = NULL;
+}
+
+static zloop_t* publisher_loop_new(publisher_state_t *state)
+{
+    int rc;
 
     // set up event loop
     zloop_t *loop = zloop_new();
     assert(loop);
     zloop_set_verbose(loop, 0);
 
-    // setup publisher state
-    publisher_state_t publisher_state = {
-        .receiver = zsock_resolve(receiver),
-        .router_receiver = zsock_resolve(router_receiver),
-        .router_output = zsock_resolve(router_output),
-        .publisher = zsock_resolve(publisher),
-        .compressor_input = zsock_resolve(compressor_input),
-        .compressor_output = zsock_resolve(compressor_output),
-    };
-
     // calculate statistics every 1000 ms
-    int timer_id = zloop_timer(loop, 1000, 0, timer_event, publisher);
+    int timer_id = zloop_timer(loop, 1000, 0, timer_event, state);
     assert(timer_id != -1);
 
     // setup handler for compression results
-    rc = zloop_reader(loop, compressor_output, read_zmq_message_and_forward, &publisher_state);
-    assert(rc == 0);
-    zloop_reader_set_tolerant(loop, compressor_output);
+    if (state->compressor_output_socket) {
+        rc = zloop_reader(loop, state->compressor_output_socket, read_zmq_message_and_forward, state);
+        assert(rc == 0);
+        zloop_reader_set_tolerant(loop, state->compressor_output_socket);
+    }
 
     // setup handler for incoming messages (all from the outside)
-    rc = zloop_reader(loop, receiver, read_zmq_message_and_forward, &publisher_state);
+    rc = zloop_reader(loop, state->receiver_socket, read_zmq_message_and_forward, state);
     assert(rc == 0);
-    zloop_reader_set_tolerant(loop, receiver);
+    zloop_reader_set_tolerant(loop, state->receiver_socket);
 
     // setup handler for event messages (all from the outside)
-    rc = zloop_reader(loop, router_receiver, read_router_message_and_forward, &publisher_state);
+    rc = zloop_reader(loop, state->router_receiver_socket, read_router_message_and_forward, state);
     assert(rc == 0);
-    zloop_reader_set_tolerant(loop, router_receiver);
+    zloop_reader_set_tolerant(loop, state->router_receiver_socket);
 
-    // initialize clock
-    global_time = zclock_time();
+    return loop;
+}
 
-    // run the loop
+static int run_loop(zloop_t *loop, const char *name)
+{
+    int rc = 0;
     if (!zsys_interrupted) {
         if (verbose)
-            printf("[I] starting main event loop\n");
+            printf("[I] starting %s event loop\n", name);
         bool should_continue_to_run = getenv("CPUPROFILE") != NULL;
         do {
             rc = zloop_start(loop);
@@ -525,25 +669,138 @@ int main(int argc, char * const *argv)
             log_zmq_error(rc, __FILE__, __LINE__);
         } while (should_continue_to_run);
         if (verbose)
-            printf("[I] main event zloop terminated with return code %d\n", rc);
+            printf("[I] %s event zloop terminated with return code %d\n", name, rc);
     }
+    return rc;
+}
+
+static int worker_command(zloop_t *loop, zsock_t *pipe, void *arg)
+{
+    char *cmd = zstr_recv(pipe);
+    bool terminate = cmd == NULL || streq(cmd, "$TERM");
+    free(cmd);
+    return terminate ? -1 : 0;
+}
+
+static void device_worker(zsock_t *pipe, void *args)
+{
+    publisher_state_t *state = args;
+    char name[16];
+    snprintf(name, sizeof(name), "worker[%zu]", state->id);
+    set_thread_name(name);
+
+    zloop_t *loop = publisher_loop_new(state);
+    int rc = zloop_reader(loop, pipe, worker_command, state);
+    assert(rc == 0);
+
+    // signal readyiness
+    zsock_signal(pipe, 0);
+
+    run_loop(loop, name);
+    zloop_destroy(&loop);
+}
+
+// in sharded mode, the watchdog only gets ticked while all workers make progress
+static int main_timer_event(zloop_t *loop, int timer_id, void *arg)
+{
+    static size_t last_ticks[MAX_WORKERS];
+    bool all_alive = true;
+    for (size_t i = 0; i < num_workers; i++) {
+        size_t ticks = __atomic_load_n(&publisher_states[i]->ticks, __ATOMIC_RELAXED);
+        if (ticks == last_ticks[i])
+            all_alive = false;
+        last_ticks[i] = ticks;
+    }
+    if (all_alive)
+        zstr_send(device_watchdog, "tick");
+    device_prometheus_client_expire_traffic();
+    device_prometheus_client_record_rusage();
+    return 0;
+}
+
+int main(int argc, char * const *argv)
+{
+    int rc = 0;
+    process_arguments(argc, argv);
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    setvbuf(stderr, NULL, _IOLBF, 0);
+
+    printf("[I] started %s\n"
+           "[I] pull-port:   %d\n"
+           "[I] pub-port:    %d\n"
+           "[I] router-port: %d\n"
+           "[I] io-threads:  %lu\n"
+           "[I] workers:     %zu\n"
+           "[I] rcv-hwm:     %d\n"
+           "[I] snd-hwm:     %d\n"
+           , argv[0], pull_port, pub_port, router_port, io_threads, num_workers, rcv_hwm, snd_hwm);
+
+    // set global config
+    zsys_init();
+    zsys_set_rcvhwm(10000);
+    zsys_set_sndhwm(10000);
+    zsys_set_pipehwm(1000);
+    zsys_set_linger(100);
+    zsys_set_io_threads(io_threads);
+
+    bool sharded = num_workers > 1;
+
+    // initalize prometheus client
+    snprintf(metrics_address, sizeof(metrics_address), "%s:%d", metrics_ip, metrics_port);
+    device_prometheus_client_init(metrics_address, device_number_s, sharded ? 0 : num_compressors, sharded ? num_workers : 0);
+
+    for (size_t i = 0; i < num_workers; i++) {
+        publisher_states[i] = publisher_state_new(i, sharded);
+        if (sharded)
+            printf("[I] worker[%zu]: device %u, pull-port %d, router-port %d, pub-port %d\n",
+                   i, publisher_states[i]->msg_meta.device_number,
+                   publisher_states[i]->pull_port, publisher_states[i]->router_port, publisher_states[i]->pub_port);
+    }
+
+    // create compressor agents, workers compress in their own thread
+    if (!sharded)
+        for (size_t i = 0; i < num_compressors; i++)
+            compressors[i] = message_compressor_new(i, compression_method, device_prometheus_client_record_rusage_compressor);
+
+    // create watchdog
+    device_watchdog = zactor_new(watchdog, NULL);
+
+    zactor_t *workers[MAX_WORKERS];
+    zloop_t *loop;
+    if (sharded) {
+        for (size_t i = 0; i < num_workers; i++)
+            workers[i] = zactor_new(device_worker, publisher_states[i]);
+        loop = zloop_new();
+        assert(loop);
+        zloop_set_verbose(loop, 0);
+        int timer_id = zloop_timer(loop, 1000, 0, main_timer_event, NULL);
+        assert(timer_id != -1);
+    } else
+        loop = publisher_loop_new(publisher_states[0]);
+
+    rc = run_loop(loop, "main");
 
     zloop_destroy(&loop);
     assert(loop == NULL);
 
+    if (sharded)
+        for (size_t i = 0; i < num_workers; i++)
+            zactor_destroy(&workers[i]);
+
+    size_t received_messages_count = 0;
+    for (size_t i = 0; i < num_workers; i++)
+        received_messages_count += publisher_states[i]->received_messages_count;
     printf("[I] received %zu messages\n", received_messages_count);
 
     printf("[I] shutting down\n");
 
     zactor_destroy(&device_watchdog);
-    zsock_destroy(&receiver);
-    zsock_destroy(&router_receiver);
-    zsock_destroy(&router_output);
-    zsock_destroy(&publisher);
-    zsock_destroy(&compressor_input);
-    zsock_destroy(&compressor_output);
-    for (size_t i = 0; i < num_compressors; i++)
-        zactor_destroy(&compressors[i]);
+    for (size_t i = 0; i < num_workers; i++)
+        publisher_state_destroy(&publisher_states[i]);
+    if (!sharded)
+        for (size_t i = 0; i < num_compressors; i++)
+            zactor_destroy(&compressors[i]);
     zsys_shutdown();
 
     device_prometheus_client_shutdown();
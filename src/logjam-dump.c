@@ -250,6 +250,10 @@ int main(int argc, char * const *argv)
     assert(rc == 0);
     zloop_reader_set_tolerant(loop, receiver);
 
+    // setup handler for reconnects of stale devices
+    rc = device_tracker_register_reconnects(tracker, loop);
+    assert(rc == 0);
+
     // calculate statistics every 1000 ms
     int timer_id = zloop_timer(loop, 1000, 0, timer_event, receiver);
     assert(timer_id != -1);
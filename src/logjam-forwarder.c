@@ -440,6 +440,10 @@ int main(int argc, char * const *argv)
     assert(rc == 0);
     zloop_reader_set_tolerant(loop, receiver);
 
+    // setup handler for reconnects of stale devices
+    rc = device_tracker_register_reconnects(tracker, loop);
+    assert(rc == 0);
+
     // initialize clock
     global_time = zclock_time();
 
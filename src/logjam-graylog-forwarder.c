@@ -9,6 +9,7 @@
 #include <getopt.h>
 #include "graylog-forwarder-common.h"
 #include "graylog-forwarder-controller.h"
+#include "gelf-transport.h"
 
 // flags
 bool dryrun = false;
@@ -33,12 +34,14 @@ static void print_usage(char * const *argv)
             "  -c, --config F             read config from file\n"
             "  -e, --subscribe S,T        subscription patterns\n"
             "  -h, --hosts H,I            specs of devices to connect to\n"
-            "  -i, --interface I          zmq spec of interface on which to listen\n"
+            "  -i, --interface I          zmq spec of interface on which to listen,\n"
+            "                             or gelf-udp://host:port, gelf-tcp://host:port\n"
             "  -n, --dryrun               don't send data to graylog\n"
             "  -p, --parsers N            use N threads for parsing log messages\n"
             "  -z, --compress             compress data sent to graylog\n"
             "  -R, --rcv-hwm N            high watermark for input socket\n"
             "  -S, --snd-hwm N            high watermark for output socket\n"
+            "  -Q, --queue-size N         messages to queue before dropping when graylog is slow\n"
             "  -L, --logjam-url U         url from where to retrieve stream config\n"
             "      --help                 display this message\n"
             "\nEnvironment: (parameters take precedence)\n"
@@ -65,6 +68,7 @@ static void process_arguments(int argc, char * const *argv)
         { "hosts",         required_argument, 0, 'h' },
         { "interface",     required_argument, 0, 'i' },
         { "parsers",       required_argument, 0, 'p' },
+        { "queue-size",    required_argument, 0, 'Q' },
         { "quiet",         no_argument,       0, 'q' },
         { "rcv-hwm",       required_argument, 0, 'R' },
         { "snd-hwm",       required_argument, 0, 'S' },
@@ -74,7 +78,7 @@ static void process_arguments(int argc, char * const *argv)
         { 0,               0,                 0,  0  }
     };
 
-    while ((c = getopt_long(argc, argv, "vqc:np:zh:S:R:e:L:", long_options, &longindex)) != -1) {
+    while ((c = getopt_long(argc, argv, "vqc:np:zh:i:S:R:Q:e:L:", long_options, &longindex)) != -1) {
         switch (c) {
         case 'v':
             if (verbose)
@@ -123,6 +127,9 @@ static void process_arguments(int argc, char * const *argv)
         case 'S':
             snd_hwm = atoi(optarg);
             break;
+        case 'Q':
+            spill_queue_size = strtoul(optarg, NULL, 0);
+            break;
         case 'L':
             logjam_url = optarg;
             break;
@@ -153,7 +160,7 @@ static void process_arguments(int argc, char * const *argv)
 
     if (interface == NULL)
         interface = getenv("LOGJAM_INTERACE");
-    if (interface)
+    if (interface && !gelf_transport_spec_is_native(interface))
         interface = augment_zmq_connection_spec(interface, 9610);
 
     if (subscription_pattern == NULL)
@@ -226,12 +233,24 @@ int main(int argc, char * const *argv)
     if (snd_hwm == -1)
         snd_hwm = atoi(zconfig_resolve(config, "/graylog/high_water_mark", DEFAULT_SND_HWM_STR));
 
+    // set size of the queue used when graylog is slow
+    if (spill_queue_size == 0)
+        spill_queue_size = strtoul(zconfig_resolve(config, "/graylog/queue_size", DEFAULT_SPILL_QUEUE_SIZE_STR), NULL, 0);
+    if (spill_queue_size == 0)
+        spill_queue_size = 1;
+
+    if (compress_gelf && !strncmp(interface, "gelf-tcp://", 11)) {
+        fprintf(stderr, "[W] GELF over TCP does not support compression. sending uncompressed messages.\n");
+        compress_gelf = false;
+    }
+
     if (!quiet)
         printf("[I] started %s\n"
                "[I] interface %s\n"
                "[I] rcv-hwm:  %d\n"
                "[I] snd-hwm:  %d\n"
-               , argv[0], interface, rcv_hwm, snd_hwm);
+               "[I] queue:    %zu\n"
+               , argv[0], interface, rcv_hwm, snd_hwm, spill_queue_size);
 
     return graylog_forwarder_run_controller_loop(config, hosts, subscription_pattern, logjam_stream_url, rcv_hwm, snd_hwm);
 }
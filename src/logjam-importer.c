@@ -4,19 +4,12 @@
 #include "importer-mongoutils.h"
 #include "importer-processor.h"
 #include "importer-prometheus-client.h"
+#include "importer-admission.h"
 #include <getopt.h>
 
-int snd_hwm = -1;
-int rcv_hwm = -1;
-int pull_port = -1;
-int router_port = -1;
-int sub_port = -1;
 int metrics_port = -1;
 char metrics_address[256] = {0};
-char* live_stream_connection_spec = NULL;
-char* prom_collector_connection_spec = NULL;
 const char *metrics_ip = "0.0.0.0";
-zlist_t *hosts = NULL;
 
 static const char *logjam_url = "http://localhost:3000/";
 static char *logjam_stream_url = "http://localhost:3000/admin/streams";
@@ -24,7 +17,6 @@ static char *logjam_stream_url = "http://localhost:3000/admin/streams";
 static const char *subscription_pattern = NULL;
 static const char *config_file_name = "logjam.conf";
 
-FILE* frontend_timings = NULL;
 static char *frontend_timings_file_name = NULL;
 static char *frontend_timings_apdex_attr = NULL;
 
@@ -68,6 +60,7 @@ void print_usage(char * const *argv)
             "  -h, --hosts H,I            specs of devices to connect to\n"
             "  -i, --io-threads N         zeromq io threads\n"
             "  -l, --live-stream S        zmq bind spec for publishing live stream data\n"
+            "  -n, --dryrun               don't store anything (same as the null backend)\n"
             "  -p, --parsers N            number of parser threads\n"
             "  -b, --subscribers N        number of subscriber threads\n"
             "  -u, --updaters N           number of db stats updater threads\n"
@@ -352,6 +345,8 @@ int main(int argc, char * const *argv)
                , argv[0], pull_port, sub_port, live_stream_connection_spec, io_threads, rcv_hwm, snd_hwm,
                num_parsers, num_writers, num_updaters, subscription_pattern);
 
+    admission_setup(config);
+    key_guard_setup(config);
     initialize_mongo_db_globals(config);
     snprintf(metrics_address, sizeof(metrics_address), "%s:%d", metrics_ip, metrics_port);
     importer_prometheus_client_params_t prometheus_params = { .num_subscribers = num_subscribers, .num_parsers = num_parsers, .num_writers = num_writers, .num_updaters = num_updaters};
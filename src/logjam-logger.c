@@ -1,5 +1,6 @@
 #include "logjam-util.h"
 #include <getopt.h>
+#include <errno.h>
 
 bool verbose = false;
 bool debug = false;
@@ -18,6 +19,22 @@ static size_t buffer_size;
 #define INITIAL_BUFFER_SIZE 8*1024
 static bool terminating = false;
 
+// batch mode: stdin is read in large blocks and lines are published in batches
+static bool batch_mode = false;
+#define DEFAULT_BATCH_SIZE_KB 256
+// partial batches are published after at most this many milliseconds
+#define BATCH_FLUSH_INTERVAL 100
+static size_t batch_size = DEFAULT_BATCH_SIZE_KB * 1024;
+static int compression_method = NO_COMPRESSION;
+#define INITIAL_READ_BUFFER_SIZE 1024*1024
+static char* read_buffer = NULL;
+static size_t read_buffer_size = 0;
+static size_t read_buffer_used = 0;
+static zchunk_t *batch = NULL;
+static uint32_t batch_lines = 0;
+static zchunk_t *compression_buffer = NULL;
+static size_t published_batches_count = 0;
+
 static char *topic = "";
 static char *app_name = NULL;
 
@@ -37,6 +54,11 @@ static int timer_event( zloop_t *loop, int timer_id, void *arg)
     if (verbose)
         printf("[I] processed %zu lines (%.2f KB), avg: %.2f KB, max: %.2f KB\n",
                message_count, message_bytes/1024.0, avg_line_size, max_line_size);
+    if (verbose && batch_mode) {
+        static size_t last_published_batches_count = 0;
+        printf("[I] published %zu batches\n", published_batches_count - last_published_batches_count);
+        last_published_batches_count = published_batches_count;
+    }
     last_processed_count = processed_lines_count;
     last_processed_bytes = processed_lines_bytes;
     processed_lines_max_bytes = 0;
@@ -82,6 +104,115 @@ static int read_line_and_forward(zloop_t *loop, zmq_pollitem_t *item, void* arg)
     return 0;
 }
 
+static void publish_batch(zsock_t *socket)
+{
+    if (batch_lines == 0)
+        return;
+
+    void *sender = zsock_resolve(socket);
+    const char *data = (const char*) zchunk_data(batch);
+    size_t data_len = zchunk_size(batch);
+
+    zmq_msg_t body;
+    if (compression_method) {
+        zmq_msg_init(&body);
+        compress_message_data(compression_method, compression_buffer, &body, data, data_len);
+    } else {
+        zmq_msg_init_size(&body, data_len);
+        memcpy(zmq_msg_data(&body), data, data_len);
+    }
+
+    if (debug)
+        printf("[D] publishing batch: %u lines, %zu bytes (%zu on the wire)\n",
+               batch_lines, data_len, zmq_msg_size(&body));
+
+    line_batch_info_t info = {LINE_BATCH_TAG, compression_method, LINE_BATCH_VERSION, batch_lines};
+    line_batch_info_encode(&info);
+
+    zmq_send(sender, topic, strlen(topic), ZMQ_SNDMORE);
+    zmq_msg_send(&body, sender, ZMQ_SNDMORE);
+    zmq_send(sender, &info, sizeof(info), 0);
+    zmq_msg_close(&body);
+
+    published_batches_count++;
+    zchunk_set(batch, NULL, 0);
+    batch_lines = 0;
+}
+
+static void add_line_to_batch(zsock_t *socket, const char *line, size_t line_length)
+{
+    if (log_to_syslog)
+        syslog(log_level, "%.*s", (int)line_length, line);
+
+    line_batch_append(batch, line, line_length);
+    batch_lines++;
+
+    // calculate stats (line length includes the newline, as in line mode)
+    processed_lines_count++;
+    processed_lines_bytes += line_length + 1;
+    if (line_length + 1 > processed_lines_max_bytes)
+        processed_lines_max_bytes = line_length + 1;
+
+    if (zchunk_size(batch) >= batch_size)
+        publish_batch(socket);
+}
+
+static int flush_batch_timer_event(zloop_t *loop, int timer_id, void *arg)
+{
+    publish_batch(arg);
+    return 0;
+}
+
+static int read_lines_and_forward(zloop_t *loop, zmq_pollitem_t *item, void* arg)
+{
+    zsock_t *socket = arg;
+
+    // a single line filling the whole buffer: make room for more
+    if (read_buffer_used == read_buffer_size) {
+        read_buffer_size *= 2;
+        read_buffer = realloc(read_buffer, read_buffer_size);
+        assert(read_buffer);
+    }
+
+    ssize_t n = read(item->fd, read_buffer + read_buffer_used, read_buffer_size - read_buffer_used);
+    if (n == -1 && (errno == EINTR || errno == EAGAIN))
+        return 0;
+    if (n == -1)
+        fprintf(stderr, "[E] reading input failed: %s\n", strerror(errno));
+    bool end_of_input = n <= 0;
+    if (n > 0)
+        read_buffer_used += n;
+
+    char *p = read_buffer;
+    char *end = read_buffer + read_buffer_used;
+    char *newline;
+    while ((newline = memchr(p, '\n', end - p))) {
+        add_line_to_batch(socket, p, newline - p);
+        p = newline + 1;
+    }
+    // the last line of the input need not be terminated by a newline
+    if (end_of_input && p < end) {
+        add_line_to_batch(socket, p, end - p);
+        p = end;
+    }
+    read_buffer_used = end - p;
+    if (read_buffer_used)
+        memmove(read_buffer, p, read_buffer_used);
+
+    // pipes deliver at most their capacity per read, so short reads don't
+    // mean much. partial batches are published by the flush timer instead.
+    if (end_of_input)
+        publish_batch(socket);
+
+    if (end_of_input) {
+        if (verbose) printf("[I] end of input. aborting.\n");
+        terminating = true;
+        return -1;
+    }
+
+    return 0;
+}
+
 void print_usage(char * const *argv)
 {
     fprintf(stderr,
@@ -89,14 +220,17 @@ void print_usage(char * const *argv)
             "\nOptions:\n"
             "  -a, --app                  app name for syslog (default: %s)\n"
             "  -b, --bind I               zmq specification for binding pub socket\n"
+            "  -B, --batch                read input in large blocks and publish batches of lines\n"
+            "  -S, --batch-size K         maximum batch size in KB (default: %d)\n"
             "  -i, --io-threads N         zeromq io threads\n"
             "  -s, --syslog [F.L]         send data to syslog with optional facility.level\n"
             "                             facility can be one of (user, local0 ... local7), default: user\n"
             "                             level can be one of (error, warn, notice, info),  default: info\n"
             "  -t, --topic                data for topic frame\n"
             "  -v, --verbose              log more (use -vv for debug output)\n"
+            "  -z, --compress M           compress batches using M (zlib, snappy or lz4), implies -B\n"
             "      --help                 display this message\n"
-            , argv[0], log_id);
+            , argv[0], log_id, DEFAULT_BATCH_SIZE_KB);
 }
 
 bool scan_syslog_param(char *arg, int* level, int* facility)
@@ -162,15 +296,18 @@ void process_arguments(int argc, char * const *argv)
     static struct option long_options[] = {
         { "help",          no_argument,       0,  0  },
         { "app",           required_argument, 0, 'a' },
+        { "batch",         no_argument,       0, 'B' },
+        { "batch-size",    required_argument, 0, 'S' },
         { "bind",          required_argument, 0, 'b' },
         { "io-threads",    required_argument, 0, 'i' },
         { "syslog",        optional_argument, 0, 's' },
         { "topic",         required_argument, 0, 't' },
         { "verbose",       no_argument,       0, 'v' },
+        { "compress",      required_argument, 0, 'z' },
         { 0,               0,                 0,  0  }
     };
 
-    while ((c = getopt_long(argc, argv, ":vi:b:t:a:s:", long_options, &longindex)) != -1) {
+    while ((c = getopt_long(argc, argv, ":vi:b:t:a:s:BS:z:", long_options, &longindex)) != -1) {
         switch (c) {
         case 'v':
             if (verbose)
@@ -190,6 +327,29 @@ void process_arguments(int argc, char * const *argv)
         case 't':
             topic = optarg;
             break;
+        case 'B':
+            batch_mode = true;
+            break;
+        case 'S': {
+            char *end;
+            errno = 0;
+            long kb = strtol(optarg, &end, 10);
+            // reject garbage, non positive sizes and sizes not fitting into memory
+            if (errno || end == optarg || *end != '\0' || kb <= 0 || (unsigned long)kb > SIZE_MAX / 1024) {
+                fprintf(stderr, "[E] batch size must be a positive number of KB: %s\n", optarg);
+                exit(1);
+            }
+            batch_size = kb * 1024;
+            break;
+        }
+        case 'z':
+            compression_method = string_to_compression_method(optarg);
+            if (compression_method == NO_COMPRESSION) {
+                print_usage(argv);
+                exit(1);
+            }
+            batch_mode = true;
+            break;
         case 's':
             log_to_syslog = true;
             if (!scan_syslog_param(optarg, &log_facility, &log_level)) {
@@ -210,7 +370,7 @@ void process_arguments(int argc, char * const *argv)
             exit(0);
             break;
         case '?':
-            if (strchr("abits", optopt))
+            if (strchr("abitsSz", optopt))
                 fprintf(stderr, "[E] option -%c requires an argument.\n", optopt);
             else if (isprint (optopt))
                 fprintf(stderr, "[E] unknown option `-%c'.\n", optopt);
@@ -273,12 +433,24 @@ int main(int argc, char * const *argv)
         .fd = fileno(stdin),
         .events = ZMQ_POLLIN
     };
-    rc = zloop_poller(loop, &stdio_item, read_line_and_forward, sender);
+    if (batch_mode) {
+        if (verbose)
+            printf("[I] publishing batches of up to %zu KB (%s)\n", batch_size / 1024,
+                   compression_method_to_string(compression_method));
+        read_buffer_size = INITIAL_READ_BUFFER_SIZE;
+        read_buffer = zmalloc(read_buffer_size);
+        batch = zchunk_new(NULL, batch_size + 4096);
+        compression_buffer = zchunk_new(NULL, INITIAL_COMPRESSION_BUFFER_SIZE);
+        rc = zloop_timer(loop, BATCH_FLUSH_INTERVAL, 0, flush_batch_timer_event, sender);
+        assert(rc != -1);
+        rc = zloop_poller(loop, &stdio_item, read_lines_and_forward, sender);
+    } else {
+        // allocate the input buffer
+        buffer = zmalloc(INITIAL_BUFFER_SIZE);
+        rc = zloop_poller(loop, &stdio_item, read_line_and_forward, sender);
+    }
     assert(rc==0);
 
-    // allocate the input buffer
-    buffer = zmalloc(INITIAL_BUFFER_SIZE);
-
     if (!zsys_interrupted) {
         if (verbose) printf("[I] starting main event loop\n");
         bool should_continue_to_run = getenv("CPUPROFILE") != NULL;
@@ -299,6 +471,12 @@ int main(int argc, char * const *argv)
     zsock_destroy(&sender);
     zsys_shutdown();
 
+    if (batch_mode) {
+        zchunk_destroy(&batch);
+        zchunk_destroy(&compression_buffer);
+        free(read_buffer);
+    }
+
     closelog();
 
     if (verbose) printf("[I] terminated\n");
@@ -2,7 +2,7 @@
 #include <czmq.h>
 #include "logjam-util.h"
 #include "gelf-message.h"
-#include "str-builder.h"
+#include "gelf-rules.h"
 #include "logjam-message.h"
 #include "logjam-streaminfo.h"
 
@@ -38,6 +38,31 @@ static inline void str_normalize(char *str)
     }
 }
 
+// whether two header names are mapped to the same gelf field by str_normalize
+static inline bool header_names_collide(const char *a, const char *b)
+{
+    for (; *a && *b; a++, b++) {
+        char x = *a == '-' ? '_' : tolower(*a);
+        char y = *b == '-' ? '_' : tolower(*b);
+        if (x != y)
+            return false;
+    }
+    return *a == *b;
+}
+
+// whether a header preceding the given one in the headers object maps to the same gelf field
+static bool header_field_taken(json_object *headers, const char *header)
+{
+    json_object_object_foreach (headers, key, value) {
+        (void) value;
+        if (key == header)
+            return false;
+        if (header_names_collide (key, header))
+            return true;
+    }
+    return false;
+}
+
 size_t logjam_message_size(logjam_message *msg)
 {
     return msg->size;
@@ -113,23 +138,55 @@ char* extract_module(const char *action)
    return strdup(module_str);
 }
 
-gelf_message* logjam_message_to_gelf(logjam_message *logjam_msg, json_tokener *tokener, zhash_t *stream_info_cache, zchunk_t *decompression_buffer, zchunk_t *buffer)
+// appends at most *budget bytes, without splitting UTF-8 sequences. returns false if str was truncated.
+static inline bool append_limited(gelf_message *gelf_msg, const char *str, size_t len, size_t *budget)
+{
+    if (len <= *budget) {
+        gelf_message_append_string (gelf_msg, str, len);
+        *budget -= len;
+        return true;
+    }
+    len = *budget;
+    while (len > 0 && (str[len] & 0xC0) == 0x80)
+        len--;
+    gelf_message_append_string (gelf_msg, str, len);
+    *budget = 0;
+    return false;
+}
+
+static inline bool append_json_text(gelf_message *gelf_msg, json_object *obj, size_t *budget)
+{
+    const char *str = json_object_get_string (obj);
+    if (str == NULL)
+        return true;
+    size_t len = json_object_is_type (obj, json_type_string) ? (size_t) json_object_get_string_len (obj) : strlen (str);
+    return append_limited (gelf_msg, str, len, budget);
+}
+
+bool logjam_message_to_gelf(logjam_message *logjam_msg, json_tokener *tokener, zhash_t *stream_info_cache, zchunk_t *decompression_buffer, zchunk_t *buffer, gelf_message *gelf_msg, gelf_rules_t *rules)
 {
     json_object *obj = NULL, *http_request = NULL, *lines = NULL;
     const char *host = "Not found", *action = "";
-    char *str = NULL;
 
     // extract meta information
     msg_meta_t meta;
     frame_extract_meta_info(logjam_msg->frames[3], &meta);
 
     char *app_env = zframe_strdup (logjam_msg->frames[0]);
+
+    // sampling is decided before spending any time on the message
+    gelf_rule_t *rule = rules ? gelf_rules_lookup(rules, app_env) : NULL;
+    if (rule && gelf_rule_sample_out(rules, rule)) {
+        free(app_env);
+        return false;
+    }
+
     stream_info_t *stream_info = get_stream_info(app_env, stream_info_cache);
     if (stream_info == NULL) {
         if (verbose)
             fprintf(stderr, "[W] dropped request from unknown stream: %s\n", app_env);
         free(app_env);
-        return NULL;
+        return false;
     }
 
     // decompress if necessary
@@ -142,12 +199,23 @@ gelf_message* logjam_message_to_gelf(logjam_message *logjam_msg, json_tokener *t
         json_data_len = zframe_size(logjam_msg->frames[2]);
     }
 
+    // agents send the maximum severity of all lines, so we can drop boring requests without parsing them
+    if (rule && rule->min_severity > 0) {
+        int severity = find_json_int_value(json_data, json_data_len, "\"severity\"");
+        if (severity >= 0 && gelf_rule_severity_too_low(rules, rule, severity)) {
+            free(app_env);
+            release_stream_info(stream_info);
+            return false;
+        }
+    }
+
     // now see whether we can parse it
     json_object *request = parse_json_data(json_data, json_data_len, tokener);
 
     if (!request) {
         free(app_env);
-        return NULL;
+        release_stream_info(stream_info);
+        return false;
     }
 
     // dump_json_object(stdout, "[D]", request);
@@ -176,7 +244,7 @@ gelf_message* logjam_message_to_gelf(logjam_message *logjam_msg, json_tokener *t
         strcat (pos, "unknown_method");
     action = buf;
 
-    gelf_message *gelf_msg = gelf_message_new (host, action);
+    gelf_message_start (gelf_msg, host, action);
 
     gelf_message_add_string (gelf_msg, "_app", app_env);
 
@@ -226,7 +294,7 @@ gelf_message* logjam_message_to_gelf(logjam_message *logjam_msg, json_tokener *t
             gelf_message_add_json_object (gelf_msg, "_http_url", obj);
             const char *path = json_object_get_string(obj);
             char* module = extract_module(action);
-            adjust_caller_info(path, module, request, stream_info);
+            adjust_caller_info(path, stream_module_rules(stream_info, module, NULL), request, stream_info);
             free(module);
         }
 
@@ -242,8 +310,13 @@ gelf_message* logjam_message_to_gelf(logjam_message *logjam_msg, json_tokener *t
             } else {
                 char header[1024] = "_http_header_";
                 json_object_object_foreach (obj, key, value) {
+                    // distinct headers can normalize to the same field, the first one wins
+                    if (header_field_taken (obj, key))
+                        continue;
                     snprintf (header, 1024, "_http_header_%s", key);
                     str_normalize (header + 13);
+                    if (rule && !gelf_rule_header_allowed (rule, header + 13))
+                        continue;
                     gelf_message_add_json_object (gelf_msg, header, value);
                 }
             }
@@ -256,9 +329,7 @@ gelf_message* logjam_message_to_gelf(logjam_message *logjam_msg, json_tokener *t
         const char *caller_id = json_object_get_string(obj);
         char app[256], env[256], rid[256];
         extract_app_env_rid (caller_id, 256, app, env, rid);
-        json_object *app_obj = json_object_new_string(app);
-        gelf_message_add_json_object (gelf_msg, "_caller_app", app_obj);
-        json_object_put(app_obj);
+        gelf_message_add_string (gelf_msg, "_caller_app", app);
     }
 
     // needs to happen after the call to adjust_caller_info
@@ -273,31 +344,42 @@ gelf_message* logjam_message_to_gelf(logjam_message *logjam_msg, json_tokener *t
 
     if (json_object_object_get_ex (request, "lines", &lines) && json_object_get_type(lines) == json_type_array) {
         int n_lines = json_object_array_length (lines);
+        size_t budget = rule && rule->max_full_message ? rule->max_full_message : SIZE_MAX;
+        bool truncated = false;
 
-        str_builder *sb = sb_new (1024*10);
+        gelf_message_begin_string (gelf_msg, "full_message");
         for (int i = 0; i < n_lines; i++) {
             json_object *line = json_object_array_get_idx (lines, i);
             if (line && json_object_get_type (line) == json_type_array) {
                 obj = json_object_array_get_idx (line, 0);
                 int l = json_object_get_int (obj);
+                if (l < 0 || l > 5)
+                    l = 5;
                 if (l > level)
                     level = l;
-                sb_append(sb, LOG_LEVELS_NAMES[l], strlen (LOG_LEVELS_NAMES[l]));
-                sb_append(sb, " ", 1);
-
-                obj = json_object_array_get_idx (line, 1);
-                str = (char *) json_object_get_string(obj);
-                sb_append (sb, str, strlen (str));
-                sb_append (sb, " ", 1);
-
-                obj = json_object_array_get_idx (line, 2);
-                str = (char *) json_object_get_string (obj);
-                sb_append (sb, str, strlen (str));
-                sb_append (sb, "\n", 1);
+                // remaining lines still count for the level
+                if (truncated)
+                    continue;
+                truncated = !(append_limited (gelf_msg, LOG_LEVELS_NAMES[l], strlen (LOG_LEVELS_NAMES[l]), &budget)
+                              && append_limited (gelf_msg, " ", 1, &budget)
+                              && append_json_text (gelf_msg, json_object_array_get_idx (line, 1), &budget)
+                              && append_limited (gelf_msg, " ", 1, &budget)
+                              && append_json_text (gelf_msg, json_object_array_get_idx (line, 2), &budget)
+                              && append_limited (gelf_msg, "\n", 1, &budget));
             }
         }
-        gelf_message_add_full_message (gelf_msg, sb_string(sb));
-        sb_destroy (&sb);
+        gelf_message_end_string (gelf_msg);
+        if (truncated) {
+            rules->truncated++;
+            gelf_message_add_int (gelf_msg, "_full_message_truncated", 1);
+        }
+    }
+
+    if (rule && gelf_rule_severity_too_low (rules, rule, level)) {
+        free (app_env);
+        release_stream_info(stream_info);
+        json_object_put (request);
+        return false;
     }
 
     gelf_message_add_int (gelf_msg, "level", SYSLOG_MAPPING[level]);
@@ -308,7 +390,7 @@ gelf_message* logjam_message_to_gelf(logjam_message *logjam_msg, json_tokener *t
     release_stream_info(stream_info);
     json_object_put (request);
 
-    return gelf_msg;
+    return true;
 }
 
 void logjam_message_destroy(logjam_message **msg)
@@ -4,12 +4,15 @@
 #include <czmq.h>
 #include <json_tokener.h>
 #include "gelf-message.h"
+#include "gelf-rules.h"
 
 typedef struct _logjam_message logjam_message;
 
 logjam_message* logjam_message_read(zsock_t *receiver);
 
-gelf_message* logjam_message_to_gelf(logjam_message *logjam_msg, json_tokener *tokener, zhash_t* stream_info_cache, zchunk_t *decompression_buffer, zchunk_t *scratch_buffer);
+// write the GELF representation of the given message into gelf_msg. returns false if the
+// message should not be forwarded. rules may be NULL.
+bool logjam_message_to_gelf(logjam_message *logjam_msg, json_tokener *tokener, zhash_t* stream_info_cache, zchunk_t *decompression_buffer, zchunk_t *scratch_buffer, gelf_message *gelf_msg, gelf_rules_t *rules);
 
 size_t logjam_message_size(logjam_message *msg);
 
@@ -57,12 +57,40 @@ static msg_meta_t msg_meta = META_INFO_EMPTY;
 #define MAX_COMPRESSORS 64
 static uint64_t global_time = 0;
 
+// Messages are published in the order they were received, even though
+// decompression happens in parallel: every message gets a slot in a ring of
+// reorder_window slots, indexed by its input sequence number. Compressed
+// messages carry that number through the decompressors in the sequence number
+// field of their meta frame. Slots are published once all slots before them
+// are done. If the ring is full, intake waits for the decompressors. Slots
+// still pending after REORDER_TIMEOUT_MS are given up, so that a lost or stuck
+// decompression can't hold back everything behind it.
+#define DEFAULT_REORDER_WINDOW 1024
+#define REORDER_TIMEOUT_MS 5000
+
+typedef enum { SLOT_EMPTY, SLOT_PENDING, SLOT_READY, SLOT_FAILED } slot_status_t;
+
+typedef struct {
+    zmq_msg_t parts[3];
+    uint64_t created_ms;
+    int64_t deadline;
+    slot_status_t status;
+} reorder_slot_t;
+
+static size_t reorder_window = DEFAULT_REORDER_WINDOW;
+static reorder_slot_t *reorder_buffer = NULL;
+static uint64_t next_input_sequence = 0;
+static uint64_t next_output_sequence = 0;
+static size_t reorder_waits = 0;
+static size_t reorder_timeouts = 0;
+
 typedef struct {
     // raw zmq sockets, to avoid zsock_resolve
     void *receiver;
     void *publisher;
     void *compressor_input;
     void *compressor_output;
+    zactor_t **decompressors;
 } publisher_state_t;
 
 
@@ -87,6 +115,8 @@ static bool config_file_has_changed()
     return changed;
 }
 
+static void flush_reorder_buffer(publisher_state_t *state);
+
 static int timer_event(zloop_t *loop, int timer_id, void *arg)
 {
     static size_t last_received_count = 0;
@@ -112,8 +142,22 @@ static int timer_event(zloop_t *loop, int timer_id, void *arg)
         printf("[I] decompressed %zu messages (%.2f KB), avg: %.2f KB, max: %.2f KB\n",
                decompressed_count, decompressed_bytes/1024.0, avg_decompressed_size, max_decompressed_size);
         if (dropped_messages > 0)
-            printf("[W] dropped      %zu messages\n", message_count);
+            printf("[W] dropped      %zu messages\n", dropped_messages);
+        if (reorder_waits > 0)
+            printf("[W] waited %zu times for decompressors (reorder window: %zu)\n", reorder_waits, reorder_window);
+        if (reorder_timeouts > 0)
+            printf("[W] gave up on %zu messages pending decompression\n", reorder_timeouts);
     }
+    reorder_waits = 0;
+    reorder_timeouts = 0;
+
+    // expire stuck slots even if no messages arrive
+    publisher_state_t *state = arg;
+    flush_reorder_buffer(state);
+
+    // tick decompressors, which report their throughput
+    for (size_t i = 0; i < num_compressors; i++)
+        zstr_send(state->decompressors[i], "tick");
 
     last_received_count = received_messages_count;
     last_received_bytes = received_messages_bytes;
@@ -137,12 +181,93 @@ static int timer_event(zloop_t *loop, int timer_id, void *arg)
     return 0;
 }
 
-static int read_zmq_message_and_forward(zloop_t *loop, zsock_t *sock, void *callback_data)
+static void reorder_buffer_init()
+{
+    reorder_buffer = zmalloc(reorder_window * sizeof(reorder_slot_t));
+    assert(reorder_buffer);
+    for (size_t i = 0; i < reorder_window; i++)
+        for (int j = 0; j < 3; j++)
+            zmq_msg_init(&reorder_buffer[i].parts[j]);
+}
+
+static void reorder_buffer_destroy()
+{
+    for (size_t i = 0; i < reorder_window; i++)
+        for (int j = 0; j < 3; j++)
+            zmq_msg_close(&reorder_buffer[i].parts[j]);
+    free(reorder_buffer);
+    reorder_buffer = NULL;
+}
+
+static void reorder_slot_store(reorder_slot_t *slot, zmq_msg_t *message_parts)
+{
+    for (int j = 0; j < 3; j++)
+        zmq_msg_move(&slot->parts[j], &message_parts[j]);
+}
+
+static void reorder_slot_clear(reorder_slot_t *slot)
+{
+    for (int j = 0; j < 3; j++) {
+        zmq_msg_close(&slot->parts[j]);
+        zmq_msg_init(&slot->parts[j]);
+    }
+    slot->status = SLOT_EMPTY;
+}
+
+static void publish_slot(publisher_state_t *state, reorder_slot_t *slot)
+{
+    zmq_msg_t *message_parts = slot->parts;
+    msg_meta.created_ms = slot->created_ms;
+    msg_meta.compression_method = NO_COMPRESSION;
+    msg_meta.sequence_number++;
+    if (debug) {
+        my_zmq_msg_fprint(&message_parts[0], 3, "[D]", stdout);
+        dump_meta_info("[D]", &msg_meta);
+    }
+    char *pub_spec = NULL;
+    bool is_heartbeat = zmq_msg_size(&message_parts[0]) == 9 && strncmp("heartbeat", zmq_msg_data(&message_parts[0]), 9) == 0;
+    if (is_heartbeat) {
+        if (debug)
+            printf("[D] received heartbeat message from device %u\n", msg_meta.device_number);
+        pub_spec = strndup(zmq_msg_data(&message_parts[1]), zmq_msg_size(&message_parts[1]));
+    }
+    device_tracker_calculate_gap(tracker, &msg_meta, pub_spec);
+    if (!is_heartbeat) {
+        // forward to comsumer
+        int rc = publish_on_zmq_transport(&message_parts[0], state->publisher, &msg_meta, ZMQ_DONTWAIT);
+        if (rc == -1) {
+            dropped_messages_count++;
+        }
+    }
+}
+
+static void flush_reorder_buffer(publisher_state_t *state)
+{
+    int64_t now = 0;
+    while (next_output_sequence < next_input_sequence) {
+        reorder_slot_t *slot = &reorder_buffer[next_output_sequence % reorder_window];
+        if (slot->status == SLOT_PENDING) {
+            if (now == 0)
+                now = zclock_mono();
+            if (now < slot->deadline)
+                break;
+            // a late result will be dropped as unexpected
+            fprintf(stderr, "[E] gave up waiting for decompression of message %" PRIu64 "\n", next_output_sequence);
+            slot->status = SLOT_FAILED;
+            reorder_timeouts++;
+            dropped_messages_count++;
+        }
+        if (slot->status == SLOT_READY)
+            publish_slot(state, slot);
+        reorder_slot_clear(slot);
+        next_output_sequence++;
+    }
+}
+
+// returns the index of the last part received, or -1 on errors
+static int receive_message(void *socket, zmq_msg_t *message_parts)
 {
     int i = 0;
-    zmq_msg_t message_parts[4];
-    publisher_state_t *state = (publisher_state_t*)callback_data;
-    void *socket = zsock_resolve(sock);
 
     // read the message parts, possibly including the message meta info
     while (!zsys_interrupted) {
@@ -164,64 +289,116 @@ static int read_zmq_message_and_forward(zloop_t *loop, zsock_t *sock, void *call
         if (!zsys_interrupted) {
             fprintf(stderr, "[E] received only %d message parts\n", i);
         }
-        goto cleanup;
     } else if (i>3) {
         fprintf(stderr, "[E] received more than 4 message parts\n");
-        goto cleanup;
-    }
+    } else
+        return i;
+
+    for (int j = i > 3 ? 3 : i; j >= 0; j--)
+        zmq_msg_close(&message_parts[j]);
+    return -1;
+}
+
+// puts a decompressed message into its slot and publishes whatever became ready
+static bool read_decompressed_message(publisher_state_t *state)
+{
+    zmq_msg_t message_parts[4];
+    int i = receive_message(state->compressor_output, message_parts);
+    if (i < 0)
+        return false;
 
-    zmq_msg_t *body = &message_parts[2];
     msg_meta_t meta = META_INFO_EMPTY;
     if (i==3)
         zmq_msg_extract_meta_info(&message_parts[3], &meta);
 
-    // const char *prefix = socket == state->compressor_output ? "EXTERNAL MESSAGE" : "INTERNAL MESSAGE";
-    // my_zmq_msg_fprint(&message_parts[0], 3, prefix, stdout);
-    // dump_meta_info(prefix, &meta);
-
-    if (meta.created_ms)
-        msg_meta.created_ms = meta.created_ms;
-    else
-        msg_meta.created_ms = global_time;
-
-    size_t msg_bytes = zmq_msg_size(body);
-    if (socket == state->compressor_output) {
+    uint64_t sequence = meta.sequence_number;
+    reorder_slot_t *slot = &reorder_buffer[sequence % reorder_window];
+    if (i != 3 || sequence < next_output_sequence || sequence >= next_input_sequence || slot->status != SLOT_PENDING) {
+        fprintf(stderr, "[E] dropped decompressed message with unexpected sequence number %" PRIu64 "\n", sequence);
+    } else if (meta.compression_method) {
+        // the decompressor already complained
+        slot->status = SLOT_FAILED;
+        dropped_messages_count++;
+    } else {
+        size_t msg_bytes = zmq_msg_size(&message_parts[2]);
         decompressed_messages_count++;
         decompressed_messages_bytes += msg_bytes;
         if (msg_bytes > decompressed_messages_max_bytes)
             decompressed_messages_max_bytes = msg_bytes;
-    } else {
-        received_messages_count++;
-        received_messages_bytes += msg_bytes;
-        if (msg_bytes > received_messages_max_bytes)
-            received_messages_max_bytes = msg_bytes;
+        reorder_slot_store(slot, message_parts);
+        slot->status = SLOT_READY;
     }
 
-    msg_meta.compression_method = meta.compression_method;
+    for (; i>=0; i--)
+        zmq_msg_close(&message_parts[i]);
+
+    flush_reorder_buffer(state);
+    return true;
+}
+
+static int read_decompressed_message_and_forward(zloop_t *loop, zsock_t *sock, void *callback_data)
+{
+    read_decompressed_message((publisher_state_t*)callback_data);
+    return 0;
+}
+
+static int read_zmq_message_and_forward(zloop_t *loop, zsock_t *sock, void *callback_data)
+{
+    zmq_msg_t message_parts[4];
+    publisher_state_t *state = (publisher_state_t*)callback_data;
+
+    int i = receive_message(state->receiver, message_parts);
+    if (i < 0)
+        return 0;
+
+    zmq_msg_t *body = &message_parts[2];
+    msg_meta_t meta = META_INFO_EMPTY;
+    if (i==3)
+        zmq_msg_extract_meta_info(&message_parts[3], &meta);
+
+    // my_zmq_msg_fprint(&message_parts[0], 3, "EXTERNAL MESSAGE", stdout);
+    // dump_meta_info("EXTERNAL MESSAGE", &meta);
+
+    size_t msg_bytes = zmq_msg_size(body);
+    received_messages_count++;
+    received_messages_bytes += msg_bytes;
+    if (msg_bytes > received_messages_max_bytes)
+        received_messages_max_bytes = msg_bytes;
+
+    // wait for the decompressors if the reorder window is exhausted, but no
+    // longer than the deadline of the oldest pending slot
+    if (next_input_sequence - next_output_sequence >= reorder_window)
+        reorder_waits++;
+    while (next_input_sequence - next_output_sequence >= reorder_window) {
+        reorder_slot_t *head = &reorder_buffer[next_output_sequence % reorder_window];
+        int64_t timeout = head->deadline - zclock_mono();
+        zmq_pollitem_t item = { state->compressor_output, 0, ZMQ_POLLIN, 0 };
+        int rc = zmq_poll(&item, 1, timeout > 0 ? timeout : 0);
+        if (rc > 0 && !read_decompressed_message(state))
+            rc = -1;
+        if (rc < 0) {
+            dropped_messages_count++;
+            goto cleanup;
+        }
+        if (rc == 0)
+            flush_reorder_buffer(state);
+    }
+
+    uint64_t sequence = next_input_sequence++;
+    reorder_slot_t *slot = &reorder_buffer[sequence % reorder_window];
+    slot->created_ms = meta.created_ms ? meta.created_ms : global_time;
+
     if (meta.compression_method) {
-        // decompress
-        publish_on_zmq_transport(&message_parts[0], state->compressor_input, &msg_meta, 0);
+        // decompress, remembering the slot
+        slot->status = SLOT_PENDING;
+        slot->deadline = zclock_mono() + REORDER_TIMEOUT_MS;
+        meta.sequence_number = sequence;
+        meta.created_ms = slot->created_ms;
+        publish_on_zmq_transport(&message_parts[0], state->compressor_input, &meta, 0);
     } else {
-        // forward to comsumer
-        msg_meta.sequence_number++;
-        if (debug) {
-            my_zmq_msg_fprint(&message_parts[0], 3, "[D]", stdout);
-            dump_meta_info("[D]", &msg_meta);
-        }
-        char *pub_spec = NULL;
-        bool is_heartbeat = zmq_msg_size(&message_parts[0]) == 9 && strncmp("heartbeat", zmq_msg_data(&message_parts[0]), 9) == 0;
-        if (is_heartbeat) {
-            if (debug)
-                printf("[D] received heartbeat message from device %u\n", msg_meta.device_number);
-            pub_spec = strndup(zmq_msg_data(&message_parts[1]), zmq_msg_size(&message_parts[1]));
-        }
-        device_tracker_calculate_gap(tracker, &msg_meta, pub_spec);
-        if (!is_heartbeat) {
-            int rc = publish_on_zmq_transport(&message_parts[0], state->publisher, &msg_meta, ZMQ_DONTWAIT);
-            if (rc == -1) {
-                dropped_messages_count++;
-            }
-        }
+        reorder_slot_store(slot, message_parts);
+        slot->status = SLOT_READY;
+        flush_reorder_buffer(state);
     }
 
  cleanup:
@@ -245,6 +422,7 @@ static void print_usage(char * const *argv)
             "  -q, --quiet                supress most output\n"
             "  -s, --decompressors N      number of decompressor threads\n"
             "  -v, --verbose              log more (use -vv for debug output)\n"
+            "  -w, --reorder-window N     max messages in flight while preserving order\n"
             "  -P, --output-port N        port number of zeromq ouput socket\n"
             "  -R, --rcv-hwm N            high watermark for input socket\n"
             "  -S, --snd-hwm N            high watermark for output socket\n"
@@ -278,10 +456,11 @@ static void process_arguments(int argc, char * const *argv)
         { "snd-hwm",       required_argument, 0, 'S' },
         { "subscribe",     required_argument, 0, 'e' },
         { "verbose",       no_argument,       0, 'v' },
+        { "reorder-window", required_argument, 0, 'w' },
         { 0,               0,                 0,  0  }
     };
 
-    while ((c = getopt_long(argc, argv, "vqd:p:P:R:S:c:e:i:s:h:", long_options, &longindex)) != -1) {
+    while ((c = getopt_long(argc, argv, "vqd:p:P:R:S:c:e:i:s:h:w:", long_options, &longindex)) != -1) {
         switch (c) {
         case 'v':
             if (verbose)
@@ -332,6 +511,15 @@ static void process_arguments(int argc, char * const *argv)
                 exit(1);
             }
             break;
+        case 'w': {
+            int window = atoi(optarg);
+            if (window < 1) {
+                printf("[E] invalid reorder window: must be greater than 0\n");
+                exit(1);
+            }
+            reorder_window = window;
+            break;
+        }
         case 'R':
             rcv_hwm = atoi(optarg);
             break;
@@ -343,7 +531,7 @@ static void process_arguments(int argc, char * const *argv)
             exit(0);
             break;
         case '?':
-            if (strchr("depcish", optopt))
+            if (strchr("depcishw", optopt))
                 fprintf(stderr, "option -%c requires an argument.\n", optopt);
             else if (isprint (optopt))
                 fprintf(stderr, "unknown option `-%c'.\n", optopt);
@@ -451,6 +639,8 @@ int main(int argc, char * const *argv)
     rc = zsock_bind(compressor_output, "inproc://compressor-output");
     assert_x(rc==0, "compressor output socket bind failed", __FILE__, __LINE__);
 
+    reorder_buffer_init();
+
     // create compressor agents
     zactor_t *compressors[MAX_COMPRESSORS];
     for (size_t i = 0; i < num_compressors; i++)
@@ -461,20 +651,21 @@ int main(int argc, char * const *argv)
     assert(loop);
     zloop_set_verbose(loop, 0);
 
-    // calculate statistics every 1000 ms
-    int timer_id = zloop_timer(loop, 1000, 0, timer_event, NULL);
-    assert(timer_id != -1);
-
     // setup handler for the receiver socket
     publisher_state_t publisher_state = {
         .receiver = zsock_resolve(receiver),
         .publisher = zsock_resolve(publisher),
         .compressor_input = zsock_resolve(compressor_input),
         .compressor_output = zsock_resolve(compressor_output),
+        .decompressors = compressors,
     };
 
+    // calculate statistics every 1000 ms
+    int timer_id = zloop_timer(loop, 1000, 0, timer_event, &publisher_state);
+    assert(timer_id != -1);
+
     // setup handler for compression results
-    rc = zloop_reader(loop, compressor_output, read_zmq_message_and_forward, &publisher_state);
+    rc = zloop_reader(loop, compressor_output, read_decompressed_message_and_forward, &publisher_state);
     assert(rc == 0);
     zloop_reader_set_tolerant(loop, compressor_output);
 
@@ -483,6 +674,10 @@ int main(int argc, char * const *argv)
     assert(rc == 0);
     zloop_reader_set_tolerant(loop, receiver);
 
+    // setup handler for reconnects of stale devices
+    rc = device_tracker_register_reconnects(tracker, loop);
+    assert(rc == 0);
+
     // initialize clock
     global_time = zclock_time();
 
@@ -533,6 +728,7 @@ int main(int argc, char * const *argv)
     device_tracker_destroy(&tracker);
     for (size_t i = 0; i < num_compressors; i++)
         zactor_destroy(&compressors[i]);
+    reorder_buffer_destroy();
     zsys_shutdown();
 
     if (!quiet)
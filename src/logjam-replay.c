@@ -25,6 +25,34 @@ static int messages_per_second = 100000;
 static int message_credit = 1000000;
 static int device_number = 4711;
 
+// replay modes
+#define REPLAY_RATE   0   // flat message rate, given by messages_per_second
+#define REPLAY_TIMED  1   // reproduce original inter-arrival times, scaled by replay_speed
+#define REPLAY_BURSTS 2   // as fast as possible, but keep messages created in the same ms together
+
+static int replay_mode = REPLAY_RATE;
+static double replay_speed = 1.0;
+
+// gaps between bursts are shortened to this in burst mode. must stay well
+// below a millisecond, otherwise dense traffic replays at about real time.
+#define BURST_GAP_MS 0.01
+
+// the longest we sleep inside the poller, so that the loop stays responsive
+#define MAX_REPLAY_SLEEP_MS 10
+
+// fan out over several sockets, each simulating a distinct device number
+#define MAX_SOCKETS 256
+static int num_sockets = 1;
+static zsock_t *publishers[MAX_SOCKETS];
+static uint64_t sequence_numbers[MAX_SOCKETS];
+
+// timing state for the timed and burst replay modes
+static zmsg_t *pending_msg = NULL;
+static uint64_t last_created_ms = 0;
+static double next_due_ms = 0;
+static bool timing_started = false;
+static size_t replayed_messages_late = 0;
+
 static size_t replayed_messages_count = 0;
 static size_t replayed_messages_bytes = 0;
 static size_t replayed_messages_max_bytes = 0;
@@ -37,35 +65,42 @@ static int timer_event( zloop_t *loop, int timer_id, void *arg)
     size_t message_bytes = replayed_messages_bytes - last_replayed_bytes;
     double avg_msg_size = message_count ? (message_bytes / 1024.0) / message_count : 0;
     double max_msg_size = replayed_messages_max_bytes / 1024.0;
-    printf("[I] processed %zu messages (%.2f KB), avg: %.2f KB, max: %.2f KB\n",
-           message_count, message_bytes/1024.0, avg_msg_size, max_msg_size);
+    if (replay_mode == REPLAY_RATE)
+        printf("[I] processed %zu messages (%.2f KB), avg: %.2f KB, max: %.2f KB\n",
+               message_count, message_bytes/1024.0, avg_msg_size, max_msg_size);
+    else
+        printf("[I] processed %zu messages (%.2f KB), avg: %.2f KB, max: %.2f KB, late: %zu\n",
+               message_count, message_bytes/1024.0, avg_msg_size, max_msg_size, replayed_messages_late);
     last_replayed_count = replayed_messages_count;
     last_replayed_bytes = replayed_messages_bytes;
     replayed_messages_max_bytes = 0;
+    replayed_messages_late = 0;
     message_credit = messages_per_second;
 
     return 0;
 }
 
-static int file_consume_message_and_forward(zloop_t *loop, zmq_pollitem_t *item, void* arg)
+static size_t stream_hash(zframe_t *stream_frame)
 {
-    zsock_t *socket = arg;
-
-    if (message_credit-- <= 0) {
-        zclock_sleep(1);
-        return 0;
-    }
+    // djb2, so that all messages of a given stream end up on the same socket
+    const byte *data = zframe_data(stream_frame);
+    size_t n = zframe_size(stream_frame);
+    size_t hash = 5381;
+    for (size_t i = 0; i < n; i++)
+        hash = ((hash << 5) + hash) + data[i];
+    return hash;
+}
 
-    zmsg_t *msg = zmsg_loadx(NULL, dump_file);
-    if (!msg) return 1;
+static void send_message(zmsg_t **msg_p)
+{
+    zmsg_t *msg = *msg_p;
 
-    // update device and seqeunce number
-    static uint64_t sequence_number = 0;
-    zmsg_set_device_and_sequence_number(msg, device_number, ++sequence_number);
+    // select socket and update device and sequence number
+    int i = num_sockets > 1 ? stream_hash(zmsg_first(msg)) % num_sockets : 0;
+    zmsg_set_device_and_sequence_number(msg, device_number + i, ++sequence_numbers[i]);
 
     // calculate stats
     size_t msg_bytes = zmsg_content_size(msg);
-    bytes_read_from_file  += sizeof(size_t) * 5 + msg_bytes;
     replayed_messages_count++;
     replayed_messages_bytes += msg_bytes;
     if (msg_bytes > replayed_messages_max_bytes)
@@ -74,21 +109,99 @@ static int file_consume_message_and_forward(zloop_t *loop, zmq_pollitem_t *item,
     if (debug) {
         my_zmsg_fprint(msg, "[D]", stdout);
         msg_meta_t meta;
-        msg_extract_meta_info(msg, &meta);
-        dump_meta_info("[D]", &meta);
+        if (msg_extract_meta_info(msg, &meta))
+            dump_meta_info("[D]", &meta);
     }
 
     // send message and destroy it
-    zmsg_send(&msg, socket);
-
-    if (bytes_read_from_file == dump_file_size) {
-        if (endless_loop) {
-            if (verbose) printf("[I] end of dump file reached. rewinding.\n");
-            bytes_read_from_file = 0;
-            rewind(dump_file);
-        } else
-            zsys_interrupted = 1;
+    zmsg_send_and_destroy(msg_p, publishers[i]);
+}
+
+static zmsg_t* load_message()
+{
+    zmsg_t *msg = zmsg_loadx(NULL, dump_file);
+    if (!msg) return NULL;
+
+    // each message is stored as frame count, frame sizes and frame data
+    bytes_read_from_file += sizeof(size_t) * (1 + zmsg_size(msg)) + zmsg_content_size(msg);
+
+    return msg;
+}
+
+static void check_end_of_file()
+{
+    if (bytes_read_from_file < dump_file_size)
+        return;
+
+    if (endless_loop) {
+        if (verbose) printf("[I] end of dump file reached. rewinding.\n");
+        bytes_read_from_file = 0;
+        rewind(dump_file);
+        // the creation times start over, so we need a new time base
+        timing_started = false;
+    } else if (pending_msg == NULL)
+        zsys_interrupted = 1;
+}
+
+static double scaled_gap_ms(uint64_t created_ms)
+{
+    // dump files can contain messages from several devices, whose
+    // creation times are not necessarily monotonic. never go back in time.
+    if (created_ms <= last_created_ms)
+        return 0;
+    double gap = created_ms - last_created_ms;
+    last_created_ms = created_ms;
+    if (replay_mode == REPLAY_BURSTS)
+        return BURST_GAP_MS;
+    return gap / replay_speed;
+}
+
+static int file_consume_message_and_forward_rate(zloop_t *loop, zmq_pollitem_t *item, void* arg)
+{
+    if (message_credit-- <= 0) {
+        zclock_sleep(1);
+        return 0;
+    }
+
+    zmsg_t *msg = load_message();
+    if (!msg) return 1;
+
+    send_message(&msg);
+    check_end_of_file();
+
+    return 0;
+}
+
+static int file_consume_message_and_forward_timed(zloop_t *loop, zmq_pollitem_t *item, void* arg)
+{
+    if (pending_msg == NULL) {
+        pending_msg = load_message();
+        if (!pending_msg) return 1;
+
+        // messages without creation time are due together with their predecessor
+        msg_meta_t meta;
+        if (zmsg_size(pending_msg) == 4 && msg_extract_meta_info(pending_msg, &meta) && meta.created_ms) {
+            if (!timing_started) {
+                timing_started = true;
+                last_created_ms = meta.created_ms;
+                next_due_ms = zclock_mono();
+            } else
+                next_due_ms += scaled_gap_ms(meta.created_ms);
+        }
+        check_end_of_file();
     }
+
+    double wait_ms = next_due_ms - zclock_mono();
+    if (wait_ms >= 1) {
+        zclock_sleep(wait_ms < MAX_REPLAY_SLEEP_MS ? (int)wait_ms : MAX_REPLAY_SLEEP_MS);
+        return 0;
+    }
+    if (timing_started && wait_ms < -1000)
+        replayed_messages_late++;
+
+    send_message(&pending_msg);
+    check_end_of_file();
+
     return 0;
 }
 
@@ -100,6 +213,10 @@ void print_usage(char * const *argv)
             "  -i, --io-threads N         zeromq io threads\n"
             "  -l, --loop                 loop the dump file\n"
             "  -r, --msg-rate N           output message rate (per second)\n"
+            "  -t, --timed                replay using original inter-arrival times\n"
+            "  -x, --speed F              speed up timed replay by factor F (implies -t)\n"
+            "  -b, --bursts               replay as fast as possible, preserving bursts\n"
+            "  -n, --sockets N            fan out over N sockets, simulating N devices\n"
             "  -v, --verbose              log more (use -vv for debug output)\n"
             "  -d, --dealer               use zqm DEALER socket for publishing\n"
             "  -p, --pub S                zmq specification for publishing socket\n"
@@ -123,10 +240,14 @@ void process_arguments(int argc, char * const *argv)
         { "device",        required_argument, 0, 's' },
         { "verbose",       no_argument,       0, 'v' },
         { "dealer",        no_argument,       0, 'd' },
+        { "timed",         no_argument,       0, 't' },
+        { "speed",         required_argument, 0, 'x' },
+        { "bursts",        no_argument,       0, 'b' },
+        { "sockets",       required_argument, 0, 'n' },
         { 0,               0,                 0,  0  }
     };
 
-    while ((c = getopt_long(argc, argv, "vdlr:i:p:s:", long_options, &longindex)) != -1) {
+    while ((c = getopt_long(argc, argv, "vdltbr:i:p:s:x:n:", long_options, &longindex)) != -1) {
         switch (c) {
         case 'v':
             if (verbose)
@@ -152,12 +273,33 @@ void process_arguments(int argc, char * const *argv)
         case 's':
             device_number = atoi(optarg);
             break;
+        case 't':
+            replay_mode = REPLAY_TIMED;
+            break;
+        case 'x':
+            replay_mode = REPLAY_TIMED;
+            replay_speed = atof(optarg);
+            if (replay_speed <= 0) {
+                fprintf(stderr, "[E] speed factor must be positive\n");
+                exit(1);
+            }
+            break;
+        case 'b':
+            replay_mode = REPLAY_BURSTS;
+            break;
+        case 'n':
+            num_sockets = atoi(optarg);
+            if (num_sockets < 1 || num_sockets > MAX_SOCKETS) {
+                fprintf(stderr, "[E] number of sockets must be between 1 and %d\n", MAX_SOCKETS);
+                exit(1);
+            }
+            break;
         case 0:
             print_usage(argv);
             exit(0);
             break;
         case '?':
-            if (strchr("rips", optopt))
+            if (strchr("ripsxn", optopt))
                 fprintf(stderr, "[E] option -%c requires an argument.\n", optopt);
             else if (isprint (optopt))
                 fprintf(stderr, "[E] unknown option `-%c'.\n", optopt);
@@ -192,6 +334,26 @@ void process_arguments(int argc, char * const *argv)
     }
 }
 
+static char* connection_spec_for_socket(int i)
+{
+    // dealers all connect to the same endpoint, publishers bind to consecutive ports
+    if (i == 0 || socket_type != ZMQ_PUB)
+        return strdup(connection_spec);
+
+    char buffer[1024];
+    if (strncmp(connection_spec, "tcp://", 6)) {
+        // ipc endpoints are file names, which may contain colons: add a suffix instead
+        snprintf(buffer, sizeof(buffer), "%s-%d", connection_spec, i);
+        return strdup(buffer);
+    }
+
+    char *colon = strrchr(connection_spec, ':');
+    assert(colon);
+    int port = atoi(colon + 1);
+    snprintf(buffer, sizeof(buffer), "%.*s:%d", (int)(colon - connection_spec), connection_spec, port + i);
+    return strdup(buffer);
+}
+
 int main(int argc, char * const *argv)
 {
     // don't buffer stdout and stderr
@@ -217,25 +379,30 @@ int main(int argc, char * const *argv)
     zsys_set_linger(100);
     zsys_set_io_threads(io_threads);
 
-    // create socket to push messages to
-    zsock_t* publisher = zsock_new(socket_type);
-    assert_x(publisher != NULL, "[E] zmq socket creation failed", __FILE__, __LINE__);
+    // create sockets to push messages to
+    for (int i = 0; i < num_sockets; i++) {
+        zsock_t* publisher = zsock_new(socket_type);
+        assert_x(publisher != NULL, "[E] zmq socket creation failed", __FILE__, __LINE__);
 
-    // configure the push socket
-    zsock_set_sndhwm(publisher, 1000000);
+        // configure the push socket
+        zsock_set_sndhwm(publisher, 1000000);
 
-    if (socket_type == ZMQ_PUB) {
-        // bind pub socket
-        printf("[I] binding PUB socket to %s\n", connection_spec);
-        int rc = zsock_bind(publisher, "%s", connection_spec);
-        log_zmq_error(rc, __FILE__, __LINE__);
-        assert(rc != -1);
-    } else {
-        // connect dealer socket
-        printf("[I] connecting DEALER socket to %s\n", connection_spec);
-        int rc = zsock_connect(publisher, "%s", connection_spec);
-        log_zmq_error(rc, __FILE__, __LINE__);
-        assert(rc == 0);
+        char *spec = connection_spec_for_socket(i);
+        if (socket_type == ZMQ_PUB) {
+            // bind pub socket
+            printf("[I] binding PUB socket for device %d to %s\n", device_number + i, spec);
+            int rc = zsock_bind(publisher, "%s", spec);
+            log_zmq_error(rc, __FILE__, __LINE__);
+            assert(rc != -1);
+        } else {
+            // connect dealer socket
+            printf("[I] connecting DEALER socket for device %d to %s\n", device_number + i, spec);
+            int rc = zsock_connect(publisher, "%s", spec);
+            log_zmq_error(rc, __FILE__, __LINE__);
+            assert(rc == 0);
+        }
+        free(spec);
+        publishers[i] = publisher;
     }
 
     // set up event loop
@@ -248,7 +415,9 @@ int main(int argc, char * const *argv)
         .fd = fileno(dump_file),
         .events = ZMQ_POLLIN
     };
-    int rc = zloop_poller(loop, &dump_file_item, file_consume_message_and_forward, publisher);
+    zloop_fn *handler = replay_mode == REPLAY_RATE ?
+        file_consume_message_and_forward_rate : file_consume_message_and_forward_timed;
+    int rc = zloop_poller(loop, &dump_file_item, handler, NULL);
     assert(rc==0);
 
     // calculate statistics every 1000 ms
@@ -278,7 +447,9 @@ int main(int argc, char * const *argv)
     fclose(dump_file);
     zloop_destroy(&loop);
     assert(loop == NULL);
-    zsock_destroy(&publisher);
+    zmsg_destroy(&pending_msg);
+    for (int i = 0; i < num_sockets; i++)
+        zsock_destroy(&publishers[i]);
     zsys_shutdown();
 
     if (verbose) printf("[I] terminated\n");
@@ -14,6 +14,8 @@ static zlist_t *active_stream_names = NULL;
 static zlist_t *stream_subscriptions = NULL;
 // lock around all stream access operations
 static pthread_mutex_t lock;
+// incremented whenever the stream config has been replaced
+static uint32_t stream_config_version = 0;
 // logjam url, to be used for retrieving stream information
 static const char* streams_url = NULL;
 // whether we subscribe to a subset of streams
@@ -46,6 +48,11 @@ stream_info_t* get_stream_info(const char* stream_name, zhash_t *thread_local_ca
     return stream_info;
 }
 
+uint32_t get_stream_config_version()
+{
+    return __atomic_load_n(&stream_config_version, __ATOMIC_ACQUIRE);
+}
+
 const char* get_subscription_pattern()
 {
     return subscription_pattern;
@@ -124,6 +131,8 @@ void add_backend_only_requests_settings(stream_info_t* info, const char* value)
             info->backend_only_requests[i++] = strdup(prefix);
             prefix = strtok(NULL, ",");
         }
+        // strtok skips empty prefixes
+        info->backend_only_requests_size = i;
         free(valdup);
     }
 }
@@ -167,6 +176,7 @@ void add_stream_settings(stream_info_t *info, json_object *stream_obj)
     }
     if (json_object_object_get_ex(stream_obj, "ignored_request_uri", &obj)) {
         info->ignored_request_prefix = strdup(json_object_get_string(obj));
+        info->ignored_request_prefix_len = strlen(info->ignored_request_prefix);
     }
     if (json_object_object_get_ex(stream_obj, "backend_only_requests", &obj)) {
         add_backend_only_requests_settings(info, json_object_get_string(obj));
@@ -183,6 +193,36 @@ void add_stream_settings(stream_info_t *info, json_object *stream_obj)
     }
 }
 
+// Compiles the prefix lists into tries, so that classifying a request doesn't
+// depend on the number of configured prefixes.
+static
+void compile_request_rules(stream_info_t *info)
+{
+    info->page_rules = prefix_trie_new();
+    if (info->all_requests_are_backend_only_requests)
+        prefix_trie_add_prefix(info->page_rules, "", REQUEST_RULE_BACKEND_ONLY);
+    for (int i = 0; i < info->backend_only_requests_size; i++)
+        prefix_trie_add_prefix(info->page_rules, info->backend_only_requests[i], REQUEST_RULE_BACKEND_ONLY);
+
+    info->module_rules = prefix_trie_new();
+    if (info->all_requests_are_api_requests)
+        prefix_trie_add_prefix(info->module_rules, "", REQUEST_RULE_API);
+    for (int i = 0; i < info->api_requests_size; i++)
+        prefix_trie_add(info->module_rules, info->api_requests[i], REQUEST_RULE_API, 0);
+    for (int i = 0; i < info->module_threshold_count; i++) {
+        module_threshold_t *t = &info->module_thresholds[i];
+        // the first threshold given for a module wins
+        if (!(prefix_trie_match(info->module_rules, t->name, NULL) & REQUEST_RULE_THRESHOLD))
+            prefix_trie_add(info->module_rules, t->name, REQUEST_RULE_THRESHOLD, t->value);
+    }
+}
+
+uint32_t stream_module_rules(stream_info_t *stream_info, const char *module, int *threshold)
+{
+    while (*module == ':') module++;
+    return prefix_trie_match(stream_info->module_rules, module, threshold);
+}
+
 static
 stream_info_t* stream_info_new(const char* key, json_object *stream_obj)
 {
@@ -215,7 +255,14 @@ stream_info_t* stream_info_new(const char* key, json_object *stream_obj)
     snprintf(yek, info->key_len+1, "%s.%s", env, app);
     info->yek = strdup(yek);
 
+    info->live_stream_key = zmalloc(info->key_len + 2);
+    for (size_t i = 0; i < info->key_len; i++)
+        info->live_stream_key[i] = tolower(info->key[i]);
+    info->live_stream_key[info->key_len] = ',';
+    info->live_stream_key_len = info->key_len + 1;
+
     add_stream_settings(info, stream_obj);
+    compile_request_rules(info);
 
     info->known_modules = zhash_new();
     assert(info->known_modules);
@@ -233,6 +280,7 @@ void release_stream_info(stream_info_t *info)
     // printf("[D] stream-op: freeing stream %s\n", info->key);
     free(info->key);
     free(info->yek);
+    free(info->live_stream_key);
     free(info->app);
     free(info->env);
     if (info->module_thresholds) {
@@ -254,6 +302,8 @@ void release_stream_info(stream_info_t *info)
             free(info->api_requests[i]);
         free(info->api_requests);
     }
+    prefix_trie_destroy(&info->page_rules);
+    prefix_trie_destroy(&info->module_rules);
     zhash_destroy(&info->known_modules);
     free(info);
 }
@@ -294,9 +344,50 @@ void dump_stream_info(stream_info_t *stream)
     }
 }
 
+static
+zhash_t* parse_streams(const char* body, int body_len)
+{
+    json_tokener* tokener = json_tokener_new();
+    json_object *streams_obj = parse_json_data(body, body_len, tokener);
+    json_tokener_free(tokener);
+    if (streams_obj == NULL)
+        return NULL;
+
+    zhash_t *streams = zhash_new();
+    json_object_object_foreach(streams_obj, key, val) {
+        stream_info_t *stream = stream_info_new(key, val);
+        if (0) dump_stream_info(stream);
+        zhash_insert(streams, key, stream);
+        zhash_freefn(streams, key, (zhash_free_fn*)release_stream_info);
+    }
+    json_object_put(streams_obj);
+    return streams;
+}
+
+static
+zhash_t* get_streams_from_file(const char* path)
+{
+    zhash_t *streams = NULL;
+    zfile_t *file = zfile_new(NULL, path);
+    if (file == NULL || zfile_input(file)) goto cleanup;
+
+    zchunk_t *chunk = zfile_read(file, zfile_cursize(file), 0);
+    if (chunk == NULL) goto cleanup;
+    streams = parse_streams((const char*)zchunk_data(chunk), zchunk_size(chunk));
+    zchunk_destroy(&chunk);
+
+ cleanup:
+    zfile_destroy(&file);
+    return streams;
+}
+
 static
 zhash_t* get_streams()
 {
+    // file urls allow running without a logjam instance (see importer-benchmark.c)
+    if (!strncmp(streams_url, "file://", 7))
+        return get_streams_from_file(streams_url + 7);
+
     zhash_t *streams = NULL;
 
     zhttp_request_t *request = zhttp_request_new();
@@ -315,19 +406,7 @@ zhash_t* get_streams()
     const char* body = zhttp_response_content(response);
     const int body_len = zhttp_response_content_length(response);
 
-    json_tokener* tokener = json_tokener_new();
-    json_object *streams_obj = parse_json_data(body, body_len, tokener);
-    json_tokener_free(tokener);
-    if (streams_obj == NULL) goto cleanup;
-
-    streams = zhash_new();
-    json_object_object_foreach(streams_obj, key, val) {
-        stream_info_t *stream = stream_info_new(key, val);
-        if (0) dump_stream_info(stream);
-        zhash_insert(streams, key, stream);
-        zhash_freefn(streams, key, (zhash_free_fn*)release_stream_info);
-    }
-    json_object_put(streams_obj);
+    streams = parse_streams(body, body_len);
 
  cleanup:
     zhttp_request_destroy(&request);
@@ -373,6 +452,7 @@ bool update_stream_config()
     configured_streams = new_streams;
     stream_subscriptions = new_subscriptions;
     active_stream_names = new_active_streams;
+    __atomic_add_fetch(&stream_config_version, 1, __ATOMIC_RELEASE);
     pthread_mutex_unlock(&lock);
 
     printf("[I] stream-updater: updated stream config\n");
@@ -512,27 +592,14 @@ void stream_config_updater(zsock_t *pipe, void *args)
         printf("[I] stream-updater: terminated\n");
 }
 
-void adjust_caller_info(const char* path, const char* module, json_object *request, stream_info_t *stream_info)
+void adjust_caller_info(const char* path, uint32_t module_rules, json_object *request, stream_info_t *stream_info)
 {
     // check whether we have a HTTP request
     if (path == NULL)
         return;
-    // check whether app has no api requests at all
-    if (!stream_info->all_requests_are_api_requests && stream_info->api_requests_size == 0)
-        return;
     // check whether we have an api request
-    while (*module == ':') module++;
-    bool api_request = stream_info->all_requests_are_api_requests;
-    if (!api_request) {
-        for (int i = 0; i < stream_info->api_requests_size; i++) {
-            if (streq(module, stream_info->api_requests[i])) {
-                api_request = true;
-                break;
-            }
-        }
-        if (!api_request)
-            return;
-    }
+    if (!(module_rules & REQUEST_RULE_API))
+        return;
     // set caller_id if not present
     bool dump = false;
     json_object *caller_id_obj;
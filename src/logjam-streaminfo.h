@@ -12,13 +12,18 @@ typedef struct {
     size_t value;
 } module_threshold_t;
 
+// must not be smaller than MAX_PARSERS
+#define STREAM_INFO_MAX_PARSERS 32
+
 typedef struct {
     int32_t ref_count;
     char *key;      // [app,env].join('-')
     char *yek;      // [env,app].join('.')
     char *app;
     char *env;
+    char *live_stream_key;  // lower case "app-env," prefix of live stream keys
     size_t key_len;
+    size_t live_stream_key_len;
     size_t app_len;
     size_t env_len;
     int db;
@@ -26,25 +31,36 @@ typedef struct {
     int request_cleaning_threshold;
     int import_threshold;
     int module_threshold_count;
-    int64_t storage_size;
+    struct _storage_account *storage;   // set on first use by the importer
+    struct _importer_counters *parser_counters[STREAM_INFO_MAX_PARSERS]; // set on first use by each importer parser
     double sampling_rate_400s;
     long sampling_rate_400s_threshold;
     module_threshold_t *module_thresholds;
     char *ignored_request_prefix;
+    size_t ignored_request_prefix_len;
     char **backend_only_requests;
     int backend_only_requests_size;
     int all_requests_are_backend_only_requests;
     char **api_requests;
     int api_requests_size;
     int all_requests_are_api_requests;
+    prefix_trie_t *page_rules;      // compiled backend only request prefixes
+    prefix_trie_t *module_rules;    // compiled api requests and module import thresholds
     zhash_t *known_modules;
 } stream_info_t;
 
+// request classification flags, see stream_page_rules and stream_module_rules
+#define REQUEST_RULE_BACKEND_ONLY 1
+#define REQUEST_RULE_API          2
+#define REQUEST_RULE_THRESHOLD    4
+
 extern stream_info_t* get_stream_info(const char* stream_name, zhash_t* thread_local_cache);
 static inline void reference_stream_info(stream_info_t *stream_info) {
     __sync_fetch_and_add(&stream_info->ref_count, 1);
 }
 extern void release_stream_info(stream_info_t *stream_info);
+// changes whenever the stream config has been reloaded, to invalidate thread local caches
+extern uint32_t get_stream_config_version();
 extern const char* get_subscription_pattern();
 extern zlist_t* get_stream_subscriptions();
 extern zlist_t* get_active_stream_names();
@@ -52,15 +68,16 @@ extern zlist_t* get_active_stream_names();
 extern void stream_config_updater(zsock_t *pipe, void *args);
 
 #define MAX_RANDOM_VALUE ((1L<<31) - 1)
-#define TEN_PERCENT_OF_MAX_RANDOM 214748364
-
-// request storage size soft limit is 15 GB, hard limit 30 GB, per app
-#define SOFT_LIMIT_STORAGE_SIZE 16106127360
-#define HARD_LIMIT_STORAGE_SIZE 32212254720
 
 extern bool setup_stream_config(const char* logjam_url, const char* pattern);
 extern void update_known_modules(stream_info_t *stream_info, zhash_t* module_hash);
-extern void adjust_caller_info(const char* path, const char* module, json_object *request, stream_info_t *stream_info);
+// classify a request with a single walk over its page or module name
+static inline uint32_t stream_page_rules(stream_info_t *stream_info, const char *page) {
+    return prefix_trie_match(stream_info->page_rules, page, NULL);
+}
+extern uint32_t stream_module_rules(stream_info_t *stream_info, const char *module, int *threshold);
+
+extern void adjust_caller_info(const char* path, uint32_t module_rules, json_object *request, stream_info_t *stream_info);
 
 typedef int sampling_reason_t;
 #define SAMPLE_SLOW_REQUEST    1
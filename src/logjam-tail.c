@@ -1,5 +1,7 @@
 #include "logjam-util.h"
 #include <getopt.h>
+#include <regex.h>
+#include <sys/uio.h>
 
 bool verbose = false;
 bool debug = false;
@@ -19,6 +21,26 @@ static size_t processed_lines_max_bytes = 0;
 static char *log_file_name = NULL;
 static FILE *log_file = NULL;
 
+static zchunk_t *decompression_buffer = NULL;
+
+// messages read from the SUB socket per wakeup
+#define RECEIVE_BATCH_SIZE 256
+
+// buffered mode: lines are copied into a large output buffer, which gets
+// written when it's full or every OUTPUT_FLUSH_INTERVAL milliseconds
+static bool buffered = false;
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+#define OUTPUT_FLUSH_INTERVAL 100
+static char *output_buffer = NULL;
+static size_t output_buffer_used = 0;
+
+// line content filters, compiled once
+static const char *grep_string = NULL;
+static size_t grep_string_length = 0;
+static const char *grep_pattern = NULL;
+static regex_t grep_regex;
+static size_t filtered_lines_count = 0;
+
 static
 void sighup_handler(int value)
 {
@@ -50,6 +72,11 @@ static int timer_event( zloop_t *loop, int timer_id, void *arg)
     if (verbose)
         printf("[I] processed %zu lines (%.2f KB), avg: %.2f KB, max: %.2f KB\n",
                message_count, message_bytes/1024.0, avg_line_size, max_line_size);
+    if (verbose && (grep_string || grep_pattern)) {
+        static size_t last_filtered_count = 0;
+        printf("[I] filtered %zu lines\n", filtered_lines_count - last_filtered_count);
+        last_filtered_count = filtered_lines_count;
+    }
     last_processed_count = processed_lines_count;
     last_processed_bytes = processed_lines_bytes;
     processed_lines_max_bytes = 0;
@@ -57,21 +84,100 @@ static int timer_event( zloop_t *loop, int timer_id, void *arg)
     return 0;
 }
 
-static int read_msg_and_print(zloop_t *loop, zsock_t *socket, void* arg)
+static void write_output(struct iovec *iov, int n)
+{
+    int fd = fileno(log_file);
+    while (n > 0) {
+        ssize_t written = writev(fd, iov, n);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "[E] writing output failed: %s\n", strerror(errno));
+            return;
+        }
+        // skip what has been written completely and retry the rest
+        while (n > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+static void flush_output()
+{
+    if (output_buffer_used == 0)
+        return;
+    struct iovec iov = { output_buffer, output_buffer_used };
+    write_output(&iov, 1);
+    output_buffer_used = 0;
+}
+
+static int flush_output_timer_event(zloop_t *loop, int timer_id, void *arg)
+{
+    flush_output();
+    return 0;
+}
+
+static void buffer_line(const char *topic, size_t topic_length, const char *line, size_t line_length)
 {
-    zmsg_t *msg = zmsg_recv(socket);
+    if (!prefix)
+        topic_length = 0;
+    size_t needed = (prefix ? topic_length + 1 : 0) + line_length + 1;
+
+    if (output_buffer_used + needed > OUTPUT_BUFFER_SIZE) {
+        // write buffer and line in one go instead of copying the line first
+        struct iovec iov[5] = {
+            { output_buffer, output_buffer_used },
+            { (char*)topic, topic_length },
+            { prefix ? ":" : "", prefix ? 1 : 0 },
+            { (char*)line, line_length },
+            { "\n", 1 }
+        };
+        write_output(iov, 5);
+        output_buffer_used = 0;
+        return;
+    }
 
-    zframe_t *topic_frame = zmsg_first(msg);
-    zframe_t *content_frame = zmsg_next(msg);
+    char *p = output_buffer + output_buffer_used;
+    if (prefix) {
+        memcpy(p, topic, topic_length);
+        p += topic_length;
+        *p++ = ':';
+    }
+    memcpy(p, line, line_length);
+    p += line_length;
+    *p = '\n';
+    output_buffer_used += needed;
+}
 
-    int topic_length = zframe_size(topic_frame);
-    const char* topic = (const char*)zframe_data(topic_frame);
+static bool line_selected(const char *line, size_t line_length)
+{
+    if (grep_string && !memmem(line, line_length, grep_string, grep_string_length))
+        return false;
+    if (grep_pattern) {
+        // lines aren't null terminated, so pass the bounds in the match array
+        regmatch_t match = { .rm_so = 0, .rm_eo = line_length };
+        if (regexec(&grep_regex, line, 1, &match, REG_STARTEND))
+            return false;
+    }
+    return true;
+}
 
-    int line_length = zframe_size(content_frame);
-    const char* line = (const char*)zframe_data(content_frame);
+static void print_line(const char *topic, int topic_length, const char *line, int line_length)
+{
+    if (!line_selected(line, line_length)) {
+        filtered_lines_count++;
+        return;
+    }
 
-    // print line
-    if (prefix)
+    if (buffered)
+        buffer_line(topic, topic_length, line, line_length);
+    else if (prefix)
         fprintf(log_file, "%.*s:%.*s\n", topic_length, topic, line_length, line);
     else
         fprintf(log_file, "%.*s\n", line_length, line);
@@ -81,8 +187,83 @@ static int read_msg_and_print(zloop_t *loop, zsock_t *socket, void* arg)
     processed_lines_bytes += line_length;
     if (line_length > processed_lines_max_bytes)
         processed_lines_max_bytes = line_length;
+}
 
-    zmsg_destroy(&msg);
+static void print_batch(const char *topic, int topic_length, zmq_msg_t *content, line_batch_info_t *info)
+{
+    char *body;
+    size_t body_len;
+    if (info->compression_method) {
+        if (!decompress_message_data(content, info->compression_method, decompression_buffer, &body, &body_len)) {
+            fprintf(stderr, "[E] could not decompress batch of %u lines\n", info->line_count);
+            return;
+        }
+    } else {
+        body = (char*) zmq_msg_data(content);
+        body_len = zmq_msg_size(content);
+    }
+
+    const char *p = body;
+    const char *end = body + body_len;
+    const char *line;
+    size_t line_length;
+    uint32_t lines = 0;
+    while ((p = line_batch_next(p, end, &line, &line_length))) {
+        print_line(topic, topic_length, line, line_length);
+        lines++;
+    }
+    if (lines != info->line_count)
+        fprintf(stderr, "[E] corrupt batch: expected %u lines, found %u\n", info->line_count, lines);
+}
+
+// receives all parts of a message, keeping the first three. returns the
+// number of parts or -1 if no message could be received.
+static int receive_message(void *receiver, zmq_msg_t *parts, int flags)
+{
+    int n = 0;
+    while (true) {
+        zmq_msg_t *part = &parts[n < 3 ? n : 2];
+        if (zmq_msg_recv(part, receiver, n ? 0 : flags) == -1) {
+            // once we have the first part, the rest must be consumed as well,
+            // or it would be taken for the start of the next message
+            if (n > 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        n++;
+        if (!zmq_msg_more(part))
+            return n;
+    }
+}
+
+static int read_msgs_and_print(zloop_t *loop, zsock_t *socket, void* arg)
+{
+    void *receiver = zsock_resolve(socket);
+    zmq_msg_t parts[3];
+    for (int i = 0; i < 3; i++)
+        zmq_msg_init(&parts[i]);
+
+    // drain the socket without allocating anything per message
+    for (int i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+        int n = receive_message(receiver, parts, i ? ZMQ_DONTWAIT : 0);
+        if (n == -1)
+            break;
+        if (n < 2)
+            continue;
+
+        int topic_length = zmq_msg_size(&parts[0]);
+        const char* topic = (const char*)zmq_msg_data(&parts[0]);
+
+        // batches published by logjam-logger -B carry a third frame
+        line_batch_info_t info;
+        if (n == 3 && zmq_msg_extract_line_batch_info(&parts[2], &info))
+            print_batch(topic, topic_length, &parts[1], &info);
+        else
+            print_line(topic, topic_length, (const char*)zmq_msg_data(&parts[1]), zmq_msg_size(&parts[1]));
+    }
+
+    for (int i = 0; i < 3; i++)
+        zmq_msg_close(&parts[i]);
 
     return 0;
 }
@@ -92,7 +273,10 @@ void print_usage(char * const *argv)
     fprintf(stderr,
             "usage: %s [options] [log-file]\n"
             "\nOptions:\n"
+            "  -B, --buffered             buffer output and write it in large blocks\n"
             "  -c, --connect S            zmq specification for connecting SUB socket\n"
+            "  -e, --regex R              only print lines matching extended regular expression R\n"
+            "  -g, --grep S               only print lines containing string S\n"
             "  -p, --prefix               prefix each line with its topic\n"
             "  -i, --io-threads N         zeromq io threads\n"
             "  -t, --topic T              subscribe to list of topics\n"
@@ -109,6 +293,9 @@ void process_arguments(int argc, char * const *argv)
 
     static struct option long_options[] = {
         { "help",          no_argument,       0,  0  },
+        { "buffered",      no_argument,       0, 'B' },
+        { "grep",          required_argument, 0, 'g' },
+        { "regex",         required_argument, 0, 'e' },
         { "io-threads",    required_argument, 0, 'i' },
         { "connect",       required_argument, 0, 'c' },
         { "topic",         required_argument, 0, 't' },
@@ -117,7 +304,7 @@ void process_arguments(int argc, char * const *argv)
         { 0,               0,                 0,  0  }
     };
 
-    while ((c = getopt_long(argc, argv, "vi:c:t:p", long_options, &longindex)) != -1) {
+    while ((c = getopt_long(argc, argv, "vi:c:t:pBg:e:", long_options, &longindex)) != -1) {
         switch (c) {
         case 'v':
             if (verbose)
@@ -137,12 +324,22 @@ void process_arguments(int argc, char * const *argv)
         case 'p':
             prefix = true;
             break;
+        case 'B':
+            buffered = true;
+            break;
+        case 'g':
+            grep_string = optarg;
+            grep_string_length = strlen(optarg);
+            break;
+        case 'e':
+            grep_pattern = optarg;
+            break;
         case 0:
             print_usage(argv);
             exit(0);
             break;
         case '?':
-            if (strchr("cit", optopt))
+            if (strchr("citge", optopt))
                 fprintf(stderr, "[E] option -%c requires an argument.\n", optopt);
             else if (isprint (optopt))
                 fprintf(stderr, "[E] unknown option `-%c'.\n", optopt);
@@ -173,6 +370,16 @@ void process_arguments(int argc, char * const *argv)
     if (connection_spec == NULL)
         connection_spec = DEFAULT_CONNECTION_SPEC;
 
+    if (grep_pattern) {
+        int rc = regcomp(&grep_regex, grep_pattern, REG_EXTENDED | REG_NOSUB);
+        if (rc) {
+            char error[256];
+            regerror(rc, &grep_regex, error, sizeof(error));
+            fprintf(stderr, "[E] invalid regular expression '%s': %s\n", grep_pattern, error);
+            exit(1);
+        }
+    }
+
     if (topics == NULL) {
         topics = zlist_new();
         zlist_append(topics, "");
@@ -228,10 +435,18 @@ int main(int argc, char * const *argv)
     rc = zloop_timer(loop, 1000, 0, timer_event, &timer_id);
     assert(rc != -1);
 
+    decompression_buffer = zchunk_new(NULL, INITIAL_DECOMPRESSION_BUFFER_SIZE);
+
     // register a reader for the SUB socket
-    rc = zloop_reader(loop, receiver, read_msg_and_print, NULL);
+    rc = zloop_reader(loop, receiver, read_msgs_and_print, NULL);
     assert(rc==0);
 
+    if (buffered) {
+        output_buffer = zmalloc(OUTPUT_BUFFER_SIZE);
+        rc = zloop_timer(loop, OUTPUT_FLUSH_INTERVAL, 0, flush_output_timer_event, NULL);
+        assert(rc != -1);
+    }
+
     if (!zsys_interrupted) {
         if (verbose) printf("[I] starting main event loop\n");
         bool should_continue_to_run = getenv("CPUPROFILE") != NULL;
@@ -250,8 +465,16 @@ int main(int argc, char * const *argv)
     zloop_destroy(&loop);
     assert(loop == NULL);
     zsock_destroy(&receiver);
+    zchunk_destroy(&decompression_buffer);
     zsys_shutdown();
 
+    if (buffered) {
+        flush_output();
+        free(output_buffer);
+    }
+    if (grep_pattern)
+        regfree(&grep_regex);
+
     if (verbose) printf("[I] terminated\n");
 
     return 0;
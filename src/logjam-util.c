@@ -798,6 +798,163 @@ bool extract_app_env_rid(const char* s, int n, char* app, char* env, char* rid)
     return extract_app_env(buf, n, app, env);
 }
 
+static inline uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void fast_random_seed(fast_random_t *rng, uint64_t seed)
+{
+    // the state must not be all zero, which splitmix64 guarantees
+    for (int i = 0; i < 4; i++)
+        rng->s[i] = splitmix64(&seed);
+}
+
+uint64_t hash_string(const char *str, size_t len)
+{
+    // FNV-1a, followed by the murmur3 finalizer to spread similar keys over all bits
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) str[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+typedef struct {
+    uint32_t first_child;   // 0 means none, as the root is never a child
+    uint32_t next_sibling;
+    uint32_t prefix_flags;
+    uint32_t exact_flags;
+    int value;
+    unsigned char c;
+} prefix_trie_node_t;
+
+struct _prefix_trie {
+    prefix_trie_node_t *nodes;
+    uint32_t size;
+    uint32_t capacity;
+    size_t keys;
+};
+
+prefix_trie_t* prefix_trie_new()
+{
+    prefix_trie_t *trie = zmalloc(sizeof(*trie));
+    assert(trie);
+    trie->capacity = 16;
+    trie->nodes = zmalloc(trie->capacity * sizeof(prefix_trie_node_t));
+    assert(trie->nodes);
+    trie->size = 1;
+    return trie;
+}
+
+static
+uint32_t prefix_trie_find_child(const prefix_trie_node_t *nodes, uint32_t node, unsigned char c)
+{
+    uint32_t child = nodes[node].first_child;
+    while (child && nodes[child].c != c)
+        child = nodes[child].next_sibling;
+    return child;
+}
+
+static
+uint32_t prefix_trie_insert(prefix_trie_t *trie, const char *key)
+{
+    uint32_t node = 0;
+    for (const unsigned char *p = (const unsigned char*) key; *p; p++) {
+        uint32_t child = prefix_trie_find_child(trie->nodes, node, *p);
+        if (child == 0) {
+            if (trie->size == trie->capacity) {
+                trie->capacity *= 2;
+                trie->nodes = realloc(trie->nodes, trie->capacity * sizeof(prefix_trie_node_t));
+                assert(trie->nodes);
+            }
+            child = trie->size++;
+            prefix_trie_node_t *n = &trie->nodes[child];
+            memset(n, 0, sizeof(*n));
+            n->c = *p;
+            n->next_sibling = trie->nodes[node].first_child;
+            trie->nodes[node].first_child = child;
+        }
+        node = child;
+    }
+    trie->keys++;
+    return node;
+}
+
+void prefix_trie_add(prefix_trie_t *trie, const char *key, uint32_t flags, int value)
+{
+    prefix_trie_node_t *node = &trie->nodes[prefix_trie_insert(trie, key)];
+    node->exact_flags |= flags;
+    if (node->value == 0)
+        node->value = value;
+}
+
+void prefix_trie_add_prefix(prefix_trie_t *trie, const char *prefix, uint32_t flags)
+{
+    trie->nodes[prefix_trie_insert(trie, prefix)].prefix_flags |= flags;
+}
+
+uint32_t prefix_trie_match(const prefix_trie_t *trie, const char *str, int *value)
+{
+    const prefix_trie_node_t *nodes = trie->nodes;
+    uint32_t node = 0;
+    uint32_t flags = nodes[0].prefix_flags;
+    if (value)
+        *value = 0;
+    for (const unsigned char *p = (const unsigned char*) str; *p; p++) {
+        node = prefix_trie_find_child(nodes, node, *p);
+        if (node == 0)
+            return flags;
+        flags |= nodes[node].prefix_flags;
+    }
+    if (value)
+        *value = nodes[node].value;
+    return flags | nodes[node].exact_flags;
+}
+
+size_t prefix_trie_size(const prefix_trie_t *trie)
+{
+    return trie->keys;
+}
+
+void prefix_trie_destroy(prefix_trie_t **trie_p)
+{
+    prefix_trie_t *trie = *trie_p;
+    if (trie == NULL)
+        return;
+    free(trie->nodes);
+    free(trie);
+    *trie_p = NULL;
+}
+
+int find_json_int_value(const char *json, size_t json_len, const char *key)
+{
+    size_t key_len = strlen(key);
+    const char *end = json + json_len;
+    const char *p = json;
+    while (p < end && (p = memmem(p, end - p, key, key_len))) {
+        p += key_len;
+        while (p < end && (*p == ' ' || *p == ':'))
+            p++;
+        if (p < end && *p >= '0' && *p <= '9') {
+            int value = 0;
+            while (p < end && *p >= '0' && *p <= '9')
+                value = 10 * value + (*p++ - '0');
+            return value;
+        }
+    }
+    return -1;
+}
+
 void ensure_chunk_can_take(zchunk_t* buffer, size_t data_size)
 {
     size_t buffer_size = zchunk_max_size(buffer);
@@ -829,6 +986,24 @@ void append_null_byte(zchunk_t* buffer)
     zchunk_append(buffer, "", 1);
 }
 
+void line_batch_append(zchunk_t *batch, const char *line, size_t line_len)
+{
+    uint32_t n = htonl(line_len);
+    ensure_chunk_can_take(batch, line_len + 4);
+    zchunk_append(batch, &n, 4);
+    zchunk_append(batch, line, line_len);
+}
+
+int zmq_msg_extract_line_batch_info(zmq_msg_t *msg, line_batch_info_t *info)
+{
+    if (zmq_msg_size(msg) != sizeof(line_batch_info_t))
+        return 0;
+    memcpy(info, zmq_msg_data(msg), sizeof(*info));
+    info->tag = ntohs(info->tag);
+    info->line_count = ntohl(info->line_count);
+    return info->tag == LINE_BATCH_TAG && info->version == LINE_BATCH_VERSION;
+}
+
 static void test_uint64wrap (int verbose)
 {
     uint64_t i = 0xffffffffffffffff;
@@ -925,6 +1100,132 @@ static void test_extract_app_env_rid (int verbose)
     assert(streq(rid, "r"));
 }
 
+static void test_find_json_int_value (int verbose)
+{
+    const char *json = "{\"code\":\"x\",\"severity\" : 3,\"response_code\":500}";
+    assert(find_json_int_value(json, strlen(json), "\"severity\"") == 3);
+    assert(find_json_int_value(json, strlen(json), "\"response_code\"") == 500);
+    assert(find_json_int_value(json, strlen(json), "\"code\"") == -1);
+    assert(find_json_int_value(json, strlen(json), "\"level\"") == -1);
+    // must not read beyond the given length
+    assert(find_json_int_value(json, strlen(json) - 2, "\"response_code\"") == 50);
+}
+
+static void test_fast_random (int verbose)
+{
+    fast_random_t a, b;
+    fast_random_seed(&a, 42);
+    fast_random_seed(&b, 42);
+    const long max = (1L << 31) - 1;
+    size_t below_half = 0;
+    for (int i = 0; i < 10000; i++) {
+        long x = fast_random(&a);
+        assert(x == fast_random(&b));
+        assert(x >= 0 && x <= max);
+        if (x < max / 2)
+            below_half++;
+    }
+    assert(below_half > 4500 && below_half < 5500);
+    fast_random_seed(&b, 43);
+    assert(fast_random_next(&a) != fast_random_next(&b));
+}
+
+static void test_hash_string (int verbose)
+{
+    const char *rid = "0123456789abcdef0123456789abcdef";
+    assert(hash_string(rid, 32) == hash_string(rid, 32));
+    assert(hash_string(rid, 32) != hash_string(rid, 31));
+    assert(hash_string("", 0) != 0);
+}
+
+static void test_line_batch (int verbose)
+{
+    zchunk_t *batch = zchunk_new(NULL, 16);
+    line_batch_append(batch, "first", 5);
+    line_batch_append(batch, "", 0);
+    line_batch_append(batch, "third line", 10);
+    assert(zchunk_size(batch) == 3*4 + 15);
+
+    const char *p = (const char*) zchunk_data(batch);
+    const char *end = p + zchunk_size(batch);
+    const char *line;
+    size_t len;
+    p = line_batch_next(p, end, &line, &len);
+    assert(p && len == 5 && !strncmp(line, "first", 5));
+    p = line_batch_next(p, end, &line, &len);
+    assert(p && len == 0);
+    p = line_batch_next(p, end, &line, &len);
+    assert(p == end && len == 10 && !strncmp(line, "third line", 10));
+    assert(line_batch_next(p, end, &line, &len) == NULL);
+    // truncated batches are detected
+    p = (const char*) zchunk_data(batch);
+    assert(line_batch_next(p, p + 8, &line, &len) == NULL);
+
+    zmq_msg_t msg;
+    line_batch_info_t info = {LINE_BATCH_TAG, LZ4_COMPRESSION, LINE_BATCH_VERSION, 3};
+    line_batch_info_encode(&info);
+    zmq_msg_init_size(&msg, sizeof(info));
+    memcpy(zmq_msg_data(&msg), &info, sizeof(info));
+    line_batch_info_t decoded;
+    assert(zmq_msg_extract_line_batch_info(&msg, &decoded));
+    assert(decoded.tag == LINE_BATCH_TAG);
+    assert(decoded.compression_method == LZ4_COMPRESSION);
+    assert(decoded.line_count == 3);
+    zmq_msg_close(&msg);
+
+    // frames of other sizes, tags or versions are not line batch infos
+    zmq_msg_init_size(&msg, sizeof(info) - 1);
+    memcpy(zmq_msg_data(&msg), &info, sizeof(info) - 1);
+    assert(!zmq_msg_extract_line_batch_info(&msg, &decoded));
+    zmq_msg_close(&msg);
+    zmq_msg_init(&msg);
+    assert(!zmq_msg_extract_line_batch_info(&msg, &decoded));
+    zmq_msg_close(&msg);
+    line_batch_info_t other = info;
+    other.tag = htons(META_INFO_TAG);
+    zmq_msg_init_size(&msg, sizeof(other));
+    memcpy(zmq_msg_data(&msg), &other, sizeof(other));
+    assert(!zmq_msg_extract_line_batch_info(&msg, &decoded));
+    zmq_msg_close(&msg);
+    other = info;
+    other.version = LINE_BATCH_VERSION + 1;
+    zmq_msg_init_size(&msg, sizeof(other));
+    memcpy(zmq_msg_data(&msg), &other, sizeof(other));
+    assert(!zmq_msg_extract_line_batch_info(&msg, &decoded));
+    zmq_msg_close(&msg);
+
+    zchunk_destroy(&batch);
+}
+
+static void test_prefix_trie (int verbose)
+{
+    prefix_trie_t *trie = prefix_trie_new();
+    assert(prefix_trie_match(trie, "anything", NULL) == 0);
+    prefix_trie_add_prefix(trie, "Admin::", 1);
+    prefix_trie_add_prefix(trie, "Admin::Users", 2);
+    prefix_trie_add(trie, "Api", 4, 0);
+    prefix_trie_add(trie, "Api", 8, 500);
+    prefix_trie_add(trie, "Api", 8, 800);
+    assert(prefix_trie_size(trie) == 5);
+
+    int value = -1;
+    assert(prefix_trie_match(trie, "Admin::Users#index", &value) == 3);
+    assert(value == 0);
+    assert(prefix_trie_match(trie, "Admin::Groups#index", NULL) == 1);
+    assert(prefix_trie_match(trie, "Admin:", NULL) == 0);
+    assert(prefix_trie_match(trie, "Api", &value) == 12);
+    assert(value == 500);
+    assert(prefix_trie_match(trie, "Apis", &value) == 0);
+    assert(value == 0);
+    assert(prefix_trie_match(trie, "", NULL) == 0);
+
+    prefix_trie_add_prefix(trie, "", 16);
+    assert(prefix_trie_match(trie, "", NULL) == 16);
+    assert(prefix_trie_match(trie, "Api", NULL) == 28);
+    prefix_trie_destroy(&trie);
+    assert(trie == NULL);
+}
+
 static void test_compression_decompression (int verbose)
 {
     assert(sizeof(int32_t) == 4);
@@ -981,6 +1282,11 @@ void logjam_util_test (int verbose)
     test_extract_app_env (verbose);
     test_extract_app_env_rid (verbose);
     test_compression_decompression (verbose);
+    test_find_json_int_value (verbose);
+    test_fast_random (verbose);
+    test_hash_string (verbose);
+    test_prefix_trie (verbose);
+    test_line_batch (verbose);
 
     printf ("OK\n");
 }
@@ -123,6 +123,46 @@ extern int decompress_frame(zframe_t *body_frame, int compression_method, zchunk
 
 extern int decompress_message_data(zmq_msg_t *msg, int compression_method, zchunk_t *buffer, char **body, size_t* body_len);
 
+// logjam-logger batches: the body frame holds a sequence of lines, each prefixed
+// with its length (uint32, network byte order), optionally compressed. A third
+// frame carrying a line_batch_info_t tells receivers how to unpack the body.
+#define LINE_BATCH_TAG 0x6c62
+#define LINE_BATCH_VERSION 1
+
+typedef struct {
+    uint16_t tag;
+    uint8_t  compression_method;
+    uint8_t  version;
+    uint32_t line_count;
+} line_batch_info_t;
+
+extern void line_batch_append(zchunk_t *batch, const char *line, size_t line_len);
+static inline void line_batch_info_encode(line_batch_info_t *info)
+{
+    info->tag = htons(info->tag);
+    info->line_count = htonl(info->line_count);
+}
+
+// returns 0 if the frame doesn't describe a line batch
+extern int zmq_msg_extract_line_batch_info(zmq_msg_t *msg, line_batch_info_t *info);
+
+// returns the position after the next line of a batch or NULL if there are no
+// more lines or the batch is corrupt
+static inline const char* line_batch_next(const char *p, const char *end, const char **line, size_t *line_len)
+{
+    uint32_t n;
+    if (end - p < 4)
+        return NULL;
+    memcpy(&n, p, 4);
+    n = ntohl(n);
+    p += 4;
+    if ((size_t)(end - p) < n)
+        return NULL;
+    *line = p;
+    *line_len = n;
+    return p + n;
+}
+
 extern json_object* parse_json_data(const char *json_data, size_t json_data_len, json_tokener* tokener);
 
 extern void dump_json_object(FILE *f, const char* prefix, json_object *jobj);
@@ -202,6 +242,57 @@ static inline zmsg_t* zmsg_recv_with_retry(zsock_t *socket)
     return msg;
 }
 
+// xoshiro256** by Blackman and Vigna. much cheaper than random(), which takes a global
+// lock in glibc. not thread safe: every thread needs a state of its own.
+typedef struct {
+    uint64_t s[4];
+} fast_random_t;
+
+extern void fast_random_seed(fast_random_t *rng, uint64_t seed);
+
+static inline uint64_t fast_random_rotl(const uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t fast_random_next(fast_random_t *rng)
+{
+    uint64_t *s = rng->s;
+    const uint64_t result = fast_random_rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = fast_random_rotl(s[3], 45);
+    return result;
+}
+
+// same range as random(): 0 .. 2^31-1
+static inline long fast_random(fast_random_t *rng)
+{
+    return fast_random_next(rng) >> 33;
+}
+
+// stable across processes and machines, so it can be used for deterministic sampling
+extern uint64_t hash_string(const char *str, size_t len);
+
+// Byte wise trie for matching a string against many keys in a single walk.
+// Exact keys contribute their flags if the string equals the key, prefix keys
+// if the string starts with the key. Adding a key twice ORs the flags and keeps
+// the first non-zero value. Tries are read-only after construction and can be
+// shared between threads.
+typedef struct _prefix_trie prefix_trie_t;
+
+extern prefix_trie_t* prefix_trie_new();
+extern void prefix_trie_add(prefix_trie_t *trie, const char *key, uint32_t flags, int value);
+extern void prefix_trie_add_prefix(prefix_trie_t *trie, const char *prefix, uint32_t flags);
+// returns the flags of all matching keys, value is set to the value of the exact match (or 0)
+extern uint32_t prefix_trie_match(const prefix_trie_t *trie, const char *str, int *value);
+extern size_t prefix_trie_size(const prefix_trie_t *trie);
+extern void prefix_trie_destroy(prefix_trie_t **trie_p);
+
 extern int zmsg_savex (zmsg_t *self, FILE *file);
 extern zmsg_t* zmsg_loadx (zmsg_t *self, FILE *file);
 
@@ -215,6 +306,9 @@ extern const char* my_fqdn();
 extern void send_heartbeat(zsock_t *socket, msg_meta_t* meta, int pub_port);
 extern bool extract_app_env(const char* app_env, int n, char* app, char* env);
 extern bool extract_app_env_rid(const char* s, int n, char* app, char* env, char* rid);
+// returns the integer value of the first occurence of the given quoted key which has one, or -1.
+// only meant for quick checks on flat objects, as it ignores the structure of the json data.
+extern int find_json_int_value(const char *json, size_t json_len, const char *key);
 
 extern void ensure_chunk_can_take(zchunk_t* buffer, size_t data_size);
 extern void append_line(zchunk_t* buffer, const char* format, ...);
@@ -26,6 +26,8 @@ typedef struct {
     zchunk_t *compression_buffer;
     bool decompress;
     compressor_callback_fn *cb;
+    size_t message_count;           // messages handled (since last tick)
+    size_t message_bytes;           // input bytes handled (since last tick)
 } compressor_state_t;
 
 #define COMPRESS false
@@ -87,6 +89,8 @@ void handle_compressor_request(zmsg_t *msg, compressor_state_t *state)
 
     void *data = zframe_data(body_frame);
     size_t data_len = zframe_size(body_frame);
+    state->message_count++;
+    state->message_bytes += data_len;
 
     // my_zmsg_fprint(msg, "COMPRESSED", stdout);
     // dump_meta_info_network_format(meta);
@@ -153,6 +157,12 @@ void message_compressor(zsock_t *pipe, void *args)
             if (streq(cmd, "tick")) {
                 if (verbose)
                     printf("[D] compressor[%zu]: tick\n", id);
+                // decompressors run in parallel with reordering, so we report per worker throughput
+                if ((state->decompress && !quiet) || verbose)
+                    printf("[I] %s[%zu]: %zu messages (%.2f KB)\n", state->decompress ? "decompressor" : "compressor",
+                           id, state->message_count, state->message_bytes/1024.0);
+                state->message_count = 0;
+                state->message_bytes = 0;
                 if (state->cb) {
                     state->cb(id);
                 }